@@ -0,0 +1,392 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_FRAMES_H
+#define AUDIO_FRAMES_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * A typed layer over the raw bytes that audio is moved around in. An
+ * AudioFormat names the sample type, channel count and byte order of
+ * some audio as template arguments, such as
+ *
+ *     // sox -c 1 -b 16 -e signed -L
+ *     using MicFormat = AudioFormat<int16_t, 1, Endian::Little>;
+ *
+ * and the kernels below (convertFrames, applyGain, mixFrames) are
+ * instantiated for the formats they are given. Everything that depends
+ * on the format (sample size, byte swapping, scaling, channel mapping)
+ * is resolved at compile time, so each kernel is a tight loop with no
+ * per-sample branching that the compiler can unroll and vectorize.
+ * Copying audio between identical formats is a memcpy.
+ *
+ * Sample types are int16_t, Int24 (packed 3-byte samples), int32_t and
+ * float (from -1 to 1). Integer samples are converted to one another by
+ * shifting, and to and from float by scaling; conversion to a narrower
+ * type rounds and clips.
+ */
+
+enum class Endian { Little, Big };
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr Endian hostEndian = Endian::Big;
+#else
+constexpr Endian hostEndian = Endian::Little;
+#endif
+
+// Packed 24-bit samples, held as int32_t values from -2^23 to 2^23 - 1.
+struct Int24 {};
+
+/*
+ * SampleTraits describes how a sample type is stored. Value is the type
+ * used to work with a sample, Bits its resolution, and Bytes its size
+ * in memory.
+ */
+template <typename T> struct SampleTraits;
+
+template <> struct SampleTraits<int16_t> {
+  using Value = int16_t;
+  static const int Bits = 16;
+  static const size_t Bytes = 2;
+  static const bool IsFloat = false;
+};
+
+template <> struct SampleTraits<Int24> {
+  using Value = int32_t;
+  static const int Bits = 24;
+  static const size_t Bytes = 3;
+  static const bool IsFloat = false;
+};
+
+template <> struct SampleTraits<int32_t> {
+  using Value = int32_t;
+  static const int Bits = 32;
+  static const size_t Bytes = 4;
+  static const bool IsFloat = false;
+};
+
+template <> struct SampleTraits<float> {
+  using Value = float;
+  static const int Bits = 32;
+  static const size_t Bytes = 4;
+  static const bool IsFloat = true;
+};
+
+// The format of some interleaved audio.
+template <typename Sample, unsigned int NumChannels, Endian Order>
+struct AudioFormat {
+  static_assert(NumChannels > 0, "audio must have at least one channel");
+
+  using SampleType = Sample;
+  using Value = typename SampleTraits<Sample>::Value;
+  static const unsigned int Channels = NumChannels;
+  static const Endian ByteOrder = Order;
+  static const size_t SampleBytes = SampleTraits<Sample>::Bytes;
+  static const size_t FrameBytes = SampleBytes * NumChannels;
+};
+
+namespace audio_detail {
+
+inline uint16_t byteSwap(uint16_t v) { return uint16_t((v >> 8) | (v << 8)); }
+
+inline uint32_t byteSwap(uint32_t v) {
+#if defined(__GNUC__)
+  return __builtin_bswap32(v);
+#else
+  return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+#endif
+}
+
+template <size_t Bytes> struct UintOfSize;
+template <> struct UintOfSize<2> { using Type = uint16_t; };
+template <> struct UintOfSize<4> { using Type = uint32_t; };
+
+/*
+ * Loading and storing one sample at an address with any alignment.
+ * Samples in the host's byte order are copied directly; others are
+ * swapped after loading and before storing.
+ */
+template <typename Sample, Endian Order, bool Swap = (Order != hostEndian)>
+struct SampleIO {
+  using Value = typename SampleTraits<Sample>::Value;
+  using Raw = typename UintOfSize<sizeof(Value)>::Type;
+
+  static Value load(const char *p) {
+    Raw raw;
+    std::memcpy(&raw, p, sizeof(raw));
+    if (Swap) {
+      raw = byteSwap(raw);
+    }
+    Value v;
+    std::memcpy(&v, &raw, sizeof(v));
+    return v;
+  }
+
+  static void store(Value v, char *p) {
+    Raw raw;
+    std::memcpy(&raw, &v, sizeof(raw));
+    if (Swap) {
+      raw = byteSwap(raw);
+    }
+    std::memcpy(p, &raw, sizeof(raw));
+  }
+};
+
+template <Endian Order, bool Swap> struct SampleIO<Int24, Order, Swap> {
+  // Byte k of the sample, counting from the least significant, is p[index(k)]
+  static size_t index(size_t k) { return Order == Endian::Little ? k : 2 - k; }
+
+  static int32_t load(const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    uint32_t v = uint32_t(u[index(0)]) | (uint32_t(u[index(1)]) << 8) |
+                 (uint32_t(u[index(2)]) << 16);
+    // Sign-extend from 24 bits
+    return int32_t(v << 8) >> 8;
+  }
+
+  static void store(int32_t v, char *p) {
+    p[index(0)] = char(v & 0xFF);
+    p[index(1)] = char((v >> 8) & 0xFF);
+    p[index(2)] = char((v >> 16) & 0xFF);
+  }
+};
+
+/*
+ * Converting a sample value from one sample type to another. Each case
+ * is a separate specialization, chosen by whether each side is an
+ * integer or float and by how their resolutions compare.
+ */
+enum CastKind { Same, Widen, Narrow, IntToFloat, FloatToInt };
+
+template <typename From, typename To>
+struct CastKindOf
+    : std::integral_constant<
+          CastKind,
+          std::is_same<From, To>::value ? Same
+          : SampleTraits<From>::IsFloat && SampleTraits<To>::IsFloat ? Same
+          : SampleTraits<To>::IsFloat   ? IntToFloat
+          : SampleTraits<From>::IsFloat ? FloatToInt
+          : (SampleTraits<To>::Bits > SampleTraits<From>::Bits) ? Widen
+                                                                : Narrow> {};
+
+template <typename From, typename To,
+          CastKind Kind = CastKindOf<From, To>::value>
+struct SampleCast;
+
+template <typename From, typename To> struct SampleCast<From, To, Same> {
+  static typename SampleTraits<To>::Value
+  apply(typename SampleTraits<From>::Value v) {
+    return v;
+  }
+};
+
+template <typename From, typename To> struct SampleCast<From, To, Widen> {
+  static const int Shift = SampleTraits<To>::Bits - SampleTraits<From>::Bits;
+  static typename SampleTraits<To>::Value
+  apply(typename SampleTraits<From>::Value v) {
+    // Multiplying rather than shifting keeps negative values defined
+    return typename SampleTraits<To>::Value(v) * (int32_t(1) << Shift);
+  }
+};
+
+template <typename From, typename To> struct SampleCast<From, To, Narrow> {
+  static const int Shift = SampleTraits<From>::Bits - SampleTraits<To>::Bits;
+  static typename SampleTraits<To>::Value
+  apply(typename SampleTraits<From>::Value v) {
+    // Round to nearest, then clip the one value that rounds past the top
+    int64_t r = (int64_t(v) + (int64_t(1) << (Shift - 1))) >> Shift;
+    const int64_t maxValue = (int64_t(1) << (SampleTraits<To>::Bits - 1)) - 1;
+    return typename SampleTraits<To>::Value(r > maxValue ? maxValue : r);
+  }
+};
+
+template <typename From, typename To> struct SampleCast<From, To, IntToFloat> {
+  static float apply(typename SampleTraits<From>::Value v) {
+    const float scale = float(int64_t(1) << (SampleTraits<From>::Bits - 1));
+    return float(v) * (1.0f / scale);
+  }
+};
+
+template <typename From, typename To> struct SampleCast<From, To, FloatToInt> {
+  static typename SampleTraits<To>::Value apply(float v) {
+    const float scale = float(int64_t(1) << (SampleTraits<To>::Bits - 1));
+    // The largest float below scale, which for 32-bit samples is less
+    // than scale - 1.
+    const float top = scale - (scale > 16777216.0f ? scale / 16777216.0f : 1);
+    float s = v * scale;
+    s = s < -scale ? -scale : (s > top ? top : s);
+    // Round half away from zero; the conversion truncates.
+    return typename SampleTraits<To>::Value(
+        int32_t(s + std::copysign(0.5f, s)));
+  }
+};
+
+// How channels are mapped from one format to another.
+enum ChannelMap { SameChannels, Downmix, Upmix };
+
+template <unsigned int From, unsigned int To>
+struct ChannelMapOf
+    : std::integral_constant<ChannelMap, From == To ? SameChannels
+                                         : To == 1  ? Downmix
+                                                    : Upmix> {
+  static_assert(From == To || From == 1 || To == 1,
+                "channels can only be converted to or from mono");
+};
+
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out,
+                   std::integral_constant<ChannelMap, SameChannels>) {
+  using Load = SampleIO<typename In::SampleType, In::ByteOrder>;
+  using Store = SampleIO<typename Out::SampleType, Out::ByteOrder>;
+  using Cast = SampleCast<typename In::SampleType, typename Out::SampleType>;
+  const size_t numSamples = numFrames * In::Channels;
+  for (size_t i = 0; i < numSamples; i++) {
+    Store::store(Cast::apply(Load::load(in + i * In::SampleBytes)),
+                 out + i * Out::SampleBytes);
+  }
+}
+
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out,
+                   std::integral_constant<ChannelMap, Downmix>) {
+  using Load = SampleIO<typename In::SampleType, In::ByteOrder>;
+  using Store = SampleIO<typename Out::SampleType, Out::ByteOrder>;
+  using ToFloat = SampleCast<typename In::SampleType, float>;
+  using FromFloat = SampleCast<float, typename Out::SampleType>;
+  const float scale = 1.0f / In::Channels;
+  for (size_t i = 0; i < numFrames; i++) {
+    const char *frame = in + i * In::FrameBytes;
+    float sum = 0;
+    for (unsigned int ch = 0; ch < In::Channels; ch++) {
+      sum += ToFloat::apply(Load::load(frame + ch * In::SampleBytes));
+    }
+    Store::store(FromFloat::apply(sum * scale), out + i * Out::SampleBytes);
+  }
+}
+
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out,
+                   std::integral_constant<ChannelMap, Upmix>) {
+  using Load = SampleIO<typename In::SampleType, In::ByteOrder>;
+  using Store = SampleIO<typename Out::SampleType, Out::ByteOrder>;
+  using Cast = SampleCast<typename In::SampleType, typename Out::SampleType>;
+  for (size_t i = 0; i < numFrames; i++) {
+    typename Out::Value v = Cast::apply(Load::load(in + i * In::SampleBytes));
+    char *frame = out + i * Out::FrameBytes;
+    for (unsigned int ch = 0; ch < Out::Channels; ch++) {
+      Store::store(v, frame + ch * Out::SampleBytes);
+    }
+  }
+}
+
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out,
+                   std::true_type /* identical formats */) {
+  std::memcpy(out, in, numFrames * In::FrameBytes);
+}
+
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out,
+                   std::false_type) {
+  convertFrames<In, Out>(in, numFrames, out,
+                         ChannelMapOf<In::Channels, Out::Channels>());
+}
+
+} // namespace audio_detail
+
+/*
+ * Convert numFrames frames of audio in format In to format Out, writing
+ * numFrames * Out::FrameBytes bytes to out. Channels may be kept as they
+ * are, averaged down to mono, or copied from mono to every channel.
+ */
+template <typename In, typename Out>
+void convertFrames(const char *in, size_t numFrames, char *out) {
+  audio_detail::convertFrames<In, Out>(
+      in, numFrames, out,
+      std::integral_constant<bool,
+                             std::is_same<typename In::SampleType,
+                                          typename Out::SampleType>::value &&
+                                 In::Channels == Out::Channels &&
+                                 In::ByteOrder == Out::ByteOrder>());
+}
+
+// Multiply every sample by gain, in place, clipping the result.
+template <typename Format>
+void applyGain(char *data, size_t numFrames, float gain) {
+  using IO =
+      audio_detail::SampleIO<typename Format::SampleType, Format::ByteOrder>;
+  using ToFloat = audio_detail::SampleCast<typename Format::SampleType, float>;
+  using FromFloat =
+      audio_detail::SampleCast<float, typename Format::SampleType>;
+  const size_t numSamples = numFrames * Format::Channels;
+  for (size_t i = 0; i < numSamples; i++) {
+    char *p = data + i * Format::SampleBytes;
+    IO::store(FromFloat::apply(ToFloat::apply(IO::load(p)) * gain), p);
+  }
+}
+
+// Add the samples of src to those of dst, in place, clipping the sums.
+template <typename Format>
+void mixFrames(char *dst, const char *src, size_t numFrames) {
+  using IO =
+      audio_detail::SampleIO<typename Format::SampleType, Format::ByteOrder>;
+  using ToFloat = audio_detail::SampleCast<typename Format::SampleType, float>;
+  using FromFloat =
+      audio_detail::SampleCast<float, typename Format::SampleType>;
+  const size_t numSamples = numFrames * Format::Channels;
+  for (size_t i = 0; i < numSamples; i++) {
+    char *p = dst + i * Format::SampleBytes;
+    float sum = ToFloat::apply(IO::load(p)) +
+                ToFloat::apply(IO::load(src + i * Format::SampleBytes));
+    IO::store(FromFloat::apply(sum), p);
+  }
+}
+
+/*
+ * FrameView gives typed access to interleaved audio in the given format
+ * that is held in a byte buffer, without copying it.
+ */
+template <typename Format> class FrameView {
+public:
+  using Value = typename Format::Value;
+
+  FrameView(const char *data, size_t size)
+      : mData(data), mFrames(size / Format::FrameBytes) {}
+
+  // The number of whole frames in the buffer.
+  size_t frames() const { return mFrames; }
+
+  // The sample for the given channel of the given frame.
+  Value sample(size_t frame, unsigned int channel) const {
+    using IO =
+        audio_detail::SampleIO<typename Format::SampleType, Format::ByteOrder>;
+    return IO::load(mData + frame * Format::FrameBytes +
+                    channel * Format::SampleBytes);
+  }
+
+  const char *data() const { return mData; }
+
+private:
+  const char *mData;
+  size_t mFrames;
+};
+
+#endif // AUDIO_FRAMES_H
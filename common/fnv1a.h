@@ -0,0 +1,40 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Returns the 64-bit FNV-1a hash of the given bytes. It is fast, and
+ * unlike std::hash it is the same on every platform and every run, so
+ * it can name files and pick shards that must be found again later. It
+ * is not collision resistant; callers that look something up by its
+ * hash must check that they found what they were looking for.
+ */
+inline uint64_t fnv1a(const std::string &data) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+#endif // FNV1A_H
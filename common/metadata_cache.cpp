@@ -0,0 +1,112 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metadata_cache.h"
+#include "fnv1a.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+MetadataCache::MetadataCache(const std::string &dir, int ttlSeconds)
+    : mDir(dir), mTTLSeconds(ttlSeconds) {
+  if (mkdir(mDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw std::runtime_error("could not create cache directory " + mDir +
+                             ": " + strerror(errno));
+  }
+}
+
+bool MetadataCache::load(const std::string &key, std::string *data) const {
+  std::string path = entryPath(key);
+
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+  if (time(nullptr) - info.st_mtime >= mTTLSeconds) {
+    return false;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  if (file.bad()) {
+    return false;
+  }
+
+  // Each entry starts with its length-prefixed key, which must match
+  // exactly, since different keys can have the same hash.
+  std::string entry = contents.str();
+  uint64_t keyLen = key.size();
+  size_t headerSize = sizeof(keyLen) + key.size();
+  if (entry.size() < headerSize ||
+      memcmp(entry.data(), &keyLen, sizeof(keyLen)) != 0 ||
+      entry.compare(sizeof(keyLen), key.size(), key) != 0) {
+    return false;
+  }
+  data->assign(entry, headerSize, std::string::npos);
+  return true;
+}
+
+void MetadataCache::store(const std::string &key,
+                          const std::string &data) const {
+  // Write to a temporary file and rename it into place, so that other
+  // processes never see a partially written entry.
+  std::string path = entryPath(key);
+  std::string tmpPath = path + ".XXXXXX";
+  int fd = mkstemp(&tmpPath[0]);
+  if (fd < 0) {
+    return;
+  }
+
+  FILE *file = fdopen(fd, "wb");
+  if (file == nullptr) {
+    close(fd);
+    unlink(tmpPath.c_str());
+    return;
+  }
+
+  uint64_t keyLen = key.size();
+  bool ok = fwrite(&keyLen, sizeof(keyLen), 1, file) == 1 &&
+            fwrite(key.data(), 1, key.size(), file) == key.size() &&
+            fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    unlink(tmpPath.c_str());
+  }
+}
+
+std::string MetadataCache::entryPath(const std::string &key) const {
+  // Keys may contain characters (such as the ':' in a server address)
+  // that don't belong in file names, so the file is named by a hash of
+  // the key. The key itself is stored in the file.
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.meta",
+           static_cast<unsigned long long>(fnv1a(key)));
+  return mDir + "/" + name;
+}
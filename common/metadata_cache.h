@@ -0,0 +1,61 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <string>
+
+/*
+ * MetadataCache keeps small blobs (such as serialized model lists) as
+ * files in a directory, so that a later run of the application can reuse
+ * them instead of asking the server again. Each entry expires ttlSeconds
+ * after it was stored, based on the file's modification time.
+ *
+ * Each file is named by a hash of its entry's key and starts with the
+ * key itself, so an entry is never mistaken for another whose key has
+ * the same hash.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * several processes may share the same directory. A failure to store an
+ * entry is not an error; the entry is simply fetched again next time.
+ */
+class MetadataCache {
+public:
+  /*
+   * Create a cache that stores entries in the given directory, which is
+   * created if it does not exist. Throws std::runtime_error if it could
+   * not be created.
+   */
+  MetadataCache(const std::string &dir, int ttlSeconds);
+
+  /*
+   * Read the entry with the given key. Returns false if there is no such
+   * entry or it has expired.
+   */
+  bool load(const std::string &key, std::string *data) const;
+
+  // Store the entry with the given key, replacing any previous value.
+  void store(const std::string &key, const std::string &data) const;
+
+private:
+  std::string mDir;
+  int mTTLSeconds;
+
+  std::string entryPath(const std::string &key) const;
+};
+
+#endif // METADATA_CACHE_H
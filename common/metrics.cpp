@@ -0,0 +1,385 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Percentiles written for each histogram.
+const double summaryQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// Returns the position of the highest set bit of a non-zero value.
+int highestBit(uint64_t value) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(value);
+#else
+  int bit = 0;
+  while (value >>= 1) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+// Formats a metric value the way Prometheus expects.
+std::string formatValue(double value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.9g", value);
+  return buf;
+}
+
+// Joins the metric's own labels with an extra one.
+std::string joinLabels(const std::string &labels, const std::string &extra) {
+  if (labels.empty()) {
+    return extra;
+  }
+  if (extra.empty()) {
+    return labels;
+  }
+  return labels + "," + extra;
+}
+
+std::string withLabels(const std::string &name, const std::string &labels) {
+  return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+} // namespace
+
+Counter::Counter() : mValue(0) {}
+
+void Counter::add(uint64_t n) { mValue.fetch_add(n, std::memory_order_relaxed); }
+
+uint64_t Counter::value() const {
+  return mValue.load(std::memory_order_relaxed);
+}
+
+Gauge::Gauge() : mValue(0) {}
+
+void Gauge::add(int64_t n) { mValue.fetch_add(n, std::memory_order_relaxed); }
+
+void Gauge::set(int64_t value) {
+  mValue.store(value, std::memory_order_relaxed);
+}
+
+int64_t Gauge::value() const { return mValue.load(std::memory_order_relaxed); }
+
+const size_t Histogram::numBuckets;
+
+Histogram::Histogram() : mCount(0), mSum(0), mMax(0) {
+  for (size_t i = 0; i < numBuckets; i++) {
+    mBuckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::record(uint64_t value) {
+  mBuckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  mCount.fetch_add(1, std::memory_order_relaxed);
+  mSum.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t prev = mMax.load(std::memory_order_relaxed);
+  while (value > prev &&
+         !mMax.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t Histogram::count() const {
+  return mCount.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::sum() const { return mSum.load(std::memory_order_relaxed); }
+
+uint64_t Histogram::max() const { return mMax.load(std::memory_order_relaxed); }
+
+uint64_t Histogram::percentile(double p) const {
+  // The buckets may change while they are summed, so the total is taken
+  // from the buckets themselves rather than from mCount.
+  uint64_t counts[numBuckets];
+  uint64_t total = 0;
+  for (size_t i = 0; i < numBuckets; i++) {
+    counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  // Nearest rank, as in LatencyStats
+  p = std::min(std::max(p, 0.0), 100.0);
+  uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+  rank = std::max<uint64_t>(rank, 1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < numBuckets; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return std::min(bucketMidpoint(i), max());
+    }
+  }
+  return max();
+}
+
+size_t Histogram::bucketIndex(uint64_t value) {
+  const uint64_t subBuckets = 1u << subBucketBits;
+  if (value < subBuckets) {
+    return static_cast<size_t>(value);
+  }
+
+  int shift = highestBit(value) - subBucketBits;
+  if (shift + subBucketBits >= maxValueBits) {
+    return numBuckets - 1;
+  }
+  return static_cast<size_t>(((shift + 1) << subBucketBits) +
+                             ((value >> shift) - subBuckets));
+}
+
+uint64_t Histogram::bucketMidpoint(size_t index) {
+  const uint64_t subBuckets = 1u << subBucketBits;
+  size_t block = index >> subBucketBits;
+  uint64_t sub = index & (subBuckets - 1);
+  if (block == 0) {
+    return sub;
+  }
+
+  int shift = static_cast<int>(block) - 1;
+  uint64_t lower = (subBuckets + sub) << shift;
+  return lower + ((uint64_t(1) << shift) >> 1);
+}
+
+ScopedTimer::ScopedTimer(Histogram &histogram)
+    : mHistogram(histogram), mStart(std::chrono::steady_clock::now()) {}
+
+ScopedTimer::~ScopedTimer() {
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - mStart);
+  mHistogram.record(static_cast<uint64_t>(elapsed.count()));
+}
+
+ScopedGauge::ScopedGauge(Gauge &gauge) : mGauge(gauge) { mGauge.add(1); }
+
+ScopedGauge::~ScopedGauge() { mGauge.add(-1); }
+
+MetricsRegistry::MetricsRegistry() {}
+
+MetricsRegistry::~MetricsRegistry() {}
+
+Counter &MetricsRegistry::counter(const std::string &name,
+                                  const std::string &help,
+                                  const std::string &labels) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  Entry &e = entry(name, help, labels, CounterType);
+  if (!e.counter) {
+    e.counter.reset(new Counter());
+  }
+  return *e.counter;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help,
+                              const std::string &labels) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  Entry &e = entry(name, help, labels, GaugeType);
+  if (!e.gauge) {
+    e.gauge.reset(new Gauge());
+  }
+  return *e.gauge;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name,
+                                      const std::string &help,
+                                      const std::string &labels,
+                                      double scale) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  Entry &e = entry(name, help, labels, HistogramType);
+  if (!e.histogram) {
+    e.histogram.reset(new Histogram());
+    e.scale = scale;
+  }
+  return *e.histogram;
+}
+
+std::string MetricsRegistry::prometheusText() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  // Metrics with the same name must be written together, under a single
+  // HELP and TYPE line, so sort them by name but otherwise keep the
+  // order they were created in.
+  std::vector<const Entry *> sorted;
+  for (const auto &e : mEntries) {
+    sorted.push_back(e.get());
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Entry *a, const Entry *b) {
+                     return a->name < b->name;
+                   });
+
+  std::ostringstream out;
+  const std::string *lastName = nullptr;
+  for (const Entry *e : sorted) {
+    if (!lastName || *lastName != e->name) {
+      static const char *typeNames[] = {"counter", "gauge", "summary"};
+      out << "# HELP " << e->name << " " << e->help << "\n";
+      out << "# TYPE " << e->name << " " << typeNames[e->type] << "\n";
+      lastName = &e->name;
+    }
+
+    switch (e->type) {
+    case CounterType:
+      out << withLabels(e->name, e->labels) << " " << e->counter->value()
+          << "\n";
+      break;
+    case GaugeType:
+      out << withLabels(e->name, e->labels) << " " << e->gauge->value()
+          << "\n";
+      break;
+    case HistogramType:
+      for (double q : summaryQuantiles) {
+        std::string quantile = "quantile=\"" + formatValue(q) + "\"";
+        out << withLabels(e->name, joinLabels(e->labels, quantile)) << " "
+            << formatValue(e->histogram->percentile(q * 100) * e->scale)
+            << "\n";
+      }
+      out << withLabels(e->name + "_sum", e->labels) << " "
+          << formatValue(e->histogram->sum() * e->scale) << "\n";
+      out << withLabels(e->name + "_count", e->labels) << " "
+          << e->histogram->count() << "\n";
+      break;
+    }
+  }
+
+  return out.str();
+}
+
+void MetricsRegistry::writeTextFile(const std::string &path) const {
+  std::string text = prometheusText();
+
+  // Write to a temporary file in the same directory, then rename it
+  // over the old file.
+  std::string tmpPath = path + ".XXXXXX";
+  std::vector<char> tmpName(tmpPath.begin(), tmpPath.end());
+  tmpName.push_back('\0');
+  int fd = mkstemp(tmpName.data());
+  if (fd < 0) {
+    throw std::runtime_error("could not create " + tmpPath + ": " +
+                             strerror(errno));
+  }
+
+  size_t written = 0;
+  while (written < text.size()) {
+    ssize_t n = write(fd, text.data() + written, text.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      int err = errno;
+      ::close(fd);
+      unlink(tmpName.data());
+      throw std::runtime_error("could not write " + path + ": " +
+                               strerror(err));
+    }
+    written += static_cast<size_t>(n);
+  }
+
+  // mkstemp() creates the file readable only by its owner
+  fchmod(fd, 0644);
+  ::close(fd);
+  if (rename(tmpName.data(), path.c_str()) != 0) {
+    int err = errno;
+    unlink(tmpName.data());
+    throw std::runtime_error("could not write " + path + ": " +
+                             strerror(err));
+  }
+}
+
+MetricsRegistry::Entry &MetricsRegistry::entry(const std::string &name,
+                                               const std::string &help,
+                                               const std::string &labels,
+                                               Type type) {
+  for (auto &e : mEntries) {
+    if (e->name == name && e->labels == labels) {
+      if (e->type != type) {
+        throw std::invalid_argument("metric " + name +
+                                    " already exists with another type");
+      }
+      return *e;
+    }
+  }
+
+  std::unique_ptr<Entry> e(new Entry());
+  e->name = name;
+  e->help = help;
+  e->labels = labels;
+  e->type = type;
+  e->scale = 1.0;
+  mEntries.push_back(std::move(e));
+  return *mEntries.back();
+}
+
+MetricsExporter::MetricsExporter(const MetricsRegistry &registry,
+                                 const std::string &path, int intervalMs)
+    : mRegistry(registry), mPath(path), mIntervalMs(intervalMs),
+      mStopping(false) {
+  mThread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() { stop(); }
+
+void MetricsExporter::close() {
+  stop();
+  mRegistry.writeTextFile(mPath);
+}
+
+void MetricsExporter::run() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (!mStopping) {
+    mCond.wait_for(lock, std::chrono::milliseconds(mIntervalMs));
+    if (mStopping) {
+      break;
+    }
+
+    // A failed write is tried again next time, and reported by close()
+    lock.unlock();
+    try {
+      mRegistry.writeTextFile(mPath);
+    } catch (std::exception &) {
+    }
+    lock.lock();
+  }
+}
+
+void MetricsExporter::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mStopping) {
+      return;
+    }
+    mStopping = true;
+  }
+  mCond.notify_all();
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * A small metrics layer for the clients. Counters, gauges and histograms
+ * are updated with atomic operations only, so recording a value never
+ * takes a lock and is cheap enough for every pushAudio() call. Metrics
+ * are created through a MetricsRegistry, which writes them all in the
+ * Prometheus text format.
+ */
+
+// A count that only goes up, such as the number of bytes sent.
+class Counter {
+public:
+  Counter();
+
+  void add(uint64_t n = 1);
+  uint64_t value() const;
+
+private:
+  std::atomic<uint64_t> mValue;
+};
+
+// A value that goes up and down, such as the number of open streams.
+class Gauge {
+public:
+  Gauge();
+
+  void add(int64_t n);
+  void set(int64_t value);
+  int64_t value() const;
+
+private:
+  std::atomic<int64_t> mValue;
+};
+
+/*
+ * Histogram counts non-negative integer values (such as durations in
+ * microseconds) in HDR-style log-linear buckets: each power of two is
+ * split into 32 equal buckets, so any value is known to within about
+ * 3%, from zero up to 2^40. Values above that are counted in the last
+ * bucket. Percentiles are estimated from the buckets.
+ */
+class Histogram {
+public:
+  Histogram();
+
+  void record(uint64_t value);
+
+  uint64_t count() const;
+  uint64_t sum() const;
+  uint64_t max() const;
+
+  /*
+   * Returns an estimate of the given percentile (0-100) of the values
+   * recorded, or 0 if there are none.
+   */
+  uint64_t percentile(double p) const;
+
+private:
+  static const int subBucketBits = 5;
+  static const int maxValueBits = 40;
+  static const size_t numBuckets =
+      (maxValueBits - subBucketBits + 1) << subBucketBits;
+
+  std::atomic<uint64_t> mBuckets[numBuckets];
+  std::atomic<uint64_t> mCount;
+  std::atomic<uint64_t> mSum;
+  std::atomic<uint64_t> mMax;
+
+  static size_t bucketIndex(uint64_t value);
+  static uint64_t bucketMidpoint(size_t index);
+};
+
+// Records the time from its creation to its destruction in a histogram,
+// in microseconds.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram &histogram);
+  ~ScopedTimer();
+
+private:
+  Histogram &mHistogram;
+  std::chrono::steady_clock::time_point mStart;
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
+// Adds one to a gauge for as long as it exists.
+class ScopedGauge {
+public:
+  explicit ScopedGauge(Gauge &gauge);
+  ~ScopedGauge();
+
+private:
+  Gauge &mGauge;
+
+  ScopedGauge(const ScopedGauge &) = delete;
+  ScopedGauge &operator=(const ScopedGauge &) = delete;
+};
+
+/*
+ * MetricsRegistry owns a set of named metrics. Each metric has a name,
+ * help text and an optional set of Prometheus labels, written as they
+ * would appear between the braces (such as method="recognize"). Asking
+ * for a metric that already exists returns the existing one, so several
+ * parts of a program can share the registry.
+ *
+ * Histograms are written as Prometheus summaries, with the 50th, 90th,
+ * 99th and 99.9th percentiles, the sum and the count. Their values are
+ * multiplied by the histogram's scale when they are written, so a
+ * histogram of microseconds with a scale of 1e-6 is written in seconds.
+ */
+class MetricsRegistry {
+public:
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  Counter &counter(const std::string &name, const std::string &help,
+                   const std::string &labels = "");
+  Gauge &gauge(const std::string &name, const std::string &help,
+               const std::string &labels = "");
+  Histogram &histogram(const std::string &name, const std::string &help,
+                       const std::string &labels = "", double scale = 1.0);
+
+  // Returns every metric in the Prometheus text exposition format.
+  std::string prometheusText() const;
+
+  /*
+   * Write the metrics to the given file, replacing it atomically so that
+   * a reader (such as the node_exporter textfile collector) never sees
+   * a partly written file. Throws std::runtime_error on failure.
+   */
+  void writeTextFile(const std::string &path) const;
+
+private:
+  enum Type { CounterType, GaugeType, HistogramType };
+
+  struct Entry {
+    std::string name;
+    std::string help;
+    std::string labels;
+    Type type;
+    double scale;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  mutable std::mutex mMutex;
+  std::vector<std::unique_ptr<Entry>> mEntries;
+
+  Entry &entry(const std::string &name, const std::string &help,
+               const std::string &labels, Type type);
+
+  MetricsRegistry(const MetricsRegistry &) = delete;
+  MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+};
+
+/*
+ * MetricsExporter writes a registry's metrics to a file on a background
+ * thread every intervalMs, and once more when it is closed, so that a
+ * long-running client can be scraped while it runs.
+ */
+class MetricsExporter {
+public:
+  MetricsExporter(const MetricsRegistry &registry, const std::string &path,
+                  int intervalMs = 10000);
+  ~MetricsExporter();
+
+  /*
+   * Stop the thread and write the metrics one last time. Throws
+   * std::runtime_error if that write fails.
+   */
+  void close();
+
+private:
+  const MetricsRegistry &mRegistry;
+  std::string mPath;
+  int mIntervalMs;
+
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  bool mStopping;
+  std::thread mThread;
+
+  void run();
+  void stop();
+};
+
+#endif // METRICS_H
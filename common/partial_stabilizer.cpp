@@ -0,0 +1,172 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "partial_stabilizer.h"
+
+#include <sys/ioctl.h>
+
+#include <algorithm>
+
+namespace {
+
+// Returns the number of characters in UTF-8 text.
+size_t utf8Length(const std::string &text) {
+  size_t n = 0;
+  for (unsigned char c : text) {
+    if ((c & 0xC0) != 0x80) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Returns true if position pos of text is inside a word.
+bool insideWord(const std::string &text, size_t pos) {
+  return pos > 0 && pos < text.size() && text[pos] != ' ' &&
+         text[pos - 1] != ' ';
+}
+
+/*
+ * Returns the length of the stable prefix of two hypotheses: their
+ * common prefix, backed up so that it does not end in the middle of a
+ * word (or a UTF-8 character) in either of them.
+ */
+size_t stablePrefix(const std::string &a, const std::string &b) {
+  size_t n = 0;
+  const size_t maxLen = std::min(a.size(), b.size());
+  while (n < maxLen && a[n] == b[n]) {
+    n++;
+  }
+  while (n > 0 && (insideWord(a, n) || insideWord(b, n))) {
+    n--;
+  }
+  return n;
+}
+
+} // namespace
+
+TranscriptDelta::TranscriptDelta() : stableBytes(0), isFinal(false) {}
+
+std::string TranscriptDelta::terminalEdit(int columns) const {
+  if (removed.empty()) {
+    return added;
+  }
+
+  std::string out;
+  size_t stableChars = utf8Length(text.substr(0, stableBytes));
+  if (columns > 0) {
+    // The cursor stays on the last column once a line is full, so the
+    // row it is on is worked out from the last character written.
+    size_t cols = static_cast<size_t>(columns);
+    size_t shownChars = stableChars + utf8Length(removed);
+    size_t upRows = (shownChars - 1) / cols - stableChars / cols;
+    if (upRows > 0) {
+      out += "\x1b[" + std::to_string(upRows) + "A";
+    }
+    out += "\r";
+    if (stableChars % cols > 0) {
+      out += "\x1b[" + std::to_string(stableChars % cols) + "C";
+    }
+    out += added;
+  } else {
+    out += "\r";
+    out += text;
+  }
+
+  // Clear the rest of the old text, including any lines it wrapped onto
+  out += "\x1b[J";
+  return out;
+}
+
+int terminalColumns(int fd) {
+  struct winsize ws;
+  if (ioctl(fd, TIOCGWINSZ, &ws) != 0) {
+    return 0;
+  }
+  return ws.ws_col;
+}
+
+PartialStabilizer::PartialStabilizer(int minIntervalMs)
+    : mMinInterval(std::chrono::milliseconds(minIntervalMs)),
+      mLastUpdate(Clock::time_point()), mHavePending(false), mHypotheses(0),
+      mUpdates(0), mBytesEmitted(0), mBytesReprinted(0) {}
+
+bool PartialStabilizer::update(const std::string &text, bool isFinal,
+                               TranscriptDelta *delta) {
+  mHypotheses++;
+
+  Clock::time_point now = Clock::now();
+  if (!isFinal && now - mLastUpdate < mMinInterval) {
+    mHavePending = true;
+    mPending = text;
+    return false;
+  }
+  mHavePending = false;
+  if (!isFinal && text == mShown) {
+    return false;
+  }
+
+  mLastUpdate = now;
+  makeDelta(text, isFinal, delta);
+  return true;
+}
+
+bool PartialStabilizer::flush(TranscriptDelta *delta) {
+  Clock::time_point now = Clock::now();
+  if (!mHavePending || now - mLastUpdate < mMinInterval) {
+    return false;
+  }
+  mHavePending = false;
+  if (mPending == mShown) {
+    return false;
+  }
+
+  mLastUpdate = now;
+  makeDelta(mPending, false, delta);
+  return true;
+}
+
+const std::string &PartialStabilizer::shown() const { return mShown; }
+
+uint64_t PartialStabilizer::hypotheses() const { return mHypotheses; }
+
+uint64_t PartialStabilizer::updates() const { return mUpdates; }
+
+uint64_t PartialStabilizer::bytesEmitted() const { return mBytesEmitted; }
+
+uint64_t PartialStabilizer::bytesReprinted() const { return mBytesReprinted; }
+
+void PartialStabilizer::makeDelta(const std::string &text, bool isFinal,
+                                  TranscriptDelta *delta) {
+  size_t stable = stablePrefix(mShown, text);
+  delta->stableBytes = stable;
+  delta->removed.assign(mShown, stable, std::string::npos);
+  delta->added.assign(text, stable, std::string::npos);
+  delta->text = text;
+  delta->isFinal = isFinal;
+
+  mUpdates++;
+  mBytesEmitted += delta->added.size();
+  mBytesReprinted += text.size();
+
+  // A final result ends the utterance, and the next one starts empty.
+  if (isFinal) {
+    mShown.clear();
+    mLastUpdate = Clock::time_point();
+  } else {
+    mShown = text;
+  }
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARTIAL_STABILIZER_H
+#define PARTIAL_STABILIZER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * TranscriptDelta is the change from the text shown for an utterance so
+ * far to its latest hypothesis: the first stableBytes bytes are kept,
+ * the removed text after them is replaced by the added text.
+ */
+struct TranscriptDelta {
+  size_t stableBytes;
+  std::string removed;
+  std::string added;
+
+  // The whole hypothesis, of which added is the end.
+  std::string text;
+
+  // The hypothesis was final, so the next one starts a new utterance.
+  bool isFinal;
+
+  TranscriptDelta();
+
+  /*
+   * Returns the bytes that make the change on an ANSI terminal, with
+   * the cursor at the end of the shown text and the utterance starting
+   * at the beginning of a line. Given the terminal's width in columns,
+   * the cursor is moved back to the end of the stable text, even if the
+   * text has wrapped onto several lines, and only the added text is
+   * written. Without it, the line is redrawn from its start, which is
+   * only right if the text fits on one line. Either way, whatever is
+   * left of the old text is cleared. The caller ends the line after a
+   * final result, perhaps after adding something of its own.
+   */
+  std::string terminalEdit(int columns = 0) const;
+};
+
+/*
+ * Returns the width of the terminal open on fd in columns, or 0 if fd
+ * is not a terminal.
+ */
+int terminalColumns(int fd);
+
+/*
+ * PartialStabilizer turns the stream of partial and final hypotheses for
+ * each utterance into deltas, so that the work done to show them (or
+ * send them anywhere else) depends on how much changed rather than on
+ * how long the transcript is.
+ *
+ * Each hypothesis is compared with the text already shown. Their common
+ * prefix, backed up to the last whole word, is the stable part; only the
+ * text after it is replaced. Partial hypotheses that arrive less than
+ * minIntervalMs after the last update are held back, since the next
+ * update covers their changes too. The newest of them is kept, so that
+ * flush() can show it once the interval has passed if no later
+ * hypothesis has replaced it. Final hypotheses are always passed on.
+ *
+ * It is not thread safe; use it from the thread that receives results.
+ */
+class PartialStabilizer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit PartialStabilizer(int minIntervalMs = 100);
+
+  /*
+   * Add the next hypothesis for the current utterance. Returns true and
+   * fills in delta if it should be shown now, or false if it is held
+   * back or changes nothing.
+   */
+  bool update(const std::string &text, bool isFinal, TranscriptDelta *delta);
+
+  /*
+   * Show the newest partial hypothesis held back by update(), if there
+   * is one and minIntervalMs has passed since the last update. Returns
+   * true and fills in delta if there is something to show. Call this
+   * whenever there is a chance to update the display without a new
+   * hypothesis, such as after each response.
+   */
+  bool flush(TranscriptDelta *delta);
+
+  // Returns the text currently shown for the utterance.
+  const std::string &shown() const;
+
+  // Returns the number of hypotheses added and deltas returned so far.
+  uint64_t hypotheses() const;
+  uint64_t updates() const;
+
+  /*
+   * Returns the bytes of text in the deltas returned so far, and the
+   * bytes that reprinting each of those hypotheses whole would take.
+   */
+  uint64_t bytesEmitted() const;
+  uint64_t bytesReprinted() const;
+
+private:
+  Clock::duration mMinInterval;
+  Clock::time_point mLastUpdate;
+  std::string mShown;
+
+  // The newest partial hypothesis not shown yet.
+  bool mHavePending;
+  std::string mPending;
+
+  uint64_t mHypotheses;
+  uint64_t mUpdates;
+  uint64_t mBytesEmitted;
+  uint64_t mBytesReprinted;
+
+  void makeDelta(const std::string &text, bool isFinal, TranscriptDelta *delta);
+};
+
+#endif // PARTIAL_STABILIZER_H
@@ -0,0 +1,253 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "process_source.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+extern char **environ;
+
+namespace {
+
+std::runtime_error systemError(const std::string &what) {
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+} // namespace
+
+ProcessSource::ProcessSource(const std::string &cmd)
+    : mCmd(cmd), mPid(-1), mPipeFd(-1), mEpollFd(-1), mCancelFd(-1),
+      mEof(false), mCancelled(false) {
+  /*
+   * The eventfd used for cancellation lives as long as this object (not
+   * just while the application runs), so cancel() is always safe to call
+   * from another thread.
+   */
+  mCancelFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mCancelFd < 0 || mEpollFd < 0) {
+    std::runtime_error e = systemError("could not create epoll instance");
+    closeFds();
+    throw e;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = mCancelFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCancelFd, &ev);
+}
+
+ProcessSource::~ProcessSource() {
+  this->stop();
+  closeFds();
+}
+
+void ProcessSource::start() {
+  // Ignore if the application is already running
+  if (mPid > 0) {
+    return;
+  }
+
+  // Clear any cancellation left over from a previous run
+  uint64_t count;
+  while (::read(mCancelFd, &count, sizeof(count)) > 0) {
+  }
+  mEof = false;
+  mCancelled = false;
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    throw systemError("could not create pipe");
+  }
+
+  // The child's end of the pipe becomes its stdout. dup2() clears
+  // O_CLOEXEC on the new descriptor, so only stdout survives the exec.
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  const char *argv[] = {"/bin/sh", "-c", mCmd.c_str(), nullptr};
+  int err = posix_spawn(&mPid, "/bin/sh", &actions, &attr,
+                        const_cast<char *const *>(argv), environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(fds[1]);
+
+  if (err != 0) {
+    close(fds[0]);
+    mPid = -1;
+    throw std::runtime_error("could not start '" + mCmd +
+                             "': " + strerror(err));
+  }
+
+  mPipeFd = fds[0];
+  fcntl(mPipeFd, F_SETFL, fcntl(mPipeFd, F_GETFL) | O_NONBLOCK);
+
+  // The pipe is removed from the epoll set automatically when closed.
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = mPipeFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mPipeFd, &ev);
+}
+
+size_t ProcessSource::read(char *buffer, size_t buffSize, int timeoutMs) {
+  if (mPipeFd < 0) {
+    throw std::runtime_error("can't read - process not started.");
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+
+  while (!mCancelled && !mEof) {
+    // Try the read first so that no epoll_wait() call is made when data
+    // is already waiting in the pipe.
+    ssize_t n = ::read(mPipeFd, buffer, buffSize);
+    if (n > 0) {
+      return n;
+    }
+    if (n == 0) {
+      mEof = true;
+      break;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      throw systemError("could not read from '" + mCmd + "'");
+    }
+
+    int waitMs = -1;
+    if (timeoutMs >= 0) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
+        break;
+      }
+      waitMs = remaining.count();
+    }
+
+    // Wait for either data on the pipe or a cancellation. Both are
+    // handled at the top of the loop.
+    struct epoll_event events[2];
+    if (epoll_wait(mEpollFd, events, 2, waitMs) < 0 && errno != EINTR) {
+      throw systemError("could not wait on '" + mCmd + "'");
+    }
+  }
+
+  return 0;
+}
+
+void ProcessSource::cancel() {
+  mCancelled = true;
+
+  // The eventfd is left signalled, so any later epoll_wait() returns
+  // immediately as well.
+  uint64_t one = 1;
+  ssize_t unused = write(mCancelFd, &one, sizeof(one));
+  (void)unused;
+}
+
+bool ProcessSource::eof() const { return mEof; }
+
+bool ProcessSource::cancelled() const { return mCancelled; }
+
+int ProcessSource::stop(int graceMs) {
+  // Ignore if the application is already stopped
+  if (mPid <= 0) {
+    return -1;
+  }
+
+  // Reap the application first if it has already exited (for example,
+  // because it could not open its input device), so its own status is
+  // reported rather than the effect of our signals.
+  int status = -1;
+  pid_t ret;
+  while ((ret = waitpid(mPid, &status, WNOHANG)) < 0 && errno == EINTR) {
+  }
+  if (ret == mPid || ret < 0) {
+    close(mPipeFd);
+    mPipeFd = -1;
+    mPid = -1;
+    return status;
+  }
+
+  // Closing the pipe alone can leave the application blocked on its
+  // input device until its next write, so signal it directly as well.
+  kill(-mPid, SIGTERM);
+  close(mPipeFd);
+  mPipeFd = -1;
+
+  bool killed = false;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(graceMs);
+  while (true) {
+    ret = waitpid(mPid, &status, WNOHANG);
+    if (ret == mPid || (ret < 0 && errno != EINTR)) {
+      break;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      kill(-mPid, SIGKILL);
+      killed = true;
+      while (waitpid(mPid, &status, 0) < 0 && errno == EINTR) {
+      }
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  mPid = -1;
+
+  // Being killed by our own signal, or by SIGPIPE once the pipe was
+  // closed, is how a stopped application is expected to end, so it is
+  // reported as a clean exit.
+  if (WIFSIGNALED(status)) {
+    int sig = WTERMSIG(status);
+    if (sig == SIGTERM || sig == SIGPIPE || (killed && sig == SIGKILL)) {
+      return 0;
+    }
+  }
+  return status;
+}
+
+void ProcessSource::closeFds() {
+  int *fds[] = {&mPipeFd, &mEpollFd, &mCancelFd};
+  for (int *fd : fds) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
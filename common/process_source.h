@@ -0,0 +1,102 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROCESS_SOURCE_H
+#define PROCESS_SOURCE_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+/*
+ * ProcessSource launches an external application (such as sox or
+ * arecord) and reads the data it writes to stdout. The pipe is read
+ * without blocking, using epoll to wait for data, so a read may be
+ * given a timeout or be cancelled from another thread at any time.
+ *
+ * The application is run with "/bin/sh -c", in its own process group
+ * so that stop() can signal the application as well as the shell.
+ */
+class ProcessSource {
+public:
+  /*
+   * Create a new source that will run the given shell command. Throws
+   * std::runtime_error if the epoll instance could not be created.
+   */
+  ProcessSource(const std::string &cmd);
+
+  // Stops the application if it is still running.
+  ~ProcessSource();
+
+  ProcessSource(const ProcessSource &) = delete;
+  ProcessSource &operator=(const ProcessSource &) = delete;
+
+  /*
+   * Launch the application. Throws std::runtime_error if it could not
+   * be started. Does nothing if the application is already running.
+   */
+  void start();
+
+  /*
+   * Read up to buffSize bytes from the application's stdout, waiting at
+   * most timeoutMs milliseconds for data to arrive (or forever if
+   * timeoutMs is negative). Returns the number of bytes read, which may
+   * be less than buffSize. Returns zero if the timeout expired, the
+   * source was cancelled, or the application closed its stdout; use
+   * eof() and cancelled() to tell these apart.
+   */
+  size_t read(char *buffer, size_t buffSize, int timeoutMs = -1);
+
+  /*
+   * Wake up any thread waiting in read() and make all future reads
+   * return immediately. Unlike the other methods, this may be called
+   * from any thread.
+   */
+  void cancel();
+
+  // Returns true once the application has closed its stdout.
+  bool eof() const;
+
+  // Returns true if cancel() has been called.
+  bool cancelled() const;
+
+  /*
+   * Stop the application and return its wait status (see waitpid(2)),
+   * or -1 if it was not running. If the application has not already
+   * exited, it is sent SIGTERM and the pipe is closed. If it has not
+   * exited after graceMs milliseconds it is sent SIGKILL. Being killed
+   * by one of these signals (or by SIGPIPE) is reported as a status of
+   * zero, so any other status comes from the application itself. Must
+   * not be called while another thread is in read(); call cancel()
+   * first.
+   */
+  int stop(int graceMs = 100);
+
+private:
+  std::string mCmd;
+  pid_t mPid;
+  int mPipeFd;
+  int mEpollFd;
+  int mCancelFd;
+  bool mEof;
+  std::atomic<bool> mCancelled;
+
+  void closeFds();
+};
+
+#endif // PROCESS_SOURCE_H
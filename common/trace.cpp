@@ -0,0 +1,235 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACING
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/*
+ * A recorded event. The fields are atomics only so that the exporter
+ * may read a slot while its thread overwrites it; relaxed loads and
+ * stores compile to plain moves.
+ */
+struct Event {
+  std::atomic<const char *> name;
+  std::atomic<int64_t> startNs;
+  std::atomic<int64_t> durationNs; // negative for an instant event
+};
+
+/*
+ * The ring of events recorded by one thread. Only the owning thread
+ * writes events, and it publishes each one by advancing mWritten.
+ */
+class ThreadBuffer {
+public:
+  explicit ThreadBuffer(int tid)
+      : mTid(tid), mEvents(new Event[Tracer::eventsPerThread]), mWritten(0) {}
+
+  void add(const char *name, int64_t startNs, int64_t durationNs) {
+    uint64_t n = mWritten.load(std::memory_order_relaxed);
+    Event &e = mEvents[n % Tracer::eventsPerThread];
+    e.name.store(name, std::memory_order_relaxed);
+    e.startNs.store(startNs, std::memory_order_relaxed);
+    e.durationNs.store(durationNs, std::memory_order_relaxed);
+    mWritten.store(n + 1, std::memory_order_release);
+  }
+
+  int mTid;
+  std::unique_ptr<Event[]> mEvents;
+  std::atomic<uint64_t> mWritten;
+
+  std::mutex mNameMutex;
+  std::string mName;
+};
+
+struct EventCopy {
+  const char *name;
+  int64_t startNs;
+  int64_t durationNs;
+};
+
+/*
+ * Every thread's buffer. Buffers are kept after their thread exits so
+ * its events are still exported, and the registry itself is never
+ * destroyed, so threads still running at exit can keep recording.
+ */
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry &registry() {
+  static Registry *r = new Registry;
+  return *r;
+}
+
+// Event times are written relative to this, which is close to when the
+// program started.
+const Tracer::Clock::time_point traceEpoch = Tracer::Clock::now();
+
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+ThreadBuffer &currentBuffer() {
+  if (!threadBuffer) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.buffers.emplace_back(new ThreadBuffer(r.buffers.size() + 1));
+    threadBuffer = r.buffers.back().get();
+  }
+  return *threadBuffer;
+}
+
+int64_t sinceEpochNs(Tracer::Clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t - traceEpoch)
+      .count();
+}
+
+// Copies out the events a buffer holds that were not overwritten while
+// they were being copied.
+std::vector<EventCopy> copyEvents(const ThreadBuffer &buf) {
+  const uint64_t cap = Tracer::eventsPerThread;
+  uint64_t end = buf.mWritten.load(std::memory_order_acquire);
+  uint64_t begin = end > cap ? end - cap : 0;
+
+  std::vector<EventCopy> events;
+  events.reserve(end - begin);
+  for (uint64_t i = begin; i < end; i++) {
+    const Event &e = buf.mEvents[i % cap];
+    events.push_back({e.name.load(std::memory_order_relaxed),
+                      e.startNs.load(std::memory_order_relaxed),
+                      e.durationNs.load(std::memory_order_relaxed)});
+  }
+
+  // The thread may have written up to (and be part way through) event
+  // number nowWritten while we were copying, which replaces the slots
+  // of every event before nowWritten + 1 - cap.
+  uint64_t nowWritten = buf.mWritten.load(std::memory_order_acquire);
+  if (nowWritten + 1 > begin + cap) {
+    size_t lost = std::min<uint64_t>(nowWritten + 1 - cap - begin, events.size());
+    events.erase(events.begin(), events.begin() + lost);
+  }
+  return events;
+}
+
+void writeJSONString(std::ostream &out, const char *str) {
+  out << '"';
+  for (const char *p = str; *p; p++) {
+    unsigned char c = *p;
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out << buf;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// Formats nanoseconds as the microseconds the trace format uses.
+std::string micros(int64_t ns) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.3f", ns / 1000.0);
+  return buf;
+}
+
+} // namespace
+
+void Tracer::span(const char *name, Clock::time_point start,
+                  Clock::time_point end) {
+  int64_t startNs = sinceEpochNs(start);
+  currentBuffer().add(name, startNs, sinceEpochNs(end) - startNs);
+}
+
+void Tracer::instant(const char *name) {
+  currentBuffer().add(name, sinceEpochNs(Clock::now()), -1);
+}
+
+void Tracer::setThreadName(const std::string &name) {
+  ThreadBuffer &buf = currentBuffer();
+  std::lock_guard<std::mutex> lock(buf.mNameMutex);
+  buf.mName = name;
+}
+
+void Tracer::writeChromeTrace(const std::string &path) {
+  std::vector<ThreadBuffer *> buffers;
+  {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (auto &buf : r.buffers) {
+      buffers.push_back(buf.get());
+    }
+  }
+
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("could not open trace file " + path);
+  }
+
+  const int pid = getpid();
+  const char *sep = "\n";
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (ThreadBuffer *buf : buffers) {
+    std::string threadName;
+    {
+      std::lock_guard<std::mutex> lock(buf->mNameMutex);
+      threadName = buf->mName;
+    }
+    if (!threadName.empty()) {
+      out << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+          << ",\"tid\":" << buf->mTid << ",\"args\":{\"name\":";
+      writeJSONString(out, threadName.c_str());
+      out << "}}";
+      sep = ",\n";
+    }
+
+    for (const EventCopy &e : copyEvents(*buf)) {
+      out << sep << "{\"name\":";
+      writeJSONString(out, e.name);
+      if (e.durationNs < 0) {
+        out << ",\"ph\":\"i\",\"s\":\"t\"";
+      } else {
+        out << ",\"ph\":\"X\",\"dur\":" << micros(e.durationNs);
+      }
+      out << ",\"pid\":" << pid << ",\"tid\":" << buf->mTid
+          << ",\"ts\":" << micros(e.startNs) << "}";
+      sep = ",\n";
+    }
+  }
+  out << "\n]}\n";
+
+  out.close();
+  if (!out) {
+    throw std::runtime_error("could not write trace file " + path);
+  }
+}
+
+#endif // ENABLE_TRACING
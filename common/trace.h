@@ -0,0 +1,106 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Event tracing for finding where the time goes in a request. Code is
+ * instrumented with these macros:
+ *
+ *     TRACE_SCOPE("name")        records a span from here to the end of
+ *                                the enclosing scope
+ *     TRACE_INSTANT("name")      records a single point in time
+ *     TRACE_THREAD_NAME("name")  names the calling thread in the trace
+ *
+ * Names must be string literals (or otherwise live for the rest of the
+ * program), since only the pointer is stored.
+ *
+ * Tracing is compiled in only when ENABLE_TRACING is defined (configure
+ * with -DENABLE_TRACING=ON). Otherwise the macros expand to nothing and
+ * cost nothing at all.
+ *
+ * Each thread records its events into its own fixed-size ring buffer,
+ * without taking any locks, so recording a span costs two clock reads
+ * and a few stores. When a buffer is full the oldest events are
+ * overwritten. Tracer::writeChromeTrace() writes the events from every
+ * thread as Chrome trace-event JSON, which can be opened in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing.
+ */
+
+#ifdef ENABLE_TRACING
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_INSTANT(name) Tracer::instant(name)
+#define TRACE_THREAD_NAME(name) Tracer::setThreadName(name)
+
+class Tracer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // The number of events kept for each thread.
+  static const size_t eventsPerThread = 32768;
+
+  // Record a span that started at start and ended at end.
+  static void span(const char *name, Clock::time_point start,
+                   Clock::time_point end);
+
+  // Record a single point in time.
+  static void instant(const char *name);
+
+  // Name the calling thread in the trace.
+  static void setThreadName(const std::string &name);
+
+  /*
+   * Write the events recorded so far, from every thread, to the given
+   * file as Chrome trace-event JSON. Threads may keep recording while
+   * this runs; events they overwrite while it runs are left out.
+   * Throws std::runtime_error if the file could not be written.
+   */
+  static void writeChromeTrace(const std::string &path);
+};
+
+// Records a span covering the lifetime of the object.
+class TraceSpan {
+public:
+  explicit TraceSpan(const char *name)
+      : mName(name), mStart(Tracer::Clock::now()) {}
+  ~TraceSpan() { Tracer::span(mName, mStart, Tracer::Clock::now()); }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *mName;
+  Tracer::Clock::time_point mStart;
+};
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif // ENABLE_TRACING
+
+#endif // TRACE_H
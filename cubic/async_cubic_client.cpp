@@ -0,0 +1,321 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_cubic_client.h"
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+AsyncRecognizerStream::AsyncRecognizerStream(AsyncCubicClient *client,
+                                             ResultCallback onResult,
+                                             DoneCallback onDone,
+                                             WriteCallback onWrite)
+    : mClient(client), mOnResult(onResult), mOnDone(onDone),
+      mOnWrite(onWrite), mQueuedBytes(0),
+      mStarted(false), mWriting(false), mAudioFinished(false),
+      mWritesDone(false), mReadsDone(false), mFinishing(false),
+      mFinished(false)
+{
+    const Op ops[] = {OpStart, OpWrite, OpWritesDone, OpRead, OpFinish};
+    for (Op op : ops)
+    {
+        mTags[op].stream = this;
+        mTags[op].op = op;
+    }
+}
+
+AsyncRecognizerStream::~AsyncRecognizerStream() {}
+
+void AsyncRecognizerStream::pushAudio(const char *audioData, size_t sizeInBytes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFinished || mAudioFinished || mWritesDone)
+    {
+        return;
+    }
+
+    mQueue.emplace_back();
+    mQueue.back().set_audio(audioData, sizeInBytes);
+    mQueuedBytes += sizeInBytes;
+    startNextWrite();
+}
+
+void AsyncRecognizerStream::audioFinished()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAudioFinished = true;
+    startNextWrite();
+}
+
+void AsyncRecognizerStream::cancel()
+{
+    mContext.TryCancel();
+}
+
+size_t AsyncRecognizerStream::queuedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueuedBytes;
+}
+
+void AsyncRecognizerStream::start(CubicPB::Cubic::Stub *stub,
+                                  grpc::CompletionQueue *cq,
+                                  const CubicPB::RecognitionConfig &config)
+{
+    mSelf = shared_from_this();
+
+    // The config is the first message sent, as with the SDK.
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.emplace_back();
+        *mQueue.back().mutable_config() = config;
+    }
+
+    mStream = stub->PrepareAsyncStreamingRecognize(&mContext, cq);
+    mStream->StartCall(&mTags[OpStart]);
+}
+
+void AsyncRecognizerStream::handle(Op op, bool ok)
+{
+    switch (op)
+    {
+    case OpStart:
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStarted = true;
+        if (ok)
+        {
+            mStream->Read(&mResponse, &mTags[OpRead]);
+            startNextWrite();
+        }
+        else
+        {
+            mReadsDone = true;
+            startFinishIfDone();
+        }
+        break;
+    }
+
+    case OpWrite:
+    case OpWritesDone:
+    {
+        size_t queued;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mWriting = false;
+            if (!ok)
+            {
+                // The call is broken, so nothing more will be sent. The
+                // failed read that follows collects the status.
+                mWritesDone = true;
+                mQueue.clear();
+                mQueuedBytes = 0;
+            }
+            queued = mQueuedBytes;
+            startNextWrite();
+            startFinishIfDone();
+        }
+
+        if (op == OpWrite && mOnWrite)
+        {
+            mOnWrite(queued);
+        }
+        break;
+    }
+
+    case OpRead:
+        if (ok)
+        {
+            // Only one read is outstanding at a time, so the response
+            // is not touched again until the next Read() below.
+            if (mOnResult)
+            {
+                mOnResult(mResponse);
+            }
+            mStream->Read(&mResponse, &mTags[OpRead]);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mReadsDone = true;
+            startFinishIfDone();
+        }
+        break;
+
+    case OpFinish:
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mFinished = true;
+            mQueue.clear();
+            mQueuedBytes = 0;
+        }
+
+        if (mOnDone)
+        {
+            mOnDone(mStatus);
+        }
+        mClient->streamFinished(this);
+
+        // gRPC is done with the stream, so let it go. This may destroy
+        // the stream, so nothing may touch it afterwards.
+        std::shared_ptr<AsyncRecognizerStream> self;
+        self.swap(mSelf);
+        break;
+    }
+    }
+}
+
+// Must be called with mMutex held.
+void AsyncRecognizerStream::startNextWrite()
+{
+    // gRPC allows only one write in flight per call
+    if (!mStarted || mWriting || mWritesDone || mReadsDone)
+    {
+        return;
+    }
+
+    if (!mQueue.empty())
+    {
+        mWriteRequest.Swap(&mQueue.front());
+        mQueue.pop_front();
+        mQueuedBytes -= mWriteRequest.audio().size();
+        mWriting = true;
+        mStream->Write(mWriteRequest, &mTags[OpWrite]);
+    }
+    else if (mAudioFinished)
+    {
+        mWritesDone = true;
+        mWriting = true;
+        mStream->WritesDone(&mTags[OpWritesDone]);
+    }
+}
+
+// Must be called with mMutex held.
+void AsyncRecognizerStream::startFinishIfDone()
+{
+    // Finish() may not overlap a write, so wait for the last one.
+    if (mReadsDone && !mWriting && !mFinishing)
+    {
+        mFinishing = true;
+        mStream->Finish(&mStatus, &mTags[OpFinish]);
+    }
+}
+
+AsyncCubicClient::AsyncCubicClient(const std::string &url, int numThreads)
+    : mNextQueue(0)
+{
+    init(grpc::CreateChannel(url, grpc::InsecureChannelCredentials()),
+         numThreads);
+}
+
+AsyncCubicClient::AsyncCubicClient(
+    const std::shared_ptr<grpc::Channel> &channel, int numThreads)
+    : mNextQueue(0)
+{
+    init(channel, numThreads);
+}
+
+AsyncCubicClient::~AsyncCubicClient()
+{
+    // No new operations may be started once a queue is shut down, so
+    // every stream has to end first.
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (AsyncRecognizerStream *stream : mStreams)
+        {
+            stream->cancel();
+        }
+        mCond.wait(lock, [this]() { return mStreams.empty(); });
+    }
+
+    for (auto &cq : mQueues)
+    {
+        cq->Shutdown();
+    }
+    for (std::thread &t : mThreads)
+    {
+        t.join();
+    }
+}
+
+std::shared_ptr<AsyncRecognizerStream>
+AsyncCubicClient::streamingRecognize(
+    const CubicPB::RecognitionConfig &config,
+    AsyncRecognizerStream::ResultCallback onResult,
+    AsyncRecognizerStream::DoneCallback onDone,
+    AsyncRecognizerStream::WriteCallback onWrite)
+{
+    std::shared_ptr<AsyncRecognizerStream> stream(
+        new AsyncRecognizerStream(this, onResult, onDone, onWrite));
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStreams.insert(stream.get());
+    }
+
+    grpc::CompletionQueue *cq = mQueues[mNextQueue++ % mQueues.size()].get();
+    stream->start(mStub.get(), cq, config);
+    return stream;
+}
+
+size_t AsyncCubicClient::activeStreams() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStreams.size();
+}
+
+void AsyncCubicClient::init(const std::shared_ptr<grpc::Channel> &channel,
+                            int numThreads)
+{
+    mStub = CubicPB::Cubic::NewStub(channel);
+
+    if (numThreads < 1)
+    {
+        numThreads = 1;
+    }
+    for (int i = 0; i < numThreads; i++)
+    {
+        mQueues.emplace_back(new grpc::CompletionQueue());
+    }
+    for (int i = 0; i < numThreads; i++)
+    {
+        mThreads.emplace_back(&AsyncCubicClient::run, this, mQueues[i].get());
+    }
+}
+
+void AsyncCubicClient::run(grpc::CompletionQueue *cq)
+{
+    void *tag;
+    bool ok;
+    while (cq->Next(&tag, &ok))
+    {
+        AsyncRecognizerStream::Tag *t =
+            static_cast<AsyncRecognizerStream::Tag *>(tag);
+        t->stream->handle(t->op, ok);
+    }
+}
+
+void AsyncCubicClient::streamFinished(AsyncRecognizerStream *stream)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStreams.erase(stream);
+    if (mStreams.empty())
+    {
+        mCond.notify_all();
+    }
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASYNC_CUBIC_CLIENT_H
+#define ASYNC_CUBIC_CLIENT_H
+
+#include "cubic.grpc.pb.h"
+
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/completion_queue.h>
+#include <grpcpp/support/async_stream.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+class AsyncCubicClient;
+
+/*
+ * AsyncRecognizerStream is a streaming recognition call made with an
+ * AsyncCubicClient. Unlike CubicRecognizerStream, no method ever waits
+ * for the network: pushAudio() queues a copy of the audio, which is sent
+ * by the client's completion queue threads as the connection allows, and
+ * results are delivered to a callback on one of those threads.
+ *
+ * A stream's callbacks are never called at the same time, and the done
+ * callback is always the last one called. They run on a completion
+ * queue thread, so they should return quickly rather than blocking it.
+ */
+class AsyncRecognizerStream :
+    public std::enable_shared_from_this<AsyncRecognizerStream>
+{
+public:
+    using ResultCallback =
+        std::function<void(const cobaltspeech::cubic::RecognitionResponse &)>;
+    using DoneCallback = std::function<void(const grpc::Status &)>;
+    using WriteCallback = std::function<void(size_t queuedBytes)>;
+
+    ~AsyncRecognizerStream();
+
+    AsyncRecognizerStream(const AsyncRecognizerStream &) = delete;
+    AsyncRecognizerStream &operator=(const AsyncRecognizerStream &) = delete;
+
+    // Queue a copy of the given audio to be sent. Does nothing once the
+    // stream has finished. Safe to call from any thread.
+    void pushAudio(const char *audioData, size_t sizeInBytes);
+
+    // Let Cubic know that no more audio will be pushed, once the queued
+    // audio has been sent. Safe to call from any thread.
+    void audioFinished();
+
+    // Cancel the call. The done callback is still called, with a
+    // CANCELLED status. Safe to call from any thread.
+    void cancel();
+
+    // Returns the number of bytes of audio queued but not yet sent.
+    size_t queuedBytes() const;
+
+private:
+    friend class AsyncCubicClient;
+
+    enum Op
+    {
+        OpStart,
+        OpWrite,
+        OpWritesDone,
+        OpRead,
+        OpFinish
+    };
+
+    // The tag given to gRPC for each kind of operation.
+    struct Tag
+    {
+        AsyncRecognizerStream *stream;
+        Op op;
+    };
+
+    using GrpcStream = grpc::ClientAsyncReaderWriter<
+        cobaltspeech::cubic::StreamingRecognizeRequest,
+        cobaltspeech::cubic::RecognitionResponse>;
+
+    AsyncCubicClient *mClient;
+    ResultCallback mOnResult;
+    DoneCallback mOnDone;
+    WriteCallback mOnWrite;
+
+    grpc::ClientContext mContext;
+    std::unique_ptr<GrpcStream> mStream;
+    Tag mTags[5];
+
+    mutable std::mutex mMutex;
+    std::deque<cobaltspeech::cubic::StreamingRecognizeRequest> mQueue;
+    size_t mQueuedBytes;
+    bool mStarted;
+    bool mWriting;
+    bool mAudioFinished;
+    bool mWritesDone;
+    bool mReadsDone;
+    bool mFinishing;
+    bool mFinished;
+
+    cobaltspeech::cubic::StreamingRecognizeRequest mWriteRequest;
+    cobaltspeech::cubic::RecognitionResponse mResponse;
+    grpc::Status mStatus;
+
+    // Keeps the stream alive while gRPC may still refer to it.
+    std::shared_ptr<AsyncRecognizerStream> mSelf;
+
+    AsyncRecognizerStream(AsyncCubicClient *client, ResultCallback onResult,
+                          DoneCallback onDone, WriteCallback onWrite);
+
+    void start(cobaltspeech::cubic::Cubic::Stub *stub,
+               grpc::CompletionQueue *cq,
+               const cobaltspeech::cubic::RecognitionConfig &config);
+    void handle(Op op, bool ok);
+    void startNextWrite();
+    void startFinishIfDone();
+};
+
+/*
+ * AsyncCubicClient runs streaming recognition calls on gRPC completion
+ * queues serviced by a small, fixed pool of threads, so that thousands of
+ * concurrent streams do not need thousands of threads. Each thread owns
+ * one completion queue, and streams are spread across them in turn.
+ *
+ * Destroying the client cancels any streams still running and waits for
+ * their done callbacks.
+ */
+class AsyncCubicClient
+{
+public:
+    // Connect to the given address (insecurely, like CubicClient) and
+    // start numThreads completion queue threads.
+    AsyncCubicClient(const std::string &url, int numThreads = 1);
+
+    // Make calls over an existing channel.
+    AsyncCubicClient(const std::shared_ptr<grpc::Channel> &channel,
+                     int numThreads = 1);
+
+    ~AsyncCubicClient();
+
+    AsyncCubicClient(const AsyncCubicClient &) = delete;
+    AsyncCubicClient &operator=(const AsyncCubicClient &) = delete;
+
+    /*
+     * Start a streaming recognition call with the given config. The
+     * result callback is called with each response, and the done
+     * callback with the status of the call once it has ended. If given,
+     * the write callback is called each time a message has been sent,
+     * with the number of bytes of audio still queued, which lets the
+     * caller hold off pushing more audio when the call falls behind.
+     */
+    std::shared_ptr<AsyncRecognizerStream>
+    streamingRecognize(const cobaltspeech::cubic::RecognitionConfig &config,
+                       AsyncRecognizerStream::ResultCallback onResult,
+                       AsyncRecognizerStream::DoneCallback onDone,
+                       AsyncRecognizerStream::WriteCallback onWrite =
+                           AsyncRecognizerStream::WriteCallback());
+
+    // Returns the number of streams that have not finished yet.
+    size_t activeStreams() const;
+
+private:
+    friend class AsyncRecognizerStream;
+
+    std::unique_ptr<cobaltspeech::cubic::Cubic::Stub> mStub;
+    std::vector<std::unique_ptr<grpc::CompletionQueue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNextQueue;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+    std::unordered_set<AsyncRecognizerStream *> mStreams;
+
+    void init(const std::shared_ptr<grpc::Channel> &channel, int numThreads);
+    void run(grpc::CompletionQueue *cq);
+    void streamFinished(AsyncRecognizerStream *stream);
+};
+
+#endif // ASYNC_CUBIC_CLIENT_H
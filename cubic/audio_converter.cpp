@@ -0,0 +1,546 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_converter.h"
+#include "audio_frames.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVERTER_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// WAV format tags for the sample formats the converter supports.
+const uint16_t wavFormatPCM = 1;
+const uint16_t wavFormatFloat = 3;
+const uint16_t wavFormatALaw = 6;
+const uint16_t wavFormatMuLaw = 7;
+
+// The resampling filter has this many taps per phase when the sample
+// rate is increased, and proportionally more when it is decreased.
+const size_t baseTaps = 32;
+
+// G.711 decoding, as in the ITU reference code.
+int16_t muLawToLinear(uint8_t u)
+{
+    u = ~u;
+    int t = ((u & 0x0F) << 3) + 0x84;
+    t <<= (u & 0x70) >> 4;
+    return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+int16_t aLawToLinear(uint8_t a)
+{
+    a ^= 0x55;
+    int t = (a & 0x0F) << 4;
+    int seg = (a & 0x70) >> 4;
+    if (seg == 0)
+    {
+        t += 8;
+    }
+    else
+    {
+        t += 0x108;
+        if (seg > 1)
+        {
+            t <<= seg - 1;
+        }
+    }
+    return (a & 0x80) ? t : -t;
+}
+
+// Lookup tables from 8-bit G.711 codes to samples scaled to [-1, 1).
+struct CompandTables
+{
+    float muLaw[256];
+    float aLaw[256];
+
+    CompandTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            muLaw[i] = muLawToLinear(uint8_t(i)) / 32768.0f;
+            aLaw[i] = aLawToLinear(uint8_t(i)) / 32768.0f;
+        }
+    }
+};
+
+const CompandTables compandTables;
+
+void decodeInt16(const char *audio, size_t n, float *out)
+{
+    size_t i = 0;
+#if CONVERTER_X86 && defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(audio + 2 * i));
+
+        // Sign-extend each sample by moving it to the top of a 32-bit
+        // lane and shifting it back down.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(audio) + 2 * i;
+        out[i] = int16_t(p[0] | (p[1] << 8)) / 32768.0f;
+    }
+}
+
+// Samples are decoded one channel-interleaved sample at a time, so the
+// channel count of these formats does not matter.
+using Int24Samples = AudioFormat<::Int24, 1, Endian::Little>;
+using Float32Samples = AudioFormat<float, 1, Endian::Little>;
+using DecodedSamples = AudioFormat<float, 1, hostEndian>;
+
+void decodeInt24(const char *audio, size_t n, float *out)
+{
+    convertFrames<Int24Samples, DecodedSamples>(audio, n,
+                                                reinterpret_cast<char *>(out));
+}
+
+void decodeFloat32(const char *audio, size_t n, float *out)
+{
+    // WAV floats are little-endian, which on most CPUs is a plain copy.
+    convertFrames<Float32Samples, DecodedSamples>(audio, n,
+                                                  reinterpret_cast<char *>(out));
+}
+
+void decodeCompanded(const char *audio, size_t n, const float *table, float *out)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(audio);
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = table[p[i]];
+    }
+}
+
+// Average interleaved stereo frames into mono.
+void downmixStereo(const float *in, size_t numFrames, float *out)
+{
+    size_t i = 0;
+#if CONVERTER_X86 && defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 4 <= numFrames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(in + 2 * i);
+        __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+        __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+    }
+#endif
+    for (; i < numFrames; i++)
+    {
+        out[i] = 0.5f * (in[2 * i] + in[2 * i + 1]);
+    }
+}
+
+float dotScalar(const float *a, const float *b, size_t n)
+{
+    float sum = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// The filter dot products take n as a multiple of 8.
+#if CONVERTER_X86 && defined(__SSE2__)
+float dotSSE(const float *a, const float *b, size_t n)
+{
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                           _mm_loadu_ps(b + i + 4)));
+    }
+
+    float s[4];
+    _mm_storeu_ps(s, _mm_add_ps(sum0, sum1));
+    return s[0] + s[1] + s[2] + s[3];
+}
+#endif
+
+#if CONVERTER_X86
+__attribute__((target("avx2,fma")))
+float dotAVX2(const float *a, const float *b, size_t n)
+{
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8)
+    {
+        sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+    }
+
+    __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float s[4];
+    _mm_storeu_ps(s, s4);
+    return s[0] + s[1] + s[2] + s[3];
+}
+#endif
+
+typedef float (*DotFunc)(const float *, const float *, size_t);
+
+DotFunc chooseDotFunc()
+{
+#if CONVERTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return dotAVX2;
+    }
+#endif
+#if CONVERTER_X86 && defined(__SSE2__)
+    return dotSSE;
+#else
+    return dotScalar;
+#endif
+}
+
+const DotFunc dot = chooseDotFunc();
+
+unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0)
+    {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+} // namespace
+
+AudioConverter::Format::Format()
+    : sampleFormat(Int16), channels(1), sampleRate(16000)
+{
+}
+
+AudioConverter::AudioConverter(const Format &input, unsigned int outputRate)
+    : mInput(input), mOutputRate(outputRate), mHistoryStart(0),
+      mNextOutput(0), mDelay(0), mInputSamples(0)
+{
+    if (input.channels == 0 || input.sampleRate == 0 || outputRate == 0)
+    {
+        throw std::invalid_argument("invalid audio format for conversion");
+    }
+
+    size_t sampleBytes = 2;
+    switch (input.sampleFormat)
+    {
+    case Int16:
+        sampleBytes = 2;
+        break;
+    case Int24:
+        sampleBytes = 3;
+        break;
+    case Float32:
+        sampleBytes = 4;
+        break;
+    case MuLaw:
+    case ALaw:
+        sampleBytes = 1;
+        break;
+    default:
+        throw std::invalid_argument("unsupported sample format");
+    }
+    mFrameBytes = sampleBytes * input.channels;
+
+    unsigned int g = gcd(input.sampleRate, outputRate);
+    mUp = outputRate / g;
+    mDown = input.sampleRate / g;
+    if (mUp == 1 && mDown == 1)
+    {
+        mTaps = 0;
+        return;
+    }
+
+    /*
+     * Design a windowed-sinc low-pass filter at the upsampled rate, with
+     * its cutoff just below the lower of the two Nyquist frequencies.
+     * Each phase gets the same number of taps, rounded up to a multiple
+     * of 8 for the vector dot products.
+     */
+    double ratio = std::max(1.0, double(mDown) / mUp);
+    mTaps = static_cast<size_t>(std::ceil(baseTaps * ratio));
+    mTaps = (mTaps + 7) & ~size_t(7);
+
+    // The prototype is one tap shorter than the phases hold, so that its
+    // length is odd and its delay a whole number of samples.
+    size_t length = mTaps * mUp - 1;
+    double cutoff = 0.5 * 0.92 / std::max(mUp, mDown);
+    double center = (length - 1) / 2.0;
+    std::vector<double> proto(length + 1, 0.0);
+    for (size_t i = 0; i < length; i++)
+    {
+        double x = i - center;
+        double sinc = x == 0 ? 2 * cutoff
+                             : std::sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * std::cos(2 * M_PI * i / (length - 1)) +
+                        0.08 * std::cos(4 * M_PI * i / (length - 1));
+        proto[i] = mUp * sinc * window;
+    }
+
+    // Store each phase reversed, so its dot product runs over the
+    // input history in increasing order.
+    mCoefs.resize(mTaps * mUp);
+    for (size_t p = 0; p < mUp; p++)
+    {
+        for (size_t k = 0; k < mTaps; k++)
+        {
+            mCoefs[p * mTaps + (mTaps - 1 - k)] = float(proto[p + k * mUp]);
+        }
+    }
+
+    // Prime the history with silence, and read each output that much
+    // later in the input to make up for the filter's delay.
+    mHistory.assign(mTaps - 1, 0.0f);
+    mHistoryStart = -int64_t(mTaps - 1);
+    mDelay = (length - 1) / 2;
+}
+
+AudioConverter::~AudioConverter() {}
+
+bool AudioConverter::passthrough() const
+{
+    return mInput.sampleFormat == Int16 && mInput.channels == 1 && mTaps == 0;
+}
+
+void AudioConverter::convert(const char *audio, size_t size, std::string *out)
+{
+    if (passthrough())
+    {
+        out->append(audio, size);
+        return;
+    }
+
+    // Complete a frame split across calls
+    if (!mPending.empty())
+    {
+        size_t n = std::min(size, mFrameBytes - mPending.size());
+        mPending.append(audio, n);
+        audio += n;
+        size -= n;
+        if (mPending.size() < mFrameBytes)
+        {
+            return;
+        }
+
+        std::string frame;
+        frame.swap(mPending);
+        convert(frame.data(), frame.size(), out);
+    }
+
+    size_t numFrames = size / mFrameBytes;
+    if (numFrames > 0)
+    {
+        decode(audio, numFrames);
+        downmix(numFrames);
+        mInputSamples += numFrames;
+        if (mTaps == 0)
+        {
+            encode(mMono.data(), numFrames, out);
+        }
+        else
+        {
+            resample(mMono.data(), numFrames, UINT64_MAX);
+            encode(mResampled.data(), mResampled.size(), out);
+        }
+    }
+
+    mPending.assign(audio + numFrames * mFrameBytes, size - numFrames * mFrameBytes);
+}
+
+void AudioConverter::flush(std::string *out)
+{
+    mPending.clear();
+    if (mTaps == 0)
+    {
+        return;
+    }
+
+    // Feed silence through the filter until the output covers all of
+    // the input.
+    uint64_t total = (mInputSamples * mUp + mDown - 1) / mDown;
+    std::vector<float> silence(2 * mTaps + mDown, 0.0f);
+    resample(silence.data(), silence.size(), total);
+    encode(mResampled.data(), mResampled.size(), out);
+}
+
+void AudioConverter::decode(const char *audio, size_t numFrames)
+{
+    size_t n = numFrames * mInput.channels;
+    mDecoded.resize(n);
+    switch (mInput.sampleFormat)
+    {
+    case Int16:
+        decodeInt16(audio, n, mDecoded.data());
+        break;
+    case Int24:
+        decodeInt24(audio, n, mDecoded.data());
+        break;
+    case Float32:
+        decodeFloat32(audio, n, mDecoded.data());
+        break;
+    case MuLaw:
+        decodeCompanded(audio, n, compandTables.muLaw, mDecoded.data());
+        break;
+    case ALaw:
+        decodeCompanded(audio, n, compandTables.aLaw, mDecoded.data());
+        break;
+    }
+}
+
+void AudioConverter::downmix(size_t numFrames)
+{
+    if (mInput.channels == 1)
+    {
+        mMono.swap(mDecoded);
+        return;
+    }
+
+    mMono.resize(numFrames);
+    if (mInput.channels == 2)
+    {
+        downmixStereo(mDecoded.data(), numFrames, mMono.data());
+        return;
+    }
+
+    const unsigned int c = mInput.channels;
+    const float scale = 1.0f / c;
+    for (size_t i = 0; i < numFrames; i++)
+    {
+        float sum = 0;
+        for (unsigned int ch = 0; ch < c; ch++)
+        {
+            sum += mDecoded[i * c + ch];
+        }
+        mMono[i] = sum * scale;
+    }
+}
+
+void AudioConverter::resample(const float *samples, size_t numSamples,
+                              uint64_t maxOutputs)
+{
+    mHistory.insert(mHistory.end(), samples, samples + numSamples);
+    const int64_t available = mHistoryStart + int64_t(mHistory.size());
+
+    mResampled.clear();
+    while (mNextOutput < maxOutputs)
+    {
+        // The last input sample this output depends on
+        uint64_t pos = mNextOutput * mDown + mDelay;
+        int64_t last = int64_t(pos / mUp);
+        if (last >= available)
+        {
+            break;
+        }
+
+        size_t phase = pos % mUp;
+        const float *x = &mHistory[last - int64_t(mTaps) + 1 - mHistoryStart];
+        mResampled.push_back(dot(x, &mCoefs[phase * mTaps], mTaps));
+        mNextOutput++;
+    }
+
+    // Drop the history the next output no longer needs
+    int64_t keepFrom = int64_t((mNextOutput * mDown + mDelay) / mUp) - int64_t(mTaps) + 1;
+    if (keepFrom > mHistoryStart)
+    {
+        size_t drop = std::min<size_t>(keepFrom - mHistoryStart, mHistory.size());
+        mHistory.erase(mHistory.begin(), mHistory.begin() + drop);
+        mHistoryStart += drop;
+    }
+}
+
+void AudioConverter::encode(const float *samples, size_t numSamples,
+                            std::string *out)
+{
+    size_t start = out->size();
+    out->resize(start + 2 * numSamples);
+    char *dst = &(*out)[start];
+
+    size_t i = 0;
+#if CONVERTER_X86 && defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        // Clip before converting, since out of range floats convert to
+        // INT_MIN rather than saturating.
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(samples + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(samples + i + 4), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i), packed);
+    }
+#endif
+    for (; i < numSamples; i++)
+    {
+        float v = std::min(32767.0f, std::max(-32768.0f, samples[i] * 32768.0f));
+        int16_t s = static_cast<int16_t>(std::lrint(v));
+        dst[2 * i] = char(s & 0xFF);
+        dst[2 * i + 1] = char((s >> 8) & 0xFF);
+    }
+}
+
+bool converterFormat(const WavFormat &wav, AudioConverter::Format *format)
+{
+    format->channels = wav.channels;
+    format->sampleRate = wav.sampleRate;
+
+    if (wav.formatTag == wavFormatPCM && wav.bitsPerSample == 16)
+    {
+        format->sampleFormat = AudioConverter::Int16;
+    }
+    else if (wav.formatTag == wavFormatPCM && wav.bitsPerSample == 24)
+    {
+        format->sampleFormat = AudioConverter::Int24;
+    }
+    else if (wav.formatTag == wavFormatFloat && wav.bitsPerSample == 32)
+    {
+        format->sampleFormat = AudioConverter::Float32;
+    }
+    else if (wav.formatTag == wavFormatMuLaw && wav.bitsPerSample == 8)
+    {
+        format->sampleFormat = AudioConverter::MuLaw;
+    }
+    else if (wav.formatTag == wavFormatALaw && wav.bitsPerSample == 8)
+    {
+        format->sampleFormat = AudioConverter::ALaw;
+    }
+    else
+    {
+        return false;
+    }
+
+    return wav.channels > 0 && wav.sampleRate > 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_CONVERTER_H
+#define AUDIO_CONVERTER_H
+
+#include "wav_header.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * AudioConverter turns audio in a common file or telephony format into
+ * the 16-bit mono little-endian samples that Cubic expects for
+ * RAW_LINEAR16 at the model's sample rate. It replaces running an
+ * external tool such as sox on each file before sending it.
+ *
+ * Samples are decoded to floating point, mixed down to one channel, run
+ * through a polyphase low-pass resampling filter, and converted back to
+ * 16-bit integers. The decode, mix, filter and encode loops use SSE2 on
+ * x86, with AVX2 for the filter when the CPU supports it, and plain C++
+ * elsewhere.
+ *
+ * Audio is converted in chunks of any size as it arrives, so the whole
+ * file never needs to be held in memory. Call flush() after the last
+ * chunk to get the audio still held in the filter.
+ */
+class AudioConverter
+{
+public:
+    enum SampleFormat
+    {
+        Int16,      // signed 16-bit little-endian
+        Int24,      // signed 24-bit little-endian, packed in 3 bytes
+        Float32,    // 32-bit little-endian IEEE float, from -1 to 1
+        MuLaw,      // 8-bit G.711 mu-law
+        ALaw        // 8-bit G.711 A-law
+    };
+
+    struct Format
+    {
+        SampleFormat sampleFormat;
+        unsigned int channels;
+        unsigned int sampleRate;
+
+        Format();
+    };
+
+    /*
+     * Create a converter from the given input format to 16-bit mono
+     * audio at outputRate. Throws std::invalid_argument if the format
+     * is not supported.
+     */
+    AudioConverter(const Format &input, unsigned int outputRate);
+    ~AudioConverter();
+
+    // Returns true if the input is already 16-bit mono audio at the
+    // output rate, so it can be sent without being converted.
+    bool passthrough() const;
+
+    /*
+     * Convert the given audio and append the result to out. Input that
+     * does not fill a whole frame (one sample for every channel) is held
+     * until the next call.
+     */
+    void convert(const char *audio, size_t size, std::string *out);
+
+    // Append the rest of the converted audio to out.
+    void flush(std::string *out);
+
+private:
+    Format mInput;
+    unsigned int mOutputRate;
+    size_t mFrameBytes;
+    std::string mPending;
+
+    // Scratch buffers, reused between calls to avoid allocating.
+    std::vector<float> mDecoded;
+    std::vector<float> mMono;
+    std::vector<float> mResampled;
+
+    // The resampler produces output sample n from input position
+    // (n * mDown + mDelay) / mUp, using the phase of the filter for that
+    // position. mDelay is the filter's delay at the upsampled rate, so
+    // the output lines up with the input.
+    unsigned int mUp;
+    unsigned int mDown;
+    size_t mTaps;
+    std::vector<float> mCoefs;
+    std::vector<float> mHistory;
+    int64_t mHistoryStart;
+    uint64_t mNextOutput;
+    uint64_t mDelay;
+    uint64_t mInputSamples;
+
+    void decode(const char *audio, size_t numFrames);
+    void downmix(size_t numFrames);
+    void resample(const float *samples, size_t numSamples, uint64_t maxOutputs);
+    void encode(const float *samples, size_t numSamples, std::string *out);
+};
+
+/*
+ * Fill in the converter format matching a parsed WAV header. Returns
+ * false if the WAV file uses a sample format the converter does not
+ * support.
+ */
+bool converterFormat(const WavFormat &wav, AudioConverter::Format *format);
+
+#endif // AUDIO_CONVERTER_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+AudioFile::AudioFile(const std::string &filename, AccessMode mode)
+    : mData(nullptr), mSize(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("could not open " + filename + ": " +
+                                 strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("could not stat " + filename + ": " +
+                                 strerror(err));
+    }
+
+    mSize = info.st_size;
+
+    // mmap() rejects zero-length mappings, so leave empty files unmapped.
+    if (mSize > 0)
+    {
+        void *addr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error("could not map " + filename + ": " +
+                                     strerror(err));
+        }
+        mData = static_cast<const char *>(addr);
+
+        if (mode == Sequential)
+        {
+            madvise(addr, mSize, MADV_SEQUENTIAL);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+}
+
+AudioFile::~AudioFile()
+{
+    if (mData)
+    {
+        munmap(const_cast<char *>(mData), mSize);
+    }
+}
+
+const char *AudioFile::data() const
+{
+    return mData;
+}
+
+size_t AudioFile::size() const
+{
+    return mSize;
+}
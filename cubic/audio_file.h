@@ -0,0 +1,67 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#include <cstddef>
+#include <string>
+
+/*
+ * AudioFile maps an audio file into memory so that its contents can be
+ * passed directly to pushAudio() or recognize() without first copying
+ * them into a separate buffer. Pages are loaded by the kernel as they
+ * are touched, so even multi-hour recordings do not need to fit in
+ * memory all at once.
+ */
+class AudioFile
+{
+public:
+    // Hints given to the kernel about how the file will be accessed.
+    enum AccessMode
+    {
+        // No hint; the kernel uses its default read-ahead.
+        Normal,
+
+        /*
+         * The file will be read from beginning to end. The kernel reads
+         * ahead aggressively and may drop pages soon after they are used.
+         */
+        Sequential
+    };
+
+    /*
+     * Open and map the given file. Throws std::runtime_error if the file
+     * cannot be opened or mapped.
+     */
+    AudioFile(const std::string &filename, AccessMode mode = Sequential);
+    ~AudioFile();
+
+    AudioFile(const AudioFile &) = delete;
+    AudioFile &operator=(const AudioFile &) = delete;
+
+    // Returns a pointer to the start of the file contents.
+    const char *data() const;
+
+    // Returns the size of the file in bytes.
+    size_t size() const;
+
+private:
+    const char *mData;
+    size_t mSize;
+};
+
+#endif // AUDIO_FILE_H
@@ -0,0 +1,84 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_pacer.h"
+
+#include <stdexcept>
+#include <thread>
+
+AudioPacer::AudioPacer(double bytesPerSecond, double speed)
+    : mBytesPerSecond(bytesPerSecond), mSpeed(speed), mStarted(false),
+      mReleased(0), mLagMs(0)
+{
+    if (bytesPerSecond <= 0)
+    {
+        throw std::invalid_argument("bytesPerSecond must be positive");
+    }
+}
+
+void AudioPacer::start()
+{
+    mStart = Clock::now();
+    mStarted = true;
+}
+
+void AudioPacer::pace(size_t numBytes)
+{
+    if (!mStarted)
+    {
+        start();
+    }
+
+    mReleased += numBytes;
+    if (mSpeed <= 0)
+    {
+        return;
+    }
+
+    Clock::time_point due = releaseTime(mReleased);
+    Clock::time_point now = Clock::now();
+    if (now < due)
+    {
+        std::this_thread::sleep_until(due);
+        mLagMs = 0;
+    }
+    else
+    {
+        mLagMs = std::chrono::duration<double, std::milli>(now - due).count();
+    }
+}
+
+AudioPacer::Clock::time_point AudioPacer::releaseTime(uint64_t byteOffset) const
+{
+    if (mSpeed <= 0)
+    {
+        return mStart;
+    }
+
+    double seconds = byteOffset / mBytesPerSecond / mSpeed;
+    return mStart + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(seconds));
+}
+
+uint64_t AudioPacer::bytesReleased() const
+{
+    return mReleased;
+}
+
+double AudioPacer::lagMs() const
+{
+    return mLagMs;
+}
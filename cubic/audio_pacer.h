@@ -0,0 +1,84 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_PACER_H
+#define AUDIO_PACER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * AudioPacer releases recorded audio at the rate it would arrive from a
+ * live source, so that replaying a file behaves like a real call. Call
+ * pace() before each pushAudio() call; it waits until the chunk would
+ * have finished being captured.
+ *
+ * Deadlines are computed from the start time and the total number of
+ * bytes released, using a monotonic clock, rather than by sleeping for
+ * each chunk's duration. Oversleeping on one chunk is therefore made up
+ * on the next, and the replay does not drift from real time.
+ */
+class AudioPacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /*
+     * Create a pacer for audio with the given data rate. speed is the
+     * multiple of real time to replay at (2.0 replays twice as fast).
+     * A speed of zero or less disables pacing.
+     */
+    AudioPacer(double bytesPerSecond, double speed = 1.0);
+
+    /*
+     * Start the clock. This is called automatically by the first call to
+     * pace(), but may be called earlier to include setup time.
+     */
+    void start();
+
+    /*
+     * Wait until the next numBytes of audio would have been captured,
+     * then count them as released.
+     */
+    void pace(size_t numBytes);
+
+    /*
+     * Returns the time at which the given byte offset into the audio was
+     * (or will be) released. Comparing this to when a result arrives
+     * gives the latency from the end of speech to the result.
+     */
+    Clock::time_point releaseTime(uint64_t byteOffset) const;
+
+    // Returns the number of bytes released so far.
+    uint64_t bytesReleased() const;
+
+    /*
+     * Returns how late the last chunk was released, in milliseconds.
+     * This stays near zero unless the caller cannot keep up.
+     */
+    double lagMs() const;
+
+private:
+    double mBytesPerSecond;
+    double mSpeed;
+    bool mStarted;
+    Clock::time_point mStart;
+    uint64_t mReleased;
+    double mLagMs;
+};
+
+#endif // AUDIO_PACER_H
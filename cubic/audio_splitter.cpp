@@ -0,0 +1,155 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_splitter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+inline int16_t sampleAt(const char *audio, size_t i)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(audio) + 2 * i;
+    return static_cast<int16_t>(p[0] | (p[1] << 8));
+}
+
+/*
+ * Find the quietest window of windowSamples between from and to (which
+ * must hold at least one window), and return the sample at its centre.
+ * The window slides 10ms at a time. Of equally quiet windows, the one
+ * nearest target wins.
+ */
+uint64_t quietestPoint(const char *audio, uint64_t from, uint64_t to,
+                       uint64_t target, uint64_t windowSamples,
+                       unsigned int sampleRate)
+{
+    // Sum the energy of each 10ms step once, then slide over the steps
+    uint64_t stepSamples = std::max<uint64_t>(1, sampleRate / 100);
+    uint64_t windowSteps = std::max<uint64_t>(1, windowSamples / stepSamples);
+    uint64_t numSteps = (to - from) / stepSamples;
+
+    std::vector<uint64_t> stepEnergy(numSteps, 0);
+    for (uint64_t s = 0; s < numSteps; s++)
+    {
+        uint64_t first = from + s * stepSamples;
+        uint64_t sum = 0;
+        for (uint64_t i = first; i < first + stepSamples; i++)
+        {
+            int32_t x = sampleAt(audio, i);
+            sum += static_cast<uint64_t>(x * x);
+        }
+        stepEnergy[s] = sum;
+    }
+
+    if (numSteps <= windowSteps)
+    {
+        return (from + to) / 2;
+    }
+
+    uint64_t energy = 0;
+    for (uint64_t s = 0; s < windowSteps; s++)
+    {
+        energy += stepEnergy[s];
+    }
+
+    auto centre = [&](uint64_t firstStep) {
+        return from + firstStep * stepSamples + windowSteps * stepSamples / 2;
+    };
+    auto distance = [target](uint64_t point) {
+        return point > target ? point - target : target - point;
+    };
+
+    uint64_t bestEnergy = energy;
+    uint64_t bestPoint = centre(0);
+    for (uint64_t s = 1; s + windowSteps <= numSteps; s++)
+    {
+        energy += stepEnergy[s + windowSteps - 1];
+        energy -= stepEnergy[s - 1];
+
+        uint64_t point = centre(s);
+        if (energy < bestEnergy ||
+            (energy == bestEnergy && distance(point) < distance(bestPoint)))
+        {
+            bestEnergy = energy;
+            bestPoint = point;
+        }
+    }
+
+    return bestPoint;
+}
+
+} // namespace
+
+SplitOptions::SplitOptions() :
+    sampleRate(16000),
+    chunkSeconds(60.0),
+    searchSeconds(10.0),
+    windowMs(300),
+    overlapSeconds(1.0)
+{}
+
+std::vector<AudioChunk> splitAudio(const char *audio, size_t size,
+                                   const SplitOptions &opts)
+{
+    if (opts.sampleRate == 0 || opts.chunkSeconds <= 0 ||
+        opts.searchSeconds < 0 || opts.overlapSeconds < 0)
+    {
+        throw std::invalid_argument("invalid audio split options");
+    }
+
+    uint64_t numSamples = size / 2;
+    uint64_t chunkSamples = static_cast<uint64_t>(opts.chunkSeconds * opts.sampleRate);
+    uint64_t searchSamples = static_cast<uint64_t>(opts.searchSeconds * opts.sampleRate);
+    uint64_t windowSamples = static_cast<uint64_t>(opts.windowMs) * opts.sampleRate / 1000;
+    uint64_t overlapSamples = static_cast<uint64_t>(opts.overlapSeconds * opts.sampleRate);
+    chunkSamples = std::max<uint64_t>(chunkSamples, 1);
+
+    // Choose the kept ranges, each ending at the quietest point near its
+    // target length. The search never reaches back to the previous split,
+    // so every chunk has some audio of its own.
+    std::vector<AudioChunk> chunks;
+    uint64_t keepBegin = 0;
+    while (keepBegin < numSamples)
+    {
+        uint64_t target = keepBegin + chunkSamples;
+        uint64_t keepEnd = numSamples;
+        if (target + searchSamples < numSamples)
+        {
+            uint64_t from = target > searchSamples ? target - searchSamples : 0;
+            from = std::max(from, keepBegin + chunkSamples / 2);
+            uint64_t to = target + searchSamples;
+            keepEnd = to > from ? quietestPoint(audio, from, to, target,
+                                                windowSamples, opts.sampleRate)
+                                : target;
+        }
+
+        AudioChunk chunk;
+        chunk.keepBegin = keepBegin;
+        chunk.keepEnd = keepEnd;
+        chunks.push_back(chunk);
+        keepBegin = keepEnd;
+    }
+
+    for (AudioChunk &chunk : chunks)
+    {
+        chunk.begin = chunk.keepBegin > overlapSamples ? chunk.keepBegin - overlapSamples : 0;
+        chunk.end = std::min(chunk.keepEnd + overlapSamples, numSamples);
+    }
+
+    return chunks;
+}
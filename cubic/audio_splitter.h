@@ -0,0 +1,74 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_SPLITTER_H
+#define AUDIO_SPLITTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A piece of a long recording to be recognized on its own. Offsets are
+ * in samples from the start of the recording.
+ *
+ * The chunk is responsible for the audio from keepBegin to keepEnd, and
+ * the chunks' kept ranges cover the recording without gaps. The audio
+ * sent for the chunk (begin to end) extends past the kept range by the
+ * overlap on each side, so that words at the edges are recognized with
+ * some context; whatever is recognized in the overlap belongs to the
+ * neighbouring chunk.
+ */
+struct AudioChunk
+{
+    uint64_t begin;
+    uint64_t end;
+    uint64_t keepBegin;
+    uint64_t keepEnd;
+};
+
+struct SplitOptions
+{
+    // Sample rate of the audio.
+    unsigned int sampleRate;
+
+    // Chunks are about this long.
+    double chunkSeconds;
+
+    // Each split point is the quietest place within this many seconds
+    // either side of where a chunk of chunkSeconds would end.
+    double searchSeconds;
+
+    // Quietness is measured as the energy of this much audio, so that a
+    // short gap between words is not mistaken for a pause.
+    unsigned int windowMs;
+
+    // The audio sent for each chunk extends this far into its neighbours.
+    double overlapSeconds;
+
+    SplitOptions();
+};
+
+/*
+ * Split 16-bit mono little-endian audio into chunks at low-energy points
+ * (usually pauses between sentences). The audio is only examined around
+ * each candidate split point, so this is quick even for long recordings.
+ * Audio shorter than chunkSeconds plus searchSeconds is a single chunk.
+ */
+std::vector<AudioChunk> splitAudio(const char *audio, size_t size,
+                                   const SplitOptions &opts = SplitOptions());
+
+#endif // AUDIO_SPLITTER_H
@@ -0,0 +1,516 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_client.h"
+#include "cubic_exception.h"
+#include "audio_converter.h"
+#include "audio_file.h"
+#include "cubic_metrics.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "transcript_sink.h"
+#include "wav_header.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+// Some useful variables to define the client configuration
+const std::string serverAddress = "localhost:2727";
+
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The number of bytes sent with each pushAudio() call in streaming mode.
+const size_t streamChunkSize = 8192;
+
+// Request durations, result latencies and the like are written to this
+// file in the Prometheus text format when the batch is done.
+const std::string metricsFile = "cubic_metrics.prom";
+
+// A single audio file to be transcribed as part of the batch.
+struct BatchItem {
+    std::string path;
+    CubicPB::RecognitionConfig::Encoding encoding;
+};
+
+// The outcome of transcribing a single BatchItem.
+struct BatchResult {
+    bool ok = false;
+    double audioSeconds = 0.0;
+    double wallSeconds = 0.0;
+    std::string transcript;
+    std::string error;
+};
+
+// Returns true if the given string ends with the given suffix.
+bool endsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Picks the encoding to send to Cubic based on the file extension.
+BatchItem makeItem(const std::string &path) {
+    BatchItem item;
+    item.path = path;
+    if (endsWith(path, ".wav") || endsWith(path, ".WAV")) {
+        item.encoding = CubicPB::RecognitionConfig::WAV;
+    } else {
+        item.encoding = CubicPB::RecognitionConfig::RAW_LINEAR16;
+    }
+    return item;
+}
+
+/*
+ * Builds the list of files to transcribe. If the given path is a
+ * directory, every .wav and .raw file in it is used. Otherwise the
+ * path is treated as a manifest with one audio file path per line.
+ * Blank lines and lines starting with '#' are ignored.
+ */
+std::vector<BatchItem> loadBatch(const std::string &path) {
+    std::vector<BatchItem> items;
+
+    DIR *dir = opendir(path.c_str());
+    if (dir) {
+        while (struct dirent *entry = readdir(dir)) {
+            std::string name(entry->d_name);
+            if (endsWith(name, ".wav") || endsWith(name, ".WAV") ||
+                endsWith(name, ".raw")) {
+                items.push_back(makeItem(path + "/" + name));
+            }
+        }
+        closedir(dir);
+
+        // readdir() makes no ordering guarantees
+        std::sort(items.begin(), items.end(),
+                  [](const BatchItem &a, const BatchItem &b) {
+                      return a.path < b.path;
+                  });
+        return items;
+    }
+
+    std::ifstream manifest(path);
+    if (!manifest.is_open()) {
+        throw std::runtime_error("could not open manifest " + path);
+    }
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        items.push_back(makeItem(line));
+    }
+
+    return items;
+}
+
+/*
+ * Estimates the duration of the given audio in seconds. WAV files use
+ * the format from their header; raw files are assumed to be mono,
+ * 16-bit samples at the model's sample rate.
+ */
+double audioDuration(const BatchItem &item, const AudioFile &audio,
+                     unsigned int modelSampleRate) {
+    if (item.encoding == CubicPB::RecognitionConfig::WAV) {
+        WavFormat wav;
+        if (!parseWavHeader(audio.data(), audio.size(), &wav) ||
+            wav.bytesPerSecond() <= 0) {
+            return 0.0;
+        }
+        return wav.dataSize / wav.bytesPerSecond();
+    }
+
+    if (modelSampleRate == 0) {
+        return 0.0;
+    }
+    return audio.size() / (2.0 * modelSampleRate);
+}
+
+// Appends the final transcripts in the given response to the transcript.
+// If a sink is given, each result is also written to it, tagged with the
+// path of the audio file.
+void appendTranscripts(const CubicPB::RecognitionResponse &resp,
+                       TranscriptSink *sink, const std::string &source,
+                       std::string *transcript) {
+    for (int i = 0; i < resp.results_size(); i++) {
+        const CubicPB::RecognitionResult &result = resp.results(i);
+        if (sink) {
+            sink->write(result, source);
+        }
+        if (!result.is_partial() && result.alternatives_size() > 0) {
+            if (!transcript->empty()) {
+                *transcript += " ";
+            }
+            *transcript += result.alternatives(0).transcript();
+        }
+    }
+}
+
+// Sends the whole file with a single unary Recognize call. If a
+// converter is given, the audio is converted in memory first.
+void recognizeFile(CubicClient &client, CubicMetrics &metrics,
+                   const CubicPB::RecognitionConfig &cfg,
+                   const char *audio, size_t audioSize,
+                   AudioConverter *converter, TranscriptSink *sink,
+                   const std::string &source, std::string *transcript) {
+    std::string pcm;
+    if (converter) {
+        converter->convert(audio, audioSize, &pcm);
+        converter->flush(&pcm);
+        audio = pcm.data();
+        audioSize = pcm.size();
+    }
+    CubicPB::RecognitionResponse resp =
+        metrics.timeRpc(CubicMetrics::Recognize, [&]() {
+            return client.recognize(cfg, audio, audioSize);
+        });
+    appendTranscripts(resp, sink, source, transcript);
+}
+
+// Sends the file in chunks over a StreamingRecognize call. If a
+// converter is given, each chunk is converted just before it is sent.
+// bytesPerSecond and headerBytes describe the audio as it is sent.
+void streamFile(CubicClient &client, CubicMetrics &metrics,
+                const CubicPB::RecognitionConfig &cfg,
+                const char *audio, size_t audioSize,
+                double bytesPerSecond, size_t headerBytes,
+                AudioConverter *converter, TranscriptSink *sink,
+                const std::string &source, std::string *transcript) {
+    auto stream = client.streamingRecognize(cfg);
+    CubicMetrics::Stream streamMetrics(metrics, bytesPerSecond, headerBytes);
+    auto push = [&stream, &streamMetrics](const char *data, size_t size) {
+        CubicMetrics::Clock::time_point start = CubicMetrics::Clock::now();
+        stream.pushAudio(data, size);
+        streamMetrics.pushed(size, start);
+    };
+
+    // Push the audio on a separate thread, as in stream_client. Errors
+    // other than a failed push are passed back to this thread.
+    std::exception_ptr audioError;
+    std::thread audioThread([&stream, &push, &audioError, audio, audioSize,
+                             converter]() {
+        try {
+            std::string pcm;
+            for (size_t pos = 0; pos < audioSize; pos += streamChunkSize) {
+                size_t n = std::min(streamChunkSize, audioSize - pos);
+                if (!converter) {
+                    push(audio + pos, n);
+                    continue;
+                }
+
+                pcm.clear();
+                converter->convert(audio + pos, n, &pcm);
+                if (!pcm.empty()) {
+                    push(pcm.data(), pcm.size());
+                }
+            }
+
+            if (converter) {
+                pcm.clear();
+                converter->flush(&pcm);
+                if (!pcm.empty()) {
+                    push(pcm.data(), pcm.size());
+                }
+            }
+        } catch (CubicException &) {
+            // The error is reported by close() below.
+        } catch (...) {
+            audioError = std::current_exception();
+        }
+
+        stream.audioFinished();
+    });
+
+    // The audio thread has to be joined before leaving, even when
+    // handling a result fails.
+    try {
+        CubicPB::RecognitionResponse resp;
+        while (stream.receiveResults(&resp)) {
+            streamMetrics.received(resp);
+            appendTranscripts(resp, sink, source, transcript);
+        }
+    } catch (...) {
+        audioThread.join();
+        throw;
+    }
+
+    audioThread.join();
+    if (audioError) {
+        try {
+            stream.close();
+        } catch (CubicException &) {
+            // The audio thread's error is the one worth reporting.
+        }
+        std::rethrow_exception(audioError);
+    }
+    stream.close();
+}
+
+// Transcribes a single item, capturing any error in the result.
+BatchResult transcribe(CubicClient &client, CubicMetrics &metrics,
+                       const std::string &modelID,
+                       unsigned int modelSampleRate, bool streaming,
+                       TranscriptSink *sink, const BatchItem &item) {
+    BatchResult res;
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        AudioFile audio(item.path, AudioFile::Sequential);
+        res.audioSeconds = audioDuration(item, audio, modelSampleRate);
+
+        CubicPB::RecognitionConfig cfg;
+        cfg.set_model_id(modelID);
+        cfg.set_audio_encoding(item.encoding);
+
+        // WAV files that are not already 16-bit mono at the model's
+        // sample rate are converted here and sent as RAW_LINEAR16.
+        // Formats the converter does not know are sent unchanged.
+        const char *data = audio.data();
+        size_t dataSize = audio.size();
+        double bytesPerSecond = 2.0 * modelSampleRate;
+        size_t headerBytes = 0;
+        std::unique_ptr<AudioConverter> converter;
+        WavFormat wav;
+        AudioConverter::Format inputFormat;
+        bool isWav = item.encoding == CubicPB::RecognitionConfig::WAV &&
+                     parseWavHeader(audio.data(), audio.size(), &wav);
+        if (isWav) {
+            bytesPerSecond = wav.bytesPerSecond();
+            headerBytes = wav.dataOffset;
+        }
+        if (isWav && converterFormat(wav, &inputFormat)) {
+            converter.reset(new AudioConverter(inputFormat, modelSampleRate));
+            if (converter->passthrough()) {
+                converter.reset();
+            } else {
+                cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
+                data += wav.dataOffset;
+                dataSize = wav.dataSize;
+                bytesPerSecond = 2.0 * modelSampleRate;
+                headerBytes = 0;
+            }
+        }
+
+        if (streaming) {
+            streamFile(client, metrics, cfg, data, dataSize, bytesPerSecond,
+                       headerBytes, converter.get(), sink, item.path,
+                       &res.transcript);
+        } else {
+            recognizeFile(client, metrics, cfg, data, dataSize,
+                          converter.get(), sink, item.path, &res.transcript);
+        }
+        res.ok = true;
+    } catch (std::exception &e) {
+        res.error = e.what();
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    res.wallSeconds = elapsed.count();
+    return res;
+}
+
+void printUsage(const char *prog) {
+    std::cerr << "Usage: " << prog
+              << " <manifest|directory> [workers] [sync|stream] [output]"
+              << std::endl
+              << "  manifest   text file with one audio file path per line"
+              << std::endl
+              << "  directory  transcribes every .wav and .raw file in it"
+              << std::endl
+              << "  workers    number of concurrent requests (default 4)"
+              << std::endl
+              << "  sync       use Recognize (default)" << std::endl
+              << "  stream     use StreamingRecognize" << std::endl
+              << "  output     also write every final result, with word"
+              << std::endl
+              << "             timings, to this file as JSON lines, or in"
+              << std::endl
+              << "             the binary format if it ends in .bin"
+              << std::endl;
+}
+
+/*
+ * This client demonstrates transcribing a large batch of files. All
+ * requests share a single CubicClient (and therefore a single gRPC
+ * channel), and a fixed number of worker threads keep a bounded number
+ * of requests in flight. The version and model handshake is done once
+ * for the whole batch.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const std::string batchPath = argv[1];
+    int numWorkers = argc > 2 ? std::atoi(argv[2]) : 4;
+    bool streaming = argc > 3 && std::string(argv[3]) == "stream";
+    const std::string outputPath = argc > 4 ? argv[4] : "";
+    if (numWorkers < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::vector<BatchItem> items = loadBatch(batchPath);
+        std::cout << "Transcribing " << items.size() << " files with "
+                  << numWorkers << " workers ("
+                  << (streaming ? "streaming" : "synchronous") << ")"
+                  << std::endl;
+
+        // Create the client (note this is an insecure connection,
+        // which is not recommended for production).
+        CubicClient client(serverAddress);
+
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
+        // Display the Cubic version
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
+        std::cout << "Connected to " << serverAddress << std::endl;
+        std::cout << std::endl;
+
+        // Use the first model for every file in the batch
+        const std::vector<CubicModel> &models = startup.models();
+        if (models.empty()) {
+            throw std::runtime_error("server has no models");
+        }
+        const std::string modelID = models[0].id();
+        const unsigned int modelSampleRate = models[0].sampleRate();
+
+        // All of the workers record into the same metrics
+        MetricsRegistry registry;
+        CubicMetrics metrics(registry);
+
+        // Detailed results are written by a background thread, so the
+        // workers go straight back to sending audio.
+        std::unique_ptr<TranscriptSink> sink;
+        if (!outputPath.empty()) {
+            TranscriptSink::Options sinkOpts;
+            if (endsWith(outputPath, ".bin")) {
+                sinkOpts.format = TranscriptSink::Binary;
+            }
+            sink.reset(new TranscriptSink(outputPath, sinkOpts));
+        }
+
+        // Each worker pulls the next unclaimed item until none are left,
+        // so at most numWorkers requests are in flight at once.
+        std::atomic<size_t> nextItem(0);
+        std::mutex outputMutex;
+        size_t numFailed = 0;
+        double totalAudioSeconds = 0.0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> workers;
+        for (int w = 0; w < numWorkers; w++) {
+            workers.emplace_back([&]() {
+                size_t idx;
+                while ((idx = nextItem++) < items.size()) {
+                    const BatchItem &item = items[idx];
+                    BatchResult res = transcribe(client, metrics, modelID,
+                                                 modelSampleRate, streaming,
+                                                 sink.get(), item);
+
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    if (res.ok) {
+                        totalAudioSeconds += res.audioSeconds;
+                        std::cout << item.path << ": " << res.transcript
+                                  << "\n";
+                    } else {
+                        numFailed++;
+                        std::cerr << item.path << ": error: " << res.error
+                                  << "\n";
+                    }
+                }
+            });
+        }
+
+        for (std::thread &t : workers) {
+            t.join();
+        }
+
+        if (sink) {
+            sink->close();
+        }
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double wallSeconds = elapsed.count();
+
+        // Report the aggregate throughput. The real-time factor is the
+        // wall time divided by the amount of audio processed, so lower
+        // is better.
+        std::cout << "\nSummary:" << std::endl;
+        std::cout << "  Files: " << items.size() << " (" << numFailed
+                  << " failed)" << std::endl;
+        std::cout << "  Audio: " << totalAudioSeconds << " s" << std::endl;
+        std::cout << "  Wall time: " << wallSeconds << " s" << std::endl;
+        if (wallSeconds > 0) {
+            std::cout << "  Files/sec: " << items.size() / wallSeconds
+                      << std::endl;
+        }
+        if (totalAudioSeconds > 0) {
+            std::cout << "  Real-time factor: "
+                      << wallSeconds / totalAudioSeconds << std::endl;
+        }
+        if (sink) {
+            std::cout << "  Results written: " << sink->recordsWritten()
+                      << " to " << outputPath;
+            if (sink->recordsDropped() > 0) {
+                std::cout << " (" << sink->recordsDropped() << " dropped)";
+            }
+            std::cout << std::endl;
+        }
+
+        registry.writeTextFile(metricsFile);
+        std::cout << "  Metrics written to " << metricsFile << std::endl;
+
+    } catch (CubicException &e) {
+        std::cerr << "Cubic error: " << e.what() << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    std::cout << "\nDone." << std::endl;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+LatencyStats::LatencyStats() : mSorted(true), mSum(0.0) {}
+
+void LatencyStats::add(double value)
+{
+    mSamples.push_back(value);
+    mSum += value;
+    mSorted = false;
+}
+
+void LatencyStats::merge(const LatencyStats &other)
+{
+    mSamples.insert(mSamples.end(), other.mSamples.begin(),
+                    other.mSamples.end());
+    mSum += other.mSum;
+    mSorted = false;
+}
+
+size_t LatencyStats::count() const
+{
+    return mSamples.size();
+}
+
+double LatencyStats::mean() const
+{
+    return mSamples.empty() ? 0.0 : mSum / mSamples.size();
+}
+
+double LatencyStats::percentile(double p) const
+{
+    if (mSamples.empty())
+    {
+        return 0.0;
+    }
+
+    sort();
+    double rank = std::ceil(p / 100.0 * mSamples.size());
+    size_t idx = rank < 1 ? 0 : static_cast<size_t>(rank) - 1;
+    return mSamples[std::min(idx, mSamples.size() - 1)];
+}
+
+std::string LatencyStats::toJson() const
+{
+    std::ostringstream out;
+    out << "{\"count\": " << count() << ", \"mean\": " << mean()
+        << ", \"p50\": " << percentile(50) << ", \"p90\": " << percentile(90)
+        << ", \"p99\": " << percentile(99) << ", \"max\": " << percentile(100)
+        << "}";
+    return out.str();
+}
+
+void LatencyStats::sort() const
+{
+    if (!mSorted)
+    {
+        std::sort(mSamples.begin(), mSamples.end());
+        mSorted = true;
+    }
+}
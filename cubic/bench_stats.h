@@ -0,0 +1,66 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * LatencyStats collects samples (such as latencies in milliseconds) for
+ * the benchmarks and summarizes them as percentiles. It is not thread
+ * safe; collect samples on each thread and merge() them afterwards.
+ */
+class LatencyStats
+{
+public:
+    LatencyStats();
+
+    // Add a single sample.
+    void add(double value);
+
+    // Add all of the samples from another set.
+    void merge(const LatencyStats &other);
+
+    // Returns the number of samples.
+    size_t count() const;
+
+    // Returns the mean of the samples, or 0 if there are none.
+    double mean() const;
+
+    /*
+     * Returns the given percentile (0-100) of the samples using the
+     * nearest-rank method, or 0 if there are none.
+     */
+    double percentile(double p) const;
+
+    /*
+     * Returns the summary as a JSON object with count, mean, p50, p90,
+     * p99 and max fields.
+     */
+    std::string toJson() const;
+
+private:
+    mutable std::vector<double> mSamples;
+    mutable bool mSorted;
+    double mSum;
+
+    void sort() const;
+};
+
+#endif // BENCH_STATS_H
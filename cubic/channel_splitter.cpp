@@ -0,0 +1,233 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "channel_splitter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPLITTER_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+/*
+ * Splitting 16-bit stereo frames into left and right samples. There is
+ * a scalar version, an SSE2 version, and an AVX2 version that is chosen
+ * at run time if the CPU supports it. Each output gets 2 * numFrames
+ * bytes.
+ */
+void scalarStereo16(const char *audio, size_t numFrames, size_t from,
+                    char *left, char *right)
+{
+    for (size_t i = from; i < numFrames; i++)
+    {
+        memcpy(left + 2 * i, audio + 4 * i, 2);
+        memcpy(right + 2 * i, audio + 4 * i + 2, 2);
+    }
+}
+
+#if SPLITTER_X86 && defined(__SSE2__)
+void sse2Stereo16(const char *audio, size_t numFrames, char *left, char *right)
+{
+    size_t i = 0;
+    for (; i + 8 <= numFrames; i += 8)
+    {
+        // 8 frames: L0 R0 L1 R1 ... L7 R7
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(audio + 4 * i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(audio + 4 * i + 16));
+
+        // Each frame is a 32-bit lane. Shifting sign-extends the left
+        // (low) or right (high) sample to the whole lane, and packing
+        // (which cannot saturate) gathers them back into 16 bits.
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i ra = _mm_srai_epi32(a, 16);
+        __m128i rb = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + 2 * i),
+                         _mm_packs_epi32(la, lb));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + 2 * i),
+                         _mm_packs_epi32(ra, rb));
+    }
+    scalarStereo16(audio, numFrames, i, left, right);
+}
+#endif
+
+#if SPLITTER_X86
+__attribute__((target("avx2")))
+void avx2Stereo16(const char *audio, size_t numFrames, char *left, char *right)
+{
+    size_t i = 0;
+    for (; i + 16 <= numFrames; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(audio + 4 * i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(audio + 4 * i + 32));
+
+        __m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+        __m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+        __m256i ra = _mm256_srai_epi32(a, 16);
+        __m256i rb = _mm256_srai_epi32(b, 16);
+
+        // Packing works within each 128-bit half, leaving the 64-bit
+        // groups in the order a0 b0 a1 b1, so they are put back in order.
+        __m256i l = _mm256_permute4x64_epi64(_mm256_packs_epi32(la, lb), 0xD8);
+        __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(ra, rb), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + 2 * i), l);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(right + 2 * i), r);
+    }
+    scalarStereo16(audio, numFrames, i, left, right);
+}
+#endif
+
+typedef void (*Stereo16Func)(const char *, size_t, char *, char *);
+
+#if !(SPLITTER_X86 && defined(__SSE2__))
+void portableStereo16(const char *audio, size_t numFrames, char *left,
+                      char *right)
+{
+    scalarStereo16(audio, numFrames, 0, left, right);
+}
+#endif
+
+Stereo16Func chooseStereo16Func()
+{
+#if SPLITTER_X86
+    // This runs during static initialization, possibly before the
+    // compiler's own CPU detection has run.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return avx2Stereo16;
+    }
+#endif
+#if SPLITTER_X86 && defined(__SSE2__)
+    return sse2Stereo16;
+#else
+    return portableStereo16;
+#endif
+}
+
+const Stereo16Func fastestStereo16 = chooseStereo16Func();
+
+} // namespace
+
+bool ChannelSplitter::splitStereo16(Stereo16Impl impl, const char *audio,
+                                    size_t numFrames, char *left, char *right)
+{
+    switch (impl)
+    {
+    case Scalar:
+        scalarStereo16(audio, numFrames, 0, left, right);
+        return true;
+#if SPLITTER_X86 && defined(__SSE2__)
+    case SSE2:
+        sse2Stereo16(audio, numFrames, left, right);
+        return true;
+#endif
+#if SPLITTER_X86
+    case AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+        {
+            return false;
+        }
+        avx2Stereo16(audio, numFrames, left, right);
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+ChannelSplitter::ChannelSplitter(unsigned int channels, size_t sampleBytes)
+    : mChannels(channels), mSampleBytes(sampleBytes),
+      mFrameBytes(channels * sampleBytes)
+{
+    if (channels == 0 || sampleBytes == 0)
+    {
+        throw std::invalid_argument("audio must have at least one channel "
+                                    "and one byte per sample");
+    }
+}
+
+void ChannelSplitter::split(const char *audio, size_t size,
+                            std::vector<std::string> *out)
+{
+    out->resize(mChannels);
+
+    // Complete the frame left over from the last call
+    if (!mPending.empty())
+    {
+        size_t n = std::min(size, mFrameBytes - mPending.size());
+        mPending.append(audio, n);
+        audio += n;
+        size -= n;
+        if (mPending.size() < mFrameBytes)
+        {
+            return;
+        }
+        splitFrames(mPending.data(), 1, out);
+        mPending.clear();
+    }
+
+    size_t numFrames = size / mFrameBytes;
+    splitFrames(audio, numFrames, out);
+    mPending.assign(audio + numFrames * mFrameBytes, size % mFrameBytes);
+}
+
+void ChannelSplitter::splitFrames(const char *audio, size_t numFrames,
+                                  std::vector<std::string> *out)
+{
+    if (numFrames == 0)
+    {
+        return;
+    }
+
+    // Make room at the end of each channel's buffer
+    const size_t channelBytes = numFrames * mSampleBytes;
+    std::vector<char *> dst(mChannels);
+    for (unsigned int ch = 0; ch < mChannels; ch++)
+    {
+        std::string &buf = (*out)[ch];
+        size_t start = buf.size();
+        buf.resize(start + channelBytes);
+        dst[ch] = &buf[start];
+    }
+
+    if (mChannels == 1)
+    {
+        memcpy(dst[0], audio, channelBytes);
+    }
+    else if (mChannels == 2 && mSampleBytes == 2)
+    {
+        fastestStereo16(audio, numFrames, dst[0], dst[1]);
+    }
+    else
+    {
+        for (size_t i = 0; i < numFrames; i++)
+        {
+            const char *frame = audio + i * mFrameBytes;
+            for (unsigned int ch = 0; ch < mChannels; ch++)
+            {
+                memcpy(dst[ch] + i * mSampleBytes, frame + ch * mSampleBytes,
+                       mSampleBytes);
+            }
+        }
+    }
+}
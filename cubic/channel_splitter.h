@@ -0,0 +1,78 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CHANNEL_SPLITTER_H
+#define CHANNEL_SPLITTER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * ChannelSplitter separates interleaved multichannel audio into one
+ * buffer per channel, without changing the samples. Any sample size
+ * works; 16-bit stereo audio, the usual format of call recordings, is
+ * split with SSE2 on x86 (or AVX2 when the CPU supports it, chosen at
+ * run time), and everything else with plain C++.
+ *
+ * Audio may be given in pieces of any size. Bytes that do not make up a
+ * whole frame (one sample for every channel) are held until the next
+ * call.
+ */
+class ChannelSplitter
+{
+public:
+    /*
+     * Create a splitter for audio with the given number of channels and
+     * bytes per sample. Throws std::invalid_argument if either is zero.
+     */
+    ChannelSplitter(unsigned int channels, size_t sampleBytes);
+
+    /*
+     * Split the given audio, appending the samples for channel i to
+     * (*out)[i]. out is resized to the number of channels if needed.
+     */
+    void split(const char *audio, size_t size, std::vector<std::string> *out);
+
+    // The ways 16-bit stereo audio can be split.
+    enum Stereo16Impl
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    /*
+     * Split numFrames frames of 16-bit stereo audio with the given
+     * implementation, writing 2 * numFrames bytes to each of left and
+     * right. Returns false without writing anything if this build or CPU
+     * does not support the implementation. split() always uses the
+     * fastest one supported; this is so each can be tested on its own.
+     */
+    static bool splitStereo16(Stereo16Impl impl, const char *audio,
+                              size_t numFrames, char *left, char *right);
+
+private:
+    unsigned int mChannels;
+    size_t mSampleBytes;
+    size_t mFrameBytes;
+    std::string mPending;
+
+    void splitFrames(const char *audio, size_t numFrames,
+                     std::vector<std::string> *out);
+};
+
+#endif // CHANNEL_SPLITTER_H
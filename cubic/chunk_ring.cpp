@@ -0,0 +1,371 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "chunk_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+
+const size_t noChunk = static_cast<size_t>(-1);
+
+/*
+ * Audio arrives in chunks spaced many milliseconds apart, so spinning
+ * is not worthwhile while waiting for the other side. Yield briefly in
+ * case it is about to finish, then back off to short sleeps.
+ */
+void backOff(int *attempts)
+{
+    if ((*attempts)++ < 16)
+    {
+        std::this_thread::yield();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+} // namespace
+
+ChunkRing::IndexQueue::IndexQueue(size_t capacity)
+    : mCapacity(capacity), mSlots(new std::atomic<size_t>[capacity]),
+      mHead(0), mTail(0)
+{
+    for (size_t i = 0; i < capacity; i++)
+    {
+        mSlots[i].store(noChunk, std::memory_order_relaxed);
+    }
+}
+
+void ChunkRing::IndexQueue::push(size_t idx)
+{
+    // There are only as many chunks as slots, so the queue is never full
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    mSlots[tail % mCapacity].store(idx, std::memory_order_relaxed);
+    mTail.store(tail + 1, std::memory_order_release);
+}
+
+bool ChunkRing::IndexQueue::pop(size_t *idx)
+{
+    size_t pos;
+    while (peek(idx, &pos))
+    {
+        if (take(pos))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ChunkRing::IndexQueue::peek(size_t *idx, size_t *pos) const
+{
+    size_t head = mHead.load(std::memory_order_acquire);
+    if (head == mTail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    // The slot is not reused until the head moves past it, so the value
+    // read is the right one if take() succeeds.
+    *idx = mSlots[head % mCapacity].load(std::memory_order_relaxed);
+    *pos = head;
+    return true;
+}
+
+bool ChunkRing::IndexQueue::take(size_t pos)
+{
+    return mHead.compare_exchange_strong(pos, pos + 1, std::memory_order_acq_rel,
+                                         std::memory_order_acquire);
+}
+
+ChunkRing::ChunkRing(size_t numChunks, size_t chunkSize, OverflowPolicy policy,
+                     int maxBlockMs, size_t frameBytes)
+    : mNumChunks(numChunks), mChunkSize(chunkSize), mPolicy(policy),
+      mMaxBlockMs(maxBlockMs), mData(numChunks * chunkSize),
+      mLengths(new std::atomic<size_t>[numChunks]),
+      mOffsets(new std::atomic<uint64_t>[numChunks]), mFilled(numChunks),
+      mFree(numChunks), mWriting(noChunk), mBorrowed(noChunk),
+      mWriteOffset(0), mFrameBytes(frameBytes), mCarry(frameBytes),
+      mCarryBytes(0), mClosed(false),
+      mQueuedBytes(0), mHighWaterBytes(0), mDroppedChunks(0),
+      mDroppedBytes(0), mCoalescedChunks(0), mBlockedUs(0)
+{
+    if (numChunks < 2)
+    {
+        throw std::invalid_argument("ChunkRing requires at least two chunks");
+    }
+    if (frameBytes == 0 || chunkSize == 0 || chunkSize % frameBytes != 0)
+    {
+        throw std::invalid_argument("ChunkRing chunks must hold whole frames");
+    }
+
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        mLengths[i].store(0, std::memory_order_relaxed);
+        mOffsets[i].store(0, std::memory_order_relaxed);
+        mFree.push(i);
+    }
+}
+
+ChunkRing::~ChunkRing() {}
+
+size_t ChunkRing::chunkSize() const
+{
+    return mChunkSize;
+}
+
+ChunkRing::OverflowPolicy ChunkRing::policy() const
+{
+    return mPolicy;
+}
+
+char *ChunkRing::beginWrite()
+{
+    if (mWriting == noChunk)
+    {
+        std::chrono::steady_clock::time_point waitStart;
+        bool waited = false;
+        int attempts = 0;
+        while (!takeFreeChunk())
+        {
+            if (mClosed.load(std::memory_order_acquire))
+            {
+                break;
+            }
+
+            // DropOldest always finds a chunk to drop unless the consumer
+            // has borrowed every one that is not free, which is brief.
+            // The other policies wait, up to a limit, for a free chunk.
+            std::chrono::steady_clock::time_point now =
+                std::chrono::steady_clock::now();
+            if (!waited && mPolicy != DropOldest)
+            {
+                waitStart = now;
+                waited = true;
+            }
+            bool timedOut = waited &&
+                            now - waitStart >= std::chrono::milliseconds(mMaxBlockMs);
+            if ((mPolicy == DropOldest || timedOut) && dropOldest())
+            {
+                break;
+            }
+            backOff(&attempts);
+        }
+
+        if (waited)
+        {
+            std::chrono::steady_clock::duration elapsed =
+                std::chrono::steady_clock::now() - waitStart;
+            mBlockedUs.fetch_add(
+                std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+                std::memory_order_relaxed);
+        }
+    }
+
+    if (mWriting == noChunk || mClosed.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+    char *chunk = &mData[mWriting * mChunkSize];
+    std::copy(mCarry.begin(), mCarry.begin() + mCarryBytes, chunk);
+    return chunk + mCarryBytes;
+}
+
+size_t ChunkRing::writeCapacity() const
+{
+    return mChunkSize - mCarryBytes;
+}
+
+void ChunkRing::commitWrite(size_t numBytes)
+{
+    if (mWriting == noChunk)
+    {
+        throw std::logic_error("commitWrite() called without beginWrite()");
+    }
+
+    // Only whole frames are queued. The rest is copied out and written
+    // to the start of the next chunk, and a chunk without a whole frame
+    // is kept for the next write.
+    const char *chunk = &mData[mWriting * mChunkSize];
+    size_t filled = std::min(mCarryBytes + numBytes, mChunkSize);
+    size_t length = filled - filled % mFrameBytes;
+    mCarryBytes = filled - length;
+    std::copy(chunk + length, chunk + filled, mCarry.begin());
+    if (length == 0)
+    {
+        return;
+    }
+
+    size_t idx = mWriting;
+    mWriting = noChunk;
+    mLengths[idx].store(length, std::memory_order_relaxed);
+    mOffsets[idx].store(mWriteOffset, std::memory_order_relaxed);
+    mWriteOffset += length;
+
+    size_t queued = mQueuedBytes.fetch_add(length, std::memory_order_relaxed) + length;
+    if (queued > mHighWaterBytes.load(std::memory_order_relaxed))
+    {
+        mHighWaterBytes.store(queued, std::memory_order_relaxed);
+    }
+    mFilled.push(idx);
+}
+
+void ChunkRing::close()
+{
+    mClosed.store(true, std::memory_order_release);
+}
+
+bool ChunkRing::beginRead(const char **data, size_t *numBytes,
+                          uint64_t *offset)
+{
+    if (mBorrowed == noChunk)
+    {
+        if (!mFilled.pop(&mBorrowed))
+        {
+            return false;
+        }
+        if (mPolicy == Coalesce)
+        {
+            coalesce();
+        }
+    }
+
+    *data = &mData[mBorrowed * mChunkSize];
+    *numBytes = mLengths[mBorrowed].load(std::memory_order_relaxed);
+    if (offset)
+    {
+        *offset = mOffsets[mBorrowed].load(std::memory_order_relaxed);
+    }
+    return true;
+}
+
+bool ChunkRing::waitRead(const char **data, size_t *numBytes,
+                         uint64_t *offset)
+{
+    int attempts = 0;
+    while (!beginRead(data, numBytes, offset))
+    {
+        // Check the closed flag before looking at the ring one last time
+        // so that a chunk committed just before close() is not missed.
+        if (mClosed.load(std::memory_order_acquire))
+        {
+            return beginRead(data, numBytes, offset);
+        }
+        backOff(&attempts);
+    }
+
+    return true;
+}
+
+void ChunkRing::endRead()
+{
+    if (mBorrowed == noChunk)
+    {
+        throw std::logic_error("endRead() called without beginRead()");
+    }
+
+    mQueuedBytes.fetch_sub(mLengths[mBorrowed].load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+    mFree.push(mBorrowed);
+    mBorrowed = noChunk;
+}
+
+size_t ChunkRing::queuedBytes() const
+{
+    return mQueuedBytes.load(std::memory_order_relaxed);
+}
+
+size_t ChunkRing::highWaterBytes() const
+{
+    return mHighWaterBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t ChunkRing::droppedChunks() const
+{
+    return mDroppedChunks.load(std::memory_order_relaxed);
+}
+
+uint64_t ChunkRing::droppedBytes() const
+{
+    return mDroppedBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t ChunkRing::coalescedChunks() const
+{
+    return mCoalescedChunks.load(std::memory_order_relaxed);
+}
+
+double ChunkRing::blockedMs() const
+{
+    return mBlockedUs.load(std::memory_order_relaxed) / 1000.0;
+}
+
+bool ChunkRing::takeFreeChunk()
+{
+    return mFree.pop(&mWriting);
+}
+
+bool ChunkRing::dropOldest()
+{
+    if (!mFilled.pop(&mWriting))
+    {
+        return false;
+    }
+
+    size_t length = mLengths[mWriting].load(std::memory_order_relaxed);
+    mQueuedBytes.fetch_sub(length, std::memory_order_relaxed);
+    mDroppedChunks.fetch_add(1, std::memory_order_relaxed);
+    mDroppedBytes.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+void ChunkRing::coalesce()
+{
+    // Append queued chunks to the borrowed one, oldest first, while they
+    // fit and carry on from where it ends. Once the producer has dropped
+    // a chunk, the ones after it are left alone, so the gap stays
+    // visible in their offsets.
+    char *dest = &mData[mBorrowed * mChunkSize];
+    uint64_t start = mOffsets[mBorrowed].load(std::memory_order_relaxed);
+    size_t next;
+    size_t pos;
+    while (mFilled.peek(&next, &pos))
+    {
+        size_t have = mLengths[mBorrowed].load(std::memory_order_relaxed);
+        size_t length = mLengths[next].load(std::memory_order_relaxed);
+        uint64_t offset = mOffsets[next].load(std::memory_order_relaxed);
+        if (have + length > mChunkSize || offset != start + have)
+        {
+            break;
+        }
+        if (!mFilled.take(pos))
+        {
+            continue;
+        }
+
+        memcpy(dest + have, &mData[next * mChunkSize], length);
+        mLengths[mBorrowed].store(have + length, std::memory_order_relaxed);
+        mFree.push(next);
+        mCoalescedChunks.fetch_add(1, std::memory_order_relaxed);
+    }
+}
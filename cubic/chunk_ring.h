@@ -0,0 +1,237 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CHUNK_RING_H
+#define CHUNK_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * ChunkRing is a lock-free queue of fixed-size audio chunks between a
+ * single producer (such as a capture thread) and a single consumer (the
+ * thread pushing audio to Cubic). All memory is allocated up front, so
+ * its size is fixed no matter how far the consumer falls behind, and
+ * moving audio through it neither allocates nor takes a lock.
+ *
+ * The producer fills a chunk in place (beginWrite/commitWrite), and the
+ * consumer borrows a view of the oldest chunk (beginRead/endRead) until
+ * it is done with it. Chunks move between the two through a queue of
+ * filled chunks and a queue of free ones, each of which only one side
+ * adds to.
+ *
+ * What happens when the producer needs a chunk and every chunk is in
+ * use is set by the overflow policy:
+ *
+ * DropOldest takes back the oldest chunk the consumer has not yet
+ * borrowed and reuses it, so the audio that is sent stays recent and the
+ * delay through the ring never exceeds its capacity.
+ *
+ * Block makes the producer wait until the consumer returns a chunk, for
+ * at most maxBlockMs, after which the oldest chunk is dropped as with
+ * DropOldest. While it waits, the producer stops reading its source,
+ * which has to buffer the audio itself.
+ *
+ * Coalesce also waits like Block, but the consumer copies the queued
+ * chunks that fit into the chunk it borrows, freeing them without
+ * losing audio, so a backlog is sent in fewer, larger messages. The
+ * copying is done on the consumer's thread. This helps when the
+ * producer writes small chunks.
+ *
+ * Every chunk records its offset among all the bytes committed, so the
+ * consumer can tell where audio was dropped. Queued chunks are only
+ * merged if no audio was dropped between them.
+ *
+ * Chunks only ever hold whole frames of frameBytes bytes (such as one
+ * 16-bit sample), so dropping a chunk never leaves the audio after it
+ * out of step. The bytes of a partial frame committed at the end of a
+ * chunk are carried over to the start of the next one.
+ *
+ * A waiting producer also stops when close() is called from another
+ * thread. The ring counts the bytes and chunks dropped or merged, how
+ * long the producer spent waiting, and the most audio that was ever
+ * queued.
+ */
+class ChunkRing
+{
+public:
+    enum OverflowPolicy
+    {
+        Block,
+        DropOldest,
+        Coalesce
+    };
+
+    /*
+     * Create a ring holding numChunks chunks of chunkSize bytes each.
+     * numChunks must be at least 2, so that the producer can fill one
+     * chunk while the consumer has borrowed another, and chunkSize must
+     * be a multiple of frameBytes.
+     */
+    ChunkRing(size_t numChunks, size_t chunkSize,
+              OverflowPolicy policy = DropOldest, int maxBlockMs = 500,
+              size_t frameBytes = 1);
+    ~ChunkRing();
+
+    ChunkRing(const ChunkRing &) = delete;
+    ChunkRing &operator=(const ChunkRing &) = delete;
+
+    // Returns the capacity of each chunk in bytes.
+    size_t chunkSize() const;
+
+    // Returns the overflow policy.
+    OverflowPolicy policy() const;
+
+    /*
+     * Producer only. Returns a pointer into a free chunk, just after any
+     * partial frame carried over from the last one, which may be filled
+     * with up to writeCapacity() bytes. If no chunk is free, the overflow
+     * policy is applied first, which may wait for the consumer. Returns
+     * nullptr once the ring is closed.
+     */
+    char *beginWrite();
+
+    // Producer only. Returns the space left by beginWrite() in bytes.
+    size_t writeCapacity() const;
+
+    /*
+     * Producer only. Queues the whole frames in the chunk returned by
+     * beginWrite(), keeping the bytes of a partial frame for the next
+     * chunk. A chunk without a whole frame is kept for the next write
+     * rather than queued.
+     */
+    void commitWrite(size_t numBytes);
+
+    /*
+     * Indicates that no more chunks will be written, and wakes up a
+     * producer waiting in beginWrite(). Chunks already in the ring may
+     * still be read. This may be called from any thread.
+     */
+    void close();
+
+    /*
+     * Consumer only. Borrows the oldest chunk in the ring, returning
+     * false if the ring is empty. The data remains valid until endRead()
+     * is called. If offset is not null, it is set to the position of the
+     * chunk's first byte among all the bytes ever committed, so a chunk
+     * that starts later than the previous one ended follows dropped
+     * audio.
+     */
+    bool beginRead(const char **data, size_t *numBytes,
+                   uint64_t *offset = nullptr);
+
+    /*
+     * Consumer only. Like beginRead(), but waits for a chunk to become
+     * available. Returns false once the ring is closed and empty.
+     */
+    bool waitRead(const char **data, size_t *numBytes,
+                  uint64_t *offset = nullptr);
+
+    // Consumer only. Returns the chunk borrowed by beginRead() to the ring.
+    void endRead();
+
+    // Returns the number of bytes queued, including a borrowed chunk.
+    size_t queuedBytes() const;
+
+    // Returns the largest number of bytes that were ever queued.
+    size_t highWaterBytes() const;
+
+    // Returns the number of chunks dropped to make room.
+    uint64_t droppedChunks() const;
+
+    // Returns the number of bytes dropped to make room.
+    uint64_t droppedBytes() const;
+
+    // Returns the number of chunks merged into another (Coalesce).
+    uint64_t coalescedChunks() const;
+
+    // Returns the total time the producer spent waiting for a free chunk.
+    double blockedMs() const;
+
+private:
+    /*
+     * A single-producer/single-consumer queue of chunk indices. With
+     * DropOldest (or after a wait times out), the producer of the filled
+     * queue also takes chunks from it, so taking a chunk is a
+     * compare-and-swap on the head.
+     */
+    class IndexQueue
+    {
+    public:
+        explicit IndexQueue(size_t capacity);
+
+        void push(size_t idx);
+        bool pop(size_t *idx);
+
+        /*
+         * Reads the oldest index without taking it, along with its
+         * position, which take() then removes unless the other side
+         * took it first.
+         */
+        bool peek(size_t *idx, size_t *pos) const;
+        bool take(size_t pos);
+
+    private:
+        const size_t mCapacity;
+        std::unique_ptr<std::atomic<size_t>[]> mSlots;
+        alignas(64) std::atomic<size_t> mHead;
+        alignas(64) std::atomic<size_t> mTail;
+    };
+
+    const size_t mNumChunks;
+    const size_t mChunkSize;
+    const OverflowPolicy mPolicy;
+    const int mMaxBlockMs;
+    std::vector<char> mData;
+
+    // The length and offset of each chunk, written only by the side
+    // that holds it. The consumer may look at a queued chunk before
+    // taking it, so these are atomic too.
+    std::unique_ptr<std::atomic<size_t>[]> mLengths;
+    std::unique_ptr<std::atomic<uint64_t>[]> mOffsets;
+
+    IndexQueue mFilled;
+    IndexQueue mFree;
+
+    // The chunk being filled by the producer, and the chunk borrowed by
+    // the consumer. Each is only used by its own side.
+    size_t mWriting;
+    size_t mBorrowed;
+
+    // The offset of the next chunk to be committed, and the bytes of a
+    // partial frame to start it with (producer only).
+    uint64_t mWriteOffset;
+    const size_t mFrameBytes;
+    std::vector<char> mCarry;
+    size_t mCarryBytes;
+
+    std::atomic<bool> mClosed;
+    std::atomic<size_t> mQueuedBytes;
+    std::atomic<size_t> mHighWaterBytes;
+    std::atomic<uint64_t> mDroppedChunks;
+    std::atomic<uint64_t> mDroppedBytes;
+    std::atomic<uint64_t> mCoalescedChunks;
+    std::atomic<uint64_t> mBlockedUs;
+
+    bool takeFreeChunk();
+    bool dropOldest();
+    void coalesce();
+};
+
+#endif // CHUNK_RING_H
@@ -0,0 +1,167 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "context_builder.h"
+#include "fnv1a.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// The phrases (and their boost values) assigned to one shard.
+struct Shard
+{
+    std::vector<std::string> phrases;
+    std::vector<float> boostValues;
+    CubicPB::CompiledContext compiled;
+};
+
+// Shards are picked with a stable hash, so shard assignment does not
+// depend on the standard library implementation.
+size_t shardFor(const std::string &phrase, size_t numShards)
+{
+    return fnv1a(phrase) % numShards;
+}
+
+} // namespace
+
+ContextBuilder::ContextBuilder(CubicClient &client, ContextCache &cache,
+                               size_t numShards, size_t maxConcurrent)
+    : mClient(client), mCache(cache), mNumShards(std::max<size_t>(numShards, 1)),
+      mMaxConcurrent(std::max<size_t>(maxConcurrent, 1)), mShardsCompiled(0),
+      mShardsTotal(0)
+{
+}
+
+CubicPB::RecognitionContext
+ContextBuilder::build(const std::string &modelID, const std::string &token,
+                      const std::vector<std::string> &phrases,
+                      const std::vector<float> &boostValues)
+{
+    if (!boostValues.empty() && boostValues.size() != phrases.size())
+    {
+        throw std::invalid_argument(
+            "boostValues must be empty or match the number of phrases");
+    }
+
+    // Split the phrases into shards, keeping their original order. The
+    // number of shards never depends on the list, so a phrase stays in
+    // the same shard however many others are added or removed.
+    std::vector<Shard> allShards(mNumShards);
+    for (size_t i = 0; i < phrases.size(); i++)
+    {
+        Shard &shard = allShards[shardFor(phrases[i], mNumShards)];
+        shard.phrases.push_back(phrases[i]);
+        if (!boostValues.empty())
+        {
+            shard.boostValues.push_back(boostValues[i]);
+        }
+    }
+
+    std::vector<Shard *> shards;
+    for (Shard &shard : allShards)
+    {
+        if (!shard.phrases.empty())
+        {
+            shards.push_back(&shard);
+        }
+    }
+
+    // Compile the shards on a bounded number of threads. Shards that are
+    // already in the cache are returned without contacting the server.
+    // The cache may be shared with other builders, so compiles are
+    // counted here rather than taken from its miss counter.
+    std::atomic<size_t> nextShard(0);
+    std::atomic<size_t> numCompiled(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+        size_t idx;
+        while ((idx = nextShard++) < shards.size())
+        {
+            Shard *shard = shards[idx];
+            try
+            {
+                bool compiled = false;
+                shard->compiled = mCache.compile(mClient, modelID, token,
+                                                 shard->phrases,
+                                                 shard->boostValues,
+                                                 &compiled);
+                if (compiled)
+                {
+                    numCompiled++;
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+
+                // Don't start any more shards
+                nextShard = shards.size();
+            }
+        }
+    };
+
+    size_t numThreads = std::min(mMaxConcurrent, shards.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    mShardsTotal = shards.size();
+    mShardsCompiled = numCompiled;
+
+    CubicPB::RecognitionContext context;
+    for (Shard *shard : shards)
+    {
+        *(context.add_compiled()) = shard->compiled;
+    }
+    return context;
+}
+
+size_t ContextBuilder::shardsCompiled() const
+{
+    return mShardsCompiled;
+}
+
+size_t ContextBuilder::shardsTotal() const
+{
+    return mShardsTotal;
+}
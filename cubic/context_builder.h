@@ -0,0 +1,79 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONTEXT_BUILDER_H
+#define CONTEXT_BUILDER_H
+
+#include "context_cache.h"
+#include "cubic_client.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * ContextBuilder compiles very large phrase lists by splitting them into
+ * shards and compiling the shards concurrently. Each shard becomes its
+ * own CompiledContext in the resulting RecognitionContext.
+ *
+ * A phrase is assigned to one of a fixed number of shards by a hash of
+ * its text, so adding or removing a phrase only changes the shard it
+ * belongs to, however long the list is. Compiled shards are stored in a
+ * ContextCache, so when the phrase list changes, only the shards whose
+ * content changed are sent to the server again. Empty shards are
+ * skipped, but each other shard is a request of its own, so a short
+ * list is best built with fewer shards.
+ */
+class ContextBuilder
+{
+public:
+    /*
+     * Create a builder that splits phrase lists into numShards shards
+     * and compiles at most maxConcurrent shards at a time. The number of
+     * shards should stay the same between runs; changing it moves most
+     * phrases to a different shard and so invalidates the cache.
+     */
+    ContextBuilder(CubicClient &client, ContextCache &cache,
+                   size_t numShards = 16, size_t maxConcurrent = 4);
+
+    /*
+     * Compile the given phrases for the model and context token, and
+     * return a RecognitionContext holding one compiled entry for each
+     * non-empty shard. boostValues may be empty, or have one value for
+     * each phrase. If any shard fails to compile, the error is rethrown
+     * after the other in-flight requests finish.
+     */
+    cobaltspeech::cubic::RecognitionContext
+    build(const std::string &modelID, const std::string &token,
+          const std::vector<std::string> &phrases,
+          const std::vector<float> &boostValues = std::vector<float>());
+
+    // Returns the number of shards that were compiled by the last build()
+    // (rather than loaded from the cache).
+    size_t shardsCompiled() const;
+
+    // Returns the number of non-empty shards in the last build().
+    size_t shardsTotal() const;
+
+private:
+    CubicClient &mClient;
+    ContextCache &mCache;
+    size_t mNumShards;
+    size_t mMaxConcurrent;
+    size_t mShardsCompiled;
+    size_t mShardsTotal;
+};
+
+#endif // CONTEXT_BUILDER_H
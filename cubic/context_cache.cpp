@@ -0,0 +1,284 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "context_cache.h"
+#include "fnv1a.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// Appends the raw bytes of a value to the key.
+void appendBytes(std::string *key, const void *data, size_t size)
+{
+    key->append(static_cast<const char *>(data), size);
+}
+
+// Length-prefix each field so that ("ab", "c") and ("a", "bc") produce
+// different keys.
+void appendField(std::string *key, const std::string &str)
+{
+    uint64_t len = str.size();
+    appendBytes(key, &len, sizeof(len));
+    key->append(str);
+}
+
+} // namespace
+
+ContextCache::ContextCache(const std::string &dir)
+    : mDir(dir), mMemoryHits(0), mDiskHits(0), mMisses(0), mMetrics(nullptr)
+{
+    if (!mDir.empty() && mkdir(mDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("could not create cache directory " + mDir +
+                                 ": " + strerror(errno));
+    }
+}
+
+ContextCache::~ContextCache() {}
+
+CubicPB::CompiledContext
+ContextCache::compile(CubicClient &client, const std::string &modelID,
+                      const std::string &token,
+                      const std::vector<std::string> &phrases,
+                      const std::vector<float> &boostValues, bool *compiled)
+{
+    std::string key = makeKey(modelID, token, phrases, boostValues);
+
+    CubicPB::CompiledContext context;
+    bool found = lookup(key, &context);
+    if (compiled)
+    {
+        *compiled = !found;
+    }
+    if (found)
+    {
+        return context;
+    }
+
+    if (mMetrics)
+    {
+        context = mMetrics->timeRpc(CubicMetrics::CompileContext, [&]() {
+            return client.compileContext(modelID, token, phrases, boostValues);
+        });
+    }
+    else
+    {
+        context = client.compileContext(modelID, token, phrases, boostValues);
+    }
+    store(key, context);
+    return context;
+}
+
+bool ContextCache::lookup(const std::string &key,
+                          CubicPB::CompiledContext *context)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mEntries.find(key);
+        if (iter != mEntries.end())
+        {
+            *context = iter->second;
+            mMemoryHits++;
+            return true;
+        }
+    }
+
+    if (loadEntry(key, context))
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEntries[key] = *context;
+        mDiskHits++;
+        return true;
+    }
+
+    mMisses++;
+    return false;
+}
+
+void ContextCache::store(const std::string &key,
+                         const CubicPB::CompiledContext &context)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEntries[key] = context;
+    }
+
+    saveEntry(key, context);
+}
+
+std::string ContextCache::makeKey(const std::string &modelID,
+                                  const std::string &token,
+                                  const std::vector<std::string> &phrases,
+                                  const std::vector<float> &boostValues)
+{
+    std::string key;
+    appendField(&key, modelID);
+    appendField(&key, token);
+
+    uint64_t numPhrases = phrases.size();
+    appendBytes(&key, &numPhrases, sizeof(numPhrases));
+    for (const std::string &phrase : phrases)
+    {
+        appendField(&key, phrase);
+    }
+
+    uint64_t numBoosts = boostValues.size();
+    appendBytes(&key, &numBoosts, sizeof(numBoosts));
+    if (!boostValues.empty())
+    {
+        appendBytes(&key, boostValues.data(),
+                    boostValues.size() * sizeof(float));
+    }
+    return key;
+}
+
+void ContextCache::setMetrics(CubicMetrics *metrics)
+{
+    mMetrics = metrics;
+}
+
+uint64_t ContextCache::memoryHits() const
+{
+    return mMemoryHits;
+}
+
+uint64_t ContextCache::diskHits() const
+{
+    return mDiskHits;
+}
+
+uint64_t ContextCache::misses() const
+{
+    return mMisses;
+}
+
+std::string ContextCache::entryPath(const std::string &key) const
+{
+    // Keys are too long to use as file names, so files are named by a
+    // hash of the key. The key itself is stored in the file, since
+    // different keys can have the same hash.
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx",
+             static_cast<unsigned long long>(fnv1a(key)));
+    return mDir + "/" + hex + ".ctx";
+}
+
+bool ContextCache::loadEntry(const std::string &key,
+                             CubicPB::CompiledContext *context) const
+{
+    if (mDir.empty())
+    {
+        return false;
+    }
+
+    int fd = open(entryPath(key).c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // Each entry starts with its length-prefixed key, which must match
+    // exactly. Anything shorter than that is not a valid entry.
+    uint64_t keyLen = key.size();
+    size_t headerSize = sizeof(keyLen) + key.size();
+    if (info.st_size < off_t(headerSize))
+    {
+        close(fd);
+        return false;
+    }
+
+    // Parse the entry straight out of the page cache rather than reading
+    // it into an intermediate buffer first.
+    void *addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const char *data = static_cast<const char *>(addr);
+    bool ok = memcmp(data, &keyLen, sizeof(keyLen)) == 0 &&
+              memcmp(data + sizeof(keyLen), key.data(), key.size()) == 0 &&
+              context->ParseFromArray(data + headerSize,
+                                      info.st_size - headerSize);
+    munmap(addr, info.st_size);
+    return ok;
+}
+
+void ContextCache::saveEntry(const std::string &key,
+                             const CubicPB::CompiledContext &context) const
+{
+    if (mDir.empty())
+    {
+        return;
+    }
+
+    // The key is written ahead of the context, so that loadEntry() can
+    // tell this entry apart from another with the same file name.
+    std::string data;
+    uint64_t keyLen = key.size();
+    appendBytes(&data, &keyLen, sizeof(keyLen));
+    data.append(key);
+    if (!context.AppendToString(&data))
+    {
+        return;
+    }
+
+    // Write to a temporary file and rename it into place, so that other
+    // processes never see a partially written entry.
+    std::string path = entryPath(key);
+    std::string tmpPath = path + ".XXXXXX";
+    int fd = mkstemp(&tmpPath[0]);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    FILE *file = fdopen(fd, "wb");
+    if (file == nullptr)
+    {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmpPath.c_str());
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONTEXT_CACHE_H
+#define CONTEXT_CACHE_H
+
+#include "cubic_client.h"
+#include "cubic_metrics.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * ContextCache stores the results of CubicClient::compileContext() so
+ * that the same phrase list does not have to be compiled again. Entries
+ * are keyed by the model ID, context token, phrases and boost values,
+ * and are kept both in memory and (optionally) as files in a cache
+ * directory, so later runs of the application can skip the compile
+ * request entirely. Files are named by a hash of the key and hold the
+ * key itself, which is compared in full when an entry is loaded.
+ *
+ * All methods are safe to call from multiple threads.
+ */
+class ContextCache
+{
+public:
+    /*
+     * Create a cache that stores entries in the given directory, which
+     * is created if it does not exist. If dir is empty, entries are only
+     * kept in memory.
+     */
+    ContextCache(const std::string &dir = "");
+    ~ContextCache();
+
+    ContextCache(const ContextCache &) = delete;
+    ContextCache &operator=(const ContextCache &) = delete;
+
+    /*
+     * Returns the compiled context for the given phrases, calling
+     * client.compileContext() only if it is not already cached. If
+     * compiled is not null, it is set to whether the request was sent.
+     */
+    cobaltspeech::cubic::CompiledContext
+    compile(CubicClient &client, const std::string &modelID,
+            const std::string &token, const std::vector<std::string> &phrases,
+            const std::vector<float> &boostValues = std::vector<float>(),
+            bool *compiled = nullptr);
+
+    /*
+     * Look up the entry with the given key (see makeKey()), checking
+     * memory first and then the cache directory. Returns false if the
+     * entry is not cached. Updates the hit/miss counters.
+     */
+    bool lookup(const std::string &key,
+                cobaltspeech::cubic::CompiledContext *context);
+
+    // Add an entry to the cache, writing it to the cache directory.
+    void store(const std::string &key,
+               const cobaltspeech::cubic::CompiledContext &context);
+
+    /*
+     * Returns the cache key for the given compile request, which holds
+     * every field of the request (so it may be long, and is not
+     * printable). Compiled contexts are only valid for the model that
+     * created them, so the model ID is part of the key.
+     */
+    static std::string makeKey(const std::string &modelID,
+                               const std::string &token,
+                               const std::vector<std::string> &phrases,
+                               const std::vector<float> &boostValues);
+
+    // Record the time taken by each compile request in the given metrics.
+    // This must be set before compile() is first called.
+    void setMetrics(CubicMetrics *metrics);
+
+    // Number of lookups satisfied from memory.
+    uint64_t memoryHits() const;
+
+    // Number of lookups satisfied from the cache directory.
+    uint64_t diskHits() const;
+
+    // Number of lookups that required compiling the context.
+    uint64_t misses() const;
+
+private:
+    std::string mDir;
+    std::mutex mMutex;
+    std::unordered_map<std::string, cobaltspeech::cubic::CompiledContext>
+        mEntries;
+
+    std::atomic<uint64_t> mMemoryHits;
+    std::atomic<uint64_t> mDiskHits;
+    std::atomic<uint64_t> mMisses;
+    CubicMetrics *mMetrics;
+
+    std::string entryPath(const std::string &key) const;
+    bool loadEntry(const std::string &key,
+                   cobaltspeech::cubic::CompiledContext *context) const;
+    void saveEntry(const std::string &key,
+                   const cobaltspeech::cubic::CompiledContext &context) const;
+};
+
+#endif // CONTEXT_CACHE_H
@@ -16,9 +16,20 @@
 
 #include "cubic_client.h"
 #include "cubic_exception.h"
-
+#include "audio_file.h"
+#include "audio_pacer.h"
+#include "context_builder.h"
+#include "context_cache.h"
+#include "cubic_metrics.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "result_reader.h"
+#include "wav_header.h"
+
+#include <algorithm>
 #include <iostream>
-#include <fstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
@@ -33,6 +44,30 @@ namespace CubicPB = cobaltspeech::cubic;
 const std::string serverAddress = "localhost:2727";
 const std::string filename = "test.wav";
 
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The audio file is replayed at this multiple of real time, as if it
+// were being recorded live. Set this to zero to send the audio as fast
+// as it can be read.
+const double replaySpeed = 1.0;
+
+// Compiled contexts are saved here so that later runs can reuse them.
+const std::string contextCacheDir = "cubic_context_cache";
+
+// Large phrase lists are split into this many shards, which are compiled
+// concurrently (at most maxConcurrentCompiles at a time). Each non-empty
+// shard is its own request, so the short list below would be better
+// compiled with a single shard.
+const size_t numContextShards = 8;
+const size_t maxConcurrentCompiles = 4;
+
+// Compile times, result latencies and the like are written to this file
+// in the Prometheus text format before the client exits.
+const std::string metricsFile = "cubic_metrics.prom";
+
 // This client demonstrates using compiled contexts with streaming
 // recognition.
 int main(int argc, char *argv[]) {
@@ -41,14 +76,22 @@ int main(int argc, char *argv[]) {
         // which is not recommended for production).
         CubicClient client(serverAddress);
 
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
         // Display the Cubic version
-        std::cout << "Cubic version: " << client.cubicVersion() << std::endl;
-        std::cout << "Server version: " << client.serverVersion() << std::endl;
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
         std::cout << "Connected to " << serverAddress << std::endl;
         std::cout << std::endl;
 
+        MetricsRegistry registry;
+        CubicMetrics metrics(registry);
+
         // Get the list of available models
-        std::vector<CubicModel> models = client.listModels();
+        const std::vector<CubicModel> &models = startup.models();
         std::cout << "Available Models:" << std::endl;
         for (const CubicModel &m : models) {
             std::cout << "  ID = " << m.id() << std::endl
@@ -85,14 +128,29 @@ int main(int argc, char *argv[]) {
             "LAGUARDIA"
         };
 
+        // Compiling a large list can take a while, so the list is split
+        // into shards that are compiled concurrently, each producing its
+        // own compiled context. The compiled shards are cached (in memory
+        // and on disk) using the model ID, context token and phrases as
+        // the key, so if this example has been run before, unchanged
+        // shards are loaded from the cache directory and no CompileContext
+        // request is sent for them.
         std::string contextToken = model.allowedContextTokens()[0]; // "airport_names"
-        CubicPB::CompiledContext compiledResp =
-            client.compileContext(model.id(), contextToken, phrases);
+        ContextCache contextCache(contextCacheDir);
+        contextCache.setMetrics(&metrics);
+        ContextBuilder contextBuilder(client, contextCache, numContextShards,
+                                      maxConcurrentCompiles);
 
         // Save the compiled result for later use. Note this compiled
         // data is only compatible with the model ID used to create it.
-        CubicPB::RecognitionContext compiledContexts;
-        *(compiledContexts.add_compiled()) = compiledResp;
+        CubicPB::RecognitionContext compiledContexts =
+            contextBuilder.build(model.id(), contextToken, phrases);
+
+        std::cout << "Compiled " << contextBuilder.shardsCompiled() << " of "
+                  << contextBuilder.shardsTotal() << " context shards ("
+                  << contextCache.memoryHits() + contextCache.diskHits()
+                  << " cache hits, " << contextCache.misses() << " misses)"
+                  << std::endl;
 
         // Now we can send a recognize request along with the compiled
         // context. The context data is provided throught he recognition
@@ -104,31 +162,50 @@ int main(int argc, char *argv[]) {
 
         // The rest is the same as the usual streaming recognize request.
 
+        // Map the audio file into memory. Each chunk is pushed straight
+        // from the mapping without being copied into a separate buffer.
+        AudioFile audio(filename, AudioFile::Sequential);
+
+        // The WAV header tells us how many bytes make up a second of audio
+        WavFormat format;
+        if (!parseWavHeader(audio.data(), audio.size(), &format)) {
+            throw std::runtime_error(filename + " is not a valid WAV file");
+        }
+        AudioPacer pacer(format.bytesPerSecond(), replaySpeed);
+
         // Create the stream
         auto stream = client.streamingRecognize(cfg);
+        CubicMetrics::Stream streamMetrics(metrics, format.bytesPerSecond(),
+                                           format.dataOffset);
+        auto push = [&stream, &streamMetrics](const char *data, size_t size) {
+            CubicMetrics::Clock::time_point start = CubicMetrics::Clock::now();
+            stream.pushAudio(data, size);
+            streamMetrics.pushed(size, start);
+        };
 
         // Push the audio on a separate thread
-        std::thread audioThread([&stream](){
-            // Open the file and push audio bytes
-            std::ifstream infile(filename);
-            std::streamsize buffSize = 8192;
-            char *buff = new char[buffSize];
-            while (infile.good()) {
-                infile.read(buff, buffSize);
-                stream.pushAudio(buff, infile.gcount());
+        pacer.start();
+        std::thread audioThread([&stream, &audio, &format, &pacer, &push](){
+            // The header holds no audio, so it is sent right away
+            push(audio.data(), format.dataOffset);
+
+            const size_t chunkSize = 8192;
+            for (size_t pos = format.dataOffset; pos < audio.size(); pos += chunkSize) {
+                size_t n = std::min(chunkSize, audio.size() - pos);
+                pacer.pace(n);
+                push(audio.data() + pos, n);
             }
 
             // Let Cubic know that no more audio will be coming
             stream.audioFinished();
-            delete[] buff;
         });
 
         // Print the results as they come
         std::cout << "\nTranscripts:" << std::endl;
-        CubicPB::RecognitionResponse resp;
-        while (stream.receiveResults(&resp)) {
-            for (int i = 0; i < resp.results_size(); i++) {
-                CubicPB::RecognitionResult result = resp.results(i);
+        ResultReader reader(stream);
+        while (const CubicPB::RecognitionResponse *resp = reader.next()) {
+            streamMetrics.received(*resp);
+            for (const CubicPB::RecognitionResult &result : resp->results()) {
                 if (!result.is_partial()) {
                     std::cout << result.alternatives(0).transcript() << std::endl;
                 }
@@ -139,6 +216,9 @@ int main(int argc, char *argv[]) {
         audioThread.join();
         stream.close();
 
+        registry.writeTextFile(metricsFile);
+        std::cout << "\nMetrics written to " << metricsFile << std::endl;
+
     } catch (CubicException &e) {
         std::cerr << "Cubic error: " << e.what() << std::endl;
     } catch (std::exception &e) {
@@ -0,0 +1,330 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "coro_executor.h"
+
+#include <algorithm>
+
+namespace
+{
+
+coro_detail::Detached runSpawned(Executor &executor, Task<void> task)
+{
+    co_await executor.schedule();
+    try
+    {
+        co_await task;
+    }
+    catch (...)
+    {
+    }
+}
+
+// Shared by whenAll() and the tasks it is waiting for.
+struct JoinState
+{
+    Executor *executor;
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> waiter;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+coro_detail::Detached runJoined(JoinState *state, Task<void> task)
+{
+    co_await state->executor->schedule();
+    try
+    {
+        co_await task;
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error)
+        {
+            state->error = std::current_exception();
+        }
+    }
+
+    if (--state->remaining == 0)
+    {
+        state->executor->post(state->waiter);
+    }
+}
+
+struct JoinAwaiter
+{
+    JoinState *state;
+    std::vector<Task<void>> *tasks;
+
+    bool await_ready() noexcept { return tasks->empty(); }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        // The waiter may be resumed on another thread as soon as the
+        // last task is started, so nothing in its frame (including this
+        // awaiter) may be used after that.
+        JoinState *s = state;
+        std::vector<Task<void>> started = std::move(*tasks);
+        s->waiter = h;
+        for (Task<void> &task : started)
+        {
+            runJoined(s, std::move(task));
+        }
+    }
+
+    void await_resume() noexcept {}
+};
+
+// The worker running on this thread, if it belongs to a
+// WorkStealingExecutor, so that posts from a worker stay on its queue.
+thread_local const void *tCurrentExecutor = nullptr;
+thread_local size_t tCurrentWorker = 0;
+
+} // namespace
+
+Executor::~Executor() {}
+
+void Executor::spawn(Task<void> task)
+{
+    runSpawned(*this, std::move(task));
+}
+
+Task<void> whenAll(Executor &executor, std::vector<Task<void>> tasks)
+{
+    JoinState state;
+    state.executor = &executor;
+    state.remaining = tasks.size();
+    co_await JoinAwaiter{&state, &tasks};
+
+    if (state.error)
+    {
+        std::rethrow_exception(state.error);
+    }
+}
+
+SingleThreadExecutor::SingleThreadExecutor() : mTimerCount(0) {}
+
+SingleThreadExecutor::~SingleThreadExecutor() {}
+
+void SingleThreadExecutor::post(std::coroutine_handle<> h)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mReady.push_back(h);
+    }
+    mCond.notify_one();
+}
+
+void SingleThreadExecutor::postAt(Clock::time_point when,
+                                  std::coroutine_handle<> h)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTimers.emplace(when, mTimerCount++, h);
+    }
+    mCond.notify_one();
+}
+
+void SingleThreadExecutor::waitFor(const std::future<void> &done)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (done.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        Clock::time_point now = Clock::now();
+        while (!mTimers.empty() && std::get<0>(mTimers.top()) <= now)
+        {
+            mReady.push_back(std::get<2>(mTimers.top()));
+            mTimers.pop();
+        }
+
+        if (mReady.empty())
+        {
+            if (mTimers.empty())
+            {
+                mCond.wait(lock);
+            }
+            else
+            {
+                mCond.wait_until(lock, std::get<0>(mTimers.top()));
+            }
+            continue;
+        }
+
+        std::coroutine_handle<> h = mReady.front();
+        mReady.pop_front();
+        lock.unlock();
+        h.resume();
+        lock.lock();
+    }
+}
+
+WorkStealingExecutor::WorkStealingExecutor(unsigned int numThreads)
+    : mNextWorker(0), mPending(0), mTimerCount(0), mStopping(false)
+{
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        mWorkers.emplace_back(new Worker());
+    }
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        mThreads.emplace_back(&WorkStealingExecutor::run, this, i);
+    }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCond.notify_all();
+
+    for (std::thread &t : mThreads)
+    {
+        t.join();
+    }
+}
+
+void WorkStealingExecutor::post(std::coroutine_handle<> h)
+{
+    // Work posted by a worker goes on its own queue, where it is likely
+    // to still be in the cache. Other threads spread theirs around.
+    size_t index;
+    if (tCurrentExecutor == this)
+    {
+        index = tCurrentWorker;
+    }
+    else
+    {
+        index = mNextWorker++ % mWorkers.size();
+    }
+    push(index, h);
+}
+
+void WorkStealingExecutor::postAt(Clock::time_point when,
+                                  std::coroutine_handle<> h)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTimers.emplace(when, mTimerCount++, h);
+    }
+    // Wake a worker so that it waits for the new timer, which may be
+    // sooner than the one it was waiting for.
+    mCond.notify_one();
+}
+
+void WorkStealingExecutor::waitFor(const std::future<void> &done)
+{
+    done.wait();
+}
+
+void WorkStealingExecutor::push(size_t index, std::coroutine_handle<> h)
+{
+    {
+        std::lock_guard<std::mutex> lock(mWorkers[index]->mutex);
+        mWorkers[index]->queue.push_back(h);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending++;
+    }
+    mCond.notify_one();
+}
+
+bool WorkStealingExecutor::take(size_t index, std::coroutine_handle<> *h)
+{
+    // Newest first from our own queue, oldest first from the others
+    for (size_t i = 0; i < mWorkers.size(); i++)
+    {
+        Worker &worker = *mWorkers[(index + i) % mWorkers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.queue.empty())
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            *h = worker.queue.back();
+            worker.queue.pop_back();
+        }
+        else
+        {
+            *h = worker.queue.front();
+            worker.queue.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingExecutor::run(size_t index)
+{
+    tCurrentExecutor = this;
+    tCurrentWorker = index;
+
+    while (true)
+    {
+        std::coroutine_handle<> h;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (true)
+            {
+                // Move any timers that are due onto our queue
+                Clock::time_point now = Clock::now();
+                while (!mTimers.empty() && std::get<0>(mTimers.top()) <= now)
+                {
+                    std::lock_guard<std::mutex> wlock(mWorkers[index]->mutex);
+                    mWorkers[index]->queue.push_back(std::get<2>(mTimers.top()));
+                    mTimers.pop();
+                    mPending++;
+                }
+
+                if (mPending > 0)
+                {
+                    mPending--;
+                    break;
+                }
+                if (mStopping)
+                {
+                    return;
+                }
+
+                if (mTimers.empty())
+                {
+                    mCond.wait(lock);
+                }
+                else
+                {
+                    mCond.wait_until(lock, std::get<0>(mTimers.top()));
+                }
+            }
+        }
+
+        // mPending counted a queued coroutine for us, so one is there to
+        // be found, though perhaps on another worker's queue.
+        while (!take(index, &h))
+        {
+            std::this_thread::yield();
+        }
+        h.resume();
+    }
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CORO_EXECUTOR_H
+#define CORO_EXECUTOR_H
+
+#include "coro_task.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/*
+ * An Executor resumes suspended coroutines on its own threads. Awaiting
+ * an operation (such as a stream result) suspends the coroutine without
+ * blocking a thread; when the operation completes, the coroutine is
+ * posted back to its executor to continue.
+ *
+ * Every task spawned on an executor must have finished before the
+ * executor is destroyed.
+ */
+class Executor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~Executor();
+
+    // Resume the given coroutine on one of the executor's threads. Safe
+    // to call from any thread.
+    virtual void post(std::coroutine_handle<> h) = 0;
+
+    // Resume the given coroutine no earlier than the given time.
+    virtual void postAt(Clock::time_point when, std::coroutine_handle<> h) = 0;
+
+    // Start the task on the executor without waiting for it. If the task
+    // throws, the exception is lost, so tasks should handle their own.
+    void spawn(Task<void> task);
+
+    // Run the task on the executor and wait for its result. This must
+    // not be called from one of the executor's own threads.
+    template <typename T>
+    T syncWait(Task<T> task);
+
+    // Awaitable that moves the awaiting coroutine onto the executor.
+    auto schedule()
+    {
+        struct Awaiter
+        {
+            Executor *executor;
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { executor->post(h); }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{this};
+    }
+
+    // Awaitable that resumes the awaiting coroutine at the given time,
+    // leaving the thread free for other coroutines until then.
+    auto sleepUntil(Clock::time_point when)
+    {
+        struct Awaiter
+        {
+            Executor *executor;
+            Clock::time_point when;
+            bool await_ready() noexcept { return Clock::now() >= when; }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                executor->postAt(when, h);
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{this, when};
+    }
+
+protected:
+    /*
+     * Wait until the given future is ready. SingleThreadExecutor runs
+     * coroutines on the calling thread while it waits; executors with
+     * their own threads just block.
+     */
+    virtual void waitFor(const std::future<void> &done) = 0;
+
+    // Timers waiting to be posted, soonest first.
+    using Timer = std::tuple<Clock::time_point, uint64_t, std::coroutine_handle<>>;
+    using TimerQueue =
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>>;
+};
+
+/*
+ * SingleThreadExecutor runs every coroutine on one thread: the one that
+ * calls syncWait(). Coroutines never run in parallel, so they may share
+ * data without locks, as on an event loop.
+ */
+class SingleThreadExecutor : public Executor
+{
+public:
+    SingleThreadExecutor();
+    ~SingleThreadExecutor() override;
+
+    void post(std::coroutine_handle<> h) override;
+    void postAt(Clock::time_point when, std::coroutine_handle<> h) override;
+
+protected:
+    void waitFor(const std::future<void> &done) override;
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::coroutine_handle<>> mReady;
+    TimerQueue mTimers;
+    uint64_t mTimerCount;
+};
+
+/*
+ * WorkStealingExecutor runs coroutines on a fixed pool of threads. Each
+ * thread keeps its own queue of coroutines to resume, and a thread with
+ * nothing to do takes work from the others, so a busy stream does not
+ * hold up coroutines queued behind it.
+ */
+class WorkStealingExecutor : public Executor
+{
+public:
+    // Start the given number of threads (the number of cores if zero).
+    WorkStealingExecutor(unsigned int numThreads = 0);
+    ~WorkStealingExecutor() override;
+
+    void post(std::coroutine_handle<> h) override;
+    void postAt(Clock::time_point when, std::coroutine_handle<> h) override;
+
+protected:
+    void waitFor(const std::future<void> &done) override;
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::coroutine_handle<>> queue;
+    };
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNextWorker;
+
+    // Guards sleeping, the pending count and the timers.
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    size_t mPending;
+    TimerQueue mTimers;
+    uint64_t mTimerCount;
+    bool mStopping;
+
+    void run(size_t index);
+    bool take(size_t index, std::coroutine_handle<> *h);
+    void push(size_t index, std::coroutine_handle<> h);
+};
+
+/*
+ * Run the tasks concurrently on the executor, and finish once all of
+ * them have. If any of them throws, the first exception is rethrown
+ * after they have all finished.
+ */
+Task<void> whenAll(Executor &executor, std::vector<Task<void>> tasks);
+
+namespace coro_detail
+{
+
+// A coroutine that starts at once and frees itself when it finishes,
+// used to run a task that nobody awaits.
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+
+// The promises are moved into the coroutine frame, so the waiting thread
+// may return as soon as they are set.
+template <typename T>
+Detached runAndSignal(Executor &executor, Task<T> task,
+                      std::promise<T> result, std::promise<void> done)
+{
+    co_await executor.schedule();
+    try
+    {
+        if constexpr (std::is_void<T>::value)
+        {
+            co_await task;
+            result.set_value();
+        }
+        else
+        {
+            result.set_value(co_await task);
+        }
+    }
+    catch (...)
+    {
+        result.set_exception(std::current_exception());
+    }
+    done.set_value();
+}
+
+} // namespace coro_detail
+
+template <typename T>
+T Executor::syncWait(Task<T> task)
+{
+    std::promise<T> result;
+    std::promise<void> done;
+    std::future<T> resultFuture = result.get_future();
+    std::future<void> doneFuture = done.get_future();
+
+    coro_detail::runAndSignal(*this, std::move(task), std::move(result),
+                              std::move(done));
+    waitFor(doneFuture);
+    return resultFuture.get();
+}
+
+#endif // CORO_EXECUTOR_H
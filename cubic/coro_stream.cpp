@@ -0,0 +1,179 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "coro_stream.h"
+#include "cubic_exception.h"
+
+namespace CubicPB = cobaltspeech::cubic;
+
+CoroRecognizerStream::CoroRecognizerStream(
+    AsyncCubicClient &client, Executor &executor,
+    const CubicPB::RecognitionConfig &config, size_t maxQueuedBytes)
+    : mState(std::make_shared<State>())
+{
+    mState->executor = &executor;
+    mState->maxQueuedBytes = maxQueuedBytes;
+
+    // The callbacks run on completion queue threads. Each one hands any
+    // waiting coroutine back to the executor rather than resuming it
+    // there, so coroutines only ever run on their executor.
+    std::shared_ptr<State> state = mState;
+    mState->stream = client.streamingRecognize(
+        config,
+        [state](const CubicPB::RecognitionResponse &resp) {
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->results.push_back(resp);
+                std::swap(waiter, state->resultWaiter);
+            }
+            if (waiter)
+            {
+                state->executor->post(waiter);
+            }
+        },
+        [state](const grpc::Status &status) {
+            std::coroutine_handle<> resultWaiter, pushWaiter;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done = true;
+                state->status = status;
+                std::swap(resultWaiter, state->resultWaiter);
+                std::swap(pushWaiter, state->pushWaiter);
+            }
+            if (resultWaiter)
+            {
+                state->executor->post(resultWaiter);
+            }
+            if (pushWaiter)
+            {
+                state->executor->post(pushWaiter);
+            }
+        },
+        [state](size_t queuedBytes) {
+            if (queuedBytes > state->maxQueuedBytes)
+            {
+                return;
+            }
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                std::swap(waiter, state->pushWaiter);
+            }
+            if (waiter)
+            {
+                state->executor->post(waiter);
+            }
+        });
+}
+
+CoroRecognizerStream::~CoroRecognizerStream()
+{
+    mState->stream->cancel();
+}
+
+CoroRecognizerStream::PushAwaiter
+CoroRecognizerStream::push(const char *audioData, size_t sizeInBytes)
+{
+    mState->stream->pushAudio(audioData, sizeInBytes);
+    PushAwaiter awaiter;
+    awaiter.mState = mState.get();
+    return awaiter;
+}
+
+CoroRecognizerStream::PushAwaiter
+CoroRecognizerStream::push(const std::string &audio)
+{
+    return push(audio.data(), audio.size());
+}
+
+void CoroRecognizerStream::audioFinished()
+{
+    mState->stream->audioFinished();
+}
+
+CoroRecognizerStream::ResultAwaiter CoroRecognizerStream::nextResult()
+{
+    ResultAwaiter awaiter;
+    awaiter.mState = mState.get();
+    return awaiter;
+}
+
+void CoroRecognizerStream::close()
+{
+    std::lock_guard<std::mutex> lock(mState->mutex);
+    if (!mState->done)
+    {
+        throw CubicException("close() called before the stream ended");
+    }
+    if (!mState->status.ok())
+    {
+        throw CubicException(mState->status.error_message());
+    }
+}
+
+bool CoroRecognizerStream::PushAwaiter::await_ready()
+{
+    return mState->stream->queuedBytes() <= mState->maxQueuedBytes;
+}
+
+bool CoroRecognizerStream::PushAwaiter::await_suspend(
+    std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lock(mState->mutex);
+
+    // Check again now that the write callback can't miss us; returning
+    // false resumes the coroutine straight away.
+    if (mState->done ||
+        mState->stream->queuedBytes() <= mState->maxQueuedBytes)
+    {
+        return false;
+    }
+    mState->pushWaiter = h;
+    return true;
+}
+
+bool CoroRecognizerStream::ResultAwaiter::await_ready()
+{
+    std::lock_guard<std::mutex> lock(mState->mutex);
+    return !mState->results.empty() || mState->done;
+}
+
+bool CoroRecognizerStream::ResultAwaiter::await_suspend(
+    std::coroutine_handle<> h)
+{
+    std::lock_guard<std::mutex> lock(mState->mutex);
+    if (!mState->results.empty() || mState->done)
+    {
+        return false;
+    }
+    mState->resultWaiter = h;
+    return true;
+}
+
+std::optional<CubicPB::RecognitionResponse>
+CoroRecognizerStream::ResultAwaiter::await_resume()
+{
+    std::lock_guard<std::mutex> lock(mState->mutex);
+    if (mState->results.empty())
+    {
+        return std::nullopt;
+    }
+    std::optional<CubicPB::RecognitionResponse> resp(
+        std::move(mState->results.front()));
+    mState->results.pop_front();
+    return resp;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CORO_STREAM_H
+#define CORO_STREAM_H
+
+#include "async_cubic_client.h"
+#include "coro_executor.h"
+
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+/*
+ * CoroRecognizerStream is a streaming recognition call for coroutines.
+ * It is built on AsyncCubicClient, so no thread ever blocks on the
+ * network: a coroutine pushing audio or waiting for a result is
+ * suspended, and is resumed on its executor when the call can go on.
+ *
+ *     Task<void> sendAudio(CoroRecognizerStream &stream, ...)
+ *     {
+ *         for (...)
+ *         {
+ *             co_await stream.push(chunk, size);
+ *         }
+ *         stream.audioFinished();
+ *     }
+ *
+ *     Task<void> printResults(CoroRecognizerStream &stream)
+ *     {
+ *         while (auto resp = co_await stream.nextResult())
+ *         {
+ *             ...
+ *         }
+ *         stream.close();
+ *     }
+ *
+ * push() only suspends when more than maxQueuedBytes of audio are
+ * waiting to be sent, so a coroutine that produces audio faster than
+ * the connection takes it is held back instead of queueing without
+ * limit. At most one coroutine may wait in push() and one in
+ * nextResult() at a time.
+ *
+ * This needs C++20.
+ */
+class CoroRecognizerStream
+{
+public:
+    CoroRecognizerStream(AsyncCubicClient &client, Executor &executor,
+                         const cobaltspeech::cubic::RecognitionConfig &config,
+                         size_t maxQueuedBytes = 64 * 1024);
+
+    // Cancels the call if it is still running.
+    ~CoroRecognizerStream();
+
+    CoroRecognizerStream(const CoroRecognizerStream &) = delete;
+    CoroRecognizerStream &operator=(const CoroRecognizerStream &) = delete;
+
+private:
+    // State shared with the stream's callbacks, which may outlive this
+    // object until the call ends.
+    struct State
+    {
+        Executor *executor;
+        size_t maxQueuedBytes;
+        std::shared_ptr<AsyncRecognizerStream> stream;
+
+        std::mutex mutex;
+        std::deque<cobaltspeech::cubic::RecognitionResponse> results;
+        bool done = false;
+        grpc::Status status;
+        std::coroutine_handle<> resultWaiter;
+        std::coroutine_handle<> pushWaiter;
+    };
+
+public:
+    class PushAwaiter
+    {
+    public:
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> h);
+        void await_resume() {}
+
+    private:
+        friend class CoroRecognizerStream;
+        State *mState;
+    };
+
+    class ResultAwaiter
+    {
+    public:
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> h);
+        std::optional<cobaltspeech::cubic::RecognitionResponse> await_resume();
+
+    private:
+        friend class CoroRecognizerStream;
+        State *mState;
+    };
+
+    /*
+     * Queue a copy of the audio to be sent. Awaiting the result suspends
+     * the coroutine until the queue is back under maxQueuedBytes (or the
+     * call has ended).
+     */
+    PushAwaiter push(const char *audioData, size_t sizeInBytes);
+    PushAwaiter push(const std::string &audio);
+
+    // Let Cubic know that no more audio will be pushed.
+    void audioFinished();
+
+    /*
+     * Awaiting the result gives the next response from Cubic, or nothing
+     * once the call has ended.
+     */
+    ResultAwaiter nextResult();
+
+    /*
+     * Call once nextResult() has given nothing. Throws a CubicException
+     * if the call failed.
+     */
+    void close();
+
+private:
+    std::shared_ptr<State> mState;
+};
+
+#endif // CORO_STREAM_H
@@ -0,0 +1,184 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+ * Task<T> is the return type of a coroutine that produces a T (or
+ * nothing, for Task<void>). Tasks are lazy: the coroutine does not start
+ * until the task is awaited, and when it finishes the awaiting coroutine
+ * is resumed on the same thread. Exceptions thrown by the coroutine are
+ * rethrown from co_await.
+ *
+ * A task is owned by whoever holds it, and destroying a task that has
+ * not finished destroys its coroutine. To run a task without awaiting
+ * it, hand it to Executor::spawn() or syncWait() (see coro_executor.h).
+ *
+ * This needs C++20.
+ */
+template <typename T>
+class Task;
+
+namespace coro_detail
+{
+
+// The parts of the promise shared by Task<T> and Task<void>.
+class PromiseBase
+{
+public:
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // When the coroutine finishes, transfer straight to whichever
+    // coroutine was awaiting it, without growing the stack.
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            std::coroutine_handle<> next = h.promise().mContinuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { mError = std::current_exception(); }
+
+    void setContinuation(std::coroutine_handle<> h) { mContinuation = h; }
+
+protected:
+    std::coroutine_handle<> mContinuation;
+    std::exception_ptr mError;
+
+    void rethrowIfFailed()
+    {
+        if (mError)
+        {
+            std::rethrow_exception(mError);
+        }
+    }
+};
+
+template <typename T>
+class Promise : public PromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    void return_value(T value) { mValue.emplace(std::move(value)); }
+
+    T result()
+    {
+        rethrowIfFailed();
+        return std::move(*mValue);
+    }
+
+private:
+    std::optional<T> mValue;
+};
+
+template <>
+class Promise<void> : public PromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() { rethrowIfFailed(); }
+};
+
+} // namespace coro_detail
+
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = coro_detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(Handle h) : mHandle(h) {}
+
+    Task(Task &&other) noexcept : mHandle(std::exchange(other.mHandle, {})) {}
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            mHandle = std::exchange(other.mHandle, {});
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() { reset(); }
+
+    // Awaiting a task starts it and resumes the caller when it is done.
+    bool await_ready() const noexcept { return !mHandle || mHandle.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        mHandle.promise().setContinuation(caller);
+        return mHandle;
+    }
+
+    T await_resume() { return mHandle.promise().result(); }
+
+private:
+    Handle mHandle;
+
+    void reset()
+    {
+        if (mHandle)
+        {
+            mHandle.destroy();
+            mHandle = {};
+        }
+    }
+};
+
+namespace coro_detail
+{
+
+template <typename T>
+Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace coro_detail
+
+#endif // CORO_TASK_H
@@ -0,0 +1,161 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_client.h"
+#include "cubic_exception.h"
+#include "async_cubic_client.h"
+#include "audio_file.h"
+#include "audio_pacer.h"
+#include "coro_executor.h"
+#include "coro_stream.h"
+#include "coro_task.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "wav_header.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+// Some useful variables to define the client configuration
+const std::string serverAddress = "localhost:2727";
+const std::string filename = "test.wav";
+
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The audio file is replayed at this multiple of real time, as if it
+// were being recorded live.
+const double replaySpeed = 1.0;
+
+// The number of streams to run at once, each replaying the file. All of
+// them run on the one thread that calls syncWait().
+const int numStreams = 4;
+
+// Pushes the audio at the rate it would be recorded. Between chunks the
+// coroutine is suspended, leaving the thread free for the other streams.
+Task<void> sendAudio(Executor &executor, CoroRecognizerStream &stream,
+                     const AudioFile &audio, const WavFormat &format,
+                     const AudioPacer &pacer) {
+    // The header holds no audio, so it is sent right away
+    co_await stream.push(audio.data(), format.dataOffset);
+
+    const size_t chunkSize = 8192;
+    for (size_t pos = format.dataOffset; pos < audio.size(); pos += chunkSize) {
+        size_t n = std::min(chunkSize, audio.size() - pos);
+        co_await executor.sleepUntil(
+            pacer.releaseTime(pos + n - format.dataOffset));
+        co_await stream.push(audio.data() + pos, n);
+    }
+
+    // Let Cubic know that no more audio will be coming
+    stream.audioFinished();
+}
+
+// Prints the final results as they come.
+Task<void> printResults(CoroRecognizerStream &stream, int id) {
+    while (auto resp = co_await stream.nextResult()) {
+        for (const CubicPB::RecognitionResult &result : resp->results()) {
+            if (!result.is_partial() && result.alternatives_size() > 0) {
+                std::cout << "[" << id << "] "
+                          << result.alternatives(0).transcript() << std::endl;
+            }
+        }
+    }
+
+    stream.close();
+}
+
+// Streams the file, sending audio and reading results concurrently.
+Task<void> transcribe(AsyncCubicClient &client, Executor &executor,
+                      const CubicPB::RecognitionConfig &cfg, int id) {
+    AudioFile audio(filename, AudioFile::Sequential);
+    WavFormat format;
+    if (!parseWavHeader(audio.data(), audio.size(), &format)) {
+        throw std::runtime_error(filename + " is not a valid WAV file");
+    }
+    AudioPacer pacer(format.bytesPerSecond(), replaySpeed);
+    pacer.start();
+
+    CoroRecognizerStream stream(client, executor, cfg);
+
+    std::vector<Task<void>> tasks;
+    tasks.push_back(sendAudio(executor, stream, audio, format, pacer));
+    tasks.push_back(printResults(stream, id));
+    co_await whenAll(executor, std::move(tasks));
+}
+
+/*
+ * This client demonstrates streaming recognition with C++20 coroutines.
+ * Instead of a thread to push audio and another blocked reading results
+ * for each stream, every stream is a pair of coroutines, and all of them
+ * share a single thread (plus one gRPC completion queue thread).
+ */
+int main(int argc, char *argv[]) {
+    try {
+        // Create the client (note this is an insecure connection,
+        // which is not recommended for production).
+        CubicClient client(serverAddress);
+
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
+        // Display the Cubic version
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
+        std::cout << "Connected to " << serverAddress << std::endl;
+        std::cout << std::endl;
+
+        // Use the first model to set up the recognition config
+        const std::vector<CubicModel> &models = startup.models();
+        if (models.empty()) {
+            throw std::runtime_error("server has no models");
+        }
+        CubicPB::RecognitionConfig cfg;
+        cfg.set_model_id(models[0].id());
+        cfg.set_audio_encoding(CubicPB::RecognitionConfig::WAV);
+
+        // Run every stream on this thread until they have all finished
+        AsyncCubicClient asyncClient(serverAddress);
+        SingleThreadExecutor executor;
+
+        std::cout << "Transcripts:" << std::endl;
+        std::vector<Task<void>> streams;
+        for (int i = 0; i < numStreams; i++) {
+            streams.push_back(transcribe(asyncClient, executor, cfg, i));
+        }
+        executor.syncWait(whenAll(executor, std::move(streams)));
+
+    } catch (CubicException &e) {
+        std::cerr << "Cubic error: " << e.what() << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    std::cout << "\nDone." << std::endl;
+}
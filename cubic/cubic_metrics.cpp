@@ -0,0 +1,186 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_metrics.h"
+
+#include <cmath>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+const char *rpcNames[CubicMetrics::NumRpcs] = {
+    "recognize",
+    "compile_context"
+};
+
+uint64_t toMicros(CubicMetrics::Clock::duration d)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    return us > 0 ? static_cast<uint64_t>(us) : 0;
+}
+
+double toSeconds(const google::protobuf::Duration &d)
+{
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+} // namespace
+
+CubicMetrics::CubicMetrics(MetricsRegistry &registry) :
+    mActiveStreams(registry.gauge("cubic_active_streams",
+                                  "Streaming recognition requests currently open.")),
+    mStreamsTotal(registry.counter("cubic_streams_total",
+                                   "Streaming recognition requests opened.")),
+    mStreamResumes(registry.counter("cubic_stream_resumes_total",
+                                    "Failed streams replaced by a new stream.")),
+    mBytesPushed(registry.counter("cubic_audio_bytes_pushed_total",
+                                  "Bytes of audio pushed to streams.")),
+    mPushBytes(registry.histogram("cubic_push_audio_bytes",
+                                  "Size of each pushAudio() call in bytes.")),
+    mPushDuration(registry.histogram("cubic_push_audio_duration_seconds",
+                                     "Time taken by each pushAudio() call.",
+                                     "", 1e-6)),
+    mTimeToFirstPartial(registry.histogram(
+        "cubic_time_to_first_partial_seconds",
+        "Time from the first audio pushed to the first partial result.",
+        "", 1e-6)),
+    mPartialLatency(registry.histogram(
+        "cubic_result_latency_seconds",
+        "Time from pushing the end of a result's audio to receiving it.",
+        "result=\"partial\"", 1e-6)),
+    mFinalLatency(registry.histogram(
+        "cubic_result_latency_seconds",
+        "Time from pushing the end of a result's audio to receiving it.",
+        "result=\"final\"", 1e-6))
+{
+    for (int i = 0; i < NumRpcs; i++)
+    {
+        std::string labels = std::string("method=\"") + rpcNames[i] + "\"";
+        mRpcDuration[i] = &registry.histogram("cubic_rpc_duration_seconds",
+                                              "Time taken by unary Cubic calls.",
+                                              labels, 1e-6);
+        mRpcErrors[i] = &registry.counter("cubic_rpc_errors_total",
+                                          "Unary Cubic calls that failed.",
+                                          labels);
+    }
+}
+
+CubicMetrics::Stream::Stream(CubicMetrics &metrics, double bytesPerSecond,
+                             size_t headerBytes) :
+    mMetrics(metrics),
+    mActive(metrics.mActiveStreams),
+    mBytesPerSecond(bytesPerSecond),
+    mHeaderBytes(headerBytes),
+    mPushTimes(maxPushTimes),
+    mHead(0),
+    mTail(0),
+    mBytesPushed(0),
+    mHaveFirstPush(false),
+    mHavePartial(false)
+{
+    mMetrics.mStreamsTotal.add();
+}
+
+CubicMetrics::Stream::~Stream()
+{}
+
+void CubicMetrics::Stream::pushed(size_t numBytes, Clock::time_point start)
+{
+    Clock::time_point now = Clock::now();
+    mMetrics.mBytesPushed.add(numBytes);
+    mMetrics.mPushBytes.record(numBytes);
+    mMetrics.mPushDuration.record(toMicros(now - start));
+
+    if (!mHaveFirstPush.load(std::memory_order_relaxed))
+    {
+        mFirstPush = start;
+        mHaveFirstPush.store(true, std::memory_order_release);
+    }
+    mBytesPushed += numBytes;
+    if (mBytesPushed <= mHeaderBytes)
+    {
+        return;
+    }
+
+    // When the ring is full this push is not recorded. A result ending
+    // in it is then matched with a later push instead.
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load(std::memory_order_acquire) == mPushTimes.size())
+    {
+        return;
+    }
+    PushTime &entry = mPushTimes[tail % mPushTimes.size()];
+    entry.endByte = mBytesPushed - mHeaderBytes;
+    entry.time = now;
+    mTail.store(tail + 1, std::memory_order_release);
+}
+
+void CubicMetrics::Stream::received(const CubicPB::RecognitionResponse &response)
+{
+    Clock::time_point now = Clock::now();
+
+    size_t head = mHead.load(std::memory_order_relaxed);
+    size_t tail = mTail.load(std::memory_order_acquire);
+    for (const CubicPB::RecognitionResult &result : response.results())
+    {
+        if (result.is_partial() && !mHavePartial &&
+            mHaveFirstPush.load(std::memory_order_acquire))
+        {
+            mMetrics.mTimeToFirstPartial.record(toMicros(now - mFirstPush));
+            mHavePartial = true;
+        }
+        if (result.alternatives_size() == 0 || mBytesPerSecond <= 0)
+        {
+            continue;
+        }
+
+        // Find the push that delivered the end of the result's audio
+        const CubicPB::RecognitionAlternative &alt = result.alternatives(0);
+        double endSec = toSeconds(alt.start_time()) + toSeconds(alt.duration());
+        uint64_t endByte = static_cast<uint64_t>(std::ceil(endSec * mBytesPerSecond));
+        size_t i = head;
+        while (i != tail && mPushTimes[i % mPushTimes.size()].endByte < endByte)
+        {
+            ++i;
+        }
+        if (i == tail)
+        {
+            continue;
+        }
+
+        uint64_t latency = toMicros(now - mPushTimes[i % mPushTimes.size()].time);
+        if (result.is_partial())
+        {
+            mMetrics.mPartialLatency.record(latency);
+        }
+        else
+        {
+            mMetrics.mFinalLatency.record(latency);
+
+            // Later results end after this one, so earlier pushes are
+            // no longer needed.
+            head = i;
+            mHead.store(head, std::memory_order_release);
+        }
+    }
+}
+
+void CubicMetrics::Stream::resumed()
+{
+    mMetrics.mStreamResumes.add();
+}
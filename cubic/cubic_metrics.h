@@ -0,0 +1,163 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CUBIC_METRICS_H
+#define CUBIC_METRICS_H
+
+#include "cubic.pb.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * CubicMetrics records how a client's requests to Cubic perform, in a
+ * MetricsRegistry (see metrics.h):
+ *
+ *     cubic_rpc_duration_seconds{method}   time taken by each unary call
+ *     cubic_rpc_errors_total{method}       calls that failed
+ *     cubic_active_streams                 streams currently open
+ *     cubic_streams_total                  streams opened
+ *     cubic_stream_resumes_total           failed streams replaced
+ *     cubic_audio_bytes_pushed_total       audio sent on all streams
+ *     cubic_push_audio_bytes               size of each pushAudio() call
+ *     cubic_push_audio_duration_seconds    time taken by pushAudio()
+ *     cubic_time_to_first_partial_seconds  from the first audio pushed
+ *                                          to the first partial result
+ *     cubic_result_latency_seconds{result} from when the audio a result
+ *                                          ends with was pushed, to when
+ *                                          the result arrived
+ *
+ * The clients report streams through a CubicMetrics::Stream, and time
+ * unary calls with timeRpc(). All of this is safe to use from any thread.
+ */
+class CubicMetrics
+{
+public:
+    enum Rpc
+    {
+        Recognize,
+        CompileContext,
+        NumRpcs
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit CubicMetrics(MetricsRegistry &registry);
+
+    /*
+     * Call func(), recording how long it took and counting it as an
+     * error if it throws. Returns what func() returns.
+     */
+    template <typename Func>
+    auto timeRpc(Rpc rpc, Func func) -> decltype(func());
+
+    /*
+     * Stream tracks one streaming recognition request, counting it as
+     * active for as long as it exists. bytesPerSecond is the rate of the
+     * pushed audio, which is used to find when the audio a result ends
+     * with was pushed; the first headerBytes pushed (such as a WAV
+     * header) are not audio. Call pushed() from the thread pushing audio
+     * and received() from the thread reading results.
+     *
+     * Neither call takes a lock. The push times are kept in a fixed
+     * ring with one writer and one reader, so if results stop arriving
+     * for long enough that it fills up, later pushes are not recorded
+     * until a final result frees some space, and latencies measured
+     * against them read low.
+     */
+    class Stream
+    {
+    public:
+        Stream(CubicMetrics &metrics, double bytesPerSecond,
+               size_t headerBytes = 0);
+        ~Stream();
+
+        // Record a pushAudio() call of numBytes that started at start.
+        void pushed(size_t numBytes, Clock::time_point start);
+
+        // Record the results in a response as they arrive.
+        void received(const cobaltspeech::cubic::RecognitionResponse &response);
+
+        // Record that the stream failed and was replaced.
+        void resumed();
+
+    private:
+        CubicMetrics &mMetrics;
+        ScopedGauge mActive;
+        double mBytesPerSecond;
+        size_t mHeaderBytes;
+
+        // When each byte offset of audio was pushed, dropped once a
+        // final result covers it. Entries [mHead, mTail) are in use;
+        // pushed() only moves mTail and received() only moves mHead.
+        struct PushTime
+        {
+            uint64_t endByte;
+            Clock::time_point time;
+        };
+        static const size_t maxPushTimes = 4096;
+        std::vector<PushTime> mPushTimes;
+        std::atomic<size_t> mHead;
+        std::atomic<size_t> mTail;
+
+        // Only used by pushed()
+        uint64_t mBytesPushed;
+
+        // mFirstPush is written once, before mHaveFirstPush is set
+        std::atomic<bool> mHaveFirstPush;
+        Clock::time_point mFirstPush;
+
+        // Only used by received()
+        bool mHavePartial;
+
+        Stream(const Stream &) = delete;
+        Stream &operator=(const Stream &) = delete;
+    };
+
+private:
+    Histogram *mRpcDuration[NumRpcs];
+    Counter *mRpcErrors[NumRpcs];
+    Gauge &mActiveStreams;
+    Counter &mStreamsTotal;
+    Counter &mStreamResumes;
+    Counter &mBytesPushed;
+    Histogram &mPushBytes;
+    Histogram &mPushDuration;
+    Histogram &mTimeToFirstPartial;
+    Histogram &mPartialLatency;
+    Histogram &mFinalLatency;
+};
+
+template <typename Func>
+auto CubicMetrics::timeRpc(Rpc rpc, Func func) -> decltype(func())
+{
+    ScopedTimer timer(*mRpcDuration[rpc]);
+    try
+    {
+        return func();
+    }
+    catch (...)
+    {
+        mRpcErrors[rpc]->add();
+        throw;
+    }
+}
+
+#endif // CUBIC_METRICS_H
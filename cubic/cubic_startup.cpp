@@ -0,0 +1,181 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_startup.h"
+
+namespace CubicPB = cobaltspeech::cubic;
+
+CubicStartup::CubicStartup(CubicClient &client,
+                           const std::string &serverAddress,
+                           MetadataCache *cache)
+    : mClient(client), mCache(cache), mVersionKey("cubic/version/" + serverAddress),
+      mModelsKey("cubic/models/" + serverAddress), mHaveVersions(false),
+      mHaveModels(false), mModelsCached(false)
+{
+    std::string data;
+
+    CubicPB::VersionResponse version;
+    if (mCache && mCache->load(mVersionKey, &data) &&
+        version.ParseFromString(data))
+    {
+        mCubicVersion = version.cubic();
+        mServerVersion = version.server();
+        mHaveVersions = true;
+    }
+    else
+    {
+        requestVersions();
+    }
+
+    CubicPB::ListModelsResponse modelList;
+    if (mCache && mCache->load(mModelsKey, &data) &&
+        modelList.ParseFromString(data))
+    {
+        for (const CubicPB::Model &model : modelList.models())
+        {
+            mModels.push_back(CubicModel(model));
+        }
+        mHaveModels = true;
+        mModelsCached = true;
+    }
+    else
+    {
+        requestModels();
+    }
+}
+
+CubicStartup::~CubicStartup()
+{
+    // Replies nobody asked for are discarded, along with their errors.
+    if (mCubicVersionReply.valid())
+    {
+        mCubicVersionReply.wait();
+    }
+    if (mServerVersionReply.valid())
+    {
+        mServerVersionReply.wait();
+    }
+    if (mModelsReply.valid())
+    {
+        mModelsReply.wait();
+    }
+}
+
+const std::string &CubicStartup::cubicVersion()
+{
+    waitForVersions();
+    return mCubicVersion;
+}
+
+const std::string &CubicStartup::serverVersion()
+{
+    waitForVersions();
+    return mServerVersion;
+}
+
+const std::vector<CubicModel> &CubicStartup::models()
+{
+    if (mHaveModels)
+    {
+        return mModels;
+    }
+
+    // A reply that threw can't be read again, so a failed request is
+    // sent again rather than waited on.
+    if (!mModelsReply.valid())
+    {
+        requestModels();
+    }
+    mModels = mModelsReply.get();
+    mHaveModels = true;
+
+    if (mCache)
+    {
+        // CubicModel does not keep the message it was made from, so it
+        // is rebuilt here to be cached.
+        CubicPB::ListModelsResponse modelList;
+        for (const CubicModel &m : mModels)
+        {
+            CubicPB::Model *model = modelList.add_models();
+            model->set_id(m.id());
+            model->set_name(m.name());
+
+            CubicPB::ModelAttributes *attrs = model->mutable_attributes();
+            attrs->set_sample_rate(m.sampleRate());
+
+            CubicPB::ContextInfo *info = attrs->mutable_context_info();
+            info->set_supports_context(m.supportsContext());
+            for (const std::string &token : m.allowedContextTokens())
+            {
+                info->add_allowed_context_tokens(token);
+            }
+        }
+        mCache->store(mModelsKey, modelList.SerializeAsString());
+    }
+
+    return mModels;
+}
+
+bool CubicStartup::modelsCached() const
+{
+    return mModelsCached;
+}
+
+void CubicStartup::requestVersions()
+{
+    // The SDK sends a separate Version request for each of these.
+    if (!mCubicVersionReply.valid())
+    {
+        mCubicVersionReply = std::async(std::launch::async, [this]() {
+            return mClient.cubicVersion();
+        });
+    }
+    if (!mServerVersionReply.valid())
+    {
+        mServerVersionReply = std::async(std::launch::async, [this]() {
+            return mClient.serverVersion();
+        });
+    }
+}
+
+void CubicStartup::requestModels()
+{
+    mModelsReply = std::async(std::launch::async, [this]() {
+        return mClient.listModels();
+    });
+}
+
+void CubicStartup::waitForVersions()
+{
+    if (mHaveVersions)
+    {
+        return;
+    }
+
+    // As in models(), replies that failed are requested again.
+    requestVersions();
+    mCubicVersion = mCubicVersionReply.get();
+    mServerVersion = mServerVersionReply.get();
+    mHaveVersions = true;
+
+    if (mCache)
+    {
+        CubicPB::VersionResponse version;
+        version.set_cubic(mCubicVersion);
+        version.set_server(mServerVersion);
+        mCache->store(mVersionKey, version.SerializeAsString());
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CUBIC_STARTUP_H
+#define CUBIC_STARTUP_H
+
+#include "cubic_client.h"
+#include "metadata_cache.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+/*
+ * CubicStartup gets the information the examples need before they can
+ * start recognizing: the Cubic and server versions and the list of
+ * models (with their sample rates and allowed context tokens). Rather
+ * than asking for each in turn, it sends all of the requests at once
+ * when it is created, and only waits for a reply when that piece of
+ * information is first used.
+ *
+ * If a MetadataCache is given, replies are stored in it and unexpired
+ * entries are used instead of sending the request at all, so a process
+ * started with a warm cache sends no requests here; its first request
+ * is the recognition itself.
+ *
+ * The methods are not safe to call from multiple threads at once.
+ */
+class CubicStartup
+{
+public:
+    CubicStartup(CubicClient &client, const std::string &serverAddress,
+                 MetadataCache *cache = nullptr);
+
+    // Waits for any requests still in flight.
+    ~CubicStartup();
+
+    CubicStartup(const CubicStartup &) = delete;
+    CubicStartup &operator=(const CubicStartup &) = delete;
+
+    /*
+     * Each of these waits for its reply if it has not already arrived,
+     * and throws a CubicException if the request failed. Calling it
+     * again after a failure sends the request again.
+     */
+    const std::string &cubicVersion();
+    const std::string &serverVersion();
+    const std::vector<CubicModel> &models();
+
+    // Returns true if the model list came from the cache.
+    bool modelsCached() const;
+
+private:
+    CubicClient &mClient;
+    MetadataCache *mCache;
+    std::string mVersionKey;
+    std::string mModelsKey;
+
+    std::future<std::string> mCubicVersionReply;
+    std::future<std::string> mServerVersionReply;
+    std::future<std::vector<CubicModel>> mModelsReply;
+
+    bool mHaveVersions;
+    std::string mCubicVersion;
+    std::string mServerVersion;
+    bool mHaveModels;
+    bool mModelsCached;
+    std::vector<CubicModel> mModels;
+
+    void requestVersions();
+    void requestModels();
+    void waitForVersions();
+};
+
+#endif // CUBIC_STARTUP_H
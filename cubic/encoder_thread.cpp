@@ -0,0 +1,134 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "encoder_thread.h"
+
+#include <time.h>
+
+namespace
+{
+
+double threadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // namespace
+
+EncoderThread::EncoderThread(FlacEncoder &encoder, Sink sink)
+    : mEncoder(encoder), mSink(sink), mFinished(false), mCpuSeconds(0),
+      mError(nullptr)
+{
+    mThread = std::thread(&EncoderThread::run, this);
+}
+
+EncoderThread::~EncoderThread()
+{
+    stop();
+}
+
+void EncoderThread::push(const char *audio, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.emplace_back(audio, size);
+    }
+    mCond.notify_one();
+}
+
+void EncoderThread::finish()
+{
+    stop();
+    if (mError)
+    {
+        std::rethrow_exception(mError);
+    }
+}
+
+void EncoderThread::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinished = true;
+    }
+    mCond.notify_one();
+
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+}
+
+double EncoderThread::cpuSeconds() const
+{
+    return mCpuSeconds;
+}
+
+void EncoderThread::run()
+{
+    std::string encoded;
+    while (true)
+    {
+        std::string audio;
+        bool last = false;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [this]() { return mFinished || !mQueue.empty(); });
+            if (!mQueue.empty())
+            {
+                audio.swap(mQueue.front());
+                mQueue.pop_front();
+            }
+            else
+            {
+                last = true;
+            }
+        }
+
+        double start = threadCpuSeconds();
+        encoded.clear();
+        if (last)
+        {
+            mEncoder.finish(&encoded);
+        }
+        else
+        {
+            mEncoder.encode(audio.data(), audio.size(), &encoded);
+        }
+        mCpuSeconds += threadCpuSeconds() - start;
+
+        // Once the sink fails, the rest of the audio is still consumed
+        // so push() never blocks, but nothing more is sent.
+        if (!encoded.empty() && !mError)
+        {
+            try
+            {
+                mSink(encoded.data(), encoded.size());
+            }
+            catch (...)
+            {
+                mError = std::current_exception();
+            }
+        }
+
+        if (last)
+        {
+            return;
+        }
+    }
+}
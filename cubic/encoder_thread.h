@@ -0,0 +1,75 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ENCODER_THREAD_H
+#define ENCODER_THREAD_H
+
+#include "flac_encoder.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * EncoderThread compresses audio with a FlacEncoder on its own thread,
+ * so that the thread capturing or reading the audio never waits for the
+ * encoder. Each batch of encoded frames is handed to the sink, which
+ * normally pushes it to a Cubic stream.
+ */
+class EncoderThread
+{
+public:
+    using Sink = std::function<void(const char *data, size_t size)>;
+
+    EncoderThread(FlacEncoder &encoder, Sink sink);
+    ~EncoderThread();
+
+    // Queue a copy of the given audio to be encoded.
+    void push(const char *audio, size_t size);
+
+    /*
+     * Encode the rest of the queued audio, send the end of the FLAC
+     * stream to the sink, and wait for the thread to exit. If the sink
+     * threw an exception, it is rethrown here.
+     */
+    void finish();
+
+    // Returns the CPU time the thread spent encoding, in seconds. This
+    // is only complete after finish() returns.
+    double cpuSeconds() const;
+
+private:
+    FlacEncoder &mEncoder;
+    Sink mSink;
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::string> mQueue;
+    bool mFinished;
+    double mCpuSeconds;
+    std::exception_ptr mError;
+
+    std::thread mThread;
+
+    void run();
+    void stop();
+};
+
+#endif // ENCODER_THREAD_H
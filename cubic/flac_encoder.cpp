@@ -0,0 +1,433 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flac_encoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace
+{
+
+const unsigned int bitsPerSample = 16;
+const int maxFixedOrder = 4;
+const int maxPartitionOrder = 8;
+const uint32_t maxRiceParam = 14;
+
+// Writes values most significant bit first, as FLAC requires.
+class BitWriter
+{
+public:
+    BitWriter(std::string *out) : mOut(out), mAcc(0), mBits(0) {}
+
+    void write(uint32_t value, int numBits)
+    {
+        for (int shift = numBits - 8; shift > -8; shift -= 8)
+        {
+            int n = shift >= 0 ? 8 : 8 + shift;
+            uint32_t byte = shift >= 0 ? value >> shift : value;
+            append(byte & ((1u << n) - 1), n);
+        }
+    }
+
+    // Writes q zero bits followed by a one.
+    void writeUnary(uint32_t q)
+    {
+        for (; q >= 16; q -= 16)
+        {
+            append(0, 16);
+        }
+        append(1, q + 1);
+    }
+
+    // Pads with zero bits to the next byte boundary.
+    void align()
+    {
+        if (mBits > 0)
+        {
+            append(0, 8 - mBits);
+        }
+    }
+
+private:
+    std::string *mOut;
+    uint32_t mAcc;
+    int mBits;
+
+    void append(uint32_t value, int numBits)
+    {
+        mAcc = (mAcc << numBits) | value;
+        mBits += numBits;
+        while (mBits >= 8)
+        {
+            mBits -= 8;
+            mOut->push_back(char((mAcc >> mBits) & 0xFF));
+        }
+    }
+};
+
+uint8_t crc8(const char *data, size_t size)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= uint8_t(data[i]);
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x80) ? uint8_t((crc << 1) ^ 0x07) : uint8_t(crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint16_t crc16(const char *data, size_t size)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= uint16_t(uint8_t(data[i])) << 8;
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x8005) : uint16_t(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Maps signed residuals to unsigned values for Rice coding.
+inline uint32_t zigzag(int32_t v)
+{
+    return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+
+// Computes the residual of the fixed predictor of the given order for
+// samples [order, n).
+void fixedResidual(const int32_t *x, size_t n, int order, int32_t *res)
+{
+    for (size_t i = order; i < n; i++)
+    {
+        switch (order)
+        {
+        case 0:
+            res[i] = x[i];
+            break;
+        case 1:
+            res[i] = x[i] - x[i - 1];
+            break;
+        case 2:
+            res[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+            break;
+        case 3:
+            res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+            break;
+        default:
+            res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+            break;
+        }
+    }
+}
+
+// Picks the Rice parameter for a run of residuals and returns the bits
+// it takes to code them with it.
+uint64_t riceBits(const int32_t *res, size_t n, uint32_t *param)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += zigzag(res[i]);
+    }
+
+    uint32_t k = 0;
+    while (k < maxRiceParam && (uint64_t(n) << (k + 1)) < sum)
+    {
+        k++;
+    }
+
+    uint64_t bits = 4 + uint64_t(n) * (k + 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        bits += zigzag(res[i]) >> k;
+    }
+
+    *param = k;
+    return bits;
+}
+
+// Returns the bits needed to code the residual with 2^order partitions,
+// filling in the Rice parameter for each.
+uint64_t partitionBits(const int32_t *res, size_t n, int predOrder,
+                       int partOrder, std::vector<uint32_t> *params)
+{
+    size_t parts = size_t(1) << partOrder;
+    size_t partSize = n >> partOrder;
+    params->resize(parts);
+
+    uint64_t bits = 0;
+    for (size_t p = 0; p < parts; p++)
+    {
+        size_t start = p == 0 ? predOrder : p * partSize;
+        size_t end = (p + 1) * partSize;
+        bits += riceBits(res + start, end - start, &(*params)[p]);
+    }
+    return bits;
+}
+
+// Writes the UTF-8 style coded frame number used in frame headers.
+void writeFrameNumber(BitWriter &bw, uint32_t n)
+{
+    if (n < 0x80)
+    {
+        bw.write(n, 8);
+        return;
+    }
+
+    int extra = n < 0x800 ? 1 : n < 0x10000 ? 2 : n < 0x200000 ? 3 : n < 0x4000000 ? 4 : 5;
+    uint32_t lead = (0xFF00u >> (extra + 1)) & 0xFF;
+    bw.write(lead | (n >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; i--)
+    {
+        bw.write(0x80 | ((n >> (6 * i)) & 0x3F), 8);
+    }
+}
+
+} // namespace
+
+FlacEncoder::FlacEncoder(unsigned int sampleRate, size_t blockSize)
+    : mSampleRate(sampleRate), mBlockSize(blockSize), mHeaderWritten(false),
+      mFrameNumber(0), mBytesIn(0), mBytesOut(0)
+{
+    if (sampleRate == 0 || sampleRate >= (1u << 20))
+    {
+        throw std::invalid_argument("unsupported FLAC sample rate");
+    }
+    if (blockSize < 16 || blockSize > 65535)
+    {
+        throw std::invalid_argument("FLAC block size must be 16 to 65535");
+    }
+}
+
+FlacEncoder::~FlacEncoder() {}
+
+void FlacEncoder::encode(const char *audio, size_t size, std::string *out)
+{
+    size_t start = out->size();
+    mBytesIn += size;
+    if (!mHeaderWritten)
+    {
+        writeHeader(out);
+    }
+
+    const size_t blockBytes = 2 * mBlockSize;
+    if (!mPending.empty())
+    {
+        size_t n = std::min(size, blockBytes - mPending.size());
+        mPending.append(audio, n);
+        audio += n;
+        size -= n;
+        if (mPending.size() == blockBytes)
+        {
+            encodeBlock(mPending.data(), mBlockSize, out);
+            mPending.clear();
+        }
+    }
+
+    while (size >= blockBytes)
+    {
+        encodeBlock(audio, mBlockSize, out);
+        audio += blockBytes;
+        size -= blockBytes;
+    }
+
+    mPending.append(audio, size);
+    mBytesOut += out->size() - start;
+}
+
+void FlacEncoder::finish(std::string *out)
+{
+    size_t start = out->size();
+    if (!mHeaderWritten)
+    {
+        writeHeader(out);
+    }
+
+    // A trailing odd byte is half a sample, and cannot be sent.
+    size_t numSamples = mPending.size() / 2;
+    if (numSamples > 0)
+    {
+        encodeBlock(mPending.data(), numSamples, out);
+    }
+    mPending.clear();
+    mBytesOut += out->size() - start;
+}
+
+uint64_t FlacEncoder::bytesIn() const
+{
+    return mBytesIn;
+}
+
+uint64_t FlacEncoder::bytesOut() const
+{
+    return mBytesOut;
+}
+
+void FlacEncoder::writeHeader(std::string *out)
+{
+    out->append("fLaC");
+
+    // A single STREAMINFO block, marked as the last metadata block
+    BitWriter bw(out);
+    bw.write(1, 1);
+    bw.write(0, 7);
+    bw.write(34, 24);
+
+    bw.write(mBlockSize, 16);   // minimum block size
+    bw.write(mBlockSize, 16);   // maximum block size
+    bw.write(0, 24);            // minimum frame size (unknown)
+    bw.write(0, 24);            // maximum frame size (unknown)
+    bw.write(mSampleRate, 20);
+    bw.write(0, 3);             // channels - 1
+    bw.write(bitsPerSample - 1, 5);
+    bw.write(0, 4);             // total samples (unknown), top bits
+    bw.write(0, 32);
+    for (int i = 0; i < 4; i++)
+    {
+        bw.write(0, 32);        // MD5 signature (unset)
+    }
+
+    mHeaderWritten = true;
+}
+
+void FlacEncoder::encodeBlock(const char *audio, size_t n, std::string *out)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(audio);
+    mSamples.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        mSamples[i] = int16_t(p[2 * i] | (p[2 * i + 1] << 8));
+    }
+    const int32_t *x = mSamples.data();
+
+    size_t frameStart = out->size();
+    BitWriter bw(out);
+
+    // Frame header: sync code with fixed block size, an explicit 16-bit
+    // block size, and the sample rate, channels and sample size from
+    // STREAMINFO.
+    bw.write(0xFFF8, 16);
+    bw.write(7, 4);             // block size stored at the end of the header
+    bw.write(0, 4);             // sample rate from STREAMINFO
+    bw.write(0, 4);             // mono
+    bw.write(4, 3);             // 16 bits per sample
+    bw.write(0, 1);
+    writeFrameNumber(bw, mFrameNumber++);
+    bw.write(uint32_t(n - 1), 16);
+    bw.write(crc8(out->data() + frameStart, out->size() - frameStart), 8);
+
+    // A block of one repeated value (usually digital silence) is coded
+    // as a constant.
+    bool constant = std::all_of(x, x + n, [x](int32_t v) { return v == x[0]; });
+    if (constant)
+    {
+        bw.write(0, 8);
+        bw.write(uint32_t(x[0]) & 0xFFFF, bitsPerSample);
+    }
+    else
+    {
+        // Choose the fixed predictor with the smallest total residual
+        mResidual.resize(n);
+        int order = 0;
+        uint64_t bestSum = UINT64_MAX;
+        int maxOrder = std::min<int>(maxFixedOrder, int(n) - 1);
+        for (int o = 0; o <= maxOrder; o++)
+        {
+            fixedResidual(x, n, o, mResidual.data());
+            uint64_t sum = 0;
+            for (size_t i = maxOrder; i < n; i++)
+            {
+                sum += uint64_t(std::abs(int64_t(mResidual[i])));
+            }
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                order = o;
+            }
+        }
+        fixedResidual(x, n, order, mResidual.data());
+
+        // Then the partitioning of the residual that codes smallest
+        std::vector<uint32_t> params, bestParams;
+        int partOrder = 0;
+        uint64_t bestBits = UINT64_MAX;
+        for (int po = 0; po <= maxPartitionOrder; po++)
+        {
+            if ((n & ((size_t(1) << po) - 1)) != 0 || (n >> po) <= size_t(order))
+            {
+                break;
+            }
+            uint64_t bits = partitionBits(mResidual.data(), n, order, po, &params);
+            if (bits < bestBits)
+            {
+                bestBits = bits;
+                partOrder = po;
+                bestParams.swap(params);
+            }
+        }
+
+        uint64_t fixedBits = 8 + uint64_t(order) * bitsPerSample + 6 + bestBits;
+        if (fixedBits >= 8 + uint64_t(n) * bitsPerSample)
+        {
+            // Noise that does not compress is sent verbatim
+            bw.write(0x02, 8);
+            for (size_t i = 0; i < n; i++)
+            {
+                bw.write(uint32_t(x[i]) & 0xFFFF, bitsPerSample);
+            }
+        }
+        else
+        {
+            bw.write(0x10 | (order << 1), 8);
+            for (int i = 0; i < order; i++)
+            {
+                bw.write(uint32_t(x[i]) & 0xFFFF, bitsPerSample);
+            }
+
+            bw.write(0, 2);     // Rice coding with 4-bit parameters
+            bw.write(partOrder, 4);
+            size_t partSize = n >> partOrder;
+            for (size_t part = 0; part < bestParams.size(); part++)
+            {
+                uint32_t k = bestParams[part];
+                bw.write(k, 4);
+                size_t start = part == 0 ? order : part * partSize;
+                size_t end = (part + 1) * partSize;
+                for (size_t i = start; i < end; i++)
+                {
+                    uint32_t u = zigzag(mResidual[i]);
+                    bw.writeUnary(u >> k);
+                    if (k > 0)
+                    {
+                        bw.write(u & ((1u << k) - 1), k);
+                    }
+                }
+            }
+        }
+    }
+
+    bw.align();
+    uint16_t crc = crc16(out->data() + frameStart, out->size() - frameStart);
+    bw.write(crc, 16);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC_ENCODER_H
+#define FLAC_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * FlacEncoder compresses 16-bit mono RAW_LINEAR16 audio into a FLAC
+ * stream, so it can be sent to Cubic with the FLAC encoding using less
+ * bandwidth. It is a small streaming encoder rather than a full one:
+ * each block is coded with the best of FLAC's fixed predictors and
+ * partitioned Rice coding of the residual, which gets most of the
+ * compression of the reference encoder's faster settings without
+ * needing libFLAC.
+ *
+ * The stream header is written before the first frame. Since the
+ * length of the stream is not known in advance, the header leaves the
+ * total sample count and MD5 signature unset, as the format allows.
+ *
+ * Audio is held until a whole block is available, so the block size
+ * adds to the latency of the stream: 1024 samples is 64ms at 16kHz.
+ */
+class FlacEncoder
+{
+public:
+    FlacEncoder(unsigned int sampleRate, size_t blockSize = 1024);
+    ~FlacEncoder();
+
+    /*
+     * Encode the given audio, appending any complete frames to out.
+     * Audio that does not fill a block is held until the next call.
+     */
+    void encode(const char *audio, size_t size, std::string *out);
+
+    // Encode any held audio as a final, shorter block.
+    void finish(std::string *out);
+
+    // Returns the number of bytes of audio given to encode().
+    uint64_t bytesIn() const;
+
+    // Returns the number of bytes of FLAC data produced.
+    uint64_t bytesOut() const;
+
+private:
+    unsigned int mSampleRate;
+    size_t mBlockSize;
+    bool mHeaderWritten;
+    uint32_t mFrameNumber;
+    uint64_t mBytesIn;
+    uint64_t mBytesOut;
+
+    std::string mPending;
+    std::vector<int32_t> mSamples;
+    std::vector<int32_t> mResidual;
+
+    void writeHeader(std::string *out);
+    void encodeBlock(const char *audio, size_t numSamples, std::string *out);
+};
+
+#endif // FLAC_ENCODER_H
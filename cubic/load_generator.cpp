@@ -0,0 +1,637 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic.grpc.pb.h"
+#include "async_cubic_client.h"
+#include "audio_file.h"
+#include "audio_pacer.h"
+#include "bench_stats.h"
+#include "mock_cubic_server.h"
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/support/channel_arguments.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+using Clock = std::chrono::steady_clock;
+
+// Load generator settings, which may be changed from the command line.
+struct LoadOptions {
+    std::string server;         // server address (in-process mock if empty)
+    std::string modelID = "1";
+    std::string audioFile;      // raw 16-bit mono audio (silence if empty)
+    unsigned int sampleRate = 16000;
+    int channels = 1;           // streams are spread over this many channels
+    bool async = false;         // use AsyncCubicClient instead of threads
+    int cqThreads = 1;          // completion queue threads per channel
+    int startStreams = 10;      // concurrent streams at the first level
+    int stepStreams = 10;       // streams added at each level
+    int maxStreams = 100;       // concurrent streams at the last level
+    double levelSeconds = 20;   // how long each level runs
+    double audioSeconds = 10;   // audio sent on each stream
+    int chunkMs = 100;          // audio sent with each write
+    double speed = 1.0;         // multiple of real time to send audio at
+    int serverDelayMs = 50;     // mock server processing delay
+    std::string output;         // JSON output file (stdout if empty)
+};
+
+// What happened while running one level of load.
+struct LevelResult {
+    int streams = 0;
+    int completed = 0;
+    int errors = 0;
+    double audioSeconds = 0;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    int threads = 0;
+    LatencyStats finalLatencyMs;
+    std::string firstError;
+};
+
+/*
+ * A gRPC channel and Cubic stub. gRPC normally lets channels to the same
+ * address share a connection, so two CubicClient objects still send all
+ * their streams over one HTTP/2 connection. Each channel here uses its
+ * own subchannel pool so that it really does get its own connection.
+ */
+struct LoadChannel {
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<CubicPB::Cubic::Stub> stub;
+    std::unique_ptr<AsyncCubicClient> async;
+};
+
+// Returns the CPU time used so far by the whole process.
+double processCpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Returns the number of threads in this process.
+int processThreadCount() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return std::atoi(line.c_str() + 8);
+        }
+    }
+    return 0;
+}
+
+double toSeconds(const google::protobuf::Duration &d) {
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+// Adds the latency of each final result in the response, measured from
+// when the audio it ends with was released by the pacer.
+void addFinalLatencies(const CubicPB::RecognitionResponse &resp,
+                       const AudioPacer &pacer, double bytesPerSecond,
+                       LatencyStats *finalLatencyMs) {
+    Clock::time_point now = Clock::now();
+    for (const CubicPB::RecognitionResult &result : resp.results()) {
+        if (result.is_partial() || result.alternatives_size() == 0) {
+            continue;
+        }
+        const auto &alt = result.alternatives(0);
+        double endSec = toSeconds(alt.start_time()) + toSeconds(alt.duration());
+        auto spoken = pacer.releaseTime(
+            static_cast<uint64_t>(endSec * bytesPerSecond));
+        finalLatencyMs->add(
+            std::chrono::duration<double, std::milli>(now - spoken).count());
+    }
+}
+
+/*
+ * Runs a single stream the way the examples do: one thread pushes
+ * paced audio while the calling thread reads results. Stops sending
+ * audio early if stop is set. Returns the status of the stream.
+ */
+grpc::Status runStream(CubicPB::Cubic::Stub *stub, const LoadOptions &opts,
+                       const char *audio, size_t audioSize,
+                       const std::atomic<bool> &stop, double *audioSent,
+                       LatencyStats *finalLatencyMs) {
+    const double bytesPerSecond = 2.0 * opts.sampleRate;
+    const size_t chunkBytes =
+        static_cast<size_t>(bytesPerSecond * opts.chunkMs / 1000) & ~size_t(1);
+
+    grpc::ClientContext ctx;
+    auto stream = stub->StreamingRecognize(&ctx);
+
+    CubicPB::StreamingRecognizeRequest req;
+    req.mutable_config()->set_model_id(opts.modelID);
+    req.mutable_config()->set_audio_encoding(
+        CubicPB::RecognitionConfig::RAW_LINEAR16);
+    stream->Write(req);
+
+    AudioPacer pacer(bytesPerSecond, opts.speed);
+    pacer.start();
+
+    std::atomic<uint64_t> bytesSent(0);
+    std::thread audioThread([&]() {
+        CubicPB::StreamingRecognizeRequest audioReq;
+        for (size_t pos = 0; pos < audioSize && !stop; pos += chunkBytes) {
+            size_t n = std::min(chunkBytes, audioSize - pos);
+            pacer.pace(n);
+            audioReq.set_audio(audio + pos, n);
+            if (!stream->Write(audioReq)) {
+                break;
+            }
+            bytesSent += n;
+        }
+        stream->WritesDone();
+    });
+
+    CubicPB::RecognitionResponse resp;
+    while (stream->Read(&resp)) {
+        addFinalLatencies(resp, pacer, bytesPerSecond, finalLatencyMs);
+    }
+
+    audioThread.join();
+    *audioSent = bytesSent / bytesPerSecond;
+    return stream->Finish();
+}
+
+/*
+ * Keeps numStreams streams running concurrently for the level duration,
+ * starting a new stream on each worker as soon as its last one finishes.
+ */
+LevelResult runLevel(std::vector<LoadChannel> &channels, const LoadOptions &opts,
+                     const char *audio, size_t audioSize, int numStreams) {
+    LevelResult level;
+    level.streams = numStreams;
+
+    std::atomic<bool> stop(false);
+    std::mutex resultMutex;
+
+    auto start = Clock::now();
+    double cpuStart = processCpuSeconds();
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < numStreams; w++) {
+        CubicPB::Cubic::Stub *stub = channels[w % channels.size()].stub.get();
+        workers.emplace_back([&, stub]() {
+            LatencyStats latency;
+            int completed = 0, errors = 0;
+            double audioSeconds = 0;
+            std::string firstError;
+
+            while (!stop) {
+                double sent = 0;
+                grpc::Status status = runStream(stub, opts, audio, audioSize,
+                                                stop, &sent, &latency);
+                audioSeconds += sent;
+                if (status.ok()) {
+                    completed++;
+                } else {
+                    errors++;
+                    if (firstError.empty()) {
+                        firstError = status.error_message();
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            level.completed += completed;
+            level.errors += errors;
+            level.audioSeconds += audioSeconds;
+            level.finalLatencyMs.merge(latency);
+            if (level.firstError.empty()) {
+                level.firstError = firstError;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.levelSeconds));
+    level.threads = processThreadCount();
+    stop = true;
+
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    level.wallSeconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    level.cpuSeconds = processCpuSeconds() - cpuStart;
+    return level;
+}
+
+/*
+ * Runs a level the asynchronous way. Every stream is driven by the
+ * channels' AsyncCubicClient completion queue threads, and the calling
+ * thread paces the audio for all of them, pushing each stream's next
+ * chunk when it is due. A finished stream's slot is refilled with a new
+ * stream until the level ends.
+ */
+LevelResult runAsyncLevel(std::vector<LoadChannel> &channels,
+                          const LoadOptions &opts, const char *audio,
+                          size_t audioSize, int numStreams) {
+    LevelResult level;
+    level.streams = numStreams;
+
+    const double bytesPerSecond = 2.0 * opts.sampleRate;
+    const size_t chunkBytes =
+        static_cast<size_t>(bytesPerSecond * opts.chunkMs / 1000) & ~size_t(1);
+
+    CubicPB::RecognitionConfig cfg;
+    cfg.set_model_id(opts.modelID);
+    cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
+
+    // One of the concurrent streams. Only the pacing thread touches the
+    // slot, except that the result callback reads the pacer.
+    struct Slot {
+        std::shared_ptr<AsyncRecognizerStream> stream;
+        std::unique_ptr<AudioPacer> pacer;
+        size_t pos = 0;
+        int generation = 0;
+    };
+    std::vector<Slot> slots(numStreams);
+
+    // The callbacks report finished slots here and record their results
+    // in the level, both under the mutex.
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<int> finished;
+
+    // The next chunk due on each slot, soonest first. Entries left over
+    // from a slot's previous stream are recognized by their generation.
+    using Due = std::tuple<Clock::time_point, int, int>;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> schedule;
+
+    auto startStream = [&](int i) {
+        Slot &slot = slots[i];
+        slot.pacer.reset(new AudioPacer(bytesPerSecond, opts.speed));
+        slot.pacer->start();
+        slot.pos = 0;
+        slot.generation++;
+
+        const AudioPacer *pacer = slot.pacer.get();
+        AsyncCubicClient *client = channels[i % channels.size()].async.get();
+        slot.stream = client->streamingRecognize(
+            cfg,
+            [&, pacer](const CubicPB::RecognitionResponse &resp) {
+                std::lock_guard<std::mutex> lock(mutex);
+                addFinalLatencies(resp, *pacer, bytesPerSecond,
+                                  &level.finalLatencyMs);
+            },
+            [&, i](const grpc::Status &status) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (status.ok()) {
+                    level.completed++;
+                } else {
+                    level.errors++;
+                    if (level.firstError.empty()) {
+                        level.firstError = status.error_message();
+                    }
+                }
+                finished.push_back(i);
+                cond.notify_one();
+            });
+
+        size_t n = std::min(chunkBytes, audioSize);
+        schedule.emplace(pacer->releaseTime(n), i, slot.generation);
+    };
+
+    auto start = Clock::now();
+    double cpuStart = processCpuSeconds();
+    Clock::time_point levelEnd =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(opts.levelSeconds));
+
+    for (int i = 0; i < numStreams; i++) {
+        startStream(i);
+    }
+
+    bool stop = false;
+    int running = numStreams;
+    double bytesSent = 0;
+    std::vector<int> restart;
+    while (true) {
+        Clock::time_point now = Clock::now();
+        if (!stop && now >= levelEnd) {
+            stop = true;
+            level.threads = processThreadCount();
+        }
+
+        // Once the level has ended, each stream sends the chunk it was
+        // waiting for and then stops early, as the threaded streams do.
+        while (!schedule.empty() && std::get<0>(schedule.top()) <= now) {
+            int i = std::get<1>(schedule.top());
+            int generation = std::get<2>(schedule.top());
+            schedule.pop();
+
+            Slot &slot = slots[i];
+            if (generation != slot.generation) {
+                continue;
+            }
+
+            size_t n = std::min(chunkBytes, audioSize - slot.pos);
+            slot.stream->pushAudio(audio + slot.pos, n);
+            slot.pos += n;
+            bytesSent += n;
+            if (!stop && slot.pos < audioSize) {
+                size_t next = std::min(chunkBytes, audioSize - slot.pos);
+                schedule.emplace(slot.pacer->releaseTime(slot.pos + next), i,
+                                 generation);
+            } else {
+                slot.stream->audioFinished();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            restart.swap(finished);
+        }
+        for (int i : restart) {
+            if (stop) {
+                running--;
+            } else {
+                startStream(i);
+            }
+        }
+        restart.clear();
+        if (running == 0) {
+            break;
+        }
+
+        // Sleep until the next chunk is due, the level ends, or a
+        // stream finishes.
+        auto streamFinished = [&]() { return !finished.empty(); };
+        std::unique_lock<std::mutex> lock(mutex);
+        if (schedule.empty() && stop) {
+            cond.wait(lock, streamFinished);
+        } else {
+            Clock::time_point wake =
+                schedule.empty() ? levelEnd : std::get<0>(schedule.top());
+            if (!stop) {
+                wake = std::min(wake, levelEnd);
+            }
+            cond.wait_until(lock, wake, streamFinished);
+        }
+    }
+
+    level.audioSeconds = bytesSent / bytesPerSecond;
+    level.wallSeconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    level.cpuSeconds = processCpuSeconds() - cpuStart;
+    return level;
+}
+
+std::string toJson(const LevelResult &level) {
+    std::ostringstream out;
+    out << "{\"streams\": " << level.streams
+        << ", \"completed\": " << level.completed
+        << ", \"errors\": " << level.errors
+        << ", \"error_rate\": "
+        << (level.completed + level.errors > 0
+                ? double(level.errors) / (level.completed + level.errors)
+                : 0.0)
+        << ", \"audio_seconds\": " << level.audioSeconds
+        << ", \"wall_seconds\": " << level.wallSeconds
+        << ", \"audio_seconds_per_second\": "
+        << level.audioSeconds / level.wallSeconds
+        << ", \"cpu_seconds\": " << level.cpuSeconds
+        << ", \"streams_per_core\": "
+        << (level.cpuSeconds > 0
+                ? level.streams / (level.cpuSeconds / level.wallSeconds)
+                : 0.0)
+        << ", \"threads\": " << level.threads
+        << ", \"final_latency_ms\": " << level.finalLatencyMs.toJson();
+    if (!level.firstError.empty()) {
+        std::string msg = level.firstError;
+        std::replace(msg.begin(), msg.end(), '"', '\'');
+        out << ", \"first_error\": \"" << msg << "\"";
+    }
+    out << "}";
+    return out.str();
+}
+
+void printUsage(const char *prog) {
+    LoadOptions d;
+    std::cerr
+        << "Usage: " << prog << " [options]\n"
+        << "  --server=ADDR      Cubic server (default: in-process mock)\n"
+        << "  --model=ID         model ID (" << d.modelID << ")\n"
+        << "  --audio=FILE       raw 16-bit mono audio (default: silence)\n"
+        << "  --sample-rate=HZ   sample rate of the audio (" << d.sampleRate
+        << ")\n"
+        << "  --channels=N       channels to spread streams over; 1 sends\n"
+        << "                     every stream over one connection ("
+        << d.channels << ")\n"
+        << "  --client=MODE      threads (a thread per stream, as in the\n"
+        << "                     examples) or async (AsyncCubicClient)\n"
+        << "  --cq-threads=N     completion queue threads per channel in\n"
+        << "                     async mode (" << d.cqThreads << ")\n"
+        << "  --start=N          streams at the first level (" << d.startStreams
+        << ")\n"
+        << "  --step=N           streams added per level (" << d.stepStreams
+        << ")\n"
+        << "  --max=N            streams at the last level (" << d.maxStreams
+        << ")\n"
+        << "  --level-seconds=S  duration of each level (" << d.levelSeconds
+        << ")\n"
+        << "  --seconds=S        audio per stream (" << d.audioSeconds << ")\n"
+        << "  --chunk-ms=MS      audio per write (" << d.chunkMs << ")\n"
+        << "  --speed=X          multiple of real time (" << d.speed << ")\n"
+        << "  --delay-ms=MS      mock server processing delay ("
+        << d.serverDelayMs << ")\n"
+        << "  --output=FILE      write the JSON report to FILE\n";
+}
+
+// Parses --name=value arguments, returning false on an unknown option.
+bool parseArgs(int argc, char *argv[], LoadOptions *opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            return false;
+        }
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "server") {
+            opts->server = value;
+        } else if (name == "model") {
+            opts->modelID = value;
+        } else if (name == "audio") {
+            opts->audioFile = value;
+        } else if (name == "sample-rate") {
+            opts->sampleRate = std::atoi(value.c_str());
+        } else if (name == "channels") {
+            opts->channels = std::atoi(value.c_str());
+        } else if (name == "client") {
+            if (value != "threads" && value != "async") {
+                return false;
+            }
+            opts->async = value == "async";
+        } else if (name == "cq-threads") {
+            opts->cqThreads = std::atoi(value.c_str());
+        } else if (name == "start") {
+            opts->startStreams = std::atoi(value.c_str());
+        } else if (name == "step") {
+            opts->stepStreams = std::atoi(value.c_str());
+        } else if (name == "max") {
+            opts->maxStreams = std::atoi(value.c_str());
+        } else if (name == "level-seconds") {
+            opts->levelSeconds = std::atof(value.c_str());
+        } else if (name == "seconds") {
+            opts->audioSeconds = std::atof(value.c_str());
+        } else if (name == "chunk-ms") {
+            opts->chunkMs = std::atoi(value.c_str());
+        } else if (name == "speed") {
+            opts->speed = std::atof(value.c_str());
+        } else if (name == "delay-ms") {
+            opts->serverDelayMs = std::atoi(value.c_str());
+        } else if (name == "output") {
+            opts->output = value;
+        } else {
+            return false;
+        }
+    }
+
+    return opts->channels > 0 && opts->cqThreads > 0 &&
+           opts->startStreams > 0 &&
+           opts->stepStreams > 0 && opts->maxStreams >= opts->startStreams &&
+           opts->levelSeconds > 0 && opts->audioSeconds > 0 &&
+           opts->chunkMs > 0 && opts->sampleRate > 0;
+}
+
+/*
+ * This tool finds how many concurrent streams a client can sustain. It
+ * ramps up the number of streams one level at a time, keeping each level
+ * running for a fixed time, and reports throughput, errors and final
+ * result latency for each level as JSON. Streams can share a single
+ * channel (and so a single HTTP/2 connection), or be spread over a pool
+ * of channels, to show whether the connection or the thread-per-stream
+ * model is the bottleneck. With --client=async the same load is driven
+ * by AsyncCubicClient on a few threads, for comparing how many streams
+ * each core can carry.
+ */
+int main(int argc, char *argv[]) {
+    LoadOptions opts;
+    if (!parseArgs(argc, argv, &opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        // Use an in-process mock server unless a real one was given
+        std::unique_ptr<MockCubicServer> mock;
+        std::string address = opts.server;
+        if (address.empty()) {
+            MockCubicServer::Options serverOpts;
+            serverOpts.sampleRate = opts.sampleRate;
+            serverOpts.processingDelayMs = opts.serverDelayMs;
+            mock.reset(new MockCubicServer(serverOpts));
+            mock->start();
+            address = mock->address();
+        }
+
+        std::unique_ptr<AudioFile> file;
+        std::string silence;
+        const char *audio;
+        size_t audioSize;
+        if (!opts.audioFile.empty()) {
+            file.reset(new AudioFile(opts.audioFile));
+            audio = file->data();
+            audioSize = file->size();
+        } else {
+            silence.assign(
+                static_cast<size_t>(opts.audioSeconds * opts.sampleRate) * 2,
+                '\0');
+            audio = silence.data();
+            audioSize = silence.size();
+        }
+
+        std::vector<LoadChannel> channels(opts.channels);
+        for (LoadChannel &ch : channels) {
+            grpc::ChannelArguments args;
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            ch.channel = grpc::CreateCustomChannel(
+                address, grpc::InsecureChannelCredentials(), args);
+            ch.stub = CubicPB::Cubic::NewStub(ch.channel);
+            if (opts.async) {
+                ch.async.reset(new AsyncCubicClient(ch.channel, opts.cqThreads));
+            }
+        }
+
+        std::vector<LevelResult> levels;
+        for (int n = opts.startStreams; n <= opts.maxStreams;
+             n += opts.stepStreams) {
+            std::cerr << "Running " << n << " streams over " << channels.size()
+                      << " channel(s)..." << std::endl;
+            if (opts.async) {
+                levels.push_back(
+                    runAsyncLevel(channels, opts, audio, audioSize, n));
+            } else {
+                levels.push_back(runLevel(channels, opts, audio, audioSize, n));
+            }
+            std::cerr << "  " << toJson(levels.back()) << std::endl;
+        }
+
+        std::ostringstream json;
+        json << "{\n"
+             << "  \"client\": \"" << (opts.async ? "async" : "threads")
+             << "\",\n"
+             << "  \"channels\": " << opts.channels << ",\n";
+        if (mock) {
+            json << "  \"server_connections\": " << mock->connectionCount()
+                 << ",\n";
+        }
+        json << "  \"levels\": [\n";
+        for (size_t i = 0; i < levels.size(); i++) {
+            json << "    " << toJson(levels[i])
+                 << (i + 1 < levels.size() ? ",\n" : "\n");
+        }
+        json << "  ]\n}\n";
+
+        if (opts.output.empty()) {
+            std::cout << json.str();
+        } else {
+            std::ofstream out(opts.output);
+            out << json.str();
+        }
+
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_client.h"
+#include "cubic_exception.h"
+#include "audio_converter.h"
+#include "audio_file.h"
+#include "audio_splitter.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "transcript_stitcher.h"
+#include "wav_header.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+// Some useful variables to define the client configuration
+const std::string serverAddress = "localhost:2727";
+
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The number of bytes sent with each pushAudio() call.
+const size_t streamChunkSize = 8192;
+
+// Chunks are split at the quietest point within this many seconds of
+// their target length, and overlap their neighbours by this much.
+const double splitSearchSeconds = 10.0;
+const double splitOverlapSeconds = 1.0;
+
+// Returns true if the given string ends with the given suffix.
+bool endsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Formats a time in seconds as h:mm:ss.ss.
+std::string formatTime(double seconds) {
+    int whole = static_cast<int>(seconds);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%d:%02d:%05.2f", whole / 3600,
+                  (whole / 60) % 60, seconds - (whole / 60) * 60);
+    return buf;
+}
+
+// Streams one chunk of 16-bit mono audio, passing its final results to
+// the stitcher.
+void recognizeChunk(CubicClient &client, const CubicPB::RecognitionConfig &cfg,
+                    const char *audio, size_t audioSize, size_t index,
+                    TranscriptStitcher &stitcher) {
+    auto stream = client.streamingRecognize(cfg);
+
+    // There is no need to pace the audio, so it is sent as fast as the
+    // stream will take it.
+    std::thread audioThread([&stream, audio, audioSize]() {
+        try {
+            for (size_t pos = 0; pos < audioSize; pos += streamChunkSize) {
+                stream.pushAudio(audio + pos, std::min(streamChunkSize, audioSize - pos));
+            }
+        } catch (CubicException &) {
+            // The error is reported by close() below.
+        }
+
+        stream.audioFinished();
+    });
+
+    CubicPB::RecognitionResponse resp;
+    while (stream.receiveResults(&resp)) {
+        for (const CubicPB::RecognitionResult &result : resp.results()) {
+            stitcher.add(index, result);
+        }
+    }
+
+    audioThread.join();
+    stream.close();
+}
+
+void printUsage(const char *prog) {
+    std::cerr << "Usage: " << prog << " <audio> [streams] [chunk-seconds]"
+              << std::endl
+              << "  audio          a WAV file, or a .raw file of 16-bit mono"
+              << std::endl
+              << "                 audio at the model's sample rate"
+              << std::endl
+              << "  streams        number of chunks recognized at once"
+              << " (default 8)" << std::endl
+              << "  chunk-seconds  approximate length of each chunk"
+              << " (default 60)" << std::endl;
+}
+
+/*
+ * This client demonstrates transcribing a long recording quickly. The
+ * audio is split into chunks at pauses, the chunks are recognized
+ * concurrently over several streams (which a Cubic deployment with more
+ * than one server can spread across them), and the results are stitched
+ * back into one transcript on the timeline of the whole recording.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const std::string audioPath = argv[1];
+    int numStreams = argc > 2 ? std::atoi(argv[2]) : 8;
+    double chunkSeconds = argc > 3 ? std::atof(argv[3]) : 60.0;
+    if (numStreams < 1 || chunkSeconds <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        // Create the client (note this is an insecure connection,
+        // which is not recommended for production).
+        CubicClient client(serverAddress);
+
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
+        // Display the Cubic version
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
+        std::cout << "Connected to " << serverAddress << std::endl;
+        std::cout << std::endl;
+
+        // Use the first model for every chunk. Word times are needed to
+        // stitch the chunks back together.
+        const std::vector<CubicModel> &models = startup.models();
+        if (models.empty()) {
+            throw std::runtime_error("server has no models");
+        }
+        const unsigned int sampleRate = models[0].sampleRate();
+        CubicPB::RecognitionConfig cfg;
+        cfg.set_model_id(models[0].id());
+        cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
+        cfg.set_enable_word_time_offsets(true);
+
+        // The splitter works on 16-bit mono audio at the model's sample
+        // rate. WAV files in another format are converted in memory
+        // first; otherwise the chunks are sent straight from the mapping.
+        AudioFile audio(audioPath, AudioFile::Sequential);
+        const char *data = audio.data();
+        size_t dataSize = audio.size();
+        std::string converted;
+        if (endsWith(audioPath, ".wav") || endsWith(audioPath, ".WAV")) {
+            WavFormat wav;
+            AudioConverter::Format inputFormat;
+            if (!parseWavHeader(audio.data(), audio.size(), &wav)) {
+                throw std::runtime_error(audioPath + " is not a valid WAV file");
+            }
+            if (!converterFormat(wav, &inputFormat)) {
+                throw std::runtime_error(audioPath + " uses an unsupported sample format");
+            }
+            data += wav.dataOffset;
+            dataSize = wav.dataSize;
+
+            AudioConverter converter(inputFormat, sampleRate);
+            if (!converter.passthrough()) {
+                converter.convert(data, dataSize, &converted);
+                converter.flush(&converted);
+                data = converted.data();
+                dataSize = converted.size();
+            }
+        }
+
+        SplitOptions splitOpts;
+        splitOpts.sampleRate = sampleRate;
+        splitOpts.chunkSeconds = chunkSeconds;
+        splitOpts.searchSeconds = splitSearchSeconds;
+        splitOpts.overlapSeconds = splitOverlapSeconds;
+        std::vector<AudioChunk> chunks = splitAudio(data, dataSize, splitOpts);
+
+        double audioSeconds = dataSize / (2.0 * sampleRate);
+        std::cout << "Transcribing " << audioSeconds << " s of audio in "
+                  << chunks.size() << " chunks over " << numStreams
+                  << " streams" << std::endl;
+        std::cout << "\nTranscripts:" << std::endl;
+
+        // Print the stitched results in order as they become ready
+        TranscriptStitcher stitcher(chunks, sampleRate,
+            [](const CubicPB::RecognitionResult &result) {
+                const CubicPB::RecognitionAlternative &alt = result.alternatives(0);
+                double start = alt.start_time().seconds() + alt.start_time().nanos() / 1e9;
+                std::cout << "[" << formatTime(start) << "] " << alt.transcript()
+                          << std::endl;
+            });
+
+        // Each worker recognizes the next unclaimed chunk until none are
+        // left. Chunks are claimed in order, so the transcript keeps up
+        // with the earliest chunks still being recognized.
+        std::atomic<size_t> nextChunk(0);
+        std::atomic<size_t> numFailed(0);
+        std::mutex errorMutex;
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> workers;
+        for (int w = 0; w < numStreams; w++) {
+            workers.emplace_back([&]() {
+                size_t idx;
+                while ((idx = nextChunk++) < chunks.size()) {
+                    const AudioChunk &chunk = chunks[idx];
+                    try {
+                        recognizeChunk(client, cfg, data + 2 * chunk.begin,
+                                       2 * (chunk.end - chunk.begin), idx, stitcher);
+                    } catch (std::exception &e) {
+                        numFailed++;
+                        std::lock_guard<std::mutex> lock(errorMutex);
+                        std::cerr << "Chunk at " << formatTime(double(chunk.keepBegin) / sampleRate)
+                                  << " failed: " << e.what() << std::endl;
+                    }
+
+                    // A failed chunk leaves a gap rather than holding up
+                    // the rest of the transcript.
+                    stitcher.finish(idx);
+                }
+            });
+        }
+
+        for (std::thread &t : workers) {
+            t.join();
+        }
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double wallSeconds = elapsed.count();
+
+        std::cout << "\nSummary:" << std::endl;
+        std::cout << "  Chunks: " << chunks.size() << " (" << numFailed
+                  << " failed)" << std::endl;
+        std::cout << "  Audio: " << audioSeconds << " s" << std::endl;
+        std::cout << "  Wall time: " << wallSeconds << " s" << std::endl;
+        if (audioSeconds > 0) {
+            std::cout << "  Real-time factor: "
+                      << wallSeconds / audioSeconds << std::endl;
+        }
+        std::cout << "  Overlapping words dropped: " << stitcher.wordsDropped()
+                  << std::endl;
+
+    } catch (CubicException &e) {
+        std::cerr << "Cubic error: " << e.what() << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    std::cout << "\nDone." << std::endl;
+}
@@ -16,12 +16,25 @@
 
 #include "cubic_client.h"
 #include "cubic_exception.h"
+#include "chunk_ring.h"
+#include "cubic_metrics.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "metrics.h"
 #include "recorder.h"
+#include "result_reader.h"
+#include "resumable_stream.h"
+#include "trace.h"
+#include "transcript_sink.h"
+#include "vad.h"
+
+#include <sys/wait.h>
 
-#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 /*
  * Create some aliases to make the code more readable. The gRPC
@@ -33,9 +46,61 @@ namespace CubicPB = cobaltspeech::cubic;
 const std::string serverAddress = "localhost:2727";
 const std::string modelID = "1";
 
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The sample rate of the recorded audio, which should match the model's.
+// The recorder, the voice activity detector and the replay buffer all
+// use this value.
+const unsigned int sampleRate = 16000;
+
 // The external process responsible for recording audio.
 const std::string recordCmd =
-    "sox -q -d -c 1 -r 16000 -b 16 -L -e signed -t raw -";
+    "sox -q -d -c 1 -r " + std::to_string(sampleRate) +
+    " -b 16 -L -e signed -t raw -";
+
+/*
+ * Captured audio is handed from the recorder to the stream through a
+ * ring of preallocated chunks. 32 chunks of 8kB holds about 8 seconds
+ * of 16kHz audio. If Cubic falls further behind than that, the overflow
+ * policy decides what happens: DropOldest discards the oldest audio not
+ * yet sent, Block stops reading from the recorder until there is room
+ * (for at most half a second, after which the oldest audio is dropped),
+ * and Coalesce waits the same way while the backlog is packed into
+ * fewer chunks as it is sent.
+ */
+const size_t chunkSize = 8192;
+const size_t numChunks = 32;
+const ChunkRing::OverflowPolicy overflowPolicy = ChunkRing::DropOldest;
+const int maxBlockMs = 500;
+
+// Silence is detected on the client and not sent to Cubic when this is
+// set. Result timestamps still refer to the audio as it was recorded,
+// including any audio the ring dropped.
+const bool skipSilence = false;
+
+// If the stream fails partway through, it is replaced and the audio sent
+// since the last final result (up to this many seconds of it) is sent
+// again, so recognition carries on where it left off.
+const double maxReplaySeconds = 60.0;
+
+// Every final result, with its alternatives and word timings, is also
+// written to this file as JSON lines. Leave it empty to skip the file.
+const std::string transcriptFile = "transcripts.jsonl";
+
+// Result latencies, pushAudio() timings and the like are written to this
+// file in the Prometheus text format every few seconds while recording,
+// where the node_exporter textfile collector (or anything else) can read
+// them. Leave it empty to skip the file.
+const std::string metricsFile = "cubic_metrics.prom";
+const int metricsIntervalMs = 5000;
+
+// When built with -DENABLE_TRACING=ON, a trace of the whole run is
+// written to this file before the client exits, for viewing in Perfetto
+// (ui.perfetto.dev) or chrome://tracing.
+const std::string traceFile = "cubic_trace.json";
 
 // Wait for the Enter key to be pressed
 void waitForEnter() {
@@ -52,18 +117,25 @@ void waitForEnter() {
 // used instead.
 int main(int argc, char *argv[]) {
     try {
+        TRACE_THREAD_NAME("main");
+
         // Create the client (note this is an insecure connection,
         // which is not recommended for production).
         CubicClient client(serverAddress);
 
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
         // Display the Cubic version
-        std::cout << "Cubic version: " << client.cubicVersion() << std::endl;
-        std::cout << "Server version: " << client.serverVersion() << std::endl;
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
         std::cout << "Connected to " << serverAddress << std::endl;
         std::cout << std::endl;
 
         // Get the list of available models
-        std::vector<CubicModel> models = client.listModels();
+        const std::vector<CubicModel> &models = startup.models();
         std::cout << "Available Models:" << std::endl;
         for (const CubicModel &m : models) {
             std::cout << "ID = " << m.id() << ", Name = " << m.name() << std::endl;
@@ -71,39 +143,133 @@ int main(int argc, char *argv[]) {
 
         // Use the first model to set up the recognition config
         auto modelID = models[0].id();
+        if (models[0].sampleRate() != sampleRate) {
+            std::cerr << "Warning: the model expects " << models[0].sampleRate()
+                      << " Hz audio, but the recorder is set to " << sampleRate
+                      << " Hz." << std::endl;
+        }
         CubicPB::RecognitionConfig cfg;
         cfg.set_model_id(modelID);
         cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
 
-        // Create the stream
-        auto stream = client.streamingRecognize(cfg);
+        // Create the stream, recording how it performs
+        MetricsRegistry registry;
+        CubicMetrics metrics(registry);
+        std::unique_ptr<MetricsExporter> exporter;
+        if (!metricsFile.empty()) {
+            exporter.reset(new MetricsExporter(registry, metricsFile,
+                                               metricsIntervalMs));
+        }
+        ResumableStream::Options resumeOpts;
+        resumeOpts.bytesPerSecond = 2.0 * sampleRate;
+        resumeOpts.maxReplayBytes =
+            static_cast<size_t>(maxReplaySeconds * resumeOpts.bytesPerSecond);
+        resumeOpts.metrics = &metrics;
+        ResumableStream stream(serverAddress, cfg, resumeOpts);
+
+        // Everything that can fail is set up before any thread starts, so
+        // that an error here is reported rather than unwinding past a
+        // running thread. The sinks print the results and write them to
+        // the file on their own threads, so the results thread is never
+        // held up by the terminal or the disk.
+        TranscriptSink::Options consoleOpts;
+        consoleOpts.format = TranscriptSink::Text;
+        consoleOpts.sync = TranscriptSink::SyncNever;
+        consoleOpts.flushIntervalMs = 50;
+        TranscriptSink console("-", consoleOpts);
+
+        std::unique_ptr<TranscriptSink> file;
+        if (!transcriptFile.empty()) {
+            file.reset(new TranscriptSink(transcriptFile));
+        }
+
+        VoiceActivityDetector::Options vadOpts;
+        vadOpts.sampleRate = sampleRate;
+        VoiceActivityDetector vad(vadOpts);
+        // The ring only queues whole 16-bit samples, so audio it drops
+        // never leaves the rest a byte out of step.
+        ChunkRing ring(numChunks, chunkSize, overflowPolicy, maxBlockMs, 2);
 
-        // Handle the microphone audio on a separate thread
-        std::atomic_bool isRecording(true);
-        std::thread audioThread([&stream, &isRecording](){
-           // Start recording
-           Recorder rec(recordCmd);
-           rec.start();
+        // Start recording
+        Recorder rec(recordCmd);
+        rec.start();
 
-           // Push the recorded audio to Cubic
-            while(isRecording) {
-                std::string audio = rec.readAudio();
-                stream.pushAudio(audio.c_str(), audio.length());
+        // Read the microphone audio on a separate thread. The recorder
+        // writes directly into the ring, so no memory is allocated per
+        // chunk, and a full ring is handled by its overflow policy. The
+        // loop ends when the recorder is cancelled or exits.
+        std::thread captureThread([&ring, &rec](){
+            TRACE_THREAD_NAME("capture");
+            while (char *chunk = ring.beginWrite()) {
+                size_t n = rec.readAudio(chunk, ring.writeCapacity());
+                if (n == 0) {
+                    break;
+                }
+                ring.commitWrite(n);
+            }
+
+            ring.close();
+        });
+
+        // Push the recorded audio to Cubic on another thread, borrowing
+        // each chunk from the ring until pushAudio() returns. With
+        // skipSilence set, each chunk goes through the voice activity
+        // detector first and only the audio it keeps is pushed. The
+        // detector is also told about audio the ring dropped, which shows
+        // up as a jump in the chunk offsets, so that its timeline still
+        // matches the recording.
+        std::thread audioThread([&stream, &ring, &vad](){
+            TRACE_THREAD_NAME("audio");
+            const char *audio;
+            size_t audioSize;
+            uint64_t offset;
+            uint64_t expected = 0;
+            std::string voiced;
+            while (ring.waitRead(&audio, &audioSize, &offset)) {
+                if (!skipSilence) {
+                    stream.pushAudio(audio, audioSize);
+                    ring.endRead();
+                    continue;
+                }
+
+                vad.skip(offset - expected);
+                expected = offset + audioSize;
+                voiced.clear();
+                {
+                    TRACE_SCOPE("VoiceActivityDetector::process");
+                    vad.process(audio, audioSize, &voiced);
+                }
+                ring.endRead();
+                if (!voiced.empty()) {
+                    stream.pushAudio(voiced.data(), voiced.size());
+                }
+            }
+
+            if (skipSilence) {
+                voiced.clear();
+                vad.flush(&voiced);
+                if (!voiced.empty()) {
+                    stream.pushAudio(voiced.data(), voiced.size());
+                }
             }
 
             // Let Cubic know that no more audio will be coming
-            rec.stop();
             stream.audioFinished();
         });
 
-        // Print the results as they come on a separate thread
-        std::thread resultsThread([&stream]() {
-            CubicPB::RecognitionResponse resp;
-            while (stream.receiveResults(&resp)) {
-                for (int i = 0; i < resp.results_size(); i++) {
-                    CubicPB::RecognitionResult result = resp.results(i);
-                    if (!result.is_partial()) {
-                        std::cout << result.alternatives(0).transcript() << std::endl;
+        // Pass the results to the sinks as they come on a separate thread
+        std::thread resultsThread([&stream, &vad, &console, &file]() {
+            TRACE_THREAD_NAME("results");
+            ResultReader reader(stream);
+            while (CubicPB::RecognitionResponse *resp = reader.next()) {
+                TRACE_SCOPE("handleResults");
+                for (CubicPB::RecognitionResult &result : *resp->mutable_results()) {
+                    if (skipSilence) {
+                        vad.remapTimestamps(&result);
+                    }
+                    console.write(result);
+                    if (file) {
+                        file->write(result);
                     }
                 }
             }
@@ -114,10 +280,72 @@ int main(int argc, char *argv[]) {
                      "\n\nTranscripts:" << std::endl;
 
         waitForEnter();
-        isRecording = false;
+
+        // Wake up the capture thread right away instead of waiting for
+        // the next chunk of audio (or for room in the ring), then shut
+        // down the recorder app.
+        rec.cancel();
+        ring.close();
+        captureThread.join();
+        int status = rec.stop();
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            std::cerr << "\nRecorder exited with status "
+                      << WEXITSTATUS(status) << std::endl;
+        } else if (WIFSIGNALED(status)) {
+            std::cerr << "\nRecorder was killed by signal "
+                      << WTERMSIG(status) << std::endl;
+        }
+
         audioThread.join();
         resultsThread.join();
         stream.close();
+        console.close();
+        if (file) {
+            file->close();
+            std::cout << "\nWrote " << file->recordsWritten()
+                      << " transcripts to " << transcriptFile << std::endl;
+        }
+
+        // Report how close the ring came to filling up, and what was done
+        // about it if it did.
+        std::cout << "\nAt most " << ring.highWaterBytes() << " of "
+                  << numChunks * chunkSize << " bytes of audio were waiting"
+                  << " to be sent." << std::endl;
+        if (ring.droppedChunks() > 0) {
+            std::cout << "Warning: dropped " << ring.droppedBytes()
+                      << " bytes of audio in " << ring.droppedChunks()
+                      << " chunks because Cubic fell behind." << std::endl;
+        }
+        if (ring.coalescedChunks() > 0) {
+            std::cout << "Merged " << ring.coalescedChunks()
+                      << " chunks of audio to make room." << std::endl;
+        }
+        if (ring.blockedMs() > 0) {
+            std::cout << "Stopped reading from the recorder for "
+                      << ring.blockedMs() << " ms to wait for Cubic." << std::endl;
+        }
+
+        if (stream.resumes() > 0) {
+            std::cout << "\nThe stream failed and was resumed " << stream.resumes()
+                      << " times, sending " << stream.replayedBytes()
+                      << " bytes of audio again." << std::endl;
+        }
+
+        if (skipSilence && vad.bytesIn() > 0) {
+            std::cout << "\nSent " << vad.bytesOut() << " of " << vad.bytesIn()
+                      << " bytes of audio (" << 100 * vad.bytesOut() / vad.bytesIn()
+                      << "%); the rest was silence." << std::endl;
+        }
+
+        if (exporter) {
+            exporter->close();
+            std::cout << "\nMetrics written to " << metricsFile << std::endl;
+        }
+
+#ifdef ENABLE_TRACING
+        Tracer::writeChromeTrace(traceFile);
+        std::cout << "Trace written to " << traceFile << std::endl;
+#endif
 
     } catch (CubicException &e) {
         std::cerr << "Cubic error: " << e.what() << std::endl;
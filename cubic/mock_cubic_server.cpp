@@ -0,0 +1,554 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mock_cubic_server.h"
+
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server_builder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// The mock "recognizes" one word for every wordMs of audio.
+const int64_t wordMs = 250;
+
+void setDuration(google::protobuf::Duration *dur, int64_t ms)
+{
+    dur->set_seconds(ms / 1000);
+    dur->set_nanos(static_cast<int32_t>((ms % 1000) * 1000000));
+}
+
+uint8_t crc8(const unsigned char *data, size_t size)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x80) ? uint8_t((crc << 1) ^ 0x07) : uint8_t(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*
+ * Counts the samples in a FLAC stream without decoding it, by finding
+ * each frame header (a sync code followed by a header whose CRC checks
+ * out) and reading its block size. This is enough for the mock to keep
+ * time, since it never looks at the audio itself.
+ */
+class FlacSampleCounter
+{
+public:
+    FlacSampleCounter() : mSamples(0) {}
+
+    void add(const std::string &data)
+    {
+        mBuffer.append(data);
+        const unsigned char *p =
+            reinterpret_cast<const unsigned char *>(mBuffer.data());
+
+        size_t pos = 0;
+        while (pos + 16 <= mBuffer.size())
+        {
+            size_t headerSize = 0;
+            uint32_t blockSize = 0;
+            if (p[pos] == 0xFF && (p[pos + 1] & 0xFE) == 0xF8 &&
+                parseHeader(p + pos, &headerSize, &blockSize))
+            {
+                mSamples += blockSize;
+                pos += headerSize;
+            }
+            else
+            {
+                pos++;
+            }
+        }
+        mBuffer.erase(0, pos);
+    }
+
+    // Counts a frame whose header is too close to the end of the data
+    // to have been checked yet. Zeros can never look like a header.
+    void finish()
+    {
+        add(std::string(16, '\0'));
+    }
+
+    uint64_t samples() const
+    {
+        return mSamples;
+    }
+
+private:
+    std::string mBuffer;
+    uint64_t mSamples;
+
+    // Parses the frame header at p, which has at least 16 bytes.
+    static bool parseHeader(const unsigned char *p, size_t *size,
+                            uint32_t *blockSize)
+    {
+        int bsCode = p[2] >> 4;
+        int rateCode = p[2] & 0x0F;
+        if (bsCode == 0 || rateCode == 15)
+        {
+            return false;
+        }
+
+        // The coded frame number is one to seven bytes long
+        size_t pos = 4;
+        int extra = 0;
+        while (extra < 7 && (p[pos] & (0x80 >> extra)))
+        {
+            extra++;
+        }
+        if (extra == 1 || extra == 7)
+        {
+            return false;
+        }
+        pos += extra == 0 ? 1 : extra;
+
+        if (bsCode == 1)
+        {
+            *blockSize = 192;
+        }
+        else if (bsCode <= 5)
+        {
+            *blockSize = 576u << (bsCode - 2);
+        }
+        else if (bsCode == 6)
+        {
+            *blockSize = p[pos++] + 1;
+        }
+        else if (bsCode == 7)
+        {
+            *blockSize = ((p[pos] << 8) | p[pos + 1]) + 1;
+            pos += 2;
+        }
+        else
+        {
+            *blockSize = 256u << (bsCode - 8);
+        }
+
+        if (rateCode == 12)
+        {
+            pos += 1;
+        }
+        else if (rateCode == 13 || rateCode == 14)
+        {
+            pos += 2;
+        }
+
+        if (crc8(p, pos) != p[pos])
+        {
+            return false;
+        }
+        *size = pos + 1;
+        return true;
+    }
+};
+
+/*
+ * Creates a result covering the audio from startMs to endMs. Words are
+ * named after their position in the audio ("w0", "w1", ...), so the
+ * same stretch of audio always produces the same words.
+ */
+CubicPB::RecognitionResult makeResult(int64_t startMs, int64_t endMs,
+                                      bool isPartial)
+{
+    CubicPB::RecognitionResult result;
+    result.set_is_partial(isPartial);
+
+    CubicPB::RecognitionAlternative *alt = result.add_alternatives();
+    alt->set_confidence(0.9);
+    setDuration(alt->mutable_start_time(), startMs);
+    setDuration(alt->mutable_duration(), endMs - startMs);
+
+    std::string transcript;
+    for (int64_t w = startMs / wordMs; w * wordMs < endMs; w++)
+    {
+        int64_t wordStart = std::max(w * wordMs, startMs);
+        int64_t wordEnd = std::min((w + 1) * wordMs, endMs);
+
+        CubicPB::WordInfo *word = alt->add_words();
+        word->set_word("w" + std::to_string(w));
+        word->set_confidence(0.9);
+        setDuration(word->mutable_start_time(), wordStart);
+        setDuration(word->mutable_duration(), wordEnd - wordStart);
+
+        if (!transcript.empty())
+        {
+            transcript += " ";
+        }
+        transcript += word->word();
+    }
+    alt->set_transcript(transcript);
+
+    return result;
+}
+
+/*
+ * Writes the responses on a stream, each one once it is due, from its
+ * own thread. The stream keeps being read while earlier results wait
+ * out their processing delay, so the delays overlap the way they would
+ * on a real server instead of adding up and holding back the client.
+ * Every result has the same delay, so results fall due in the order
+ * they are added and a FIFO queue keeps them sorted by deadline.
+ */
+class ResultWriter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    ResultWriter(
+        grpc::ServerReaderWriter<CubicPB::RecognitionResponse,
+                                 CubicPB::StreamingRecognizeRequest> *stream,
+        int delayMs)
+        : mStream(stream), mDelay(std::chrono::milliseconds(delayMs)),
+          mDone(false), mFailed(false)
+    {
+        mThread = std::thread(&ResultWriter::run, this);
+    }
+
+    ~ResultWriter()
+    {
+        finish();
+    }
+
+    // Schedule a response to be written once the delay has passed.
+    // Returns false once a write has failed.
+    bool add(const CubicPB::RecognitionResponse &resp)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending.push_back(Entry{Clock::now() + mDelay, resp});
+        mCond.notify_one();
+        return !mFailed;
+    }
+
+    // Wait for the scheduled responses to be written.
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mDone = true;
+            mCond.notify_one();
+        }
+        if (mThread.joinable())
+        {
+            mThread.join();
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Clock::time_point due;
+        CubicPB::RecognitionResponse resp;
+    };
+
+    grpc::ServerReaderWriter<CubicPB::RecognitionResponse,
+                             CubicPB::StreamingRecognizeRequest> *mStream;
+    Clock::duration mDelay;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<Entry> mPending;
+    bool mDone;
+    bool mFailed;
+    std::thread mThread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            if (mPending.empty())
+            {
+                if (mDone)
+                {
+                    return;
+                }
+                mCond.wait(lock);
+                continue;
+            }
+
+            Clock::time_point due = mPending.front().due;
+            if (Clock::now() < due)
+            {
+                mCond.wait_until(lock, due);
+                continue;
+            }
+
+            Entry entry = std::move(mPending.front());
+            mPending.pop_front();
+            lock.unlock();
+            bool ok = mStream->Write(entry.resp);
+            lock.lock();
+            if (!ok)
+            {
+                // The client has gone; drop whatever is left.
+                mFailed = true;
+                mPending.clear();
+            }
+        }
+    }
+};
+
+} // namespace
+
+MockCubicServer::Options::Options()
+    : sampleRate(16000), processingDelayMs(0), partialIntervalMs(200),
+      utteranceMs(2000)
+{
+}
+
+MockCubicServer::MockCubicServer(const Options &opts)
+    : mOptions(opts), mPort(0)
+{
+    if (mOptions.utteranceMs <= 0)
+    {
+        throw std::invalid_argument("utteranceMs must be positive");
+    }
+}
+
+MockCubicServer::~MockCubicServer()
+{
+    this->stop();
+}
+
+void MockCubicServer::start()
+{
+    // Ignore if the server is already running
+    if (mServer)
+    {
+        return;
+    }
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(),
+                             &mPort);
+    builder.RegisterService(this);
+    mServer = builder.BuildAndStart();
+    if (!mServer || mPort == 0)
+    {
+        mServer.reset();
+        throw std::runtime_error("could not start mock Cubic server");
+    }
+}
+
+void MockCubicServer::stop()
+{
+    if (mServer)
+    {
+        mServer->Shutdown();
+        mServer->Wait();
+        mServer.reset();
+    }
+}
+
+std::string MockCubicServer::address() const
+{
+    return "127.0.0.1:" + std::to_string(mPort);
+}
+
+size_t MockCubicServer::connectionCount() const
+{
+    std::lock_guard<std::mutex> lock(mPeersMutex);
+    return mPeers.size();
+}
+
+grpc::Status MockCubicServer::Version(grpc::ServerContext *,
+                                      const google::protobuf::Empty *,
+                                      CubicPB::VersionResponse *response)
+{
+    response->set_cubic("mock");
+    response->set_server("mock");
+    return grpc::Status::OK;
+}
+
+grpc::Status MockCubicServer::ListModels(grpc::ServerContext *,
+                                         const CubicPB::ListModelsRequest *,
+                                         CubicPB::ListModelsResponse *response)
+{
+    CubicPB::Model *model = response->add_models();
+    model->set_id("1");
+    model->set_name("Mock Model");
+    model->mutable_attributes()->set_sample_rate(mOptions.sampleRate);
+    model->mutable_attributes()->mutable_context_info()->set_supports_context(
+        true);
+    model->mutable_attributes()
+        ->mutable_context_info()
+        ->add_allowed_context_tokens("mock_token");
+    return grpc::Status::OK;
+}
+
+grpc::Status MockCubicServer::Recognize(grpc::ServerContext *,
+                                        const CubicPB::RecognizeRequest *request,
+                                        CubicPB::RecognitionResponse *response)
+{
+    int64_t totalMs = audioMs(request->audio().data().size());
+    for (int64_t start = 0; start < totalMs; start += mOptions.utteranceMs)
+    {
+        int64_t end = std::min(start + mOptions.utteranceMs, totalMs);
+        *(response->add_results()) = makeResult(start, end, false);
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(mOptions.processingDelayMs));
+    return grpc::Status::OK;
+}
+
+grpc::Status MockCubicServer::StreamingRecognize(
+    grpc::ServerContext *context,
+    grpc::ServerReaderWriter<CubicPB::RecognitionResponse,
+                             CubicPB::StreamingRecognizeRequest> *stream)
+{
+    // The peer address includes the client's port, so it identifies the
+    // connection the stream arrived on.
+    {
+        std::lock_guard<std::mutex> lock(mPeersMutex);
+        mPeers.insert(context->peer());
+    }
+
+    // With a processing delay, results are written by a separate thread
+    // once they are due, so that reading carries on in the meantime.
+    std::unique_ptr<ResultWriter> writer;
+    if (mOptions.processingDelayMs > 0)
+    {
+        writer.reset(new ResultWriter(stream, mOptions.processingDelayMs));
+    }
+
+    auto send = [stream, &writer](int64_t startMs, int64_t endMs,
+                                  bool partial) {
+        CubicPB::RecognitionResponse resp;
+        *(resp.add_results()) = makeResult(startMs, endMs, partial);
+        return writer ? writer->add(resp) : stream->Write(resp);
+    };
+
+    uint64_t numBytes = 0;
+    int64_t utteranceStart = 0;
+    int64_t nextPartial = mOptions.partialIntervalMs;
+
+    // FLAC audio is timed by the samples in its frames, as if it had
+    // been sent as 16-bit samples.
+    bool flac = false;
+    FlacSampleCounter flacSamples;
+
+    CubicPB::StreamingRecognizeRequest req;
+    while (stream->Read(&req))
+    {
+        // The first message holds the config. Only the encoding is used.
+        if (req.request_case() !=
+            CubicPB::StreamingRecognizeRequest::kAudio)
+        {
+            flac = req.config().audio_encoding() ==
+                   CubicPB::RecognitionConfig::FLAC;
+            continue;
+        }
+
+        if (flac)
+        {
+            flacSamples.add(req.audio());
+            numBytes = 2 * flacSamples.samples();
+        }
+        else
+        {
+            numBytes += req.audio().size();
+        }
+        int64_t receivedMs = audioMs(numBytes);
+
+        // Send the results that are due, in the order of the audio they
+        // cover.
+        while (true)
+        {
+            int64_t nextFinal = utteranceStart + mOptions.utteranceMs;
+            bool partialDue = mOptions.partialIntervalMs > 0 &&
+                              nextPartial < nextFinal &&
+                              nextPartial <= receivedMs;
+
+            if (partialDue)
+            {
+                if (!send(utteranceStart, nextPartial, true))
+                {
+                    return grpc::Status::OK;
+                }
+                nextPartial += mOptions.partialIntervalMs;
+            }
+            else if (nextFinal <= receivedMs)
+            {
+                if (!send(utteranceStart, nextFinal, false))
+                {
+                    return grpc::Status::OK;
+                }
+                utteranceStart = nextFinal;
+                nextPartial = utteranceStart + mOptions.partialIntervalMs;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    if (flac)
+    {
+        flacSamples.finish();
+        numBytes = 2 * flacSamples.samples();
+    }
+
+    // Finish the last utterance once the client has sent all its audio.
+    int64_t totalMs = audioMs(numBytes);
+    if (totalMs > utteranceStart)
+    {
+        send(utteranceStart, totalMs, false);
+    }
+
+    return grpc::Status::OK;
+}
+
+grpc::Status
+MockCubicServer::CompileContext(grpc::ServerContext *,
+                                const CubicPB::CompileContextRequest *request,
+                                CubicPB::CompileContextResponse *response)
+{
+    // The "compiled" data is just the phrases, one per line.
+    std::string data;
+    for (const CubicPB::ContextPhrase &phrase : request->phrases())
+    {
+        data += phrase.text() + "\n";
+    }
+    response->mutable_context()->set_data(data);
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(mOptions.processingDelayMs));
+    return grpc::Status::OK;
+}
+
+int64_t MockCubicServer::audioMs(uint64_t numBytes) const
+{
+    // 16-bit mono audio
+    return static_cast<int64_t>(numBytes * 1000 /
+                                (2 * uint64_t(mOptions.sampleRate)));
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOCK_CUBIC_SERVER_H
+#define MOCK_CUBIC_SERVER_H
+
+#include "cubic.grpc.pb.h"
+
+#include <grpcpp/server.h>
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+/*
+ * MockCubicServer is an in-process stand-in for a Cubic server, used by
+ * the benchmarks to measure the client side of the SDK without a real
+ * ASR engine. It accepts 16-bit mono RAW_LINEAR16 or FLAC audio and
+ * returns placeholder transcripts on a fixed schedule based on how much
+ * audio it has received, with word timings set so that results can be
+ * matched to the audio that produced them.
+ */
+class MockCubicServer : public cobaltspeech::cubic::Cubic::Service
+{
+public:
+    struct Options
+    {
+        // Sample rate reported for the model and used to convert bytes
+        // of audio to time.
+        unsigned int sampleRate;
+
+        // Simulated processing time before each result is sent. Each
+        // result is delayed from the moment it is due, independently of
+        // the others, and audio keeps being read in the meantime.
+        int processingDelayMs;
+
+        // A partial result is sent every partialIntervalMs of audio.
+        // Set to zero to disable partial results.
+        int partialIntervalMs;
+
+        // A final result is sent every utteranceMs of audio, and when
+        // the client finishes sending audio.
+        int utteranceMs;
+
+        Options();
+    };
+
+    MockCubicServer(const Options &opts = Options());
+    ~MockCubicServer();
+
+    /*
+     * Start serving on a free port on the loopback interface. Throws
+     * std::runtime_error if the server could not be started.
+     */
+    void start();
+
+    // Shut down the server, cancelling any active streams.
+    void stop();
+
+    // Returns the address clients should connect to, such as
+    // "127.0.0.1:34567".
+    std::string address() const;
+
+    /*
+     * Returns the number of distinct client connections that have opened
+     * streams on this server. Clients that share a channel (or whose
+     * channels share a connection) count once.
+     */
+    size_t connectionCount() const;
+
+    grpc::Status Version(grpc::ServerContext *context,
+                         const google::protobuf::Empty *request,
+                         cobaltspeech::cubic::VersionResponse *response)
+        override;
+
+    grpc::Status ListModels(grpc::ServerContext *context,
+                            const cobaltspeech::cubic::ListModelsRequest *request,
+                            cobaltspeech::cubic::ListModelsResponse *response)
+        override;
+
+    grpc::Status Recognize(grpc::ServerContext *context,
+                           const cobaltspeech::cubic::RecognizeRequest *request,
+                           cobaltspeech::cubic::RecognitionResponse *response)
+        override;
+
+    grpc::Status StreamingRecognize(
+        grpc::ServerContext *context,
+        grpc::ServerReaderWriter<cobaltspeech::cubic::RecognitionResponse,
+                                 cobaltspeech::cubic::StreamingRecognizeRequest>
+            *stream) override;
+
+    grpc::Status CompileContext(
+        grpc::ServerContext *context,
+        const cobaltspeech::cubic::CompileContextRequest *request,
+        cobaltspeech::cubic::CompileContextResponse *response) override;
+
+private:
+    Options mOptions;
+    std::unique_ptr<grpc::Server> mServer;
+    int mPort;
+
+    mutable std::mutex mPeersMutex;
+    std::set<std::string> mPeers;
+
+    // Converts a number of bytes of audio to milliseconds.
+    int64_t audioMs(uint64_t numBytes) const;
+};
+
+#endif // MOCK_CUBIC_SERVER_H
@@ -0,0 +1,303 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_client.h"
+#include "cubic_exception.h"
+#include "audio_converter.h"
+#include "channel_splitter.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
+#include "result_reader.h"
+#include "transcript_merger.h"
+#include "wav_header.h"
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+// Some useful variables to define the client configuration
+const std::string serverAddress = "localhost:2727";
+
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The file is read in blocks of this size, and each block's audio is
+// pushed to every channel's stream before the next block is read.
+const size_t readSize = 32768;
+
+// One channel of the recording, recognized over its own stream.
+struct Channel {
+    std::unique_ptr<AudioConverter> converter;
+    std::unique_ptr<CubicRecognizerStream> stream;
+    std::thread resultsThread;
+    std::string pcm;
+    bool failed = false;
+};
+
+// Formats a time in seconds as h:mm:ss.ss.
+std::string formatTime(double seconds) {
+    int whole = static_cast<int>(seconds);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%d:%02d:%05.2f", whole / 3600,
+                  (whole / 60) % 60, seconds - (whole / 60) * 60);
+    return buf;
+}
+
+// Pushes a channel's converted audio to its stream. A stream that fails
+// is not sent any more audio; the error is reported by close().
+void pushChannel(Channel &ch) {
+    if (!ch.failed && !ch.pcm.empty()) {
+        try {
+            ch.stream->pushAudio(ch.pcm.data(), ch.pcm.size());
+        } catch (CubicException &) {
+            ch.failed = true;
+        }
+    }
+    ch.pcm.clear();
+}
+
+void printUsage(const char *prog) {
+    std::cerr << "Usage: " << prog << " <audio> [speaker...]" << std::endl
+              << "  audio    a WAV file with one speaker on each channel,"
+              << std::endl
+              << "           or - to read it from stdin" << std::endl
+              << "  speaker  the name of the speaker on each channel, in"
+              << std::endl
+              << "           order (default \"Channel 1\", \"Channel 2\"...)"
+              << std::endl;
+}
+
+/*
+ * This client demonstrates transcribing a recording with a different
+ * speaker on each channel, such as a call recording with the agent on
+ * the left and the customer on the right. The file is parsed as it is
+ * read, each channel is split out and sent over its own stream at the
+ * same time as the others, and the results are merged into a single
+ * transcript in time order, labelled with each channel's speaker. No
+ * separate file is written for each channel.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const std::string audioPath = argv[1];
+    std::vector<std::string> speakers(argv + 2, argv + argc);
+
+    try {
+        // Create the client (note this is an insecure connection,
+        // which is not recommended for production).
+        CubicClient client(serverAddress);
+
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
+        // Display the Cubic version
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
+        std::cout << "Connected to " << serverAddress << std::endl;
+        std::cout << std::endl;
+
+        // Use the first model for every channel
+        const std::vector<CubicModel> &models = startup.models();
+        if (models.empty()) {
+            throw std::runtime_error("server has no models");
+        }
+        const unsigned int sampleRate = models[0].sampleRate();
+        CubicPB::RecognitionConfig cfg;
+        cfg.set_model_id(models[0].id());
+        cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
+
+        std::unique_ptr<FILE, int (*)(FILE *)> file(nullptr, std::fclose);
+        FILE *in = stdin;
+        if (audioPath != "-") {
+            file.reset(std::fopen(audioPath.c_str(), "rb"));
+            if (!file) {
+                throw std::runtime_error("could not open " + audioPath);
+            }
+            in = file.get();
+        }
+
+        // The channels are set up once the header has been read, which
+        // is just before the first sample data is found.
+        WavParser parser;
+        std::unique_ptr<ChannelSplitter> splitter;
+        std::unique_ptr<TranscriptMerger> merger;
+        std::vector<Channel> channels;
+        std::vector<std::string> split;
+        std::string readError;
+
+        std::vector<char> block(readSize);
+        try {
+            while (size_t n = std::fread(block.data(), 1, block.size(), in)) {
+                const char *data = block.data();
+                while (n > 0) {
+                    const char *audio;
+                    size_t audioSize;
+                    size_t used = parser.parse(data, n, &audio, &audioSize);
+                    data += used;
+                    n -= used;
+                    if (audioSize == 0) {
+                        continue;
+                    }
+
+                    if (channels.empty()) {
+                        // Each channel is converted on its own to 16-bit
+                        // mono audio at the model's sample rate, unless it
+                        // is already in that format.
+                        const WavFormat &wav = parser.format();
+                        AudioConverter::Format channelFormat;
+                        if (!converterFormat(wav, &channelFormat)) {
+                            throw std::runtime_error(audioPath +
+                                                     " uses an unsupported sample format");
+                        }
+                        channelFormat.channels = 1;
+                        splitter.reset(new ChannelSplitter(wav.channels, wav.bitsPerSample / 8));
+
+                        for (size_t c = speakers.size(); c < wav.channels; c++) {
+                            speakers.push_back("Channel " + std::to_string(c + 1));
+                        }
+                        speakers.resize(wav.channels);
+
+                        std::cout << "Transcribing " << wav.channels
+                                  << " channels" << std::endl;
+                        std::cout << "\nTranscripts:" << std::endl;
+
+                        // Print the merged results as they become ready
+                        merger.reset(new TranscriptMerger(speakers,
+                            [](const std::string &speaker,
+                               const CubicPB::RecognitionResult &result) {
+                                const CubicPB::RecognitionAlternative &alt =
+                                    result.alternatives(0);
+                                double start = alt.start_time().seconds() +
+                                               alt.start_time().nanos() / 1e9;
+                                std::cout << "[" << formatTime(start) << "] "
+                                          << speaker << ": " << alt.transcript()
+                                          << std::endl;
+                            }));
+
+                        // Start every stream, each with a thread passing
+                        // its results to the merger.
+                        channels.resize(wav.channels);
+                        for (size_t c = 0; c < channels.size(); c++) {
+                            Channel &ch = channels[c];
+                            ch.converter.reset(new AudioConverter(channelFormat, sampleRate));
+                            if (ch.converter->passthrough()) {
+                                ch.converter.reset();
+                            }
+                            ch.stream.reset(new CubicRecognizerStream(
+                                client.streamingRecognize(cfg)));
+                            TranscriptMerger *m = merger.get();
+                            CubicRecognizerStream *stream = ch.stream.get();
+                            ch.resultsThread = std::thread([m, stream, c]() {
+                                ResultReader reader(*stream);
+                                while (const CubicPB::RecognitionResponse *resp = reader.next()) {
+                                    for (const CubicPB::RecognitionResult &result : resp->results()) {
+                                        m->add(c, result);
+                                    }
+                                }
+                                m->finish(c);
+                            });
+                        }
+                    }
+
+                    // Split the samples out to each channel, convert
+                    // them if needed, and send them
+                    splitter->split(audio, audioSize, &split);
+                    for (size_t c = 0; c < channels.size(); c++) {
+                        Channel &ch = channels[c];
+                        if (ch.converter) {
+                            ch.converter->convert(split[c].data(), split[c].size(), &ch.pcm);
+                        } else {
+                            ch.pcm.swap(split[c]);
+                        }
+                        split[c].clear();
+                        pushChannel(ch);
+                    }
+                }
+            }
+            if (std::ferror(in)) {
+                readError = "could not read " + audioPath;
+            }
+        } catch (std::exception &e) {
+            // The streams are finished below before this is reported.
+            readError = e.what();
+        }
+
+        // Let Cubic know that no more audio will be coming, wait for the
+        // last results, and report any stream that failed.
+        for (Channel &ch : channels) {
+            if (!ch.stream) {
+                continue;
+            }
+            if (ch.converter) {
+                ch.converter->flush(&ch.pcm);
+            }
+            pushChannel(ch);
+            ch.stream->audioFinished();
+        }
+        size_t numFailed = 0;
+        for (size_t c = 0; c < channels.size(); c++) {
+            if (!channels[c].resultsThread.joinable()) {
+                // Starting the streams failed before this channel's, so
+                // the results of the channels that did start must not
+                // wait for it.
+                merger->finish(c);
+                continue;
+            }
+            channels[c].resultsThread.join();
+            try {
+                channels[c].stream->close();
+            } catch (CubicException &e) {
+                numFailed++;
+                std::cerr << speakers[c] << " failed: " << e.what() << std::endl;
+            }
+        }
+
+        if (!readError.empty()) {
+            throw std::runtime_error(readError);
+        }
+        if (channels.empty()) {
+            throw std::runtime_error(audioPath + " has no audio");
+        }
+
+        std::cout << "\nMerged " << merger->resultsMerged() << " results from "
+                  << channels.size() << " channels (" << numFailed
+                  << " failed)" << std::endl;
+
+    } catch (CubicException &e) {
+        std::cerr << "Cubic error: " << e.what() << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    std::cout << "\nDone." << std::endl;
+}
@@ -15,12 +15,10 @@
  */
 
 #include "recorder.h"
+#include "trace.h"
 
-#include <unistd.h>
-#include <stdexcept>
-
-Recorder::Recorder(const std::string &record_cmd, size_t maxBuffSize)
-    : mCmd(record_cmd), mBufferSize(maxBuffSize), mStdout(nullptr)
+Recorder::Recorder(const std::string &record_cmd)
+    : mProcess(record_cmd)
 {
 }
 
@@ -28,40 +26,26 @@ Recorder::~Recorder() {}
 
 void Recorder::start()
 {
-    // Ignore if the recorder is already running
-    if (mStdout)
-        return;
-
-    // Start the external process
-    mStdout = popen(mCmd.c_str(), "r");
+    TRACE_SCOPE("Recorder::start");
+    // Start the external process. This is ignored if it is already
+    // running.
+    mProcess.start();
 }
 
-std::string Recorder::readAudio()
+size_t Recorder::readAudio(char *buffer, size_t buffSize)
 {
-    // Throw an error if the recorder is not running.
-    if (mStdout == nullptr)
-    {
-        throw std::runtime_error("can't read audio - recorder not started.");
-    }
-
-    char *buffer = new char[mBufferSize];
-
-    size_t charsRead = fread(buffer, 1, mBufferSize, mStdout);
-
-    std::string result(buffer, charsRead);
-    delete[] buffer;
-    return result;
+    TRACE_SCOPE("Recorder::readAudio");
+    return mProcess.read(buffer, buffSize);
 }
 
-void Recorder::stop()
+void Recorder::cancel()
 {
-    // Ignore if the recorder is already stopped
-    if (mStdout == nullptr)
-    {
-        return;
-    }
+    mProcess.cancel();
+}
 
-    // Close the stdout stream, which should also close the application.
-    pclose(mStdout);
-    mStdout = nullptr;
+int Recorder::stop()
+{
+    // Stop the external process without waiting for it to fill another
+    // buffer. This is ignored if it is already stopped.
+    return mProcess.stop();
 }
@@ -17,7 +17,8 @@
 #ifndef RECORDER_H
 #define RECORDER_H
 
-#include <cstdio>
+#include "process_source.h"
+
 #include <string>
 
 class Recorder
@@ -25,29 +26,37 @@ class Recorder
 public:
     /*
      * Create a new recorder instance that will launch the given external
-     * application (record_cmd). maxBuffSize defines the maximum amount of
-     * audio data (in bytes) that will be retrieved with each call to
-     * readAudio(). The default is 8kB.
+     * application (record_cmd).
      */
-    Recorder(const std::string &record_cmd, size_t maxBuffSize = 8192);
+    Recorder(const std::string &record_cmd);
     ~Recorder();
 
     // Start recording audio.
     void start();
 
     /*
-     * Read audio data from the recorder app. The binary data is returned
-     * as a string (think of it as an array of chars, or bytes).
+     * Read up to buffSize bytes of audio data from the recorder app into
+     * the given buffer, returning the number of bytes read. This waits
+     * until some audio is available, but returns as soon as any arrives,
+     * so fewer than buffSize bytes may be returned. A return value of
+     * zero means the recorder app has exited or cancel() was called.
+     */
+    size_t readAudio(char *buffer, size_t buffSize);
+
+    /*
+     * Interrupt a readAudio() call waiting on another thread. All later
+     * calls to readAudio() return zero until the recorder is restarted.
      */
-    std::string readAudio();
+    void cancel();
 
-    // Stop recording audio, and return the recorded data.
-    void stop();
+    /*
+     * Stop recording audio, and return the wait status of the recorder
+     * app (see waitpid(2)), or -1 if it was not running.
+     */
+    int stop();
 
 private:
-    std::string mCmd;
-    size_t mBufferSize;
-    FILE *mStdout;
+    ProcessSource mProcess;
 };
 
 #endif // RECORDER_H
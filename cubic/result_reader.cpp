@@ -0,0 +1,64 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "result_reader.h"
+
+#include <algorithm>
+
+namespace
+{
+
+google::protobuf::ArenaOptions arenaOptions(std::vector<char> &block)
+{
+    google::protobuf::ArenaOptions opts;
+    opts.initial_block = block.data();
+    opts.initial_block_size = block.size();
+    return opts;
+}
+
+} // namespace
+
+ResultReader::ResultReader(size_t initialSize)
+    : mInitialBlock(initialSize), mArena(arenaOptions(mInitialBlock)),
+      mResponse(nullptr), mMaxSpaceUsed(0)
+{
+}
+
+ResultReader::~ResultReader() {}
+
+cobaltspeech::cubic::RecognitionResponse *ResultReader::next()
+{
+    // Release the previous response all at once. The initial block is
+    // kept, so a response that fits in it needs no new allocations.
+    if (mResponse)
+    {
+        mMaxSpaceUsed = std::max<size_t>(mMaxSpaceUsed, mArena.SpaceUsed());
+        mArena.Reset();
+    }
+
+    mResponse = google::protobuf::Arena::CreateMessage<
+        cobaltspeech::cubic::RecognitionResponse>(&mArena);
+    if (!mReceive(mResponse))
+    {
+        return nullptr;
+    }
+    return mResponse;
+}
+
+size_t ResultReader::maxSpaceUsed() const
+{
+    return mMaxSpaceUsed;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RESULT_READER_H
+#define RESULT_READER_H
+
+#include "cubic_client.h"
+
+#include <google/protobuf/arena.h>
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/*
+ * ResultReader reads the responses from a streaming recognition request
+ * without allocating memory for each one. Every response is parsed into
+ * a message on a protobuf Arena, and the arena is reset before the next
+ * response is read, so its memory (results, alternatives and word
+ * timings alike) is reused rather than freed and allocated again.
+ *
+ * A response and any reference into it are only valid until the next
+ * call to next(). Work with the results in place, through const
+ * references, rather than copying them out:
+ *
+ *     ResultReader reader(stream);
+ *     while (const auto *resp = reader.next()) {
+ *         for (const auto &result : resp->results()) {
+ *             ...
+ *         }
+ *     }
+ */
+class ResultReader
+{
+public:
+    /*
+     * Create a reader for the given stream. The arena starts with a
+     * block of initialSize bytes, which is enough for typical responses;
+     * larger responses add blocks that are released by the next reset.
+     */
+    template <typename Stream>
+    ResultReader(Stream &stream, size_t initialSize = 64 * 1024);
+    ~ResultReader();
+
+    /*
+     * Wait for the next response and return it, or return nullptr once
+     * the stream has no more results. The response may be modified in
+     * place (for example, to adjust timestamps).
+     */
+    cobaltspeech::cubic::RecognitionResponse *next();
+
+    // Returns the arena space used by the largest response so far.
+    size_t maxSpaceUsed() const;
+
+private:
+    std::function<bool(cobaltspeech::cubic::RecognitionResponse *)> mReceive;
+    std::vector<char> mInitialBlock;
+    google::protobuf::Arena mArena;
+    cobaltspeech::cubic::RecognitionResponse *mResponse;
+    size_t mMaxSpaceUsed;
+
+    explicit ResultReader(size_t initialSize);
+
+    ResultReader(const ResultReader &) = delete;
+    ResultReader &operator=(const ResultReader &) = delete;
+};
+
+/*
+ * The stream may be a CubicRecognizerStream, or anything else with the
+ * same receiveResults() method (such as a ResumableStream).
+ */
+template <typename Stream>
+ResultReader::ResultReader(Stream &stream, size_t initialSize)
+    : ResultReader(initialSize)
+{
+    mReceive = [&stream](cobaltspeech::cubic::RecognitionResponse *resp) {
+        return stream.receiveResults(resp);
+    };
+}
+
+#endif // RESULT_READER_H
@@ -0,0 +1,471 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resumable_stream.h"
+#include "cubic_exception.h"
+#include "trace.h"
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// Replayed audio is sent in pieces of this size.
+const size_t replayChunkSize = 32 * 1024;
+
+void setSeconds(google::protobuf::Duration *d, double seconds)
+{
+    double whole = std::floor(seconds);
+    d->set_seconds(static_cast<int64_t>(whole));
+    d->set_nanos(static_cast<int32_t>((seconds - whole) * 1e9));
+}
+
+double toSeconds(const google::protobuf::Duration &d)
+{
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+void shift(google::protobuf::Duration *start, double offset)
+{
+    setSeconds(start, toSeconds(*start) + offset);
+}
+
+// Returns true if a stream that failed with the given status could
+// succeed if it were tried again. The rest describe a problem with the
+// request or the client's credentials, which a new stream would share.
+bool isTransient(const grpc::Status &status)
+{
+    switch (status.error_code())
+    {
+    case grpc::StatusCode::INVALID_ARGUMENT:
+    case grpc::StatusCode::NOT_FOUND:
+    case grpc::StatusCode::ALREADY_EXISTS:
+    case grpc::StatusCode::PERMISSION_DENIED:
+    case grpc::StatusCode::FAILED_PRECONDITION:
+    case grpc::StatusCode::OUT_OF_RANGE:
+    case grpc::StatusCode::UNIMPLEMENTED:
+    case grpc::StatusCode::UNAUTHENTICATED:
+        return false;
+    default:
+        return true;
+    }
+}
+
+std::string errorMessage(const grpc::Status &status)
+{
+    if (!status.error_message().empty())
+    {
+        return status.error_message();
+    }
+    return "stream failed with status code " +
+           std::to_string(static_cast<int>(status.error_code()));
+}
+
+} // namespace
+
+ResumableStream::Options::Options() :
+    bytesPerSecond(32000.0),
+    frameBytes(2),
+    headerBytes(0),
+    maxReplayBytes(2 * 1024 * 1024),
+    maxAttempts(5),
+    retryDelayMs(250),
+    maxRetryDelayMs(5000),
+    metrics(nullptr)
+{}
+
+ResumableStream::ResumableStream(const std::string &url,
+                                 const CubicPB::RecognitionConfig &config,
+                                 const Options &opts) :
+    mConfig(config),
+    mOptions(opts),
+    mWriteFailed(false),
+    mAudioFinished(false),
+    mDone(false),
+    mReplayStart(0),
+    mStreamStart(0),
+    mAttempts(0),
+    mResumes(0),
+    mReplayedBytes(0),
+    mReplayDroppedBytes(0)
+{
+    init(grpc::CreateChannel(url, grpc::InsecureChannelCredentials()));
+}
+
+ResumableStream::ResumableStream(const std::shared_ptr<grpc::Channel> &channel,
+                                 const CubicPB::RecognitionConfig &config,
+                                 const Options &opts) :
+    mConfig(config),
+    mOptions(opts),
+    mWriteFailed(false),
+    mAudioFinished(false),
+    mDone(false),
+    mReplayStart(0),
+    mStreamStart(0),
+    mAttempts(0),
+    mResumes(0),
+    mReplayedBytes(0),
+    mReplayDroppedBytes(0)
+{
+    init(channel);
+}
+
+ResumableStream::~ResumableStream()
+{
+    // Cancel a call that was never read to the end, so that it does not
+    // outlive the stream.
+    if (mCall && !mCall->finished)
+    {
+        mCall->context.TryCancel();
+        finishCall();
+    }
+}
+
+void ResumableStream::pushAudio(const char *audioData, size_t sizeInBytes)
+{
+    TRACE_SCOPE("ResumableStream::pushAudio");
+    std::lock_guard<std::mutex> writeLock(mWriteMutex);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mDone)
+        {
+            return;
+        }
+
+        size_t header = 0;
+        if (mHeader.size() < mOptions.headerBytes)
+        {
+            header = std::min(sizeInBytes, mOptions.headerBytes - mHeader.size());
+            mHeader.append(audioData, header);
+        }
+
+        if (mOptions.maxReplayBytes > 0)
+        {
+            mReplay.append(audioData + header, sizeInBytes - header);
+            if (mReplay.size() > mOptions.maxReplayBytes)
+            {
+                // Drop whole frames, so the replay starts on a sample
+                size_t excess = mReplay.size() - mOptions.maxReplayBytes;
+                excess += (mOptions.frameBytes - excess % mOptions.frameBytes) %
+                          mOptions.frameBytes;
+                excess = std::min(excess, mReplay.size());
+                mReplay.erase(0, excess);
+                mReplayStart += excess;
+                mReplayDroppedBytes += excess;
+            }
+        }
+    }
+
+    // A failed write is noticed by the thread receiving results, which
+    // replaces the stream and sends this audio again from the buffer.
+    if (!mWriteFailed)
+    {
+        CubicPB::StreamingRecognizeRequest request;
+        request.set_audio(audioData, sizeInBytes);
+        CubicMetrics::Clock::time_point start = CubicMetrics::Clock::now();
+        if (!mCall->stream->Write(request))
+        {
+            mWriteFailed = true;
+        }
+        else if (mMetrics)
+        {
+            mMetrics->pushed(sizeInBytes, start);
+        }
+    }
+}
+
+void ResumableStream::audioFinished()
+{
+    std::lock_guard<std::mutex> writeLock(mWriteMutex);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAudioFinished = true;
+    }
+
+    if (!mWriteFailed)
+    {
+        mCall->stream->WritesDone();
+    }
+}
+
+bool ResumableStream::receiveResults(CubicPB::RecognitionResponse *response)
+{
+    TRACE_SCOPE("ResumableStream::receiveResults");
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mDone)
+            {
+                return false;
+            }
+        }
+
+        if (mCall->stream->Read(response))
+        {
+            double offset;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                offset = mStreamStart / mOptions.bytesPerSecond;
+            }
+
+            for (CubicPB::RecognitionResult &result : *response->mutable_results())
+            {
+                if (offset > 0)
+                {
+                    for (CubicPB::RecognitionAlternative &alt : *result.mutable_alternatives())
+                    {
+                        shift(alt.mutable_start_time(), offset);
+                        for (CubicPB::WordInfo &word : *alt.mutable_words())
+                        {
+                            shift(word.mutable_start_time(), offset);
+                        }
+                    }
+                }
+
+                // Audio before the end of a final result is no longer
+                // needed for replay.
+                if (!result.is_partial() && result.alternatives_size() > 0)
+                {
+                    const CubicPB::RecognitionAlternative &alt = result.alternatives(0);
+                    acknowledge(toSeconds(alt.start_time()) + toSeconds(alt.duration()));
+                }
+            }
+
+            if (mMetrics)
+            {
+                mMetrics->received(*response);
+            }
+            return true;
+        }
+
+        // The stream has ended, either because all of the audio has been
+        // recognized or because it failed.
+        grpc::Status status;
+        {
+            std::lock_guard<std::mutex> writeLock(mWriteMutex);
+            status = finishCall();
+            if (status.ok())
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mDone = true;
+                return false;
+            }
+
+            // Writes to the failed stream can only fail, so stop them
+            // until resume() has opened a new one, instead of letting
+            // them go to the dead stream during the retry delay.
+            mWriteFailed = true;
+        }
+
+        if (!resume(status))
+        {
+            return false;
+        }
+    }
+}
+
+void ResumableStream::close()
+{
+    CubicPB::RecognitionResponse response;
+    while (receiveResults(&response))
+    {
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mError.empty())
+    {
+        throw CubicException(mError);
+    }
+}
+
+uint64_t ResumableStream::resumes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mResumes;
+}
+
+uint64_t ResumableStream::replayedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReplayedBytes;
+}
+
+uint64_t ResumableStream::replayDroppedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReplayDroppedBytes;
+}
+
+void ResumableStream::init(const std::shared_ptr<grpc::Channel> &channel)
+{
+    if (mOptions.frameBytes == 0)
+    {
+        mOptions.frameBytes = 1;
+    }
+    if (mOptions.metrics)
+    {
+        mMetrics.reset(new CubicMetrics::Stream(*mOptions.metrics,
+                                                mOptions.bytesPerSecond,
+                                                mOptions.headerBytes));
+    }
+
+    mStub = CubicPB::Cubic::NewStub(channel);
+    grpc::Status status;
+    if (!openCall(&status))
+    {
+        throw CubicException(errorMessage(status));
+    }
+}
+
+bool ResumableStream::openCall(grpc::Status *status)
+{
+    // The first message on a stream holds the config, as with the SDK
+    mCall.reset(new Call);
+    mCall->stream = mStub->StreamingRecognize(&mCall->context);
+    CubicPB::StreamingRecognizeRequest request;
+    *(request.mutable_config()) = mConfig;
+    if (!mCall->stream->Write(request))
+    {
+        *status = finishCall();
+        return false;
+    }
+    return true;
+}
+
+grpc::Status ResumableStream::finishCall()
+{
+    // A write only fails once the call is over, so any responses left
+    // to read are already here. They are discarded, since the stream is
+    // being replaced.
+    CubicPB::RecognitionResponse discard;
+    while (mCall->stream->Read(&discard))
+    {
+    }
+    mCall->finished = true;
+    return mCall->stream->Finish();
+}
+
+bool ResumableStream::resume(const grpc::Status &status)
+{
+    TRACE_SCOPE("ResumableStream::resume");
+    grpc::Status lastStatus = status;
+    while (true)
+    {
+        int delayMs;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mOptions.maxReplayBytes == 0 || !isTransient(lastStatus) ||
+                mAttempts >= mOptions.maxAttempts)
+            {
+                mError = errorMessage(lastStatus);
+                mDone = true;
+                return false;
+            }
+
+            delayMs = mOptions.retryDelayMs;
+            for (int i = 0; i < mAttempts && delayMs < mOptions.maxRetryDelayMs; i++)
+            {
+                delayMs *= 2;
+            }
+            delayMs = std::min(delayMs, mOptions.maxRetryDelayMs);
+            mAttempts++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+
+        // Hold off the pushing thread while the new stream catches up, so
+        // that its audio follows the replay.
+        std::lock_guard<std::mutex> writeLock(mWriteMutex);
+        std::string replay;
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            replay = mHeader + mReplay;
+            finished = mAudioFinished;
+            mStreamStart = mReplayStart;
+        }
+
+        if (!openCall(&lastStatus))
+        {
+            continue;
+        }
+
+        bool ok = true;
+        CubicPB::StreamingRecognizeRequest request;
+        for (size_t pos = 0; ok && pos < replay.size(); pos += replayChunkSize)
+        {
+            request.set_audio(replay.data() + pos,
+                              std::min(replayChunkSize, replay.size() - pos));
+            ok = mCall->stream->Write(request);
+        }
+        if (ok && finished)
+        {
+            ok = mCall->stream->WritesDone();
+        }
+        if (!ok)
+        {
+            // Try again with another stream. This one may already have
+            // been given some of the audio, so its results are not used.
+            lastStatus = finishCall();
+            continue;
+        }
+        mWriteFailed = false;
+
+        if (mMetrics)
+        {
+            mMetrics->resumed();
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mResumes++;
+        mReplayedBytes += replay.size() - mHeader.size();
+        return true;
+    }
+}
+
+void ResumableStream::acknowledge(double endSeconds)
+{
+    uint64_t end = static_cast<uint64_t>(std::max(0.0, endSeconds) * mOptions.bytesPerSecond);
+    end -= end % mOptions.frameBytes;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (end <= mReplayStart)
+    {
+        return;
+    }
+
+    size_t n = std::min<uint64_t>(end - mReplayStart, mReplay.size());
+    mReplay.erase(0, n);
+    mReplayStart += n;
+
+    // Cubic has finished with audio past the point where the stream was
+    // last resumed, so the stream is making progress again. Any other
+    // response (such as a partial result, or a final result for audio
+    // already acknowledged) leaves the attempts as they are, or a server
+    // that answers once and then fails would be retried forever.
+    if (n > 0)
+    {
+        mAttempts = 0;
+    }
+}
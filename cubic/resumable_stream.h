@@ -0,0 +1,201 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RESUMABLE_STREAM_H
+#define RESUMABLE_STREAM_H
+
+#include "cubic.grpc.pb.h"
+#include "cubic_metrics.h"
+
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+ * ResumableStream is a streaming recognition request that survives the
+ * stream failing partway through. It is used like the stream returned
+ * by CubicClient::streamingRecognize(), with one thread pushing audio
+ * and another receiving results. It makes the gRPC call itself, rather
+ * than through the SDK, so that it can see the status code of a failed
+ * stream.
+ *
+ * The audio sent since the last final result is kept in a replay buffer.
+ * If the stream fails, receiveResults() opens a new stream with the same
+ * config, sends that audio again, and carries on, so only the audio that
+ * Cubic had not finished with is recognized twice. Results from the new
+ * stream have their times moved onto the timeline of the audio as it was
+ * first pushed, so callers cannot tell that the stream was replaced.
+ *
+ * Failures that may be transient (such as UNAVAILABLE or an internal
+ * error) are retried. Errors that would only happen again, such as
+ * INVALID_ARGUMENT, NOT_FOUND or UNAUTHENTICATED, are reported by
+ * close() straight away. A stream that fails again before a final
+ * result covers audio past the point where it was resumed counts as
+ * another attempt, and after maxAttempts the error is reported as well. From the time a stream fails until its replacement
+ * is open, pushAudio() only adds to the replay buffer, and it never
+ * throws.
+ *
+ * The replay buffer holds at most maxReplayBytes. If no final result
+ * arrives before it fills, its oldest audio is discarded, and that audio
+ * is missing from the results if the stream then fails. Replaying needs
+ * audio that can be cut at any sample, so it works with WAV and
+ * RAW_LINEAR16 audio but not compressed audio; with a maxReplayBytes of
+ * zero, nothing is kept and a failure ends the stream as usual.
+ */
+class ResumableStream
+{
+public:
+    struct Options
+    {
+        // The rate of the pushed audio, used to convert result times to
+        // byte offsets, and the size of one sample frame.
+        double bytesPerSecond;
+        size_t frameBytes;
+
+        // The first headerBytes of audio pushed (such as a WAV header)
+        // are sent again at the start of every new stream, and are not
+        // part of the audio timeline.
+        size_t headerBytes;
+
+        // The most audio kept for replay. Zero disables resuming.
+        size_t maxReplayBytes;
+
+        // The number of times a stream may be opened without a final
+        // result moving past the resume point in between, and the delay
+        // before the first retry, which doubles with each attempt up to
+        // maxRetryDelayMs.
+        int maxAttempts;
+        int retryDelayMs;
+        int maxRetryDelayMs;
+
+        // If set, the stream's pushes, results and resumes are recorded.
+        CubicMetrics *metrics;
+
+        Options();
+    };
+
+    /*
+     * Start streaming recognition with the given config on the server at
+     * url (note this is an insecure connection, which is not recommended
+     * for production), or on an existing channel. Throws CubicException
+     * if the first stream cannot be opened.
+     */
+    ResumableStream(const std::string &url,
+                    const cobaltspeech::cubic::RecognitionConfig &config,
+                    const Options &opts = Options());
+    ResumableStream(const std::shared_ptr<grpc::Channel> &channel,
+                    const cobaltspeech::cubic::RecognitionConfig &config,
+                    const Options &opts = Options());
+    ~ResumableStream();
+
+    ResumableStream(const ResumableStream &) = delete;
+    ResumableStream &operator=(const ResumableStream &) = delete;
+
+    // Send audio to the stream, keeping it for replay.
+    void pushAudio(const char *audioData, size_t sizeInBytes);
+
+    // Indicate that no more audio will be pushed.
+    void audioFinished();
+
+    /*
+     * Wait for the next response, replacing the stream if it fails, and
+     * return false once there are no more results. Result times are on
+     * the timeline of the pushed audio.
+     */
+    bool receiveResults(cobaltspeech::cubic::RecognitionResponse *response);
+
+    /*
+     * Wait for the stream to end, discarding any results not yet
+     * received. Throws CubicException if the stream failed and could not
+     * be resumed.
+     */
+    void close();
+
+    // Returns the number of times the stream was replaced.
+    uint64_t resumes() const;
+
+    // Returns the number of bytes of audio sent again after a failure.
+    uint64_t replayedBytes() const;
+
+    // Returns the number of bytes discarded from a full replay buffer.
+    uint64_t replayDroppedBytes() const;
+
+private:
+    typedef grpc::ClientReaderWriter<
+        cobaltspeech::cubic::StreamingRecognizeRequest,
+        cobaltspeech::cubic::RecognitionResponse>
+        GrpcStream;
+
+    // One streaming call. A new one is made each time the stream is
+    // resumed.
+    struct Call
+    {
+        grpc::ClientContext context;
+        std::unique_ptr<GrpcStream> stream;
+        bool finished;
+
+        Call() : finished(false) {}
+    };
+
+    std::unique_ptr<cobaltspeech::cubic::Cubic::Stub> mStub;
+    cobaltspeech::cubic::RecognitionConfig mConfig;
+    Options mOptions;
+
+    /*
+     * mWriteMutex is held while writing to the stream and while it is
+     * replaced. Only the thread receiving results replaces mCall, so it
+     * reads from mCall without the lock. Everything below mCall is
+     * guarded by mMutex, which is never held while waiting on the
+     * network, so results can be received while a write is blocked.
+     */
+    std::mutex mWriteMutex;
+    std::unique_ptr<Call> mCall;
+    bool mWriteFailed;
+
+    mutable std::mutex mMutex;
+    bool mAudioFinished;
+    bool mDone;
+    std::string mError;
+
+    // The header, and the audio not yet covered by a final result.
+    // mReplayStart is the offset of the first byte of mReplay on the
+    // audio timeline, and mStreamStart is where the current stream's
+    // audio starts.
+    std::string mHeader;
+    std::string mReplay;
+    uint64_t mReplayStart;
+    uint64_t mStreamStart;
+
+    std::unique_ptr<CubicMetrics::Stream> mMetrics;
+
+    int mAttempts;
+    uint64_t mResumes;
+    uint64_t mReplayedBytes;
+    uint64_t mReplayDroppedBytes;
+
+    void init(const std::shared_ptr<grpc::Channel> &channel);
+    bool openCall(grpc::Status *status);
+    grpc::Status finishCall();
+    bool resume(const grpc::Status &status);
+    void acknowledge(double endSeconds);
+};
+
+#endif // RESUMABLE_STREAM_H
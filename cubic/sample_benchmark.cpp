@@ -0,0 +1,372 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_frames.h"
+#include "bench_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Benchmark settings, which may be changed from the command line.
+struct BenchOptions {
+    size_t frames = 480000;     // frames processed by each run (10s at 48kHz)
+    int runs = 50;              // timed runs of each kernel
+    std::string output;         // JSON output file (stdout if empty)
+};
+
+/*
+ * The format of some audio, known only at run time. The scalar kernels
+ * below use it the way code without the typed layer has to, deciding
+ * how to read and write every sample as it goes.
+ */
+struct RuntimeFormat {
+    int bits;
+    bool isFloat;
+    unsigned int channels;
+    bool bigEndian;
+
+    size_t sampleBytes() const { return bits / 8; }
+    size_t frameBytes() const { return sampleBytes() * channels; }
+};
+
+template <typename Format>
+RuntimeFormat runtimeFormat() {
+    using Traits = SampleTraits<typename Format::SampleType>;
+    RuntimeFormat f;
+    f.bits = Traits::Bits;
+    f.isFloat = Traits::IsFloat;
+    f.channels = Format::Channels;
+    f.bigEndian = Format::ByteOrder == Endian::Big;
+    return f;
+}
+
+// Reads a sample as a float from -1 to 1.
+float scalarLoad(const char *p, const RuntimeFormat &f) {
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    size_t n = f.sampleBytes();
+    uint32_t raw = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t k = f.bigEndian ? n - 1 - i : i;
+        raw |= uint32_t(u[k]) << (8 * i);
+    }
+
+    if (f.isFloat) {
+        float v;
+        std::memcpy(&v, &raw, sizeof(v));
+        return v;
+    }
+    int shift = 32 - f.bits;
+    int32_t v = int32_t(raw << shift) >> shift;
+    return float(v) / float(int64_t(1) << (f.bits - 1));
+}
+
+// Writes a float from -1 to 1 as a sample, rounding and clipping it.
+void scalarStore(float v, char *p, const RuntimeFormat &f) {
+    uint32_t raw;
+    if (f.isFloat) {
+        std::memcpy(&raw, &v, sizeof(raw));
+    } else {
+        double scale = double(int64_t(1) << (f.bits - 1));
+        double s = std::max(-scale, std::min(scale - 1, double(v) * scale));
+        raw = uint32_t(int32_t(std::lround(s)));
+    }
+
+    size_t n = f.sampleBytes();
+    for (size_t i = 0; i < n; i++) {
+        size_t k = f.bigEndian ? n - 1 - i : i;
+        p[k] = char((raw >> (8 * i)) & 0xFF);
+    }
+}
+
+void scalarConvert(const char *in, const RuntimeFormat &inFmt, size_t numFrames,
+                   char *out, const RuntimeFormat &outFmt) {
+    for (size_t i = 0; i < numFrames; i++) {
+        const char *src = in + i * inFmt.frameBytes();
+        char *dst = out + i * outFmt.frameBytes();
+        if (inFmt.channels == outFmt.channels) {
+            for (unsigned int ch = 0; ch < inFmt.channels; ch++) {
+                scalarStore(scalarLoad(src + ch * inFmt.sampleBytes(), inFmt),
+                            dst + ch * outFmt.sampleBytes(), outFmt);
+            }
+        } else if (outFmt.channels == 1) {
+            float sum = 0;
+            for (unsigned int ch = 0; ch < inFmt.channels; ch++) {
+                sum += scalarLoad(src + ch * inFmt.sampleBytes(), inFmt);
+            }
+            scalarStore(sum / inFmt.channels, dst, outFmt);
+        } else {
+            float v = scalarLoad(src, inFmt);
+            for (unsigned int ch = 0; ch < outFmt.channels; ch++) {
+                scalarStore(v, dst + ch * outFmt.sampleBytes(), outFmt);
+            }
+        }
+    }
+}
+
+void scalarGain(char *data, const RuntimeFormat &f, size_t numFrames,
+                float gain) {
+    for (size_t i = 0; i < numFrames * f.channels; i++) {
+        char *p = data + i * f.sampleBytes();
+        scalarStore(scalarLoad(p, f) * gain, p, f);
+    }
+}
+
+void scalarMix(char *dst, const char *src, const RuntimeFormat &f,
+               size_t numFrames) {
+    for (size_t i = 0; i < numFrames * f.channels; i++) {
+        char *p = dst + i * f.sampleBytes();
+        scalarStore(scalarLoad(p, f) + scalarLoad(src + i * f.sampleBytes(), f),
+                    p, f);
+    }
+}
+
+// Returns numFrames frames of noise in the given format.
+std::string makeAudio(const RuntimeFormat &f, size_t numFrames,
+                      uint32_t seed) {
+    std::string audio(numFrames * f.frameBytes(), '\0');
+    for (size_t i = 0; i < numFrames * f.channels; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        float v = float(int32_t(seed)) / 2147483648.0f * 0.8f;
+        scalarStore(v, &audio[i * f.sampleBytes()], f);
+    }
+    return audio;
+}
+
+/*
+ * Runs fn the given number of times, after calling setup (which is not
+ * timed) before each run, and returns the time taken per frame in ns.
+ */
+LatencyStats timeRuns(int runs, size_t numFrames,
+                      const std::function<void()> &setup,
+                      const std::function<void()> &fn) {
+    LatencyStats stats;
+    for (int i = 0; i < runs; i++) {
+        setup();
+        Clock::time_point start = Clock::now();
+        fn();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                        .count();
+        stats.add(ns / numFrames);
+    }
+    return stats;
+}
+
+// Returns the largest difference between two buffers of samples.
+template <typename Format>
+double maxDifference(const std::string &a, const std::string &b) {
+    FrameView<Format> va(a.data(), a.size());
+    FrameView<Format> vb(b.data(), b.size());
+    double maxDiff = 0;
+    for (size_t i = 0; i < va.frames(); i++) {
+        for (unsigned int ch = 0; ch < Format::Channels; ch++) {
+            double d = std::fabs(double(va.sample(i, ch)) - double(vb.sample(i, ch)));
+            maxDiff = std::max(maxDiff, d);
+        }
+    }
+    return maxDiff;
+}
+
+std::string caseJson(const std::string &name, size_t frameBytes,
+                     const LatencyStats &typed, const LatencyStats &scalar,
+                     double maxDiff) {
+    std::ostringstream json;
+    json << "    {\n"
+         << "      \"name\": \"" << name << "\",\n"
+         << "      \"typed_ns_per_frame\": " << typed.toJson() << ",\n"
+         << "      \"scalar_ns_per_frame\": " << scalar.toJson() << ",\n"
+         << "      \"speedup\": "
+         << scalar.percentile(50) / typed.percentile(50) << ",\n"
+         << "      \"typed_input_mb_per_second\": "
+         << frameBytes * 1e3 / typed.percentile(50) << ",\n"
+         << "      \"max_difference\": " << maxDiff << "\n"
+         << "    }";
+    return json.str();
+}
+
+// Converts noise from In to Out with both kinds of kernel.
+template <typename In, typename Out>
+std::string benchConvert(const std::string &name, const BenchOptions &opts) {
+    const RuntimeFormat inFmt = runtimeFormat<In>();
+    const RuntimeFormat outFmt = runtimeFormat<Out>();
+    std::string in = makeAudio(inFmt, opts.frames, 1);
+    std::string typedOut(opts.frames * Out::FrameBytes, '\0');
+    std::string scalarOut(typedOut.size(), '\0');
+
+    auto none = []() {};
+    LatencyStats typed = timeRuns(opts.runs, opts.frames, none, [&]() {
+        convertFrames<In, Out>(in.data(), opts.frames, &typedOut[0]);
+    });
+    LatencyStats scalar = timeRuns(opts.runs, opts.frames, none, [&]() {
+        scalarConvert(in.data(), inFmt, opts.frames, &scalarOut[0], outFmt);
+    });
+
+    return caseJson(name, In::FrameBytes, typed, scalar,
+                    maxDifference<Out>(typedOut, scalarOut));
+}
+
+// Scales noise in the given format with both kinds of kernel.
+template <typename Format>
+std::string benchGain(const std::string &name, const BenchOptions &opts) {
+    const RuntimeFormat fmt = runtimeFormat<Format>();
+    const float gain = 1.5f;
+    std::string in = makeAudio(fmt, opts.frames, 1);
+    std::string typedOut, scalarOut;
+
+    LatencyStats typed = timeRuns(
+        opts.runs, opts.frames, [&]() { typedOut = in; },
+        [&]() { applyGain<Format>(&typedOut[0], opts.frames, gain); });
+    LatencyStats scalar = timeRuns(
+        opts.runs, opts.frames, [&]() { scalarOut = in; },
+        [&]() { scalarGain(&scalarOut[0], fmt, opts.frames, gain); });
+
+    return caseJson(name, Format::FrameBytes, typed, scalar,
+                    maxDifference<Format>(typedOut, scalarOut));
+}
+
+// Mixes two buffers of noise in the given format with both kinds of kernel.
+template <typename Format>
+std::string benchMix(const std::string &name, const BenchOptions &opts) {
+    const RuntimeFormat fmt = runtimeFormat<Format>();
+    std::string a = makeAudio(fmt, opts.frames, 1);
+    std::string b = makeAudio(fmt, opts.frames, 2);
+    std::string typedOut, scalarOut;
+
+    LatencyStats typed = timeRuns(
+        opts.runs, opts.frames, [&]() { typedOut = a; },
+        [&]() { mixFrames<Format>(&typedOut[0], b.data(), opts.frames); });
+    LatencyStats scalar = timeRuns(
+        opts.runs, opts.frames, [&]() { scalarOut = a; },
+        [&]() { scalarMix(&scalarOut[0], b.data(), fmt, opts.frames); });
+
+    return caseJson(name, Format::FrameBytes, typed, scalar,
+                    maxDifference<Format>(typedOut, scalarOut));
+}
+
+void printUsage(const char *prog) {
+    BenchOptions defaults;
+    std::cerr
+        << "Usage: " << prog << " [options]\n"
+        << "  --frames=N         frames processed by each run ("
+        << defaults.frames << ")\n"
+        << "  --runs=N           timed runs of each kernel (" << defaults.runs
+        << ")\n"
+        << "  --output=FILE      write the JSON report to FILE\n";
+}
+
+// Parses --name=value arguments, returning false on an unknown option.
+bool parseArgs(int argc, char *argv[], BenchOptions *opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            return false;
+        }
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "frames") {
+            opts->frames = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (name == "runs") {
+            opts->runs = std::atoi(value.c_str());
+        } else if (name == "output") {
+            opts->output = value;
+        } else {
+            return false;
+        }
+    }
+
+    return opts->frames > 0 && opts->runs > 0;
+}
+
+using S16LEMono = AudioFormat<int16_t, 1, Endian::Little>;
+using S16BEMono = AudioFormat<int16_t, 1, Endian::Big>;
+using S16LEStereo = AudioFormat<int16_t, 2, Endian::Little>;
+using S24LEStereo = AudioFormat<Int24, 2, Endian::Little>;
+using S32LEMono = AudioFormat<int32_t, 1, Endian::Little>;
+using F32LEMono = AudioFormat<float, 1, Endian::Little>;
+using F32LEStereo = AudioFormat<float, 2, Endian::Little>;
+
+/*
+ * This benchmark compares the compile-time specialized sample kernels in
+ * audio_frames.h with scalar code that looks up the format of every
+ * sample at run time, on the conversions the examples need to prepare
+ * audio for Cubic (16-bit little-endian mono) and on gain and mixing.
+ * Each case reports the time per frame of both versions as JSON, along
+ * with the largest difference between their outputs, in the output
+ * format's units.
+ */
+int main(int argc, char *argv[]) {
+    BenchOptions opts;
+    if (!parseArgs(argc, argv, &opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::vector<std::string> cases;
+        cases.push_back(benchConvert<S16LEMono, S16LEMono>("copy_s16le", opts));
+        cases.push_back(
+            benchConvert<S16BEMono, S16LEMono>("s16be_to_s16le", opts));
+        cases.push_back(
+            benchConvert<S16LEStereo, S16LEMono>("s16le_stereo_to_mono", opts));
+        cases.push_back(
+            benchConvert<S24LEStereo, S16LEMono>("s24le_stereo_to_s16le_mono", opts));
+        cases.push_back(
+            benchConvert<S32LEMono, S16LEMono>("s32le_to_s16le", opts));
+        cases.push_back(
+            benchConvert<F32LEMono, S16LEMono>("f32le_to_s16le", opts));
+        cases.push_back(
+            benchConvert<S16LEMono, F32LEStereo>("s16le_mono_to_f32le_stereo", opts));
+        cases.push_back(benchGain<S16LEMono>("gain_s16le", opts));
+        cases.push_back(benchGain<F32LEMono>("gain_f32le", opts));
+        cases.push_back(benchMix<S16LEMono>("mix_s16le", opts));
+
+        std::ostringstream json;
+        json << "{\n"
+             << "  \"frames\": " << opts.frames << ",\n"
+             << "  \"runs\": " << opts.runs << ",\n"
+             << "  \"cases\": [\n";
+        for (size_t i = 0; i < cases.size(); i++) {
+            json << cases[i] << (i + 1 < cases.size() ? ",\n" : "\n");
+        }
+        json << "  ]\n"
+             << "}\n";
+
+        if (opts.output.empty()) {
+            std::cout << json.str();
+        } else {
+            std::ofstream out(opts.output);
+            out << json.str();
+        }
+
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
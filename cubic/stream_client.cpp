@@ -16,12 +16,32 @@
 
 #include "cubic_client.h"
 #include "cubic_exception.h"
+#include "audio_file.h"
+#include "audio_pacer.h"
+#include "cubic_metrics.h"
+#include "cubic_startup.h"
+#include "encoder_thread.h"
+#include "flac_encoder.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "partial_stabilizer.h"
+#include "result_reader.h"
+#include "resumable_stream.h"
+#include "trace.h"
+#include "vad.h"
+#include "wav_header.h"
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <iostream>
-#include <fstream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <thread>
 
+#include <unistd.h>
+
 /*
  * Create some aliases to make the code more readable. The gRPC
  * interface can be a bit verbose.
@@ -32,21 +52,68 @@ namespace CubicPB = cobaltspeech::cubic;
 const std::string serverAddress = "localhost:2727";
 const std::string filename = "test.wav";
 
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// The audio file is replayed at this multiple of real time, as if it
+// were being recorded live. Set this to zero to send the audio as fast
+// as it can be read.
+const double replaySpeed = 1.0;
+
+// Silence is detected on the client and not sent to Cubic when this is
+// set. This needs 16-bit mono audio, which is then sent as RAW_LINEAR16
+// without the WAV header.
+const bool skipSilence = false;
+
+// The audio is compressed with FLAC on a separate thread before it is
+// sent when this is set, which uses less bandwidth at the cost of some
+// CPU time and one FLAC block (64ms) of latency. This also needs 16-bit
+// mono audio.
+const bool compressAudio = false;
+
+// If the stream fails partway through, it is replaced and the audio sent
+// since the last final result (up to this many seconds of it) is sent
+// again. Compressed audio cannot be replayed this way.
+const double maxReplaySeconds = 60.0;
+
+// Partial results are shown as they arrive, at most this often, when
+// stdout is a terminal. Each update only rewrites the words that changed
+// since the last one, and the final result replaces them.
+const int partialIntervalMs = 100;
+
+// Result latencies, pushAudio() timings and the like are written to this
+// file in the Prometheus text format before the client exits.
+const std::string metricsFile = "cubic_metrics.prom";
+
+// When built with -DENABLE_TRACING=ON, a trace of the whole run is
+// written to this file before the client exits, for viewing in Perfetto
+// (ui.perfetto.dev) or chrome://tracing.
+const std::string traceFile = "cubic_trace.json";
+
 // This client demonstrates using streaming recognition.
 int main(int argc, char *argv[]) {
     try {
+        TRACE_THREAD_NAME("main");
+
         // Create the client (note this is an insecure connection,
         // which is not recommended for production).
         CubicClient client(serverAddress);
 
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
         // Display the Cubic version
-        std::cout << "Cubic version: " << client.cubicVersion() << std::endl;
-        std::cout << "Server version: " << client.serverVersion() << std::endl;
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
         std::cout << "Connected to " << serverAddress << std::endl;
         std::cout << std::endl;
 
         // Get the list of available models
-        std::vector<CubicModel> models = client.listModels();
+        const std::vector<CubicModel> &models = startup.models();
         std::cout << "Available Models:" << std::endl;
         for (const CubicModel &m : models) {
             std::cout << "ID = " << m.id() << ", Name = " << m.name() << std::endl;
@@ -58,41 +125,226 @@ int main(int argc, char *argv[]) {
         cfg.set_model_id(modelID);
         cfg.set_audio_encoding(CubicPB::RecognitionConfig::WAV);
 
-        // Create the stream
-        auto stream = client.streamingRecognize(cfg);
-
-        // Push the audio on a separate thread
-        std::thread audioThread([&stream](){
-            // Open the file and push audio bytes
-            std::ifstream infile(filename);
-            std::streamsize buffSize = 8192;
-            char *buff = new char[buffSize];
-            while (infile.good()) {
-                infile.read(buff, buffSize);
-                stream.pushAudio(buff, infile.gcount());
+        // Map the audio file into memory. Each chunk is pushed straight
+        // from the mapping without being copied into a separate buffer.
+        AudioFile audio(filename, AudioFile::Sequential);
+
+        // The WAV header tells us how many bytes make up a second of audio
+        WavFormat format;
+        if (!parseWavHeader(audio.data(), audio.size(), &format)) {
+            throw std::runtime_error(filename + " is not a valid WAV file");
+        }
+        AudioPacer pacer(format.bytesPerSecond(), replaySpeed);
+
+        bool pcm16Mono = format.formatTag == 1 && format.channels == 1 &&
+                         format.bitsPerSample == 16;
+        bool useVAD = skipSilence && pcm16Mono;
+        bool useFLAC = compressAudio && pcm16Mono;
+        if (useFLAC) {
+            cfg.set_audio_encoding(CubicPB::RecognitionConfig::FLAC);
+        } else if (useVAD) {
+            cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
+        }
+        VoiceActivityDetector::Options vadOpts;
+        vadOpts.sampleRate = format.sampleRate;
+        VoiceActivityDetector vad(vadOpts);
+        FlacEncoder flac(format.sampleRate);
+
+        // Create the stream, recording how it performs
+        MetricsRegistry registry;
+        CubicMetrics metrics(registry);
+        ResumableStream::Options resumeOpts;
+        resumeOpts.bytesPerSecond = format.bytesPerSecond();
+        resumeOpts.frameBytes = std::max(1, format.channels * format.bitsPerSample / 8);
+        resumeOpts.headerBytes = useVAD || useFLAC ? 0 : format.dataOffset;
+        resumeOpts.maxReplayBytes =
+            useFLAC ? 0 : static_cast<size_t>(maxReplaySeconds * format.bytesPerSecond());
+        resumeOpts.metrics = &metrics;
+        ResumableStream stream(serverAddress, cfg, resumeOpts);
+
+        // With compression on, audio goes to the encoder thread, which
+        // pushes the FLAC frames to the stream as they are produced.
+        std::unique_ptr<EncoderThread> encoder;
+        if (useFLAC) {
+            encoder.reset(new EncoderThread(flac, [&stream](const char *data, size_t size) {
+                stream.pushAudio(data, size);
+            }));
+        }
+        auto send = [&stream, &encoder](const char *data, size_t size) {
+            if (encoder) {
+                encoder->push(data, size);
+            } else {
+                stream.pushAudio(data, size);
+            }
+        };
+
+        // Push the audio on a separate thread. An error there (such as
+        // the encoder's sink failing) is passed back to this thread and
+        // rethrown once the thread has been joined.
+        pacer.start();
+        std::exception_ptr audioError;
+        std::thread audioThread([&stream, &audio, &format, &pacer, &vad, &encoder,
+                                 &send, &audioError, useVAD, useFLAC](){
+            TRACE_THREAD_NAME("audio");
+
+            try {
+                // The header holds no audio, so it is sent right away
+                if (!useVAD && !useFLAC) {
+                    send(audio.data(), format.dataOffset);
+                }
+
+                // Pacing follows the original audio, so skipped silence
+                // still takes as long as it would have to record.
+                const size_t chunkSize = 8192;
+                std::string voiced;
+                for (size_t pos = format.dataOffset; pos < audio.size(); pos += chunkSize) {
+                    size_t n = std::min(chunkSize, audio.size() - pos);
+                    pacer.pace(n);
+                    if (!useVAD) {
+                        send(audio.data() + pos, n);
+                        continue;
+                    }
+
+                    voiced.clear();
+                    {
+                        TRACE_SCOPE("VoiceActivityDetector::process");
+                        vad.process(audio.data() + pos, n, &voiced);
+                    }
+                    if (!voiced.empty()) {
+                        send(voiced.data(), voiced.size());
+                    }
+                }
+
+                if (useVAD) {
+                    voiced.clear();
+                    vad.flush(&voiced);
+                    if (!voiced.empty()) {
+                        send(voiced.data(), voiced.size());
+                    }
+                }
+
+                // Wait for the last FLAC frames to be sent
+                if (encoder) {
+                    encoder->finish();
+                }
+            } catch (...) {
+                audioError = std::current_exception();
             }
 
             // Let Cubic know that no more audio will be coming
             stream.audioFinished();
-            delete[] buff;
         });
 
-        // Print the results as they come
+        // Print the results as they come, along with how long after the
+        // end of the speech they arrived. Results are used in place in
+        // the reader's response rather than copied out.
         std::cout << "\nTranscripts:" << std::endl;
-        CubicPB::RecognitionResponse resp;
-        while (stream.receiveResults(&resp)) {
-            for (int i = 0; i < resp.results_size(); i++) {
-                CubicPB::RecognitionResult result = resp.results(i);
-                if (!result.is_partial()) {
-                    std::cout << result.alternatives(0).transcript() << std::endl;
+        const bool showPartials = isatty(STDOUT_FILENO);
+        const int columns = terminalColumns(STDOUT_FILENO);
+        PartialStabilizer stabilizer(partialIntervalMs);
+        ResultReader reader(stream);
+        try {
+            while (CubicPB::RecognitionResponse *resp = reader.next()) {
+                TRACE_SCOPE("handleResults");
+                TranscriptDelta delta;
+                for (CubicPB::RecognitionResult &result : *resp->mutable_results()) {
+                    if (useVAD) {
+                        vad.remapTimestamps(&result);
+                    }
+                    if (result.is_partial() && !showPartials) {
+                        continue;
+                    }
+
+                    // A final result with no transcript still ends the
+                    // utterance, so the partial result shown for it is
+                    // cleared.
+                    if (result.alternatives_size() == 0) {
+                        if (!result.is_partial() && stabilizer.update("", true, &delta)) {
+                            std::cout << delta.terminalEdit(columns) << std::flush;
+                        }
+                        continue;
+                    }
+
+                    const auto &alt = result.alternatives(0);
+                    if (stabilizer.update(alt.transcript(), !result.is_partial(), &delta)) {
+                        std::cout << delta.terminalEdit(columns);
+                    }
+                    if (result.is_partial()) {
+                        std::cout << std::flush;
+                    } else {
+                        double endSec = alt.start_time().seconds() +
+                                        alt.start_time().nanos() / 1e9 +
+                                        alt.duration().seconds() +
+                                        alt.duration().nanos() / 1e9;
+                        auto spoken = pacer.releaseTime(
+                            static_cast<uint64_t>(endSec * format.bytesPerSecond()));
+                        std::chrono::duration<double, std::milli> latency =
+                            AudioPacer::Clock::now() - spoken;
+
+                        std::cout << " (latency: " << latency.count() << " ms)"
+                                  << std::endl;
+                    }
+                }
+
+                // Show a partial result held back by the rate limit, if
+                // nothing newer has replaced it since.
+                if (stabilizer.flush(&delta)) {
+                    std::cout << delta.terminalEdit(columns) << std::flush;
                 }
             }
+        } catch (...) {
+            // The audio thread has to be joined even when handling a
+            // result fails.
+            audioThread.join();
+            throw;
         }
 
-        // Close the stream
+        // Close the stream, reporting an error from the audio thread
+        // ahead of the one close() would give for the same failure.
         audioThread.join();
+        if (audioError) {
+            try {
+                stream.close();
+            } catch (CubicException &) {
+            }
+            std::rethrow_exception(audioError);
+        }
         stream.close();
 
+        if (stream.resumes() > 0) {
+            std::cout << "\nThe stream failed and was resumed " << stream.resumes()
+                      << " times, sending " << stream.replayedBytes()
+                      << " bytes of audio again." << std::endl;
+        }
+
+        if (showPartials && stabilizer.updates() > 0) {
+            std::cout << "\nShowed " << stabilizer.hypotheses() << " results in "
+                      << stabilizer.updates() << " updates, printing "
+                      << stabilizer.bytesEmitted() << " bytes of text instead of "
+                      << stabilizer.bytesReprinted() << "." << std::endl;
+        }
+
+        if (useVAD && vad.bytesIn() > 0) {
+            std::cout << "\nSent " << vad.bytesOut() << " of " << vad.bytesIn()
+                      << " bytes of audio (" << 100 * vad.bytesOut() / vad.bytesIn()
+                      << "%); the rest was silence." << std::endl;
+        }
+
+        if (useFLAC && flac.bytesIn() > 0) {
+            std::cout << "FLAC compressed " << flac.bytesIn() << " bytes to "
+                      << flac.bytesOut() << " (" << 100 * flac.bytesOut() / flac.bytesIn()
+                      << "%) using " << encoder->cpuSeconds() * 1000
+                      << " ms of CPU time." << std::endl;
+        }
+
+        registry.writeTextFile(metricsFile);
+        std::cout << "\nMetrics written to " << metricsFile << std::endl;
+
+#ifdef ENABLE_TRACING
+        Tracer::writeChromeTrace(traceFile);
+        std::cout << "Trace written to " << traceFile << std::endl;
+#endif
+
     } catch (CubicException &e) {
         std::cerr << "Cubic error: " << e.what() << std::endl;
     } catch (std::exception &e) {
@@ -0,0 +1,399 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cubic_client.h"
+#include "cubic_exception.h"
+#include "audio_file.h"
+#include "audio_pacer.h"
+#include "bench_stats.h"
+#include "encoder_thread.h"
+#include "flac_encoder.h"
+#include "mock_cubic_server.h"
+#include "result_reader.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Create some aliases to make the code more readable. The gRPC
+ * interface can be a bit verbose.
+ */
+namespace CubicPB = cobaltspeech::cubic;
+
+using Clock = std::chrono::steady_clock;
+
+// Benchmark settings, which may be changed from the command line.
+struct BenchOptions {
+    int streams = 5;            // number of streams to run, one at a time
+    double audioSeconds = 10;   // length of audio sent on each stream
+    int chunkMs = 100;          // audio sent with each pushAudio() call
+    double speed = 1.0;         // multiple of real time to send audio at
+    bool flac = false;          // compress the audio with FLAC
+    std::string audioFile;      // raw 16-bit mono audio (silence if empty)
+    bool copyResults = false;   // copy each result out, as older clients did
+    MockCubicServer::Options server;
+    std::string output;         // JSON output file (stdout if empty)
+};
+
+// Measurements from a single stream.
+struct StreamMetrics {
+    LatencyStats pushUs;
+    LatencyStats firstPartialMs;
+    LatencyStats partialLatencyMs;
+    LatencyStats finalLatencyMs;
+    double clientCpuSeconds = 0;
+    double encodeCpuSeconds = 0;
+    uint64_t bytesSent = 0;
+};
+
+// Returns the CPU time used so far by the calling thread.
+double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the CPU time used so far by the whole process.
+double processCpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+double toMs(const google::protobuf::Duration &d) {
+    return d.seconds() * 1000.0 + d.nanos() / 1e6;
+}
+
+double msSince(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/*
+ * Streams the audio to the server, pacing it at the configured speed,
+ * and measures how long results take to come back.
+ *
+ * Latency is measured from the moment the audio a result ends with was
+ * handed to pushAudio() to the moment the result was received, so it
+ * covers the network, the (simulated) server processing, and all of the
+ * client-side work in between.
+ */
+StreamMetrics runStream(CubicClient &client, const BenchOptions &opts,
+                        const std::string &audio) {
+    StreamMetrics metrics;
+
+    CubicPB::RecognitionConfig cfg;
+    cfg.set_model_id("1");
+    cfg.set_audio_encoding(opts.flac ? CubicPB::RecognitionConfig::FLAC
+                                     : CubicPB::RecognitionConfig::RAW_LINEAR16);
+
+    const size_t bytesPerMs = 2 * opts.server.sampleRate / 1000;
+    const size_t chunkBytes = bytesPerMs * opts.chunkMs;
+    const size_t numChunks = (audio.size() + chunkBytes - 1) / chunkBytes;
+
+    // The time each chunk was pushed, published to the receiving thread
+    // through pushedCount.
+    std::vector<Clock::time_point> pushTimes(numChunks);
+    std::atomic<size_t> pushedCount(0);
+
+    auto stream = client.streamingRecognize(cfg);
+    const Clock::time_point start = Clock::now();
+    double pushCpu = 0;
+
+    // With FLAC, chunks are handed to the encoder thread instead, and
+    // it pushes the encoded frames. Latency still counts from when the
+    // raw chunk was handed over, so it includes the encoding delay.
+    FlacEncoder flac(opts.server.sampleRate);
+    std::unique_ptr<EncoderThread> encoder;
+    if (opts.flac) {
+        encoder.reset(new EncoderThread(flac, [&stream](const char *data, size_t size) {
+            stream.pushAudio(data, size);
+        }));
+    }
+
+    std::thread audioThread([&]() {
+        double cpuStart = threadCpuSeconds();
+        AudioPacer pacer(2.0 * opts.server.sampleRate, opts.speed);
+        pacer.start();
+        for (size_t i = 0; i < numChunks; i++) {
+            size_t offset = i * chunkBytes;
+            size_t n = std::min(chunkBytes, audio.size() - offset);
+
+            // Release each chunk when it would have been captured live.
+            pacer.pace(n);
+
+            Clock::time_point t0 = Clock::now();
+            pushTimes[i] = t0;
+            pushedCount.store(i + 1, std::memory_order_release);
+            if (encoder) {
+                encoder->push(audio.data() + offset, n);
+            } else {
+                stream.pushAudio(audio.data() + offset, n);
+            }
+            metrics.pushUs.add(msSince(t0, Clock::now()) * 1000);
+        }
+
+        if (encoder) {
+            encoder->finish();
+        }
+        stream.audioFinished();
+        pushCpu = threadCpuSeconds() - cpuStart;
+    });
+
+    double recvCpuStart = threadCpuSeconds();
+    bool gotPartial = false;
+    auto handleResult = [&](const CubicPB::RecognitionResult &result,
+                            Clock::time_point now) {
+        if (result.alternatives_size() == 0) {
+            return;
+        }
+
+        if (result.is_partial() && !gotPartial) {
+            metrics.firstPartialMs.add(msSince(start, now));
+            gotPartial = true;
+        }
+
+        // Find the chunk holding the last byte of the result's audio
+        const CubicPB::RecognitionAlternative &alt = result.alternatives(0);
+        double endMs = toMs(alt.start_time()) + toMs(alt.duration());
+        size_t endByte = static_cast<size_t>(endMs * bytesPerMs);
+        size_t chunk = endByte == 0 ? 0 : (endByte - 1) / chunkBytes;
+        if (chunk >= pushedCount.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        double latency = msSince(pushTimes[chunk], now);
+        if (result.is_partial()) {
+            metrics.partialLatencyMs.add(latency);
+        } else {
+            metrics.finalLatencyMs.add(latency);
+        }
+    };
+
+    if (opts.copyResults) {
+        // A fresh response per read, and a deep copy of every result
+        CubicPB::RecognitionResponse resp;
+        while (stream.receiveResults(&resp)) {
+            Clock::time_point now = Clock::now();
+            for (int i = 0; i < resp.results_size(); i++) {
+                CubicPB::RecognitionResult result = resp.results(i);
+                handleResult(result, now);
+            }
+            resp = CubicPB::RecognitionResponse();
+        }
+    } else {
+        ResultReader reader(stream);
+        while (const CubicPB::RecognitionResponse *resp = reader.next()) {
+            Clock::time_point now = Clock::now();
+            for (const CubicPB::RecognitionResult &result : resp->results()) {
+                handleResult(result, now);
+            }
+        }
+    }
+    double recvCpu = threadCpuSeconds() - recvCpuStart;
+
+    audioThread.join();
+    stream.close();
+
+    metrics.clientCpuSeconds = pushCpu + recvCpu;
+    if (encoder) {
+        metrics.encodeCpuSeconds = encoder->cpuSeconds();
+        metrics.clientCpuSeconds += metrics.encodeCpuSeconds;
+        metrics.bytesSent = flac.bytesOut();
+    } else {
+        metrics.bytesSent = audio.size();
+    }
+    return metrics;
+}
+
+void printUsage(const char *prog) {
+    BenchOptions defaults;
+    std::cerr
+        << "Usage: " << prog << " [options]\n"
+        << "  --streams=N        streams to run (" << defaults.streams << ")\n"
+        << "  --seconds=S        audio per stream (" << defaults.audioSeconds
+        << ")\n"
+        << "  --chunk-ms=MS      audio per pushAudio() call ("
+        << defaults.chunkMs << ")\n"
+        << "  --speed=X          multiple of real time (" << defaults.speed
+        << ")\n"
+        << "  --encoding=ENC     raw or flac (raw)\n"
+        << "  --results=MODE     reader (arena, no copies) or copy (reader)\n"
+        << "  --audio=FILE       raw 16-bit mono audio to send (default:\n"
+        << "                     --seconds of silence)\n"
+        << "  --delay-ms=MS      mock processing delay per result ("
+        << defaults.server.processingDelayMs << ")\n"
+        << "  --partial-ms=MS    audio between partial results ("
+        << defaults.server.partialIntervalMs << ")\n"
+        << "  --utterance-ms=MS  audio between final results ("
+        << defaults.server.utteranceMs << ")\n"
+        << "  --output=FILE      write the JSON report to FILE\n";
+}
+
+// Parses --name=value arguments, returning false on an unknown option.
+bool parseArgs(int argc, char *argv[], BenchOptions *opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            return false;
+        }
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "streams") {
+            opts->streams = std::atoi(value.c_str());
+        } else if (name == "seconds") {
+            opts->audioSeconds = std::atof(value.c_str());
+        } else if (name == "chunk-ms") {
+            opts->chunkMs = std::atoi(value.c_str());
+        } else if (name == "speed") {
+            opts->speed = std::atof(value.c_str());
+        } else if (name == "delay-ms") {
+            opts->server.processingDelayMs = std::atoi(value.c_str());
+        } else if (name == "partial-ms") {
+            opts->server.partialIntervalMs = std::atoi(value.c_str());
+        } else if (name == "utterance-ms") {
+            opts->server.utteranceMs = std::atoi(value.c_str());
+        } else if (name == "encoding" && (value == "raw" || value == "flac")) {
+            opts->flac = value == "flac";
+        } else if (name == "results" && (value == "reader" || value == "copy")) {
+            opts->copyResults = value == "copy";
+        } else if (name == "audio") {
+            opts->audioFile = value;
+        } else if (name == "output") {
+            opts->output = value;
+        } else {
+            return false;
+        }
+    }
+
+    return opts->streams > 0 && opts->audioSeconds > 0 && opts->chunkMs > 0 &&
+           opts->speed > 0 && opts->server.utteranceMs > 0;
+}
+
+/*
+ * This benchmark measures the client side of streaming recognition. It
+ * starts a mock Cubic server in the same process, streams synthetic
+ * audio to it, and reports latency percentiles as JSON. Since the mock
+ * server's behavior is fixed, changes in the numbers between runs point
+ * to changes in the client (or the SDK and gRPC underneath it).
+ */
+int main(int argc, char *argv[]) {
+    BenchOptions opts;
+    if (!parseArgs(argc, argv, &opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        MockCubicServer server(opts.server);
+        server.start();
+
+        CubicClient client(server.address());
+
+        // Silence is as good as speech to the mock server, but real
+        // audio is needed to measure compression.
+        std::string audio;
+        if (!opts.audioFile.empty()) {
+            AudioFile file(opts.audioFile);
+            audio.assign(file.data(), file.size() & ~size_t(1));
+            opts.audioSeconds = audio.size() / (2.0 * opts.server.sampleRate);
+        } else {
+            size_t audioBytes = static_cast<size_t>(
+                opts.audioSeconds * opts.server.sampleRate) * 2;
+            audio.assign(audioBytes, '\0');
+        }
+
+        StreamMetrics total;
+        double processCpuStart = processCpuSeconds();
+        for (int i = 0; i < opts.streams; i++) {
+            StreamMetrics m = runStream(client, opts, audio);
+            total.pushUs.merge(m.pushUs);
+            total.firstPartialMs.merge(m.firstPartialMs);
+            total.partialLatencyMs.merge(m.partialLatencyMs);
+            total.finalLatencyMs.merge(m.finalLatencyMs);
+            total.clientCpuSeconds += m.clientCpuSeconds;
+            total.encodeCpuSeconds += m.encodeCpuSeconds;
+            total.bytesSent += m.bytesSent;
+        }
+        double processCpu = processCpuSeconds() - processCpuStart;
+        double totalAudioSeconds = opts.audioSeconds * opts.streams;
+
+        server.stop();
+
+        // CPU use is reported per second of audio. The client figure
+        // only counts the threads that push audio and read results; the
+        // process figure also includes gRPC's threads and the mock server.
+        std::ostringstream json;
+        json << "{\n"
+             << "  \"streams\": " << opts.streams << ",\n"
+             << "  \"audio_seconds_per_stream\": " << opts.audioSeconds << ",\n"
+             << "  \"chunk_ms\": " << opts.chunkMs << ",\n"
+             << "  \"speed\": " << opts.speed << ",\n"
+             << "  \"encoding\": \"" << (opts.flac ? "flac" : "raw") << "\",\n"
+             << "  \"results\": \"" << (opts.copyResults ? "copy" : "reader")
+             << "\",\n"
+             << "  \"server_delay_ms\": " << opts.server.processingDelayMs << ",\n"
+             << "  \"partial_interval_ms\": " << opts.server.partialIntervalMs
+             << ",\n"
+             << "  \"utterance_ms\": " << opts.server.utteranceMs << ",\n"
+             << "  \"time_to_first_partial_ms\": "
+             << total.firstPartialMs.toJson() << ",\n"
+             << "  \"partial_latency_ms\": " << total.partialLatencyMs.toJson()
+             << ",\n"
+             << "  \"final_latency_ms\": " << total.finalLatencyMs.toJson()
+             << ",\n"
+             << "  \"push_audio_us\": " << total.pushUs.toJson() << ",\n"
+             << "  \"bytes_sent\": " << total.bytesSent << ",\n"
+             << "  \"bytes_sent_per_audio_second\": "
+             << total.bytesSent / totalAudioSeconds << ",\n"
+             << "  \"encode_cpu_ms_per_audio_second\": "
+             << total.encodeCpuSeconds * 1000 / totalAudioSeconds << ",\n"
+             << "  \"client_cpu_ms_per_audio_second\": "
+             << total.clientCpuSeconds * 1000 / totalAudioSeconds << ",\n"
+             << "  \"process_cpu_ms_per_audio_second\": "
+             << processCpu * 1000 / totalAudioSeconds << "\n"
+             << "}\n";
+
+        if (opts.output.empty()) {
+            std::cout << json.str();
+        } else {
+            std::ofstream out(opts.output);
+            out << json.str();
+        }
+
+    } catch (CubicException &e) {
+        std::cerr << "Cubic error: " << e.what() << std::endl;
+        return 1;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -16,9 +16,11 @@
 
 #include "cubic_client.h"
 #include "cubic_exception.h"
+#include "audio_file.h"
+#include "cubic_startup.h"
+#include "metadata_cache.h"
 
 #include <iostream>
-#include <fstream>
 #include <string>
 
 /*
@@ -31,6 +33,11 @@ namespace CubicPB = cobaltspeech::cubic;
 const std::string serverAddress = "localhost:2727";
 const std::string filename = "test.raw";
 
+// The server's versions and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "cubic_metadata_cache";
+const int metadataCacheTTL = 600;
+
 // This client demonstrates using synchronous recognition.
 int main(int argc, char *argv[]) {
     try {
@@ -38,14 +45,19 @@ int main(int argc, char *argv[]) {
         // which is not recommended for production).
         CubicClient client(serverAddress);
 
+        // Ask for the versions and the model list all at once, or reuse
+        // the replies from an earlier run if they are still cached.
+        MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+        CubicStartup startup(client, serverAddress, &metadataCache);
+
         // Display the Cubic version
-        std::cout << "Cubic version: " << client.cubicVersion() << std::endl;
-        std::cout << "Server version: " << client.serverVersion() << std::endl;
+        std::cout << "Cubic version: " << startup.cubicVersion() << std::endl;
+        std::cout << "Server version: " << startup.serverVersion() << std::endl;
         std::cout << "Connected to " << serverAddress << std::endl;
         std::cout << std::endl;
 
         // Get the list of available models
-        std::vector<CubicModel> models = client.listModels();
+        const std::vector<CubicModel> &models = startup.models();
         std::cout << "Available Models:" << std::endl;
         for (const CubicModel &m : models) {
             std::cout << "ID = " << m.id() << ", Name = " << m.name() << std::endl;
@@ -57,18 +69,16 @@ int main(int argc, char *argv[]) {
         cfg.set_model_id(modelID);
         cfg.set_audio_encoding(CubicPB::RecognitionConfig::RAW_LINEAR16);
 
-        // Read the entire audio file
-        std::ifstream infile(filename);
-        std::string data( (std::istreambuf_iterator<char>(infile)),
-                          (std::istreambuf_iterator<char>()) );
+        // Map the entire audio file into memory
+        AudioFile audio(filename, AudioFile::Sequential);
 
         // Send the recognition request.
-        CubicPB::RecognitionResponse resp = client.recognize(cfg, data.c_str(), data.length());
+        CubicPB::RecognitionResponse resp = client.recognize(cfg, audio.data(), audio.size());
 
         // Print the results
         std::cout << "\nTranscripts:" << std::endl;
         for (int i = 0; i < resp.results_size(); i++) {
-            CubicPB::RecognitionResult result = resp.results(i);
+            const CubicPB::RecognitionResult &result = resp.results(i);
             if (!result.is_partial()) {
                 std::cout << result.alternatives(0).transcript() << std::endl;
             }
@@ -0,0 +1,223 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_converter.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+AudioConverter::Format format(AudioConverter::SampleFormat sampleFormat,
+                              unsigned int channels, unsigned int sampleRate)
+{
+    AudioConverter::Format f;
+    f.sampleFormat = sampleFormat;
+    f.channels = channels;
+    f.sampleRate = sampleRate;
+    return f;
+}
+
+std::string int16Bytes(const std::vector<int16_t> &samples)
+{
+    std::string bytes;
+    for (int16_t s : samples)
+    {
+        bytes.push_back(char(s & 0xFF));
+        bytes.push_back(char((s >> 8) & 0xFF));
+    }
+    return bytes;
+}
+
+std::vector<int16_t> int16Samples(const std::string &bytes)
+{
+    std::vector<int16_t> samples(bytes.size() / 2);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        samples[i] = int16_t(uint8_t(bytes[2 * i]) | (uint8_t(bytes[2 * i + 1]) << 8));
+    }
+    return samples;
+}
+
+// Converts all of the audio, in pieces of chunkSize bytes.
+std::vector<int16_t> convertAll(const AudioConverter::Format &input, unsigned int outputRate,
+                                const std::string &audio, size_t chunkSize)
+{
+    AudioConverter converter(input, outputRate);
+    std::string out;
+    for (size_t pos = 0; pos < audio.size(); pos += chunkSize)
+    {
+        converter.convert(audio.data() + pos, std::min(chunkSize, audio.size() - pos), &out);
+    }
+    converter.flush(&out);
+    return int16Samples(out);
+}
+
+std::vector<int16_t> sine(size_t n, double hz, unsigned int rate, double amplitude)
+{
+    std::vector<int16_t> samples(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        samples[i] = int16_t(std::lround(amplitude * std::sin(2 * M_PI * hz * i / rate)));
+    }
+    return samples;
+}
+
+} // namespace
+
+TEST(AudioConverterTest, RejectsBadFormats)
+{
+    EXPECT_THROW(AudioConverter(format(AudioConverter::Int16, 0, 16000), 16000),
+                 std::invalid_argument);
+    EXPECT_THROW(AudioConverter(format(AudioConverter::Int16, 1, 0), 16000),
+                 std::invalid_argument);
+    EXPECT_THROW(AudioConverter(format(AudioConverter::Int16, 1, 16000), 0),
+                 std::invalid_argument);
+}
+
+TEST(AudioConverterTest, Passthrough)
+{
+    AudioConverter same(format(AudioConverter::Int16, 1, 16000), 16000);
+    EXPECT_TRUE(same.passthrough());
+    std::string out;
+    same.convert("abc", 3, &out);
+    EXPECT_EQ(out, "abc");
+
+    EXPECT_FALSE(AudioConverter(format(AudioConverter::Int16, 2, 16000), 16000).passthrough());
+    EXPECT_FALSE(AudioConverter(format(AudioConverter::Int16, 1, 8000), 16000).passthrough());
+    EXPECT_FALSE(AudioConverter(format(AudioConverter::MuLaw, 1, 16000), 16000).passthrough());
+}
+
+TEST(AudioConverterTest, MixesChannels)
+{
+    std::vector<int16_t> stereo = {1000, 3000, -2000, -4000, 32767, 32767, 0, 0};
+    std::vector<int16_t> mono = convertAll(format(AudioConverter::Int16, 2, 16000), 16000,
+                                           int16Bytes(stereo), 3);
+    std::vector<int16_t> expected = {2000, -3000, 32767, 0};
+    ASSERT_EQ(mono.size(), expected.size());
+    for (size_t i = 0; i < mono.size(); i++)
+    {
+        EXPECT_NEAR(mono[i], expected[i], 1) << i;
+    }
+}
+
+TEST(AudioConverterTest, DecodesSampleFormats)
+{
+    // 24-bit samples keep their top 16 bits
+    std::string int24 = {char(0x00), char(0x34), char(0x12),
+                         char(0xFF), char(0xFF), char(0x80)};
+    std::vector<int16_t> out = convertAll(format(AudioConverter::Int24, 1, 8000), 8000,
+                                          int24, 2);
+    ASSERT_EQ(out.size(), 2u);
+    EXPECT_NEAR(out[0], 0x1234, 1);
+    EXPECT_NEAR(out[1], -32513, 1);
+
+    float floats[] = {0.5f, -0.25f, 2.0f};
+    std::string f32(reinterpret_cast<const char *>(floats), sizeof(floats));
+    out = convertAll(format(AudioConverter::Float32, 1, 8000), 8000, f32, 5);
+    ASSERT_EQ(out.size(), 3u);
+    EXPECT_NEAR(out[0], 16384, 1);
+    EXPECT_NEAR(out[1], -8192, 1);
+    EXPECT_EQ(out[2], 32767);
+
+    // G.711 silence and full scale
+    std::string ulaw = {char(0xFF), char(0x80), char(0x00)};
+    out = convertAll(format(AudioConverter::MuLaw, 1, 8000), 8000, ulaw, 1);
+    ASSERT_EQ(out.size(), 3u);
+    EXPECT_NEAR(out[0], 0, 1);
+    EXPECT_NEAR(out[1], 32124, 2);
+    EXPECT_NEAR(out[2], -32124, 2);
+
+    std::string alaw = {char(0xD5), char(0x55), char(0xAA)};
+    out = convertAll(format(AudioConverter::ALaw, 1, 8000), 8000, alaw, 1);
+    ASSERT_EQ(out.size(), 3u);
+    EXPECT_NEAR(out[0], 8, 1);
+    EXPECT_NEAR(out[1], -8, 1);
+    EXPECT_NEAR(out[2], 32256, 2);
+}
+
+TEST(AudioConverterTest, ResamplesToOutputRate)
+{
+    const unsigned int rates[] = {8000, 22050, 44100, 48000};
+    for (unsigned int rate : rates)
+    {
+        // A 440Hz tone comes out the same length and lined up in time
+        std::vector<int16_t> in = sine(rate / 2, 440, rate, 10000);
+        std::vector<int16_t> out = convertAll(format(AudioConverter::Int16, 1, rate), 16000,
+                                              int16Bytes(in), 1000);
+        size_t expectedSize = (in.size() * 16000 + rate - 1) / rate;
+        ASSERT_EQ(out.size(), expectedSize) << rate;
+
+        std::vector<int16_t> ideal = sine(out.size(), 440, 16000, 10000);
+        for (size_t i = 200; i + 200 < out.size(); i++)
+        {
+            ASSERT_NEAR(out[i], ideal[i], 300) << rate << " Hz, sample " << i;
+        }
+    }
+}
+
+TEST(AudioConverterTest, RemovesFrequenciesAboveOutputNyquist)
+{
+    // A 6kHz tone cannot be represented at 8kHz and is filtered out
+    std::vector<int16_t> in = sine(16000, 6000, 16000, 10000);
+    std::vector<int16_t> out = convertAll(format(AudioConverter::Int16, 1, 16000), 8000,
+                                          int16Bytes(in), 4096);
+    ASSERT_EQ(out.size(), 8000u);
+    for (size_t i = 200; i + 200 < out.size(); i++)
+    {
+        ASSERT_LT(std::abs(out[i]), 300) << i;
+    }
+}
+
+TEST(AudioConverterTest, ChunkingDoesNotChangeOutput)
+{
+    std::vector<int16_t> in = sine(4410, 1000, 44100, 8000);
+    std::string bytes = int16Bytes(in);
+    AudioConverter::Format f = format(AudioConverter::Int16, 2, 44100);
+    EXPECT_EQ(convertAll(f, 16000, bytes, 1), convertAll(f, 16000, bytes, bytes.size()));
+    EXPECT_EQ(convertAll(f, 16000, bytes, 333), convertAll(f, 16000, bytes, bytes.size()));
+}
+
+TEST(AudioConverterTest, FormatFromWavHeader)
+{
+    WavFormat wav;
+    memset(&wav, 0, sizeof(wav));
+    wav.formatTag = 1;
+    wav.channels = 2;
+    wav.sampleRate = 44100;
+    wav.bitsPerSample = 24;
+
+    AudioConverter::Format f;
+    ASSERT_TRUE(converterFormat(wav, &f));
+    EXPECT_EQ(f.sampleFormat, AudioConverter::Int24);
+    EXPECT_EQ(f.channels, 2u);
+    EXPECT_EQ(f.sampleRate, 44100u);
+
+    wav.formatTag = 7;
+    wav.bitsPerSample = 8;
+    ASSERT_TRUE(converterFormat(wav, &f));
+    EXPECT_EQ(f.sampleFormat, AudioConverter::MuLaw);
+
+    wav.formatTag = 1;
+    EXPECT_FALSE(converterFormat(wav, &f));
+}
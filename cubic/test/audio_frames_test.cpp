@@ -0,0 +1,215 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "audio_frames.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+namespace
+{
+
+using audio_detail::SampleCast;
+using audio_detail::SampleIO;
+
+std::string bytes(std::initializer_list<int> values)
+{
+    std::string s;
+    for (int v : values)
+    {
+        s.push_back(char(v));
+    }
+    return s;
+}
+
+template <typename Sample, Endian Order>
+std::string stored(typename SampleTraits<Sample>::Value v)
+{
+    std::string s(SampleTraits<Sample>::Bytes, '\0');
+    SampleIO<Sample, Order>::store(v, &s[0]);
+    return s;
+}
+
+template <typename Format>
+std::string mixed(std::initializer_list<typename Format::Value> dst,
+                  std::initializer_list<typename Format::Value> src)
+{
+    using IO = SampleIO<typename Format::SampleType, Format::ByteOrder>;
+    std::string d(dst.size() * Format::SampleBytes, '\0');
+    std::string s(src.size() * Format::SampleBytes, '\0');
+    size_t i = 0;
+    for (typename Format::Value v : dst)
+    {
+        IO::store(v, &d[i++ * Format::SampleBytes]);
+    }
+    i = 0;
+    for (typename Format::Value v : src)
+    {
+        IO::store(v, &s[i++ * Format::SampleBytes]);
+    }
+    mixFrames<Format>(&d[0], s.data(), dst.size() / Format::Channels);
+    return d;
+}
+
+const int16_t int16Min = std::numeric_limits<int16_t>::min();
+const int16_t int16Max = std::numeric_limits<int16_t>::max();
+const int32_t int24Min = -8388608;
+const int32_t int24Max = 8388607;
+const int32_t int32Min = std::numeric_limits<int32_t>::min();
+const int32_t int32Max = std::numeric_limits<int32_t>::max();
+
+} // namespace
+
+TEST(AudioFramesTest, LoadsBigEndian)
+{
+    EXPECT_EQ((SampleIO<int16_t, Endian::Big>::load(bytes({0x12, 0x34}).data())),
+              0x1234);
+    EXPECT_EQ((SampleIO<int16_t, Endian::Big>::load(bytes({0xFF, 0xFE}).data())),
+              -2);
+    EXPECT_EQ((SampleIO<int32_t, Endian::Big>::load(
+                  bytes({0x80, 0x00, 0x00, 0x01}).data())),
+              int32Min + 1);
+    EXPECT_EQ((SampleIO<Int24, Endian::Big>::load(bytes({0x12, 0x34, 0x56}).data())),
+              0x123456);
+
+    // The same bytes read the other way round
+    EXPECT_EQ((SampleIO<int16_t, Endian::Little>::load(bytes({0x12, 0x34}).data())),
+              0x3412);
+    EXPECT_EQ((SampleIO<Int24, Endian::Little>::load(bytes({0x12, 0x34, 0x56}).data())),
+              0x563412);
+}
+
+TEST(AudioFramesTest, StoresBigEndian)
+{
+    EXPECT_EQ((stored<int16_t, Endian::Big>(0x1234)), bytes({0x12, 0x34}));
+    EXPECT_EQ((stored<int16_t, Endian::Big>(-2)), bytes({0xFF, 0xFE}));
+    EXPECT_EQ((stored<int32_t, Endian::Big>(0x01020304)),
+              bytes({0x01, 0x02, 0x03, 0x04}));
+    EXPECT_EQ((stored<Int24, Endian::Big>(-0x123456)), bytes({0xED, 0xCB, 0xAA}));
+    EXPECT_EQ((stored<Int24, Endian::Little>(-0x123456)), bytes({0xAA, 0xCB, 0xED}));
+}
+
+TEST(AudioFramesTest, RoundTripsEveryByteOrder)
+{
+    const int32_t values[] = {0, 1, -1, 0x123456, -0x123456, int24Min, int24Max};
+    for (int32_t v : values)
+    {
+        EXPECT_EQ((SampleIO<Int24, Endian::Big>::load(
+                      stored<Int24, Endian::Big>(v).data())),
+                  v);
+        EXPECT_EQ((SampleIO<Int24, Endian::Little>::load(
+                      stored<Int24, Endian::Little>(v).data())),
+                  v);
+        EXPECT_EQ((SampleIO<int32_t, Endian::Big>::load(
+                      stored<int32_t, Endian::Big>(v * 256).data())),
+                  v * 256);
+    }
+}
+
+TEST(AudioFramesTest, SignExtendsInt24)
+{
+    typedef SampleIO<Int24, Endian::Little> IO;
+    EXPECT_EQ(IO::load(bytes({0xFF, 0xFF, 0x7F}).data()), int24Max);
+    EXPECT_EQ(IO::load(bytes({0x00, 0x00, 0x80}).data()), int24Min);
+    EXPECT_EQ(IO::load(bytes({0xFF, 0xFF, 0xFF}).data()), -1);
+    EXPECT_EQ(IO::load(bytes({0x01, 0x00, 0x80}).data()), int24Min + 1);
+    EXPECT_EQ(IO::load(bytes({0x00, 0x00, 0x00}).data()), 0);
+
+    // Widening keeps the sign
+    EXPECT_EQ((SampleCast<Int24, int32_t>::apply(-1)), -256);
+    EXPECT_EQ((SampleCast<Int24, int32_t>::apply(int24Min)), int32Min);
+}
+
+TEST(AudioFramesTest, NarrowRoundsAndClips)
+{
+    // The largest values round up past the top of the narrower type
+    EXPECT_EQ((SampleCast<int32_t, int16_t>::apply(int32Max)), int16Max);
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(int24Max)), int16Max);
+    EXPECT_EQ((SampleCast<int32_t, Int24>::apply(int32Max)), int24Max);
+
+    // The smallest values fit exactly
+    EXPECT_EQ((SampleCast<int32_t, int16_t>::apply(int32Min)), int16Min);
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(int24Min)), int16Min);
+    EXPECT_EQ((SampleCast<int32_t, Int24>::apply(int32Min)), int24Min);
+
+    // Halves round up, towards positive infinity
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(0x7F)), 0);
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(0x80)), 1);
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(-0x80)), 0);
+    EXPECT_EQ((SampleCast<Int24, int16_t>::apply(-0x81)), -1);
+}
+
+TEST(AudioFramesTest, FloatToIntClips)
+{
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(1.0f)), int16Max);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(2.5f)), int16Max);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(-1.0f)), int16Min);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(-2.5f)), int16Min);
+
+    EXPECT_EQ((SampleCast<float, Int24>::apply(1.0f)), int24Max);
+    EXPECT_EQ((SampleCast<float, Int24>::apply(-1.0f)), int24Min);
+
+    // The top of a 32-bit sample is the largest float below 2^31
+    EXPECT_EQ((SampleCast<float, int32_t>::apply(1.0f)), 2147483520);
+    EXPECT_EQ((SampleCast<float, int32_t>::apply(10.0f)), 2147483520);
+    EXPECT_EQ((SampleCast<float, int32_t>::apply(-1.0f)), int32Min);
+    EXPECT_EQ((SampleCast<float, int32_t>::apply(-10.0f)), int32Min);
+}
+
+TEST(AudioFramesTest, FloatToIntRoundsHalfAwayFromZero)
+{
+    const float step = 1.0f / 32768;
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(0.0f)), 0);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(0.5f * step)), 1);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(-0.5f * step)), -1);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(0.49f * step)), 0);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(100.0f * step)), 100);
+    EXPECT_EQ((SampleCast<float, int16_t>::apply(-100.0f * step)), -100);
+}
+
+TEST(AudioFramesTest, MixSaturates)
+{
+    typedef AudioFormat<int16_t, 1, Endian::Little> Mono16;
+    EXPECT_EQ(mixed<Mono16>({int16Max, int16Min, 20000, -20000, 1000, 1},
+                            {int16Max, int16Min, 20000, -20000, -1000, 2}),
+              mixed<Mono16>({int16Max, int16Min, int16Max, int16Min, 0, 3},
+                            {0, 0, 0, 0, 0, 0}));
+
+    typedef AudioFormat<int16_t, 2, Endian::Big> StereoBig16;
+    std::string mix = mixed<StereoBig16>({30000, -30000}, {10000, -10000});
+    EXPECT_EQ(mix, bytes({0x7F, 0xFF, 0x80, 0x00}));
+
+    typedef AudioFormat<Int24, 1, Endian::Little> Mono24;
+    std::string mix24 = mixed<Mono24>({int24Max, int24Min, -5}, {1, -1, 5});
+    EXPECT_EQ(mix24, (stored<Int24, Endian::Little>(int24Max) +
+                      stored<Int24, Endian::Little>(int24Min) +
+                      stored<Int24, Endian::Little>(0)));
+}
+
+TEST(AudioFramesTest, ConvertsBetweenByteOrders)
+{
+    typedef AudioFormat<int16_t, 1, Endian::Big> Big16;
+    typedef AudioFormat<int16_t, 1, Endian::Little> Little16;
+    std::string in = bytes({0x12, 0x34, 0xFF, 0xFE});
+    std::string out(in.size(), '\0');
+    convertFrames<Big16, Little16>(in.data(), 2, &out[0]);
+    EXPECT_EQ(out, bytes({0x34, 0x12, 0xFE, 0xFF}));
+}
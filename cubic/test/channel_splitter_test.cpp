@@ -0,0 +1,171 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "channel_splitter.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Returns bytes that differ from one position to the next, including
+// sample values with the sign bit set.
+std::string testAudio(size_t size)
+{
+    std::string audio(size, '\0');
+    uint32_t x = 12345;
+    for (size_t i = 0; i < size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        audio[i] = char(x >> 16);
+    }
+    return audio;
+}
+
+// Splits the audio one sample at a time, the slowest way there is.
+std::vector<std::string> reference(const std::string &audio,
+                                   unsigned int channels, size_t sampleBytes)
+{
+    std::vector<std::string> out(channels);
+    size_t frameBytes = channels * sampleBytes;
+    for (size_t pos = 0; pos + frameBytes <= audio.size(); pos += frameBytes)
+    {
+        for (unsigned int ch = 0; ch < channels; ch++)
+        {
+            out[ch].append(audio, pos + ch * sampleBytes, sampleBytes);
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(ChannelSplitterTest, RejectsEmptyFormat)
+{
+    EXPECT_THROW(ChannelSplitter(0, 2), std::invalid_argument);
+    EXPECT_THROW(ChannelSplitter(2, 0), std::invalid_argument);
+}
+
+TEST(ChannelSplitterTest, Stereo16MatchesScalar)
+{
+    const ChannelSplitter::Stereo16Impl impls[] = {ChannelSplitter::SSE2,
+                                                   ChannelSplitter::AVX2};
+
+    // Frame counts either side of the 8 and 16 frame vector widths
+    const size_t frameCounts[] = {0, 1, 7, 8, 9, 15, 16, 17, 31, 33, 100, 1001};
+
+    for (ChannelSplitter::Stereo16Impl impl : impls)
+    {
+        for (size_t numFrames : frameCounts)
+        {
+            std::string audio = testAudio(4 * numFrames);
+            std::string wantLeft(2 * numFrames, '\0');
+            std::string wantRight(2 * numFrames, '\0');
+            ASSERT_TRUE(ChannelSplitter::splitStereo16(ChannelSplitter::Scalar,
+                                                       audio.data(), numFrames,
+                                                       &wantLeft[0],
+                                                       &wantRight[0]));
+
+            std::string left(2 * numFrames, '\0');
+            std::string right(2 * numFrames, '\0');
+            if (!ChannelSplitter::splitStereo16(impl, audio.data(), numFrames,
+                                                &left[0], &right[0]))
+            {
+                // Not supported by this build or CPU
+                break;
+            }
+            EXPECT_EQ(left, wantLeft) << "impl " << impl << ", " << numFrames
+                                      << " frames";
+            EXPECT_EQ(right, wantRight) << "impl " << impl << ", " << numFrames
+                                        << " frames";
+        }
+    }
+}
+
+TEST(ChannelSplitterTest, ScalarMatchesReference)
+{
+    std::string audio = testAudio(4 * 37);
+    std::vector<std::string> want = reference(audio, 2, 2);
+
+    std::string left(2 * 37, '\0');
+    std::string right(2 * 37, '\0');
+    ASSERT_TRUE(ChannelSplitter::splitStereo16(ChannelSplitter::Scalar,
+                                               audio.data(), 37, &left[0],
+                                               &right[0]));
+    EXPECT_EQ(left, want[0]);
+    EXPECT_EQ(right, want[1]);
+}
+
+TEST(ChannelSplitterTest, SplitsWholeBuffer)
+{
+    const unsigned int channels[] = {1, 2, 2, 3, 6};
+    const size_t sampleBytes[] = {2, 2, 3, 2, 4};
+    for (size_t f = 0; f < 5; f++)
+    {
+        std::string audio = testAudio(channels[f] * sampleBytes[f] * 123);
+        ChannelSplitter splitter(channels[f], sampleBytes[f]);
+        std::vector<std::string> out;
+        splitter.split(audio.data(), audio.size(), &out);
+        EXPECT_EQ(out, reference(audio, channels[f], sampleBytes[f]))
+            << channels[f] << " channels of " << sampleBytes[f] << " bytes";
+    }
+}
+
+TEST(ChannelSplitterTest, HoldsPartialFramesBetweenCalls)
+{
+    const unsigned int channels[] = {2, 3};
+    const size_t sampleBytes[] = {2, 3};
+
+    // Piece sizes that rarely end on a frame, including single bytes
+    const size_t pieces[] = {1, 3, 5, 2, 7, 61, 1, 1, 33, 130};
+
+    for (size_t f = 0; f < 2; f++)
+    {
+        std::string audio = testAudio(channels[f] * sampleBytes[f] * 200 + 1);
+        ChannelSplitter splitter(channels[f], sampleBytes[f]);
+        std::vector<std::string> out;
+        size_t pos = 0;
+        for (size_t i = 0; pos < audio.size(); i++)
+        {
+            size_t n = std::min(pieces[i % 10], audio.size() - pos);
+            splitter.split(audio.data() + pos, n, &out);
+            pos += n;
+        }
+
+        // The odd byte at the end is held back for a frame never finished
+        EXPECT_EQ(out, reference(audio, channels[f], sampleBytes[f]))
+            << channels[f] << " channels of " << sampleBytes[f] << " bytes";
+    }
+}
+
+TEST(ChannelSplitterTest, AppendsToOutput)
+{
+    ChannelSplitter splitter(2, 2);
+    std::vector<std::string> out;
+    out.push_back("ab");
+    std::string audio("LLRRllrr", 8);
+    splitter.split(audio.data(), audio.size(), &out);
+    ASSERT_EQ(out.size(), 2u);
+    EXPECT_EQ(out[0], "abLLll");
+    EXPECT_EQ(out[1], "RRrr");
+}
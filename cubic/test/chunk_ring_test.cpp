@@ -0,0 +1,316 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "chunk_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace
+{
+
+// Writes the given text as one chunk.
+void writeChunk(ChunkRing &ring, const std::string &text)
+{
+    char *chunk = ring.beginWrite();
+    ASSERT_NE(chunk, nullptr);
+    memcpy(chunk, text.data(), text.size());
+    ring.commitWrite(text.size());
+}
+
+// Reads one chunk, returning an empty string if there is none.
+std::string readChunk(ChunkRing &ring)
+{
+    const char *data;
+    size_t size;
+    if (!ring.beginRead(&data, &size))
+    {
+        return "";
+    }
+    std::string text(data, size);
+    ring.endRead();
+    return text;
+}
+
+} // namespace
+
+TEST(ChunkRingTest, RequiresTwoChunks)
+{
+    EXPECT_THROW(ChunkRing(1, 16), std::invalid_argument);
+}
+
+TEST(ChunkRingTest, RequiresWholeFrames)
+{
+    EXPECT_THROW(ChunkRing(2, 15, ChunkRing::DropOldest, 500, 2), std::invalid_argument);
+    EXPECT_THROW(ChunkRing(2, 16, ChunkRing::DropOldest, 500, 0), std::invalid_argument);
+}
+
+TEST(ChunkRingTest, ReadsChunksInOrder)
+{
+    ChunkRing ring(4, 16);
+    writeChunk(ring, "one");
+    writeChunk(ring, "two");
+    EXPECT_EQ(ring.queuedBytes(), 6u);
+    EXPECT_EQ(readChunk(ring), "one");
+    writeChunk(ring, "three");
+    EXPECT_EQ(readChunk(ring), "two");
+    EXPECT_EQ(readChunk(ring), "three");
+    EXPECT_EQ(readChunk(ring), "");
+    EXPECT_EQ(ring.queuedBytes(), 0u);
+    EXPECT_EQ(ring.highWaterBytes(), 8u);
+}
+
+TEST(ChunkRingTest, EmptyCommitIsNotQueued)
+{
+    ChunkRing ring(2, 16);
+    ASSERT_NE(ring.beginWrite(), nullptr);
+    ring.commitWrite(0);
+    EXPECT_EQ(readChunk(ring), "");
+    writeChunk(ring, "a");
+    EXPECT_EQ(readChunk(ring), "a");
+}
+
+TEST(ChunkRingTest, DropOldestKeepsRecentAudio)
+{
+    ChunkRing ring(3, 16, ChunkRing::DropOldest);
+    writeChunk(ring, "a");
+    writeChunk(ring, "bb");
+    writeChunk(ring, "ccc");
+    writeChunk(ring, "dddd");
+    writeChunk(ring, "eeeee");
+    EXPECT_EQ(ring.droppedChunks(), 2u);
+    EXPECT_EQ(ring.droppedBytes(), 3u);
+    EXPECT_EQ(readChunk(ring), "ccc");
+    EXPECT_EQ(readChunk(ring), "dddd");
+    EXPECT_EQ(readChunk(ring), "eeeee");
+}
+
+TEST(ChunkRingTest, DropOldestSkipsBorrowedChunk)
+{
+    ChunkRing ring(3, 16, ChunkRing::DropOldest);
+    writeChunk(ring, "a");
+    writeChunk(ring, "b");
+    const char *data;
+    size_t size;
+    ASSERT_TRUE(ring.beginRead(&data, &size));
+    writeChunk(ring, "c");
+    writeChunk(ring, "d");
+
+    // "a" is borrowed, so "b" was dropped instead
+    EXPECT_EQ(std::string(data, size), "a");
+    ring.endRead();
+    EXPECT_EQ(ring.droppedChunks(), 1u);
+    EXPECT_EQ(readChunk(ring), "c");
+    EXPECT_EQ(readChunk(ring), "d");
+}
+
+TEST(ChunkRingTest, BlockTimesOutAndDrops)
+{
+    ChunkRing ring(2, 16, ChunkRing::Block, 20);
+    writeChunk(ring, "a");
+    writeChunk(ring, "b");
+    writeChunk(ring, "c");
+    EXPECT_GE(ring.blockedMs(), 20.0);
+    EXPECT_EQ(ring.droppedChunks(), 1u);
+    EXPECT_EQ(readChunk(ring), "b");
+    EXPECT_EQ(readChunk(ring), "c");
+}
+
+TEST(ChunkRingTest, BlockWaitsForConsumer)
+{
+    ChunkRing ring(2, 16, ChunkRing::Block, 10000);
+    writeChunk(ring, "a");
+    writeChunk(ring, "b");
+    std::thread consumer([&ring]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_EQ(readChunk(ring), "a");
+    });
+    writeChunk(ring, "c");
+    consumer.join();
+    EXPECT_EQ(ring.droppedChunks(), 0u);
+    EXPECT_EQ(readChunk(ring), "b");
+    EXPECT_EQ(readChunk(ring), "c");
+}
+
+TEST(ChunkRingTest, CloseWakesBlockedProducer)
+{
+    ChunkRing ring(2, 16, ChunkRing::Block, 10000);
+    writeChunk(ring, "a");
+    writeChunk(ring, "b");
+    std::thread closer([&ring]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ring.close();
+    });
+    EXPECT_EQ(ring.beginWrite(), nullptr);
+    closer.join();
+
+    // What was queued can still be read
+    const char *data;
+    size_t size;
+    EXPECT_TRUE(ring.waitRead(&data, &size));
+    ring.endRead();
+    EXPECT_TRUE(ring.waitRead(&data, &size));
+    ring.endRead();
+    EXPECT_FALSE(ring.waitRead(&data, &size));
+}
+
+TEST(ChunkRingTest, CoalesceMergesQueuedChunks)
+{
+    ChunkRing ring(4, 8, ChunkRing::Coalesce);
+    writeChunk(ring, "ab");
+    writeChunk(ring, "cd");
+    writeChunk(ring, "efg");
+    writeChunk(ring, "hijk");
+    EXPECT_EQ(readChunk(ring), "abcdefg");
+    EXPECT_EQ(ring.coalescedChunks(), 2u);
+    EXPECT_EQ(readChunk(ring), "hijk");
+    EXPECT_EQ(ring.queuedBytes(), 0u);
+}
+
+TEST(ChunkRingTest, OffsetsShowDroppedAudio)
+{
+    ChunkRing ring(2, 16, ChunkRing::DropOldest);
+    writeChunk(ring, "aa");
+    writeChunk(ring, "bbb");
+    writeChunk(ring, "c");
+
+    // "aa" was dropped, so "bbb" starts two bytes in
+    const char *data;
+    size_t size;
+    uint64_t offset;
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(std::string(data, size), "bbb");
+    EXPECT_EQ(offset, 2u);
+    ring.endRead();
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(offset, 5u);
+    ring.endRead();
+}
+
+TEST(ChunkRingTest, CoalesceStopsAtDroppedAudio)
+{
+    ChunkRing ring(3, 8, ChunkRing::Coalesce, 0);
+    writeChunk(ring, "a");
+    writeChunk(ring, "b");
+    const char *data;
+    size_t size;
+    uint64_t offset;
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(std::string(data, size), "ab");
+    ring.endRead();
+
+    // Fill the ring, then write one more so that "c" is dropped. "d"
+    // and "e" are merged, but not with anything before the gap.
+    writeChunk(ring, "c");
+    writeChunk(ring, "d");
+    writeChunk(ring, "e");
+    writeChunk(ring, "f");
+    EXPECT_EQ(ring.droppedChunks(), 1u);
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(std::string(data, size), "def");
+    EXPECT_EQ(offset, 3u);
+    ring.endRead();
+}
+
+TEST(ChunkRingTest, ConcurrentTransferKeepsOrder)
+{
+    const int numChunks = 20000;
+    for (ChunkRing::OverflowPolicy policy :
+         {ChunkRing::Block, ChunkRing::Coalesce, ChunkRing::DropOldest})
+    {
+        ChunkRing ring(4, 64, policy, 10000);
+        std::thread producer([&ring]() {
+            for (int i = 0; i < numChunks; i++)
+            {
+                std::string text = std::to_string(i) + ",";
+                char *chunk = ring.beginWrite();
+                memcpy(chunk, text.data(), text.size());
+                ring.commitWrite(text.size());
+            }
+            ring.close();
+        });
+
+        // Numbers must arrive in increasing order, and all of them
+        // unless the policy drops audio.
+        std::string received;
+        const char *data;
+        size_t size;
+        while (ring.waitRead(&data, &size))
+        {
+            received.append(data, size);
+            ring.endRead();
+        }
+        producer.join();
+
+        int count = 0;
+        int last = -1;
+        size_t pos = 0;
+        while (pos < received.size())
+        {
+            size_t comma = received.find(',', pos);
+            int value = std::stoi(received.substr(pos, comma - pos));
+            EXPECT_GT(value, last);
+            last = value;
+            count++;
+            pos = comma + 1;
+        }
+        EXPECT_EQ(last, numChunks - 1);
+        EXPECT_EQ(count + ring.droppedChunks(), uint64_t(numChunks));
+    }
+}
+
+TEST(ChunkRingTest, CarriesPartialFrame)
+{
+    ChunkRing ring(4, 16, ChunkRing::DropOldest, 500, 2);
+    writeChunk(ring, "abc");
+    EXPECT_EQ(ring.writeCapacity(), 15u);
+    EXPECT_EQ(readChunk(ring), "ab");
+
+    // A write without a whole frame is held until the next one
+    writeChunk(ring, "");
+    EXPECT_EQ(readChunk(ring), "");
+    writeChunk(ring, "de");
+    EXPECT_EQ(readChunk(ring), "cd");
+    writeChunk(ring, "f");
+    EXPECT_EQ(ring.writeCapacity(), 16u);
+    EXPECT_EQ(readChunk(ring), "ef");
+}
+
+TEST(ChunkRingTest, DropsOddSizedChunkAsWholeFrames)
+{
+    ChunkRing ring(2, 16, ChunkRing::DropOldest, 500, 2);
+    writeChunk(ring, "abc");
+    writeChunk(ring, "defgh");
+    writeChunk(ring, "ijklmno");
+    EXPECT_EQ(ring.droppedChunks(), 1u);
+    EXPECT_EQ(ring.droppedBytes(), 2u);
+
+    // The audio after the dropped chunk still starts on a frame
+    const char *data;
+    size_t size;
+    uint64_t offset;
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(std::string(data, size), "cdefgh");
+    EXPECT_EQ(offset, 2u);
+    ring.endRead();
+    ASSERT_TRUE(ring.beginRead(&data, &size, &offset));
+    EXPECT_EQ(std::string(data, size), "ijklmn");
+    EXPECT_EQ(offset, 8u);
+    ring.endRead();
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flac_encoder.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Reads values most significant bit first.
+class BitReader
+{
+public:
+    BitReader(const std::string &data, size_t pos) : mData(data), mBit(pos * 8) {}
+
+    uint32_t read(int numBits)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < numBits; i++)
+        {
+            if (mBit >= mData.size() * 8)
+            {
+                throw std::runtime_error("FLAC data ends early");
+            }
+            int bit = (uint8_t(mData[mBit / 8]) >> (7 - mBit % 8)) & 1;
+            value = (value << 1) | uint32_t(bit);
+            mBit++;
+        }
+        return value;
+    }
+
+    int32_t readSigned(int numBits)
+    {
+        uint32_t v = read(numBits);
+        return int32_t(v << (32 - numBits)) >> (32 - numBits);
+    }
+
+    uint32_t readUnary()
+    {
+        uint32_t q = 0;
+        while (read(1) == 0)
+        {
+            q++;
+        }
+        return q;
+    }
+
+    void align()
+    {
+        mBit = (mBit + 7) / 8 * 8;
+    }
+
+    size_t bytePos() const
+    {
+        return mBit / 8;
+    }
+
+private:
+    const std::string &mData;
+    size_t mBit;
+};
+
+uint16_t crc16(const std::string &data, size_t start, size_t end)
+{
+    uint16_t crc = 0;
+    for (size_t i = start; i < end; i++)
+    {
+        crc ^= uint16_t(uint8_t(data[i])) << 8;
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x8005) : uint16_t(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*
+ * Decodes the subset of FLAC that FlacEncoder writes (mono, 16-bit,
+ * constant, verbatim and fixed subframes), checking the frame CRCs.
+ */
+std::vector<int16_t> decodeFlac(const std::string &flac, unsigned int *sampleRate,
+                                size_t *numFrames)
+{
+    if (flac.compare(0, 4, "fLaC") != 0)
+    {
+        throw std::runtime_error("missing fLaC marker");
+    }
+    BitReader header(flac, 4);
+    EXPECT_EQ(header.read(1), 1u);      // last metadata block
+    EXPECT_EQ(header.read(7), 0u);      // STREAMINFO
+    EXPECT_EQ(header.read(24), 34u);
+    header.read(16 + 16 + 24 + 24);
+    *sampleRate = header.read(20);
+    EXPECT_EQ(header.read(3), 0u);      // mono
+    EXPECT_EQ(header.read(5), 15u);     // 16 bits per sample
+
+    std::vector<int16_t> samples;
+    size_t pos = 4 + 4 + 34;
+    *numFrames = 0;
+    while (pos < flac.size())
+    {
+        BitReader br(flac, pos);
+        EXPECT_EQ(br.read(16), 0xFFF8u);
+        EXPECT_EQ(br.read(4), 7u);
+        br.read(4 + 4 + 3 + 1);
+        uint32_t lead = br.read(8);
+        for (int extra = 0; extra < 6 && (lead & (0x40 >> extra)) && lead >= 0xC0; extra++)
+        {
+            br.read(8);
+        }
+        size_t n = br.read(16) + 1;
+        br.read(8);
+
+        uint32_t type = br.read(8);
+        std::vector<int32_t> x;
+        if (type == 0)
+        {
+            x.assign(n, br.readSigned(16));
+        }
+        else if (type == 2)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                x.push_back(br.readSigned(16));
+            }
+        }
+        else if ((type & 0x70) == 0x10)
+        {
+            int order = (type >> 1) & 7;
+            for (int i = 0; i < order; i++)
+            {
+                x.push_back(br.readSigned(16));
+            }
+            EXPECT_EQ(br.read(2), 0u);
+            int partOrder = br.read(4);
+            size_t partSize = n >> partOrder;
+            for (size_t part = 0; part < (size_t(1) << partOrder); part++)
+            {
+                uint32_t k = br.read(4);
+                size_t count = part == 0 ? partSize - order : partSize;
+                for (size_t i = 0; i < count; i++)
+                {
+                    uint32_t u = (br.readUnary() << k) | br.read(k);
+                    int32_t r = int32_t(u >> 1) ^ -int32_t(u & 1);
+                    size_t j = x.size();
+                    switch (order)
+                    {
+                    case 0:
+                        x.push_back(r);
+                        break;
+                    case 1:
+                        x.push_back(r + x[j - 1]);
+                        break;
+                    case 2:
+                        x.push_back(r + 2 * x[j - 1] - x[j - 2]);
+                        break;
+                    case 3:
+                        x.push_back(r + 3 * x[j - 1] - 3 * x[j - 2] + x[j - 3]);
+                        break;
+                    default:
+                        x.push_back(r + 4 * x[j - 1] - 6 * x[j - 2] + 4 * x[j - 3] - x[j - 4]);
+                        break;
+                    }
+                }
+            }
+        }
+        else
+        {
+            throw std::runtime_error("unexpected subframe type");
+        }
+
+        br.align();
+        size_t end = br.bytePos();
+        EXPECT_EQ(br.read(16), crc16(flac, pos, end)) << "frame " << *numFrames;
+        pos = br.bytePos();
+        (*numFrames)++;
+        samples.insert(samples.end(), x.begin(), x.end());
+    }
+    return samples;
+}
+
+std::string toBytes(const std::vector<int16_t> &samples)
+{
+    std::string bytes;
+    for (int16_t s : samples)
+    {
+        bytes.push_back(char(s & 0xFF));
+        bytes.push_back(char((s >> 8) & 0xFF));
+    }
+    return bytes;
+}
+
+// A tone with some noise, as a stand-in for speech.
+std::vector<int16_t> makeAudio(size_t n)
+{
+    std::vector<int16_t> samples(n);
+    srand(1);
+    for (size_t i = 0; i < n; i++)
+    {
+        double v = 8000 * std::sin(i * 0.05) + (rand() % 200 - 100);
+        samples[i] = int16_t(v);
+    }
+    return samples;
+}
+
+} // namespace
+
+TEST(FlacEncoderTest, RejectsBadSettings)
+{
+    EXPECT_THROW(FlacEncoder(0), std::invalid_argument);
+    EXPECT_THROW(FlacEncoder(16000, 8), std::invalid_argument);
+}
+
+TEST(FlacEncoderTest, RoundTrip)
+{
+    std::vector<int16_t> audio = makeAudio(5000);
+    std::string bytes = toBytes(audio);
+
+    // Feed the audio in uneven pieces, so blocks span several calls
+    FlacEncoder encoder(16000, 1024);
+    std::string flac;
+    for (size_t pos = 0; pos < bytes.size(); pos += 777)
+    {
+        size_t n = std::min<size_t>(777, bytes.size() - pos);
+        encoder.encode(bytes.data() + pos, n, &flac);
+    }
+    encoder.finish(&flac);
+
+    unsigned int sampleRate;
+    size_t numFrames;
+    EXPECT_EQ(decodeFlac(flac, &sampleRate, &numFrames), audio);
+    EXPECT_EQ(sampleRate, 16000u);
+    EXPECT_EQ(numFrames, 5u);
+    EXPECT_EQ(encoder.bytesIn(), bytes.size());
+    EXPECT_EQ(encoder.bytesOut(), flac.size());
+    EXPECT_LT(flac.size(), bytes.size());
+}
+
+TEST(FlacEncoderTest, HoldsPartialBlock)
+{
+    std::string bytes = toBytes(makeAudio(100));
+    FlacEncoder encoder(8000, 64);
+    std::string flac;
+    encoder.encode(bytes.data(), 2 * 63, &flac);
+    EXPECT_EQ(flac.size(), 4u + 4u + 34u);
+
+    encoder.encode(bytes.data() + 2 * 63, bytes.size() - 2 * 63, &flac);
+    unsigned int sampleRate;
+    size_t numFrames;
+    decodeFlac(flac, &sampleRate, &numFrames);
+    EXPECT_EQ(numFrames, 1u);
+}
+
+TEST(FlacEncoderTest, SilenceAndNoise)
+{
+    std::vector<int16_t> audio(2048, 0);
+    srand(2);
+    for (size_t i = 1024; i < audio.size(); i++)
+    {
+        audio[i] = int16_t(rand());
+    }
+    std::string bytes = toBytes(audio);
+
+    FlacEncoder encoder(16000, 1024);
+    std::string flac;
+    encoder.encode(bytes.data(), bytes.size(), &flac);
+    encoder.finish(&flac);
+
+    unsigned int sampleRate;
+    size_t numFrames;
+    EXPECT_EQ(decodeFlac(flac, &sampleRate, &numFrames), audio);
+    EXPECT_EQ(numFrames, 2u);
+}
+
+TEST(FlacEncoderTest, DropsTrailingHalfSample)
+{
+    std::vector<int16_t> audio = makeAudio(20);
+    std::string bytes = toBytes(audio) + "x";
+    FlacEncoder encoder(16000, 1024);
+    std::string flac;
+    encoder.encode(bytes.data(), bytes.size(), &flac);
+    encoder.finish(&flac);
+
+    unsigned int sampleRate;
+    size_t numFrames;
+    EXPECT_EQ(decodeFlac(flac, &sampleRate, &numFrames), audio);
+}
+
+TEST(FlacEncoderTest, LongFrameNumbers)
+{
+    // Frame numbers from 128 on take more than one byte
+    std::vector<int16_t> audio = makeAudio(16 * 300);
+    std::string bytes = toBytes(audio);
+    FlacEncoder encoder(16000, 16);
+    std::string flac;
+    encoder.encode(bytes.data(), bytes.size(), &flac);
+
+    unsigned int sampleRate;
+    size_t numFrames;
+    EXPECT_EQ(decodeFlac(flac, &sampleRate, &numFrames), audio);
+    EXPECT_EQ(numFrames, 300u);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(HistogramTest, EmptyHistogram)
+{
+    Histogram h;
+    EXPECT_EQ(h.count(), 0u);
+    EXPECT_EQ(h.sum(), 0u);
+    EXPECT_EQ(h.percentile(50), 0u);
+}
+
+TEST(HistogramTest, SmallValuesAreExact)
+{
+    Histogram h;
+    for (uint64_t v = 0; v < 32; v++)
+    {
+        h.record(v);
+    }
+    EXPECT_EQ(h.count(), 32u);
+    EXPECT_EQ(h.sum(), 496u);
+    EXPECT_EQ(h.max(), 31u);
+    EXPECT_EQ(h.percentile(0), 0u);
+    EXPECT_EQ(h.percentile(50), 15u);
+    EXPECT_EQ(h.percentile(100), 31u);
+}
+
+TEST(HistogramTest, LargeValuesWithinThreePercent)
+{
+    const uint64_t values[] = {100, 1234, 99999, 1000000, 123456789};
+    for (uint64_t v : values)
+    {
+        Histogram h;
+        h.record(v);
+        h.record(v * 4);
+        uint64_t p = h.percentile(50);
+        EXPECT_GE(p, v * 97 / 100) << v;
+        EXPECT_LE(p, v * 103 / 100) << v;
+    }
+}
+
+TEST(HistogramTest, PercentileNeverExceedsMax)
+{
+    Histogram h;
+    h.record(1000);
+    EXPECT_LE(h.percentile(99.9), 1000u);
+    EXPECT_EQ(h.max(), 1000u);
+}
+
+TEST(HistogramTest, HugeValuesGoInLastBucket)
+{
+    Histogram h;
+    h.record(uint64_t(1) << 50);
+    h.record(UINT64_MAX);
+    EXPECT_EQ(h.count(), 2u);
+    EXPECT_EQ(h.max(), UINT64_MAX);
+    EXPECT_GE(h.percentile(50), (uint64_t(1) << 40) / 100 * 97);
+}
+
+TEST(HistogramTest, ConcurrentRecords)
+{
+    Histogram h;
+    const int numThreads = 4;
+    const int perThread = 10000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads.emplace_back([&h, t]() {
+            for (int i = 0; i < perThread; i++)
+            {
+                h.record(t + 1);
+            }
+        });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    EXPECT_EQ(h.count(), uint64_t(numThreads * perThread));
+    EXPECT_EQ(h.sum(), uint64_t(perThread * (1 + 2 + 3 + 4)));
+    EXPECT_EQ(h.max(), 4u);
+}
+
+TEST(HistogramTest, RegistryWritesScaledSummary)
+{
+    MetricsRegistry registry;
+    Histogram &h = registry.histogram("latency_seconds", "Latency.", "", 1e-6);
+    EXPECT_EQ(&h, &registry.histogram("latency_seconds", "Latency.", "", 1e-6));
+    h.record(2000000);
+
+    std::string text = registry.prometheusText();
+    EXPECT_NE(text.find("# TYPE latency_seconds summary\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_sum 2\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_count 1\n"), std::string::npos);
+    EXPECT_THROW(registry.counter("latency_seconds", "Latency."),
+                 std::invalid_argument);
+}
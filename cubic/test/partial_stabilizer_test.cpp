@@ -0,0 +1,206 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "partial_stabilizer.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/*
+ * A terminal just big enough for the edits: printable ASCII, carriage
+ * return, cursor up and right, and erase to the end of the screen. Like
+ * xterm, the cursor stays on the last column once a line is full.
+ */
+class Screen
+{
+public:
+    explicit Screen(size_t columns) : mColumns(columns), mRow(0), mCol(0) {}
+
+    void write(const std::string &bytes)
+    {
+        for (size_t i = 0; i < bytes.size(); i++)
+        {
+            char c = bytes[i];
+            if (c == '\r')
+            {
+                mCol = 0;
+            }
+            else if (c == '\x1b')
+            {
+                size_t end = bytes.find_first_of("ACJ", i);
+                int n = std::atoi(bytes.substr(i + 2, end - i - 2).c_str());
+                switch (bytes[end])
+                {
+                case 'A':
+                    mRow -= std::min<size_t>(mRow, n);
+                    mCol = std::min(mCol, mColumns - 1);
+                    break;
+                case 'C':
+                    mCol = std::min(mCol + n, mColumns - 1);
+                    break;
+                case 'J':
+                    line(mRow).erase(std::min(mCol, line(mRow).size()));
+                    mLines.resize(mRow + 1);
+                    break;
+                }
+                i = end;
+            }
+            else
+            {
+                if (mCol == mColumns)
+                {
+                    mRow++;
+                    mCol = 0;
+                }
+                std::string &l = line(mRow);
+                l.resize(std::max(l.size(), mCol + 1), ' ');
+                l[mCol++] = c;
+            }
+        }
+    }
+
+    std::string text() const
+    {
+        std::string all;
+        for (const std::string &l : mLines)
+        {
+            all += l;
+        }
+        return all;
+    }
+
+private:
+    size_t mColumns;
+    size_t mRow;
+    size_t mCol;
+    std::vector<std::string> mLines;
+
+    std::string &line(size_t row)
+    {
+        if (mLines.size() <= row)
+        {
+            mLines.resize(row + 1);
+        }
+        return mLines[row];
+    }
+};
+
+} // namespace
+
+TEST(PartialStabilizerTest, KeepsStableWords)
+{
+    PartialStabilizer stabilizer(0);
+    TranscriptDelta delta;
+    ASSERT_TRUE(stabilizer.update("the cat", false, &delta));
+    EXPECT_EQ(delta.added, "the cat");
+
+    ASSERT_TRUE(stabilizer.update("the cap sat", false, &delta));
+    EXPECT_EQ(delta.stableBytes, 4u);
+    EXPECT_EQ(delta.removed, "cat");
+    EXPECT_EQ(delta.added, "cap sat");
+    EXPECT_EQ(stabilizer.shown(), "the cap sat");
+
+    EXPECT_FALSE(stabilizer.update("the cap sat", false, &delta));
+}
+
+TEST(PartialStabilizerTest, FinalStartsNewUtterance)
+{
+    PartialStabilizer stabilizer(0);
+    TranscriptDelta delta;
+    stabilizer.update("hello", false, &delta);
+    ASSERT_TRUE(stabilizer.update("hello world", true, &delta));
+    EXPECT_TRUE(delta.isFinal);
+    EXPECT_EQ(stabilizer.shown(), "");
+
+    // An empty final clears the partial result
+    stabilizer.update("noise", false, &delta);
+    ASSERT_TRUE(stabilizer.update("", true, &delta));
+    EXPECT_EQ(delta.removed, "noise");
+    EXPECT_EQ(delta.added, "");
+}
+
+TEST(PartialStabilizerTest, FlushShowsHeldBackPartial)
+{
+    PartialStabilizer stabilizer(50);
+    TranscriptDelta delta;
+    ASSERT_TRUE(stabilizer.update("one", false, &delta));
+    EXPECT_FALSE(stabilizer.update("one two", false, &delta));
+    EXPECT_FALSE(stabilizer.update("one two three", false, &delta));
+    EXPECT_FALSE(stabilizer.flush(&delta));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    ASSERT_TRUE(stabilizer.flush(&delta));
+    EXPECT_EQ(delta.added, " two three");
+    EXPECT_EQ(stabilizer.shown(), "one two three");
+    EXPECT_FALSE(stabilizer.flush(&delta));
+    EXPECT_EQ(stabilizer.hypotheses(), 3u);
+    EXPECT_EQ(stabilizer.updates(), 2u);
+}
+
+TEST(PartialStabilizerTest, FinalDropsHeldBackPartial)
+{
+    PartialStabilizer stabilizer(1000);
+    TranscriptDelta delta;
+    stabilizer.update("one", false, &delta);
+    stabilizer.update("one two", false, &delta);
+    ASSERT_TRUE(stabilizer.update("one two", true, &delta));
+    EXPECT_FALSE(stabilizer.flush(&delta));
+}
+
+TEST(PartialStabilizerTest, TerminalEditWithoutWidthRedrawsLine)
+{
+    PartialStabilizer stabilizer(0);
+    TranscriptDelta delta;
+    stabilizer.update("the cat", false, &delta);
+    EXPECT_EQ(delta.terminalEdit(), "the cat");
+    stabilizer.update("the cap", false, &delta);
+    EXPECT_EQ(delta.terminalEdit(), "\rthe cap\x1b[J");
+}
+
+TEST(PartialStabilizerTest, TerminalEditAcrossWrappedLines)
+{
+    const std::vector<std::string> hypotheses = {
+        "one two three four five",
+        "one two three four fine day",
+        "one two tree",
+        "one two tree and a much longer ending",
+        "one two tree and a much longer ending here",
+        "on",
+        "",
+    };
+    for (size_t columns = 3; columns <= 12; columns++)
+    {
+        PartialStabilizer stabilizer(0);
+        Screen screen(columns);
+        for (const std::string &h : hypotheses)
+        {
+            TranscriptDelta delta;
+            if (stabilizer.update(h, false, &delta))
+            {
+                screen.write(delta.terminalEdit(columns));
+            }
+            EXPECT_EQ(screen.text(), h) << columns << " columns";
+        }
+    }
+}
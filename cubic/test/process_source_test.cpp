@@ -0,0 +1,174 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "process_source.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// A temporary file holding the given data, removed when done.
+class TempFile
+{
+public:
+    explicit TempFile(const std::string &data)
+    {
+        char name[] = "/tmp/process_source_test.XXXXXX";
+        int fd = mkstemp(name);
+        if (fd < 0 || write(fd, data.data(), data.size()) != ssize_t(data.size()))
+        {
+            throw std::runtime_error("could not create a temporary file");
+        }
+        close(fd);
+        mPath = name;
+    }
+
+    ~TempFile()
+    {
+        unlink(mPath.c_str());
+    }
+
+    const std::string &path() const
+    {
+        return mPath;
+    }
+
+private:
+    std::string mPath;
+};
+
+// Reads everything the application writes, until it closes stdout.
+std::string readAll(ProcessSource &source)
+{
+    std::string all;
+    char buffer[1000];
+    while (size_t n = source.read(buffer, sizeof(buffer), 5000))
+    {
+        all.append(buffer, n);
+    }
+    return all;
+}
+
+} // namespace
+
+TEST(ProcessSourceTest, ReadRequiresStart)
+{
+    ProcessSource source("true");
+    char buffer[16];
+    EXPECT_THROW(source.read(buffer, sizeof(buffer)), std::runtime_error);
+    EXPECT_EQ(source.stop(), -1);
+}
+
+TEST(ProcessSourceTest, ReadsFileThroughCatToEof)
+{
+    std::string data;
+    for (int i = 0; i < 10000; i++)
+    {
+        data += std::to_string(i) + " ";
+    }
+    TempFile file(data);
+
+    ProcessSource source("cat " + file.path());
+    source.start();
+    EXPECT_EQ(readAll(source), data);
+    EXPECT_TRUE(source.eof());
+    EXPECT_FALSE(source.cancelled());
+
+    int status = source.stop();
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST(ProcessSourceTest, ReadTimesOut)
+{
+    ProcessSource source("sleep 10");
+    source.start();
+
+    Clock::time_point start = Clock::now();
+    char buffer[16];
+    EXPECT_EQ(source.read(buffer, sizeof(buffer), 50), 0u);
+    double ms = elapsedMs(start);
+    EXPECT_GE(ms, 45);
+    EXPECT_LT(ms, 1000);
+    EXPECT_FALSE(source.eof());
+    EXPECT_FALSE(source.cancelled());
+
+    // Stopping it with SIGTERM counts as a clean exit
+    start = Clock::now();
+    EXPECT_EQ(source.stop(), 0);
+    EXPECT_LT(elapsedMs(start), 1000);
+}
+
+TEST(ProcessSourceTest, CancelWakesBlockedRead)
+{
+    ProcessSource source("sleep 10");
+    source.start();
+
+    std::thread canceller([&source]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        source.cancel();
+    });
+    Clock::time_point start = Clock::now();
+    char buffer[16];
+    EXPECT_EQ(source.read(buffer, sizeof(buffer)), 0u);
+    EXPECT_LT(elapsedMs(start), 200);
+    canceller.join();
+
+    EXPECT_TRUE(source.cancelled());
+    EXPECT_EQ(source.read(buffer, sizeof(buffer)), 0u);
+    EXPECT_EQ(source.stop(), 0);
+}
+
+TEST(ProcessSourceTest, StopReturnsExitStatus)
+{
+    ProcessSource source("printf hello; exit 3");
+    source.start();
+    EXPECT_EQ(readAll(source), "hello");
+
+    // Wait for it to exit, so the status is its own
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int status = source.stop();
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 3);
+}
+
+TEST(ProcessSourceTest, RestartsAfterStop)
+{
+    ProcessSource source("printf again");
+    for (int i = 0; i < 2; i++)
+    {
+        source.start();
+        EXPECT_EQ(readAll(source), "again");
+        source.stop();
+    }
+}
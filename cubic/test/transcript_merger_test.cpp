@@ -0,0 +1,121 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transcript_merger.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// Builds a final result with one alternative starting at startMs.
+CubicPB::RecognitionResult result(int startMs, const std::string &text,
+                                  bool partial = false)
+{
+    CubicPB::RecognitionResult r;
+    r.set_is_partial(partial);
+    CubicPB::RecognitionAlternative *alt = r.add_alternatives();
+    alt->set_transcript(text);
+    alt->mutable_start_time()->set_seconds(startMs / 1000);
+    alt->mutable_start_time()->set_nanos((startMs % 1000) * 1000000);
+    return r;
+}
+
+// Collects the merged results as "speaker: text".
+struct Collector
+{
+    std::vector<std::string> lines;
+
+    TranscriptMerger::ResultCallback callback()
+    {
+        return [this](const std::string &speaker, const CubicPB::RecognitionResult &r) {
+            lines.push_back(speaker + ": " + r.alternatives(0).transcript());
+        };
+    }
+};
+
+} // namespace
+
+TEST(TranscriptMergerTest, OrdersResultsByStartTime)
+{
+    Collector out;
+    TranscriptMerger merger({"A", "B"}, out.callback());
+    merger.add(0, result(0, "one"));
+    merger.add(0, result(2000, "three"));
+    merger.add(1, result(1000, "two"));
+    merger.add(1, result(3000, "four"));
+    merger.finish(0);
+    merger.finish(1);
+
+    std::vector<std::string> expected = {"A: one", "B: two", "A: three", "B: four"};
+    EXPECT_EQ(out.lines, expected);
+    EXPECT_EQ(merger.resultsMerged(), 4u);
+}
+
+TEST(TranscriptMergerTest, WaitsForOtherChannels)
+{
+    Collector out;
+    TranscriptMerger merger({"A", "B"}, out.callback());
+    merger.add(0, result(1000, "one"));
+    EXPECT_TRUE(out.lines.empty());
+
+    // B can no longer return anything starting before A's result
+    merger.add(1, result(1500, "two"));
+    ASSERT_EQ(out.lines.size(), 1u);
+    EXPECT_EQ(out.lines[0], "A: one");
+}
+
+TEST(TranscriptMergerTest, FinishReleasesHeldResults)
+{
+    Collector out;
+    TranscriptMerger merger({"A", "B", "C"}, out.callback());
+    merger.add(0, result(0, "one"));
+    merger.add(1, result(500, "two"));
+    merger.finish(0);
+    merger.finish(1);
+    EXPECT_TRUE(out.lines.empty());
+
+    // C never started, so finishing it lets the others through
+    merger.finish(2);
+    std::vector<std::string> expected = {"A: one", "B: two"};
+    EXPECT_EQ(out.lines, expected);
+}
+
+TEST(TranscriptMergerTest, IgnoresPartialAndEmptyResults)
+{
+    Collector out;
+    TranscriptMerger merger({"A"}, out.callback());
+    merger.add(0, result(0, "partial", true));
+    merger.add(0, CubicPB::RecognitionResult());
+    merger.add(0, result(100, "final"));
+    merger.finish(0);
+
+    std::vector<std::string> expected = {"A: final"};
+    EXPECT_EQ(out.lines, expected);
+}
+
+TEST(TranscriptMergerTest, RejectsUnknownChannel)
+{
+    Collector out;
+    TranscriptMerger merger({"A"}, out.callback());
+    EXPECT_THROW(merger.add(1, result(0, "x")), std::out_of_range);
+    EXPECT_THROW(merger.finish(1), std::out_of_range);
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transcript_stitcher.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// Times are in samples at this rate, so 1000 samples is one second.
+const unsigned int sampleRate = 1000;
+
+void setSeconds(google::protobuf::Duration *d, double seconds)
+{
+    double whole = std::floor(seconds);
+    d->set_seconds(static_cast<int64_t>(whole));
+    d->set_nanos(static_cast<int32_t>(std::lround((seconds - whole) * 1e9)));
+}
+
+double toSeconds(const google::protobuf::Duration &d)
+{
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+// Two chunks overlapping from 4s to 6s, split at 5s.
+std::vector<AudioChunk> twoChunks()
+{
+    AudioChunk first = {0, 6000, 0, 5000};
+    AudioChunk second = {4000, 10000, 5000, 10000};
+    return {first, second};
+}
+
+// Builds a final result from (word, start, duration) triples, with
+// times relative to the chunk.
+CubicPB::RecognitionResult result(
+    const std::vector<std::pair<std::string, std::pair<double, double>>> &words)
+{
+    CubicPB::RecognitionResult r;
+    CubicPB::RecognitionAlternative *alt = r.add_alternatives();
+    std::string transcript;
+    for (const auto &w : words)
+    {
+        CubicPB::WordInfo *info = alt->add_words();
+        info->set_word(w.first);
+        setSeconds(info->mutable_start_time(), w.second.first);
+        setSeconds(info->mutable_duration(), w.second.second);
+        transcript += (transcript.empty() ? "" : " ") + w.first;
+    }
+    alt->set_transcript(transcript);
+    double start = words.front().second.first;
+    double end = words.back().second.first + words.back().second.second;
+    setSeconds(alt->mutable_start_time(), start);
+    setSeconds(alt->mutable_duration(), end - start);
+    return r;
+}
+
+struct Collector
+{
+    std::vector<CubicPB::RecognitionResult> results;
+
+    TranscriptStitcher::ResultCallback callback()
+    {
+        return [this](const CubicPB::RecognitionResult &r) { results.push_back(r); };
+    }
+
+    std::string transcript(size_t i) const
+    {
+        return results.at(i).alternatives(0).transcript();
+    }
+};
+
+} // namespace
+
+TEST(TranscriptStitcherTest, RejectsBadArguments)
+{
+    Collector out;
+    EXPECT_THROW(TranscriptStitcher(twoChunks(), 0, out.callback()), std::invalid_argument);
+
+    TranscriptStitcher stitcher(twoChunks(), sampleRate, out.callback());
+    EXPECT_THROW(stitcher.add(2, result({{"a", {0, 1}}})), std::out_of_range);
+    EXPECT_THROW(stitcher.finish(2), std::out_of_range);
+}
+
+TEST(TranscriptStitcherTest, DropsWordsOutsideEachChunk)
+{
+    Collector out;
+    TranscriptStitcher stitcher(twoChunks(), sampleRate, out.callback());
+
+    // "c" is centred after the split, so only the second chunk keeps it
+    stitcher.add(0, result({{"a", {1.0, 0.4}}, {"b", {4.5, 0.3}}, {"c", {5.2, 0.4}}}));
+
+    // "x" is centred before the split (at 4.7s), so only the first
+    // chunk may keep it; the times here start at 4s.
+    stitcher.add(1, result({{"x", {0.5, 0.4}}, {"c", {1.2, 0.4}}, {"d", {3.0, 0.5}}}));
+    stitcher.finish(0);
+    stitcher.finish(1);
+
+    ASSERT_EQ(out.results.size(), 2u);
+    EXPECT_EQ(out.transcript(0), "a b");
+    EXPECT_EQ(out.transcript(1), "c d");
+    EXPECT_EQ(stitcher.wordsDropped(), 2u);
+    EXPECT_EQ(stitcher.chunksDone(), 2u);
+
+    // The second chunk's times are on the recording's timeline
+    const CubicPB::RecognitionAlternative &alt = out.results[1].alternatives(0);
+    EXPECT_NEAR(toSeconds(alt.start_time()), 5.2, 1e-6);
+    EXPECT_NEAR(toSeconds(alt.duration()), 2.3, 1e-6);
+    EXPECT_NEAR(toSeconds(alt.words(1).start_time()), 7.0, 1e-6);
+
+    // The first chunk's result was rebuilt without "c"
+    const CubicPB::RecognitionAlternative &first = out.results[0].alternatives(0);
+    EXPECT_NEAR(toSeconds(first.start_time()), 1.0, 1e-6);
+    EXPECT_NEAR(toSeconds(first.duration()), 3.8, 1e-6);
+}
+
+TEST(TranscriptStitcherTest, PassesResultsOnInOrder)
+{
+    Collector out;
+    TranscriptStitcher stitcher(twoChunks(), sampleRate, out.callback());
+    stitcher.add(1, result({{"later", {3.0, 0.5}}}));
+    stitcher.finish(1);
+    EXPECT_TRUE(out.results.empty());
+    EXPECT_EQ(stitcher.chunksDone(), 0u);
+
+    stitcher.add(0, result({{"earlier", {1.0, 0.5}}}));
+    stitcher.finish(0);
+    ASSERT_EQ(out.results.size(), 2u);
+    EXPECT_EQ(out.transcript(0), "earlier");
+    EXPECT_EQ(out.transcript(1), "later");
+}
+
+TEST(TranscriptStitcherTest, DropsWordClaimedByBothChunks)
+{
+    Collector out;
+    TranscriptStitcher stitcher(twoChunks(), sampleRate, out.callback());
+
+    // Each chunk times "b" so its centre falls on its own side of 5s
+    stitcher.add(0, result({{"a", {4.0, 0.5}}, {"b", {4.85, 0.2}}}));
+    stitcher.add(1, result({{"b", {0.95, 0.2}}, {"c", {1.5, 0.4}}}));
+    stitcher.finish(0);
+    stitcher.finish(1);
+
+    ASSERT_EQ(out.results.size(), 2u);
+    EXPECT_EQ(out.transcript(0), "a b");
+    EXPECT_EQ(out.transcript(1), "c");
+    EXPECT_EQ(stitcher.wordsDropped(), 1u);
+}
+
+TEST(TranscriptStitcherTest, ResultsWithoutWordsKeptByCentre)
+{
+    Collector out;
+    TranscriptStitcher stitcher(twoChunks(), sampleRate, out.callback());
+
+    CubicPB::RecognitionResult kept;
+    CubicPB::RecognitionAlternative *alt = kept.add_alternatives();
+    alt->set_transcript("kept");
+    setSeconds(alt->mutable_start_time(), 2.0);
+    setSeconds(alt->mutable_duration(), 1.0);
+
+    CubicPB::RecognitionResult dropped = kept;
+    dropped.mutable_alternatives(0)->set_transcript("dropped");
+    setSeconds(dropped.mutable_alternatives(0)->mutable_start_time(), 5.5);
+
+    CubicPB::RecognitionResult partial = kept;
+    partial.set_is_partial(true);
+
+    stitcher.add(0, kept);
+    stitcher.add(0, dropped);
+    stitcher.add(0, partial);
+    stitcher.finish(0);
+
+    ASSERT_EQ(out.results.size(), 1u);
+    EXPECT_EQ(out.transcript(0), "kept");
+}
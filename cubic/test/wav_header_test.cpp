@@ -0,0 +1,248 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wav_header.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+std::string le(uint32_t value, int numBytes)
+{
+    std::string bytes;
+    for (int i = 0; i < numBytes; i++)
+    {
+        bytes.push_back(char((value >> (8 * i)) & 0xFF));
+    }
+    return bytes;
+}
+
+// Returns a chunk with the given ID and body, padded to an even size.
+std::string chunk(const std::string &id, const std::string &body)
+{
+    std::string c = id + le(body.size(), 4) + body;
+    if (body.size() & 1)
+    {
+        c.push_back('\0');
+    }
+    return c;
+}
+
+// The body of a plain PCM "fmt " chunk.
+std::string pcmFormat(uint16_t channels, uint32_t sampleRate, uint16_t bits)
+{
+    uint16_t blockAlign = channels * bits / 8;
+    return le(1, 2) + le(channels, 2) + le(sampleRate, 4) +
+           le(sampleRate * blockAlign, 4) + le(blockAlign, 2) + le(bits, 2);
+}
+
+// The body of a WAVE_FORMAT_EXTENSIBLE "fmt " chunk with the given
+// sub-format tag.
+std::string extensibleFormat(uint16_t channels, uint32_t sampleRate,
+                             uint16_t bits, uint16_t subFormat)
+{
+    uint16_t blockAlign = channels * bits / 8;
+    std::string guidTail("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 14);
+    return le(0xFFFE, 2) + le(channels, 2) + le(sampleRate, 4) +
+           le(sampleRate * blockAlign, 4) + le(blockAlign, 2) + le(bits, 2) +
+           le(22, 2) + le(bits, 2) + le(3, 4) + le(subFormat, 2) + guidTail;
+}
+
+// An odd-sized LIST chunk body, as written by ffmpeg.
+const std::string listInfo("INFOISFT\x05\0\0\0Lavf\0", 17);
+
+std::string wavFile(const std::string &chunks)
+{
+    return "RIFF" + le(4 + chunks.size(), 4) + "WAVE" + chunks;
+}
+
+// Feeds the file to a parser in pieces of the given size and returns
+// all the sample data it passes through.
+std::string parseInPieces(WavParser *parser, const std::string &file,
+                          size_t pieceSize)
+{
+    std::string samples;
+    for (size_t pos = 0; pos < file.size(); pos += pieceSize)
+    {
+        std::string piece = file.substr(pos, pieceSize);
+        size_t used = 0;
+        while (used < piece.size())
+        {
+            const char *audio;
+            size_t audioSize;
+            size_t n = parser->parse(piece.data() + used, piece.size() - used,
+                                     &audio, &audioSize);
+            EXPECT_GT(n, 0u);
+            samples.append(audio, audioSize);
+            used += n;
+        }
+    }
+    return samples;
+}
+
+} // namespace
+
+TEST(WavHeaderTest, ParsesPlainHeader)
+{
+    std::string samples = "0123456789ab";
+    std::string file = wavFile(chunk("fmt ", pcmFormat(2, 16000, 16)) +
+                               chunk("data", samples));
+
+    WavFormat format;
+    ASSERT_TRUE(parseWavHeader(file.data(), file.size(), &format));
+    EXPECT_EQ(format.formatTag, 1);
+    EXPECT_EQ(format.channels, 2);
+    EXPECT_EQ(format.sampleRate, 16000u);
+    EXPECT_EQ(format.bitsPerSample, 16);
+    EXPECT_EQ(format.dataOffset, 44u);
+    EXPECT_EQ(format.dataSize, samples.size());
+    EXPECT_DOUBLE_EQ(format.bytesPerSecond(), 64000);
+}
+
+TEST(WavHeaderTest, SkipsListAndOddSizedChunks)
+{
+    std::string samples = "abcdef";
+    std::string file = wavFile(chunk("LIST", listInfo) +
+                               chunk("fmt ", pcmFormat(1, 8000, 16)) +
+                               chunk("junk", "odd") + chunk("data", samples));
+
+    WavFormat format;
+    ASSERT_TRUE(parseWavHeader(file.data(), file.size(), &format));
+    EXPECT_EQ(format.sampleRate, 8000u);
+    EXPECT_EQ(file.substr(format.dataOffset, format.dataSize), samples);
+}
+
+TEST(WavHeaderTest, ReadsExtensibleSubFormat)
+{
+    std::string file = wavFile(chunk("fmt ", extensibleFormat(6, 48000, 32, 3)) +
+                               chunk("data", std::string(48, '\0')));
+
+    WavFormat format;
+    ASSERT_TRUE(parseWavHeader(file.data(), file.size(), &format));
+    EXPECT_EQ(format.formatTag, 3);
+    EXPECT_EQ(format.channels, 6);
+    EXPECT_EQ(format.bitsPerSample, 32);
+}
+
+TEST(WavHeaderTest, RejectsBadHeaders)
+{
+    WavFormat format;
+    std::string notWav("RIFF\0\0\0\0AVI LIST", 16);
+    EXPECT_FALSE(parseWavHeader(notWav.data(), notWav.size(), &format));
+
+    std::string noFormat = wavFile(chunk("data", "abcd"));
+    EXPECT_FALSE(parseWavHeader(noFormat.data(), noFormat.size(), &format));
+}
+
+TEST(WavParserTest, ParsesWholeFile)
+{
+    std::string samples = "0123456789ab";
+    std::string file = wavFile(chunk("fmt ", pcmFormat(2, 16000, 16)) +
+                               chunk("data", samples) + chunk("LIST", "tail"));
+
+    WavParser parser;
+    EXPECT_EQ(parseInPieces(&parser, file, file.size()), samples);
+    ASSERT_TRUE(parser.haveFormat());
+    EXPECT_EQ(parser.format().channels, 2);
+    EXPECT_EQ(parser.format().dataOffset, 44u);
+    EXPECT_EQ(parser.format().dataSize, samples.size());
+}
+
+TEST(WavParserTest, ParsesHeadersSplitAcrossCalls)
+{
+    std::string samples;
+    for (int i = 0; i < 100; i++)
+    {
+        samples.push_back(char(i));
+    }
+    std::string file = wavFile(chunk("LIST", listInfo) +
+                               chunk("fmt ", extensibleFormat(2, 44100, 24, 1)) +
+                               chunk("bext", std::string(13, 'x')) +
+                               chunk("data", samples));
+
+    WavFormat want;
+    ASSERT_TRUE(parseWavHeader(file.data(), file.size(), &want));
+
+    // Every piece size up to past the end of the headers, so that each
+    // header and chunk boundary falls inside a piece somewhere.
+    for (size_t pieceSize = 1; pieceSize <= want.dataOffset + 1; pieceSize++)
+    {
+        WavParser parser;
+        EXPECT_EQ(parseInPieces(&parser, file, pieceSize), samples)
+            << "pieces of " << pieceSize;
+        ASSERT_TRUE(parser.haveFormat());
+        EXPECT_EQ(parser.format().formatTag, 1);
+        EXPECT_EQ(parser.format().channels, 2);
+        EXPECT_EQ(parser.format().sampleRate, 44100u);
+        EXPECT_EQ(parser.format().bitsPerSample, 24);
+        EXPECT_EQ(parser.format().dataOffset, want.dataOffset);
+    }
+}
+
+TEST(WavParserTest, SkipsPaddingOfOddSizedChunks)
+{
+    std::string samples = "sample";
+    std::string file = wavFile(chunk("fmt ", pcmFormat(1, 16000, 16)) +
+                               chunk("note", "abc") + chunk("LIST", "x") +
+                               chunk("data", samples));
+
+    WavParser parser;
+    EXPECT_EQ(parseInPieces(&parser, file, 5), samples);
+    EXPECT_EQ(parser.format().dataOffset, file.size() - samples.size());
+}
+
+TEST(WavParserTest, StreamedDataRunsToEnd)
+{
+    // Recorders writing to a pipe leave the data size at zero or all ones
+    const uint32_t sizes[] = {0, 0xFFFFFFFF};
+    for (uint32_t size : sizes)
+    {
+        std::string samples(1000, 's');
+        std::string file = wavFile(chunk("fmt ", pcmFormat(1, 16000, 16))) +
+                           "data" + le(size, 4) + samples;
+
+        WavParser parser;
+        EXPECT_EQ(parseInPieces(&parser, file, 333), samples);
+        EXPECT_EQ(parser.format().dataSize, 0u);
+    }
+}
+
+TEST(WavParserTest, RejectsBadFiles)
+{
+    const char *audio;
+    size_t audioSize;
+
+    WavParser notWav;
+    std::string riff("RIFF\0\0\0\0AVI ", 12);
+    EXPECT_THROW(notWav.parse(riff.data(), riff.size(), &audio, &audioSize),
+                 std::runtime_error);
+
+    WavParser shortFormat;
+    std::string file = wavFile(chunk("fmt ", std::string(12, '\0')));
+    EXPECT_THROW(shortFormat.parse(file.data(), file.size(), &audio, &audioSize),
+                 std::runtime_error);
+
+    WavParser noFormat;
+    file = wavFile(chunk("data", "abcd"));
+    EXPECT_THROW(noFormat.parse(file.data(), file.size(), &audio, &audioSize),
+                 std::runtime_error);
+}
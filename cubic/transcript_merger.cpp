@@ -0,0 +1,118 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transcript_merger.h"
+
+#include <algorithm>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+double startSeconds(const CubicPB::RecognitionResult &result)
+{
+    const google::protobuf::Duration &d = result.alternatives(0).start_time();
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+} // namespace
+
+TranscriptMerger::TranscriptMerger(const std::vector<std::string> &speakers,
+                                   ResultCallback onResult)
+    : mOnResult(onResult), mResultsMerged(0)
+{
+    for (const std::string &speaker : speakers)
+    {
+        Channel ch;
+        ch.speaker = speaker;
+        ch.finished = false;
+        ch.watermark = -1.0;
+        ch.next = 0;
+        mChannels.push_back(ch);
+    }
+}
+
+void TranscriptMerger::add(size_t channel, const CubicPB::RecognitionResult &result)
+{
+    if (result.is_partial() || result.alternatives_size() == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    Channel &ch = mChannels.at(channel);
+    ch.watermark = std::max(ch.watermark, startSeconds(result));
+    ch.pending.push_back(result);
+    emitReady();
+}
+
+void TranscriptMerger::finish(size_t channel)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mChannels.at(channel).finished = true;
+    emitReady();
+}
+
+size_t TranscriptMerger::resultsMerged() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mResultsMerged;
+}
+
+void TranscriptMerger::emitReady()
+{
+    while (true)
+    {
+        // Find the earliest result waiting on any channel
+        Channel *first = nullptr;
+        double firstStart = 0;
+        for (Channel &ch : mChannels)
+        {
+            if (ch.next < ch.pending.size())
+            {
+                double start = startSeconds(ch.pending[ch.next]);
+                if (!first || start < firstStart)
+                {
+                    first = &ch;
+                    firstStart = start;
+                }
+            }
+        }
+        if (!first)
+        {
+            return;
+        }
+
+        // It can only be passed on if no other channel may still return
+        // a result that starts before it.
+        for (const Channel &ch : mChannels)
+        {
+            if (&ch != first && !ch.finished && ch.watermark < firstStart)
+            {
+                return;
+            }
+        }
+
+        mOnResult(first->speaker, first->pending[first->next]);
+        mResultsMerged++;
+        if (++first->next == first->pending.size())
+        {
+            first->pending.clear();
+            first->next = 0;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRANSCRIPT_MERGER_H
+#define TRANSCRIPT_MERGER_H
+
+#include "cubic.pb.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * TranscriptMerger combines the results of several streams covering the
+ * same stretch of time, such as one stream per channel of a call
+ * recording, into a single transcript ordered by start time, with each
+ * result labelled by the speaker on its channel.
+ *
+ * Each stream returns its results in time order, so a result can be
+ * passed on once every other channel has either finished or returned a
+ * result starting at or after it. A channel that stays silent for a long
+ * time therefore holds back the results of the others until it speaks
+ * or finishes.
+ */
+class TranscriptMerger
+{
+public:
+    using ResultCallback =
+        std::function<void(const std::string &speaker,
+                           const cobaltspeech::cubic::RecognitionResult &)>;
+
+    /*
+     * Create a merger for channels with the given speaker names. The
+     * callback is called with a lock held, so results are never passed
+     * to it at the same time, and it must not call back into the merger.
+     */
+    TranscriptMerger(const std::vector<std::string> &speakers,
+                     ResultCallback onResult);
+
+    /*
+     * Add a final result from the given channel. Partial results and
+     * results without alternatives are ignored. This may be called from
+     * any thread.
+     */
+    void add(size_t channel, const cobaltspeech::cubic::RecognitionResult &result);
+
+    /*
+     * Mark the channel as finished (or failed), passing on the results
+     * that were only waiting for it.
+     */
+    void finish(size_t channel);
+
+    // Returns the number of results passed on so far.
+    size_t resultsMerged() const;
+
+private:
+    struct Channel
+    {
+        std::string speaker;
+        bool finished;
+
+        // The start time of the latest result, which no later result
+        // from this channel starts before.
+        double watermark;
+
+        // Results not yet passed on, in the order they arrived.
+        std::vector<cobaltspeech::cubic::RecognitionResult> pending;
+        size_t next;
+    };
+
+    ResultCallback mOnResult;
+
+    mutable std::mutex mMutex;
+    std::vector<Channel> mChannels;
+    size_t mResultsMerged;
+
+    void emitReady();
+};
+
+#endif // TRANSCRIPT_MERGER_H
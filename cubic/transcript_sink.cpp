@@ -0,0 +1,401 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transcript_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+int64_t toMs(const google::protobuf::Duration &d)
+{
+    return d.seconds() * 1000 + d.nanos() / 1000000;
+}
+
+void appendJsonString(std::string *out, const std::string &str)
+{
+    out->push_back('"');
+    for (char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            out->append("\\\"");
+            break;
+        case '\\':
+            out->append("\\\\");
+            break;
+        case '\n':
+            out->append("\\n");
+            break;
+        case '\r':
+            out->append("\\r");
+            break;
+        case '\t':
+            out->append("\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out->append(buf);
+            }
+            else
+            {
+                out->push_back(c);
+            }
+        }
+    }
+    out->push_back('"');
+}
+
+// Appends the confidence, start and duration fields shared by
+// alternatives and words.
+void appendJsonTiming(std::string *out, double confidence,
+                      const google::protobuf::Duration &start,
+                      const google::protobuf::Duration &duration)
+{
+    char buf[96];
+    snprintf(buf, sizeof(buf),
+             ",\"confidence\":%.4f,\"start\":%.3f,\"duration\":%.3f",
+             confidence, toMs(start) / 1000.0, toMs(duration) / 1000.0);
+    out->append(buf);
+}
+
+void formatJson(const CubicPB::RecognitionResult &result,
+                const std::string &source, std::string *out)
+{
+    out->append("{");
+    if (!source.empty())
+    {
+        out->append("\"source\":");
+        appendJsonString(out, source);
+        out->append(",");
+    }
+    out->append(result.is_partial() ? "\"partial\":true" : "\"partial\":false");
+    out->append(",\"channel\":");
+    out->append(std::to_string(result.audio_channel()));
+    out->append(",\"alternatives\":[");
+    for (int a = 0; a < result.alternatives_size(); a++)
+    {
+        const CubicPB::RecognitionAlternative &alt = result.alternatives(a);
+        out->append(a == 0 ? "{\"transcript\":" : ",{\"transcript\":");
+        appendJsonString(out, alt.transcript());
+        appendJsonTiming(out, alt.confidence(), alt.start_time(), alt.duration());
+        out->append(",\"words\":[");
+        for (int w = 0; w < alt.words_size(); w++)
+        {
+            const CubicPB::WordInfo &word = alt.words(w);
+            out->append(w == 0 ? "{\"word\":" : ",{\"word\":");
+            appendJsonString(out, word.word());
+            appendJsonTiming(out, word.confidence(), word.start_time(),
+                             word.duration());
+            out->append("}");
+        }
+        out->append("]}");
+    }
+    out->append("]}\n");
+}
+
+void putLE(std::string *out, uint64_t value, int numBytes)
+{
+    for (int i = 0; i < numBytes; i++)
+    {
+        out->push_back(char((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void putFloat(std::string *out, double value)
+{
+    float f = static_cast<float>(value);
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    putLE(out, bits, 4);
+}
+
+void putTiming(std::string *out, double confidence,
+               const google::protobuf::Duration &start,
+               const google::protobuf::Duration &duration)
+{
+    putFloat(out, confidence);
+    putLE(out, static_cast<uint32_t>(toMs(start)), 4);
+    putLE(out, static_cast<uint32_t>(toMs(duration)), 4);
+}
+
+void formatBinary(const CubicPB::RecognitionResult &result,
+                  const std::string &source, std::string *out)
+{
+    size_t lengthPos = out->size();
+    putLE(out, 0, 4);
+
+    putLE(out, result.is_partial() ? 1 : 0, 1);
+    putLE(out, result.audio_channel(), 4);
+    size_t sourceLen = std::min<size_t>(source.size(), 0xFFFF);
+    putLE(out, sourceLen, 2);
+    out->append(source, 0, sourceLen);
+
+    int numAlts = std::min(result.alternatives_size(), 0xFFFF);
+    putLE(out, numAlts, 2);
+    for (int a = 0; a < numAlts; a++)
+    {
+        const CubicPB::RecognitionAlternative &alt = result.alternatives(a);
+        putTiming(out, alt.confidence(), alt.start_time(), alt.duration());
+        putLE(out, alt.transcript().size(), 4);
+        out->append(alt.transcript());
+
+        putLE(out, alt.words_size(), 4);
+        for (const CubicPB::WordInfo &word : alt.words())
+        {
+            putTiming(out, word.confidence(), word.start_time(), word.duration());
+            size_t wordLen = std::min<size_t>(word.word().size(), 0xFFFF);
+            putLE(out, wordLen, 2);
+            out->append(word.word(), 0, wordLen);
+        }
+    }
+
+    // Fill in the record length now that it is known
+    uint32_t length = static_cast<uint32_t>(out->size() - lengthPos - 4);
+    for (int i = 0; i < 4; i++)
+    {
+        (*out)[lengthPos + i] = char((length >> (8 * i)) & 0xFF);
+    }
+}
+
+} // namespace
+
+TranscriptSink::Options::Options()
+    : format(JSONL), sync(SyncOnClose), includePartials(false),
+      flushIntervalMs(200), batchBytes(64 * 1024),
+      maxBufferedBytes(64 * 1024 * 1024)
+{
+}
+
+TranscriptSink::TranscriptSink(const std::string &path, const Options &opts)
+    : mOptions(opts), mFd(-1), mOwnsFd(false), mBufferRecords(0),
+      mClosing(false), mRecords(0), mDropped(0), mError(0)
+{
+    if (path == "-")
+    {
+        mFd = STDOUT_FILENO;
+    }
+    else
+    {
+        mFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (mFd < 0)
+        {
+            throw std::runtime_error("could not open " + path + ": " +
+                                     strerror(errno));
+        }
+        mOwnsFd = true;
+    }
+
+    if (opts.format == Binary)
+    {
+        mBuffer.append("CTR1");
+    }
+
+    mThread = std::thread(&TranscriptSink::run, this);
+}
+
+TranscriptSink::~TranscriptSink()
+{
+    stop();
+}
+
+void TranscriptSink::write(const CubicPB::RecognitionResult &result,
+                           const std::string &source)
+{
+    if (result.is_partial() && !mOptions.includePartials)
+    {
+        return;
+    }
+
+    // Format outside the lock, into a buffer each thread keeps reusing
+    static thread_local std::string record;
+    record.clear();
+    switch (mOptions.format)
+    {
+    case Text:
+        if (result.alternatives_size() > 0)
+        {
+            record.append(result.alternatives(0).transcript());
+        }
+        record.push_back('\n');
+        break;
+    case JSONL:
+        formatJson(result, source, &record);
+        break;
+    case Binary:
+        formatBinary(result, source, &record);
+        break;
+    }
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mClosing || mBuffer.size() + record.size() > mOptions.maxBufferedBytes)
+        {
+            mDropped++;
+            return;
+        }
+        mBuffer.append(record);
+        mBufferRecords++;
+        wake = mBuffer.size() >= mOptions.batchBytes;
+    }
+
+    if (wake)
+    {
+        mCond.notify_one();
+    }
+}
+
+void TranscriptSink::close()
+{
+    stop();
+
+    int err;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        err = mError;
+    }
+    if (err != 0)
+    {
+        throw std::runtime_error(std::string("transcript write failed: ") +
+                                 strerror(err));
+    }
+}
+
+uint64_t TranscriptSink::recordsWritten() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRecords;
+}
+
+uint64_t TranscriptSink::recordsDropped() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDropped;
+}
+
+void TranscriptSink::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosing = true;
+    }
+    mCond.notify_one();
+
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+
+    if (mOwnsFd && mFd >= 0)
+    {
+        ::close(mFd);
+    }
+    mFd = -1;
+}
+
+void TranscriptSink::run()
+{
+    std::string batch;
+    size_t batchRecords;
+    while (true)
+    {
+        bool closing;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait_for(lock, std::chrono::milliseconds(mOptions.flushIntervalMs),
+                           [this]() {
+                               return mClosing ||
+                                      mBuffer.size() >= mOptions.batchBytes;
+                           });
+
+            // Take everything waiting, leaving the old batch's memory
+            // behind for the next results.
+            batch.swap(mBuffer);
+            batchRecords = mBufferRecords;
+            mBufferRecords = 0;
+            closing = mClosing;
+        }
+
+        if (!batch.empty())
+        {
+            bool written = writeAll(batch);
+            int err = errno;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (written)
+                {
+                    mRecords += batchRecords;
+                }
+                else if (mError == 0)
+                {
+                    mError = err;
+                }
+            }
+            if (written && mOptions.sync == SyncEachBatch && mOwnsFd)
+            {
+                fsync(mFd);
+            }
+            batch.clear();
+        }
+
+        if (closing)
+        {
+            break;
+        }
+    }
+
+    if (mOptions.sync != SyncNever && mOwnsFd)
+    {
+        fsync(mFd);
+    }
+}
+
+bool TranscriptSink::writeAll(const std::string &data)
+{
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0)
+    {
+        ssize_t n = ::write(mFd, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    return true;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRANSCRIPT_SINK_H
+#define TRANSCRIPT_SINK_H
+
+#include "cubic.pb.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * TranscriptSink writes recognition results to a file (or stdout) on a
+ * background thread, so the thread receiving results never waits for
+ * the disk or the terminal. write() only formats the result into an
+ * in-memory buffer; the writer thread takes the whole buffer at once
+ * and writes it with as few system calls as possible.
+ *
+ * Three formats are supported:
+ *
+ * Text writes the transcript of the first alternative of each result,
+ * one per line, as the examples print them.
+ *
+ * JSONL writes one JSON object per result, with every alternative, its
+ * confidence, start time and duration (in seconds), and its words with
+ * their own confidences and times.
+ *
+ * Binary writes the same information as compact little-endian records,
+ * after a 4-byte "CTR1" file signature. Each record is:
+ *
+ *     u32 record length (not including this field)
+ *     u8  flags (1 = partial result)
+ *     u32 audio channel
+ *     u16 source length, then the source bytes
+ *     u16 number of alternatives, then for each:
+ *         f32 confidence, u32 start ms, u32 duration ms
+ *         u32 transcript length, then the transcript bytes
+ *         u32 number of words, then for each:
+ *             f32 confidence, u32 start ms, u32 duration ms
+ *             u16 word length, then the word bytes
+ *
+ * If the output falls so far behind that more than maxBufferedBytes are
+ * waiting, new results are dropped (and counted) rather than blocking
+ * the caller.
+ */
+class TranscriptSink
+{
+public:
+    enum Format
+    {
+        Text,
+        JSONL,
+        Binary
+    };
+
+    // When the writer thread calls fsync() on the output file.
+    enum SyncPolicy
+    {
+        SyncNever,      // leave it to the operating system
+        SyncEachBatch,  // after each batch of writes
+        SyncOnClose     // once, when the sink is closed
+    };
+
+    struct Options
+    {
+        Format format;
+        SyncPolicy sync;
+
+        // Partial results are skipped unless this is set.
+        bool includePartials;
+
+        // The writer waits up to this long for more results before
+        // writing a batch, unless batchBytes are already waiting.
+        int flushIntervalMs;
+        size_t batchBytes;
+
+        // Results are dropped while this much output is waiting.
+        size_t maxBufferedBytes;
+
+        Options();
+    };
+
+    /*
+     * Open the given file for writing, replacing any existing file, and
+     * start the writer thread. A path of "-" writes to stdout. Throws
+     * std::runtime_error if the file cannot be opened.
+     */
+    TranscriptSink(const std::string &path, const Options &opts = Options());
+    ~TranscriptSink();
+
+    /*
+     * Format the result and queue it to be written. The source, if not
+     * empty, is stored with the record to say where it came from (such
+     * as the audio file name). This never waits for I/O.
+     */
+    void write(const cobaltspeech::cubic::RecognitionResult &result,
+               const std::string &source = "");
+
+    /*
+     * Write everything queued, sync the file if requested, and close it.
+     * Throws std::runtime_error if any write failed.
+     */
+    void close();
+
+    /*
+     * Returns the number of results written to the file so far, and the
+     * number dropped because the buffer was full or the sink was closed.
+     * Results in a batch that failed to write are counted as neither.
+     */
+    uint64_t recordsWritten() const;
+    uint64_t recordsDropped() const;
+
+private:
+    Options mOptions;
+    int mFd;
+    bool mOwnsFd;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+    std::string mBuffer;
+    size_t mBufferRecords;
+    bool mClosing;
+    uint64_t mRecords;
+    uint64_t mDropped;
+    int mError;
+
+    std::thread mThread;
+
+    void run();
+    void stop();
+    bool writeAll(const std::string &data);
+};
+
+#endif // TRANSCRIPT_SINK_H
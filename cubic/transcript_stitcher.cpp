@@ -0,0 +1,319 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transcript_stitcher.h"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace CubicPB = cobaltspeech::cubic;
+
+namespace
+{
+
+// The number of words remembered from the end of each chunk.
+const size_t tailWords = 8;
+
+// Word timings from two chunks may disagree by up to this many seconds
+// and still be taken as the same word.
+const double boundarySlack = 0.1;
+
+void setSeconds(google::protobuf::Duration *d, double seconds)
+{
+    double whole = std::floor(seconds);
+    d->set_seconds(static_cast<int64_t>(whole));
+    d->set_nanos(static_cast<int32_t>((seconds - whole) * 1e9));
+}
+
+double toSeconds(const google::protobuf::Duration &d)
+{
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+void shift(google::protobuf::Duration *start, double offset)
+{
+    setSeconds(start, toSeconds(*start) + offset);
+}
+
+double centre(const google::protobuf::Duration &start,
+              const google::protobuf::Duration &duration)
+{
+    return toSeconds(start) + toSeconds(duration) / 2;
+}
+
+/*
+ * Rebuild an alternative's transcript, start time and duration from its
+ * words after some of them were removed.
+ */
+void rebuild(CubicPB::RecognitionAlternative *alt)
+{
+    std::string transcript;
+    for (const CubicPB::WordInfo &word : alt->words())
+    {
+        if (!transcript.empty())
+        {
+            transcript += " ";
+        }
+        transcript += word.word();
+    }
+    alt->set_transcript(transcript);
+
+    if (alt->words_size() > 0)
+    {
+        const CubicPB::WordInfo &first = alt->words(0);
+        const CubicPB::WordInfo &last = alt->words(alt->words_size() - 1);
+        double start = toSeconds(first.start_time());
+        double end = toSeconds(last.start_time()) + toSeconds(last.duration());
+        setSeconds(alt->mutable_start_time(), start);
+        setSeconds(alt->mutable_duration(), std::max(0.0, end - start));
+    }
+}
+
+} // namespace
+
+TranscriptStitcher::TranscriptStitcher(const std::vector<AudioChunk> &chunks,
+                                       unsigned int sampleRate,
+                                       ResultCallback onResult) :
+    mSampleRate(sampleRate),
+    mOnResult(onResult),
+    mNextChunk(0),
+    mWordsDropped(0)
+{
+    if (sampleRate == 0)
+    {
+        throw std::invalid_argument("sample rate must not be zero");
+    }
+
+    for (const AudioChunk &chunk : chunks)
+    {
+        ChunkState state;
+        state.chunk = chunk;
+        state.finished = false;
+        mChunks.push_back(state);
+    }
+}
+
+TranscriptStitcher::~TranscriptStitcher()
+{}
+
+void TranscriptStitcher::add(size_t chunk, const CubicPB::RecognitionResult &result)
+{
+    if (result.is_partial())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (chunk >= mChunks.size())
+    {
+        throw std::out_of_range("no such audio chunk");
+    }
+    ChunkState &state = mChunks[chunk];
+
+    // The first and last chunks own everything before and after them
+    double offset = static_cast<double>(state.chunk.begin) / mSampleRate;
+    double keepBegin = chunk == 0 ? -std::numeric_limits<double>::infinity()
+                                  : static_cast<double>(state.chunk.keepBegin) / mSampleRate;
+    double keepEnd = chunk + 1 == mChunks.size()
+                         ? std::numeric_limits<double>::infinity()
+                         : static_cast<double>(state.chunk.keepEnd) / mSampleRate;
+    auto kept = [keepBegin, keepEnd](double t) {
+        return t >= keepBegin && t < keepEnd;
+    };
+
+    CubicPB::RecognitionResult stitched;
+    stitched.set_is_partial(false);
+    stitched.set_audio_channel(result.audio_channel());
+    for (int a = 0; a < result.alternatives_size(); a++)
+    {
+        CubicPB::RecognitionAlternative alt = result.alternatives(a);
+        shift(alt.mutable_start_time(), offset);
+
+        if (alt.words_size() == 0)
+        {
+            if (kept(centre(alt.start_time(), alt.duration())))
+            {
+                *stitched.add_alternatives() = alt;
+            }
+            continue;
+        }
+
+        google::protobuf::RepeatedPtrField<CubicPB::WordInfo> words;
+        words.Swap(alt.mutable_words());
+        for (CubicPB::WordInfo &word : words)
+        {
+            shift(word.mutable_start_time(), offset);
+            if (kept(centre(word.start_time(), word.duration())))
+            {
+                alt.add_words()->Swap(&word);
+            }
+        }
+
+        if (a == 0)
+        {
+            mWordsDropped += words.size() - alt.words_size();
+        }
+        if (alt.words_size() == words.size())
+        {
+            *stitched.add_alternatives() = alt;
+        }
+        else if (alt.words_size() > 0)
+        {
+            rebuild(&alt);
+            *stitched.add_alternatives() = alt;
+        }
+    }
+
+    if (stitched.alternatives_size() > 0)
+    {
+        state.results.push_back(stitched);
+    }
+}
+
+void TranscriptStitcher::finish(size_t chunk)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (chunk >= mChunks.size())
+    {
+        throw std::out_of_range("no such audio chunk");
+    }
+
+    mChunks[chunk].finished = true;
+    emitReady();
+}
+
+size_t TranscriptStitcher::chunksDone() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mNextChunk;
+}
+
+size_t TranscriptStitcher::wordsDropped() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWordsDropped;
+}
+
+void TranscriptStitcher::emitReady()
+{
+    while (mNextChunk < mChunks.size() && mChunks[mNextChunk].finished)
+    {
+        ChunkState &state = mChunks[mNextChunk];
+
+        // Only the start of a chunk can repeat the end of the last one
+        bool checkRepeats = mNextChunk > 0;
+        for (CubicPB::RecognitionResult &result : state.results)
+        {
+            if (checkRepeats)
+            {
+                checkRepeats = dropRepeatedWords(&result);
+                if (result.alternatives_size() == 0)
+                {
+                    continue;
+                }
+            }
+
+            mOnResult(result);
+
+            const CubicPB::RecognitionAlternative &alt = result.alternatives(0);
+            for (const CubicPB::WordInfo &word : alt.words())
+            {
+                TailWord tail;
+                tail.word = word.word();
+                tail.start = toSeconds(word.start_time());
+                tail.end = tail.start + toSeconds(word.duration());
+                mTail.push_back(tail);
+            }
+            if (mTail.size() > tailWords)
+            {
+                mTail.erase(mTail.begin(), mTail.end() - tailWords);
+            }
+        }
+
+        // The results are no longer needed
+        std::vector<CubicPB::RecognitionResult>().swap(state.results);
+        mNextChunk++;
+    }
+}
+
+bool TranscriptStitcher::dropRepeatedWords(CubicPB::RecognitionResult *result)
+{
+    if (result->alternatives_size() == 0 || result->alternatives(0).words_size() == 0)
+    {
+        // Results without words are passed on as they are
+        return false;
+    }
+
+    auto repeated = [this](const CubicPB::WordInfo &word) {
+        double start = toSeconds(word.start_time());
+        double end = start + toSeconds(word.duration());
+        for (const TailWord &tail : mTail)
+        {
+            if (tail.word == word.word() && start < tail.end + boundarySlack &&
+                tail.start < end + boundarySlack)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Compare the leading words of each alternative with the words just
+    // passed on, stopping at the first that is new.
+    bool allRepeated = false;
+    for (int a = result->alternatives_size() - 1; a >= 0; a--)
+    {
+        CubicPB::RecognitionAlternative *alt = result->mutable_alternatives(a);
+        if (alt->words_size() == 0)
+        {
+            continue;
+        }
+
+        int n = 0;
+        while (n < alt->words_size() && repeated(alt->words(n)))
+        {
+            n++;
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+
+        alt->mutable_words()->DeleteSubrange(0, n);
+        if (a == 0)
+        {
+            mWordsDropped += n;
+            allRepeated = alt->words_size() == 0;
+        }
+        if (alt->words_size() == 0)
+        {
+            result->mutable_alternatives()->DeleteSubrange(a, 1);
+        }
+        else
+        {
+            rebuild(alt);
+        }
+    }
+
+    // If every word of the best alternative was a repeat, the others
+    // are most likely repeats too.
+    if (allRepeated)
+    {
+        result->clear_alternatives();
+    }
+    return allRepeated;
+}
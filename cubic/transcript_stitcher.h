@@ -0,0 +1,113 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRANSCRIPT_STITCHER_H
+#define TRANSCRIPT_STITCHER_H
+
+#include "audio_splitter.h"
+#include "cubic.pb.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * TranscriptStitcher puts the results for the chunks of a split
+ * recording (see audio_splitter.h) back together as if the recording
+ * had been recognized in one piece. The chunks may be recognized
+ * concurrently and finish in any order.
+ *
+ * Each result's times are moved from the timeline of its chunk onto the
+ * timeline of the whole recording. Words recognized in the overlap with
+ * a neighbouring chunk are dropped, keeping only the words whose centre
+ * lies in the chunk's own range, and the transcript is rebuilt from the
+ * words that are left. A word on the boundary that both chunks claim
+ * (because their timings differ slightly) is dropped from the later
+ * chunk. This needs word times, so enable_word_time_offsets should be
+ * set in the recognition config; results without words are kept or
+ * dropped whole, by their centre.
+ *
+ * Results are passed to the callback in order, as soon as every earlier
+ * chunk has finished.
+ */
+class TranscriptStitcher
+{
+public:
+    using ResultCallback =
+        std::function<void(const cobaltspeech::cubic::RecognitionResult &)>;
+
+    /*
+     * Create a stitcher for the given chunks of audio at sampleRate.
+     * The callback is called with a lock held, so results are never
+     * passed to it at the same time, and it must not call back into the
+     * stitcher.
+     */
+    TranscriptStitcher(const std::vector<AudioChunk> &chunks,
+                       unsigned int sampleRate, ResultCallback onResult);
+    ~TranscriptStitcher();
+
+    /*
+     * Add a final result from the given chunk, with times relative to
+     * the start of the audio sent for that chunk. Partial results are
+     * ignored. This may be called from any thread.
+     */
+    void add(size_t chunk, const cobaltspeech::cubic::RecognitionResult &result);
+
+    /*
+     * Mark the chunk as finished (or failed), passing on the results of
+     * any chunks that were only waiting for it.
+     */
+    void finish(size_t chunk);
+
+    // Returns the number of chunks passed on so far.
+    size_t chunksDone() const;
+
+    // Returns the number of words dropped from the overlaps.
+    size_t wordsDropped() const;
+
+private:
+    struct TailWord
+    {
+        std::string word;
+        double start;
+        double end;
+    };
+
+    struct ChunkState
+    {
+        AudioChunk chunk;
+        bool finished;
+        std::vector<cobaltspeech::cubic::RecognitionResult> results;
+    };
+
+    unsigned int mSampleRate;
+    ResultCallback mOnResult;
+
+    mutable std::mutex mMutex;
+    std::vector<ChunkState> mChunks;
+    size_t mNextChunk;
+    size_t mWordsDropped;
+
+    // The last words passed on, for finding words claimed twice.
+    std::vector<TailWord> mTail;
+
+    void emitReady();
+    bool dropRepeatedWords(cobaltspeech::cubic::RecognitionResult *result);
+};
+
+#endif // TRANSCRIPT_STITCHER_H
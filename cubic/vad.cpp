@@ -0,0 +1,416 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vad.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VAD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+/*
+ * The frame features are the sum of the squared samples and the number
+ * of times the sign changes between adjacent samples. There is a scalar
+ * version of each, an SSE2 version, and an AVX2 version that is chosen
+ * at run time if the CPU supports it. The vector versions load samples
+ * directly, so they assume a little-endian CPU (as x86 is).
+ */
+struct FrameFeatures
+{
+    uint64_t sumSquares;
+    uint32_t crossings;
+};
+
+inline int16_t sampleAt(const char *audio, size_t i)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(audio) + 2 * i;
+    return static_cast<int16_t>(p[0] | (p[1] << 8));
+}
+
+FrameFeatures scalarFeatures(const char *audio, size_t numSamples, size_t from)
+{
+    FrameFeatures f = {0, 0};
+    for (size_t i = from; i < numSamples; i++)
+    {
+        int32_t s = sampleAt(audio, i);
+        f.sumSquares += static_cast<uint64_t>(s * s);
+        if (i > 0 && ((s ^ sampleAt(audio, i - 1)) < 0))
+        {
+            f.crossings++;
+        }
+    }
+    return f;
+}
+
+#if VAD_X86 && defined(__SSE2__)
+FrameFeatures sse2Features(const char *audio, size_t numSamples)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i energy = zero;
+    __m128i crossings = zero;
+
+    // Sample 0 has no previous sample, so the vector loop starts at 1.
+    size_t i = 1;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(audio + 2 * i));
+        __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(audio + 2 * i - 2));
+
+        // Pairs of squares can reach 2^31, so they are treated as
+        // unsigned and widened to 64 bits before accumulating.
+        __m128i sq = _mm_madd_epi16(cur, cur);
+        energy = _mm_add_epi64(energy, _mm_unpacklo_epi32(sq, zero));
+        energy = _mm_add_epi64(energy, _mm_unpackhi_epi32(sq, zero));
+
+        // The sign bit of cur ^ prev is set where the sign changed;
+        // shifting it across the lane gives -1, which is subtracted.
+        __m128i changed = _mm_srai_epi16(_mm_xor_si128(cur, prev), 15);
+        crossings = _mm_sub_epi16(crossings, changed);
+    }
+
+    uint64_t e[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(e), energy);
+    uint32_t c[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(c),
+                     _mm_madd_epi16(crossings, _mm_set1_epi16(1)));
+
+    FrameFeatures f = scalarFeatures(audio, numSamples, i);
+    int32_t s0 = sampleAt(audio, 0);
+    f.sumSquares += e[0] + e[1] + static_cast<uint64_t>(s0 * s0);
+    f.crossings += c[0] + c[1] + c[2] + c[3];
+    return f;
+}
+#endif
+
+#if VAD_X86
+__attribute__((target("avx2")))
+FrameFeatures avx2Features(const char *audio, size_t numSamples)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i energy = zero;
+    __m256i crossings = zero;
+
+    size_t i = 1;
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(audio + 2 * i));
+        __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(audio + 2 * i - 2));
+
+        __m256i sq = _mm256_madd_epi16(cur, cur);
+        energy = _mm256_add_epi64(energy, _mm256_unpacklo_epi32(sq, zero));
+        energy = _mm256_add_epi64(energy, _mm256_unpackhi_epi32(sq, zero));
+
+        __m256i changed = _mm256_srai_epi16(_mm256_xor_si256(cur, prev), 15);
+        crossings = _mm256_sub_epi16(crossings, changed);
+    }
+
+    uint64_t e[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(e), energy);
+    uint32_t c[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(c),
+                        _mm256_madd_epi16(crossings, _mm256_set1_epi16(1)));
+
+    FrameFeatures f = scalarFeatures(audio, numSamples, i);
+    int32_t s0 = sampleAt(audio, 0);
+    f.sumSquares += e[0] + e[1] + e[2] + e[3] + static_cast<uint64_t>(s0 * s0);
+    for (int k = 0; k < 8; k++)
+    {
+        f.crossings += c[k];
+    }
+    return f;
+}
+#endif
+
+typedef FrameFeatures (*FeatureFunc)(const char *, size_t);
+
+FrameFeatures portableFeatures(const char *audio, size_t numSamples)
+{
+    return scalarFeatures(audio, numSamples, 0);
+}
+
+FeatureFunc chooseFeatureFunc()
+{
+#if VAD_X86
+    // This runs during static initialization, possibly before the
+    // compiler's own CPU detection has run.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return avx2Features;
+    }
+#endif
+#if VAD_X86 && defined(__SSE2__)
+    return sse2Features;
+#else
+    return portableFeatures;
+#endif
+}
+
+const FeatureFunc frameFeatures = chooseFeatureFunc();
+
+void setSeconds(google::protobuf::Duration *d, double seconds)
+{
+    double whole = std::floor(seconds);
+    d->set_seconds(static_cast<int64_t>(whole));
+    d->set_nanos(static_cast<int32_t>((seconds - whole) * 1e9));
+}
+
+double toSeconds(const google::protobuf::Duration &d)
+{
+    return d.seconds() + d.nanos() / 1e9;
+}
+
+} // namespace
+
+VoiceActivityDetector::Options::Options()
+    : sampleRate(16000), frameMs(20), energyThresholdDb(-45.0),
+      zcrThreshold(0.25), hangoverMs(500), preRollMs(200)
+{
+}
+
+VoiceActivityDetector::VoiceActivityDetector(const Options &opts)
+    : mOptions(opts), mActive(false), mHangoverLeft(0), mBytesIn(0),
+      mFrameOffset(0), mBytesOut(0)
+{
+    size_t frameSamples = opts.sampleRate * opts.frameMs / 1000;
+    if (frameSamples < 2)
+    {
+        throw std::invalid_argument("VAD frames must hold at least two samples");
+    }
+    mFrameBytes = 2 * frameSamples;
+
+    // Convert the thresholds to raw values for a whole frame, so that
+    // classifying a frame needs no floating point.
+    double rms = 32768.0 * std::pow(10.0, opts.energyThresholdDb / 20.0);
+    mEnergyThreshold = static_cast<uint64_t>(rms * rms * frameSamples);
+    mQuietThreshold = mEnergyThreshold / 4;
+    mZcrThreshold = static_cast<uint32_t>(opts.zcrThreshold * (frameSamples - 1));
+
+    mHangoverFrames = (opts.hangoverMs + opts.frameMs - 1) / opts.frameMs;
+    mPreRollBytes = (opts.preRollMs * opts.sampleRate / 1000) * 2;
+}
+
+VoiceActivityDetector::~VoiceActivityDetector() {}
+
+void VoiceActivityDetector::process(const char *audio, size_t size,
+                                    std::string *out)
+{
+    mBytesIn += size;
+
+    // Finish off a frame started by the last call
+    if (!mPending.empty())
+    {
+        size_t n = std::min(size, mFrameBytes - mPending.size());
+        mPending.append(audio, n);
+        audio += n;
+        size -= n;
+        if (mPending.size() < mFrameBytes)
+        {
+            return;
+        }
+        processFrame(mPending.data(), out);
+        mPending.clear();
+    }
+
+    // Whole frames are classified in place
+    while (size >= mFrameBytes)
+    {
+        processFrame(audio, out);
+        audio += mFrameBytes;
+        size -= mFrameBytes;
+    }
+
+    mPending.assign(audio, size);
+}
+
+void VoiceActivityDetector::flush(std::string *out)
+{
+    if (mActive && !mPending.empty())
+    {
+        out->append(mPending);
+        std::lock_guard<std::mutex> lock(mSegmentsMutex);
+        mBytesOut += mPending.size();
+    }
+    mPending.clear();
+}
+
+void VoiceActivityDetector::skip(uint64_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    mFrameOffset += mPending.size() + size;
+    mPending.clear();
+    mPreRoll.clear();
+
+    // Audio sent after the gap starts a new stretch, even if speech
+    // carries on across it.
+    if (mActive)
+    {
+        std::lock_guard<std::mutex> lock(mSegmentsMutex);
+        Segment seg;
+        seg.sentOffset = mBytesOut;
+        seg.originalOffset = mFrameOffset;
+        mSegments.push_back(seg);
+    }
+}
+
+bool VoiceActivityDetector::active() const
+{
+    return mActive;
+}
+
+uint64_t VoiceActivityDetector::bytesIn() const
+{
+    return mBytesIn;
+}
+
+uint64_t VoiceActivityDetector::bytesOut() const
+{
+    std::lock_guard<std::mutex> lock(mSegmentsMutex);
+    return mBytesOut;
+}
+
+bool VoiceActivityDetector::isSpeech(const char *frame) const
+{
+    FrameFeatures f = frameFeatures(frame, mFrameBytes / 2);
+    if (f.sumSquares >= mEnergyThreshold)
+    {
+        return true;
+    }
+    return f.sumSquares >= mQuietThreshold && f.crossings >= mZcrThreshold;
+}
+
+void VoiceActivityDetector::processFrame(const char *frame, std::string *out)
+{
+    // The offset of this frame in the original audio
+    uint64_t frameOffset = mFrameOffset;
+    mFrameOffset += mFrameBytes;
+
+    if (isSpeech(frame))
+    {
+        if (!mActive)
+        {
+            // Start a new stretch of output, including the pre-roll
+            std::lock_guard<std::mutex> lock(mSegmentsMutex);
+            Segment seg;
+            seg.sentOffset = mBytesOut;
+            seg.originalOffset = frameOffset - mPreRoll.size();
+            mSegments.push_back(seg);
+
+            out->append(mPreRoll);
+            mBytesOut += mPreRoll.size();
+            mPreRoll.clear();
+            mActive = true;
+        }
+        mHangoverLeft = mHangoverFrames;
+    }
+    else if (mActive)
+    {
+        if (mHangoverLeft == 0)
+        {
+            mActive = false;
+        }
+        else
+        {
+            mHangoverLeft--;
+        }
+    }
+
+    if (mActive)
+    {
+        out->append(frame, mFrameBytes);
+        std::lock_guard<std::mutex> lock(mSegmentsMutex);
+        mBytesOut += mFrameBytes;
+        return;
+    }
+
+    // Keep the most recent silence in case speech starts next
+    mPreRoll.append(frame, mFrameBytes);
+    if (mPreRoll.size() > mPreRollBytes)
+    {
+        mPreRoll.erase(0, mPreRoll.size() - mPreRollBytes);
+    }
+}
+
+double VoiceActivityDetector::originalTime(double sentSeconds) const
+{
+    double bytesPerSecond = 2.0 * mOptions.sampleRate;
+    double sent = sentSeconds * bytesPerSecond;
+
+    std::lock_guard<std::mutex> lock(mSegmentsMutex);
+    auto it = std::upper_bound(mSegments.begin(), mSegments.end(), sent,
+                               [](double t, const Segment &seg) {
+                                   return t < seg.sentOffset;
+                               });
+    if (it == mSegments.begin())
+    {
+        return sentSeconds;
+    }
+    --it;
+    return (it->originalOffset + (sent - it->sentOffset)) / bytesPerSecond;
+}
+
+double VoiceActivityDetector::originalEndTime(double sentSeconds) const
+{
+    double bytesPerSecond = 2.0 * mOptions.sampleRate;
+    double sent = sentSeconds * bytesPerSecond;
+
+    std::lock_guard<std::mutex> lock(mSegmentsMutex);
+    auto it = std::lower_bound(mSegments.begin(), mSegments.end(), sent,
+                               [](const Segment &seg, double t) {
+                                   return seg.sentOffset < t;
+                               });
+    if (it == mSegments.begin())
+    {
+        return sentSeconds;
+    }
+    --it;
+    return (it->originalOffset + (sent - it->sentOffset)) / bytesPerSecond;
+}
+
+void VoiceActivityDetector::setTime(google::protobuf::Duration *start,
+                                    google::protobuf::Duration *duration) const
+{
+    double sentStart = toSeconds(*start);
+    double sentEnd = sentStart + toSeconds(*duration);
+    double origStart = originalTime(sentStart);
+    double origEnd = originalEndTime(sentEnd);
+    setSeconds(start, origStart);
+    setSeconds(duration, std::max(0.0, origEnd - origStart));
+}
+
+void VoiceActivityDetector::remapTimestamps(
+    cobaltspeech::cubic::RecognitionResult *result) const
+{
+    for (auto &alt : *result->mutable_alternatives())
+    {
+        setTime(alt.mutable_start_time(), alt.mutable_duration());
+        for (auto &word : *alt.mutable_words())
+        {
+            setTime(word.mutable_start_time(), word.mutable_duration());
+        }
+    }
+}
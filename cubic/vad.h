@@ -0,0 +1,156 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VAD_H
+#define VAD_H
+
+#include "cubic.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * VoiceActivityDetector removes long stretches of silence from 16-bit
+ * mono RAW_LINEAR16 audio before it is sent to Cubic, which saves both
+ * bandwidth and server time on recordings that are mostly silence.
+ *
+ * Audio is classified in short frames using the frame energy and zero
+ * crossing rate. Once speech is detected, audio keeps being sent for a
+ * hangover period after the last speech frame, so that Cubic still sees
+ * the pause at the end of an utterance. A little of the audio before
+ * each speech onset is also kept so that quiet word beginnings are not
+ * clipped. Everything else is dropped.
+ *
+ * Since dropping audio shifts the timeline seen by the server, the
+ * detector records where each sent stretch came from. Use
+ * remapTimestamps() to move result timestamps back onto the timeline of
+ * the original audio.
+ *
+ * process() and flush() must be called from one thread, but the
+ * timestamp methods may be called from another (such as the thread
+ * receiving results).
+ */
+class VoiceActivityDetector
+{
+public:
+    struct Options
+    {
+        // Sample rate of the audio.
+        unsigned int sampleRate;
+
+        // Length of each classified frame.
+        unsigned int frameMs;
+
+        // Frames with an RMS level at or above this many dB relative
+        // to full scale are speech.
+        double energyThresholdDb;
+
+        // Frames up to 6dB quieter than the energy threshold are still
+        // speech if they cross zero at least this often (crossings per
+        // sample), which catches unvoiced sounds such as "s" and "f".
+        double zcrThreshold;
+
+        // Audio is sent for this long after the last speech frame.
+        unsigned int hangoverMs;
+
+        // Up to this much audio before each speech onset is sent.
+        unsigned int preRollMs;
+
+        Options();
+    };
+
+    VoiceActivityDetector(const Options &opts = Options());
+    ~VoiceActivityDetector();
+
+    /*
+     * Classify the given audio and append the parts that should be sent
+     * to out. Audio that does not fill a whole frame is held until the
+     * next call.
+     */
+    void process(const char *audio, size_t size, std::string *out);
+
+    // Append any held audio to out if speech is active.
+    void flush(std::string *out);
+
+    /*
+     * Record that size bytes of the original audio were lost (for
+     * example, dropped by a full buffer) before the audio given to the
+     * next call to process(). Nothing is sent for them, but they still
+     * count towards the original timeline, so later results are mapped
+     * back to the right time. Held audio that does not fill a frame is
+     * discarded, since it is not continuous with what follows.
+     */
+    void skip(uint64_t size);
+
+    // Returns true if the last frame processed was sent.
+    bool active() const;
+
+    // Returns the number of bytes of audio given to process().
+    uint64_t bytesIn() const;
+
+    // Returns the number of bytes of audio appended to the output.
+    uint64_t bytesOut() const;
+
+    /*
+     * Convert a time on the timeline of the audio that was sent to the
+     * corresponding time in the original audio. originalEndTime() is for
+     * times that end an interval, so an end that falls exactly on a point
+     * where audio was dropped stays with the audio before it.
+     */
+    double originalTime(double sentSeconds) const;
+    double originalEndTime(double sentSeconds) const;
+
+    // Move the timestamps of a result, its alternatives and their words
+    // onto the timeline of the original audio.
+    void remapTimestamps(cobaltspeech::cubic::RecognitionResult *result) const;
+
+private:
+    // A stretch of output audio that was sent without a break.
+    struct Segment
+    {
+        uint64_t sentOffset;
+        uint64_t originalOffset;
+    };
+
+    Options mOptions;
+    size_t mFrameBytes;
+    uint64_t mEnergyThreshold;
+    uint64_t mQuietThreshold;
+    uint32_t mZcrThreshold;
+    size_t mHangoverFrames;
+    size_t mPreRollBytes;
+
+    bool mActive;
+    size_t mHangoverLeft;
+    std::string mPending;
+    std::string mPreRoll;
+    uint64_t mBytesIn;
+    uint64_t mFrameOffset;
+
+    mutable std::mutex mSegmentsMutex;
+    std::vector<Segment> mSegments;
+    uint64_t mBytesOut;
+
+    void processFrame(const char *frame, std::string *out);
+    bool isSpeech(const char *frame) const;
+    void setTime(google::protobuf::Duration *start,
+                 google::protobuf::Duration *duration) const;
+};
+
+#endif // VAD_H
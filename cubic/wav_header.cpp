@@ -0,0 +1,245 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wav_header.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+uint32_t readLE(const char *data, size_t numBytes)
+{
+    uint32_t val = 0;
+    for (size_t i = 0; i < numBytes; i++)
+    {
+        val |= uint32_t(uint8_t(data[i])) << (8 * i);
+    }
+    return val;
+}
+
+// Fill in the format from the body of a "fmt " chunk, which must hold
+// at least 16 bytes.
+void parseFormatChunk(const char *body, size_t size, WavFormat *format)
+{
+    format->formatTag = readLE(body, 2);
+    format->channels = readLE(body + 2, 2);
+    format->sampleRate = readLE(body + 4, 4);
+    format->bitsPerSample = readLE(body + 14, 2);
+
+    // WAVE_FORMAT_EXTENSIBLE keeps the real format tag at the start of
+    // its sub-format GUID.
+    if (format->formatTag == 0xFFFE && size >= 26)
+    {
+        format->formatTag = readLE(body + 24, 2);
+    }
+}
+
+// The most of a "fmt " chunk that is read; the rest is skipped.
+const size_t maxFormatChunk = 40;
+
+} // namespace
+
+double WavFormat::bytesPerSecond() const
+{
+    return double(sampleRate) * channels * bitsPerSample / 8;
+}
+
+bool parseWavHeader(const char *data, size_t size, WavFormat *format)
+{
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 ||
+        memcmp(data + 8, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= size)
+    {
+        const char *chunkID = data + pos;
+        size_t chunkSize = readLE(data + pos + 4, 4);
+        size_t body = pos + 8;
+
+        if (memcmp(chunkID, "fmt ", 4) == 0)
+        {
+            if (chunkSize < 16 || body + 16 > size)
+            {
+                return false;
+            }
+            parseFormatChunk(data + body, std::min(chunkSize, size - body),
+                             format);
+            haveFormat = true;
+        }
+        else if (memcmp(chunkID, "data", 4) == 0)
+        {
+            if (!haveFormat)
+            {
+                return false;
+            }
+            format->dataOffset = body;
+            format->dataSize = size - body;
+            if (chunkSize > 0 && chunkSize < format->dataSize)
+            {
+                format->dataSize = chunkSize;
+            }
+            return true;
+        }
+
+        // Chunks are padded to an even number of bytes
+        pos = body + chunkSize + (chunkSize & 1);
+    }
+
+    return false;
+}
+
+WavParser::WavParser()
+    : mState(RiffHeader), mFormat(), mHaveFmt(false), mOffset(0), mNeed(12),
+      mRemaining(0), mUnbounded(false)
+{
+}
+
+size_t WavParser::parse(const char *data, size_t size, const char **audio,
+                        size_t *audioSize)
+{
+    *audio = nullptr;
+    *audioSize = 0;
+
+    size_t used = 0;
+    while (used < size)
+    {
+        const char *p = data + used;
+        size_t left = size - used;
+
+        if (mState == SampleData)
+        {
+            size_t n = mUnbounded ? left : std::min<uint64_t>(left, mRemaining);
+            if (!mUnbounded)
+            {
+                mRemaining -= n;
+                if (mRemaining == 0)
+                {
+                    mState = Done;
+                }
+            }
+            mOffset += n;
+            *audio = p;
+            *audioSize = n;
+            return used + n;
+        }
+
+        if (mState == Done)
+        {
+            mOffset += left;
+            return size;
+        }
+
+        if (mState == SkipChunk)
+        {
+            size_t n = std::min<uint64_t>(left, mRemaining);
+            used += n;
+            mOffset += n;
+            mRemaining -= n;
+            if (mRemaining == 0)
+            {
+                mState = ChunkHeader;
+                mNeed = 8;
+            }
+            continue;
+        }
+
+        // The rest of the states need a whole header (or format chunk)
+        size_t n = collect(p, left);
+        used += n;
+        mOffset += n;
+        if (mPending.size() < mNeed)
+        {
+            break;
+        }
+
+        const char *h = mPending.data();
+        if (mState == RiffHeader)
+        {
+            if (memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0)
+            {
+                throw std::runtime_error("not a WAV file");
+            }
+            mState = ChunkHeader;
+            mNeed = 8;
+        }
+        else if (mState == FormatChunk)
+        {
+            parseFormatChunk(h, mPending.size(), &mFormat);
+            mHaveFmt = true;
+            mState = mRemaining > 0 ? SkipChunk : ChunkHeader;
+            mNeed = 8;
+        }
+        else if (memcmp(h, "fmt ", 4) == 0)
+        {
+            uint64_t chunkSize = readLE(h + 4, 4);
+            if (chunkSize < 16)
+            {
+                throw std::runtime_error("WAV format chunk is too short");
+            }
+            mState = FormatChunk;
+            mNeed = std::min<uint64_t>(chunkSize, maxFormatChunk);
+            mRemaining = chunkSize + (chunkSize & 1) - mNeed;
+        }
+        else if (memcmp(h, "data", 4) == 0)
+        {
+            if (!mHaveFmt)
+            {
+                throw std::runtime_error("WAV data chunk comes before its format");
+            }
+            uint64_t chunkSize = readLE(h + 4, 4);
+            mUnbounded = chunkSize == 0 || chunkSize == 0xFFFFFFFF;
+            mRemaining = chunkSize;
+            mFormat.dataOffset = mOffset;
+            mFormat.dataSize = mUnbounded ? 0 : chunkSize;
+            mState = SampleData;
+        }
+        else
+        {
+            // Chunks are padded to an even number of bytes
+            uint64_t chunkSize = readLE(h + 4, 4);
+            mRemaining = chunkSize + (chunkSize & 1);
+            mState = mRemaining > 0 ? SkipChunk : ChunkHeader;
+            mNeed = 8;
+        }
+        mPending.clear();
+    }
+
+    return used;
+}
+
+bool WavParser::haveFormat() const
+{
+    return mState == SampleData || mState == Done;
+}
+
+const WavFormat &WavParser::format() const
+{
+    return mFormat;
+}
+
+size_t WavParser::collect(const char *data, size_t size)
+{
+    size_t n = std::min(size, mNeed - mPending.size());
+    mPending.append(data, n);
+    return n;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WAV_HEADER_H
+#define WAV_HEADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The audio format and data location described by a WAV file header.
+struct WavFormat
+{
+    // The format tag, such as 1 for PCM or 3 for float. For
+    // WAVE_FORMAT_EXTENSIBLE files this is taken from the sub-format.
+    uint16_t formatTag;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint16_t bitsPerSample;
+
+    // Where the sample data starts, and how many bytes of it there are.
+    size_t dataOffset;
+    size_t dataSize;
+
+    // Returns the number of bytes of sample data per second of audio.
+    double bytesPerSecond() const;
+};
+
+/*
+ * Parse the RIFF/WAVE header at the start of the given data, walking
+ * the chunk list until the "data" chunk is found. Returns false if the
+ * data does not start with a valid WAV header. If the data chunk's size
+ * is missing or larger than the data (as when a recorder never filled it
+ * in), dataSize covers the rest of the data.
+ */
+bool parseWavHeader(const char *data, size_t size, WavFormat *format);
+
+/*
+ * WavParser reads a WAV file that arrives a piece at a time, such as
+ * from a pipe, without holding the whole file in memory. It walks the
+ * RIFF chunks in any order up to the "data" chunk, skipping chunks it
+ * does not need (such as LIST), reads the format from the "fmt " chunk
+ * (including WAVE_FORMAT_EXTENSIBLE), and then passes the sample data
+ * through without copying it. Anything after the data chunk is ignored.
+ *
+ * The sample data is assumed to run to the end of the input if the data
+ * chunk's size is zero or 0xFFFFFFFF, as written by recorders that
+ * stream their output.
+ */
+class WavParser
+{
+public:
+    WavParser();
+
+    /*
+     * Parse the next size bytes of the file and return how many of them
+     * were used, which is less than size only when sample data is found.
+     * In that case *audio and *audioSize are set to the sample data at
+     * the start of the used bytes (which does not always end on a whole
+     * frame); otherwise *audioSize is zero. Call this again with the
+     * rest of the bytes until they are all used. Throws
+     * std::runtime_error if the data is not a valid WAV file.
+     */
+    size_t parse(const char *data, size_t size, const char **audio,
+                 size_t *audioSize);
+
+    // Returns true once the format and the start of the data are known.
+    bool haveFormat() const;
+
+    // The format of the file. dataOffset is where the sample data starts
+    // in the file, and dataSize is zero if the size is not known.
+    const WavFormat &format() const;
+
+private:
+    enum State
+    {
+        RiffHeader,
+        ChunkHeader,
+        FormatChunk,
+        SkipChunk,
+        SampleData,
+        Done
+    };
+
+    State mState;
+    WavFormat mFormat;
+    bool mHaveFmt;
+    uint64_t mOffset;
+
+    // Header bytes collected until there are enough to parse.
+    std::string mPending;
+    size_t mNeed;
+
+    // Bytes left in the current chunk (including its padding byte), or
+    // in the sample data if mUnbounded is not set.
+    uint64_t mRemaining;
+    bool mUnbounded;
+
+    size_t collect(const char *data, size_t size);
+};
+
+#endif // WAV_HEADER_H
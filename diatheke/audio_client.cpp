@@ -18,8 +18,16 @@
 #include <diatheke_client_error.h>
 #include <iostream>
 
+#include "diatheke_metrics.h"
+#include "diatheke_startup.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "partial_stabilizer.h"
 #include "player.h"
 #include "recorder.h"
+#include "trace.h"
+
+#include <unistd.h>
 
 /*
  * Create some aliases to make the code more readable. The gRPC
@@ -41,6 +49,26 @@ const bool insecureConnection = true;
 // The model ID to use when initializing a Diatheke session.
 const std::string modelID = "1";
 
+// The server's version and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "diatheke_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// Request durations and the number of open streams are written to this
+// file in the Prometheus text format every few seconds, where the
+// node_exporter textfile collector (or anything else) can read them.
+const std::string metricsFile = "diatheke_metrics.prom";
+const int metricsIntervalMs = 5000;
+
+// When built with -DENABLE_TRACING=ON, a trace of everything up to the
+// latest turn is written to this file after each turn, for viewing in
+// Perfetto (ui.perfetto.dev) or chrome://tracing.
+const std::string traceFile = "diatheke_trace.json";
+
+// Partial transcriptions are shown at most this often. Each update only
+// rewrites the part of the line that changed.
+const int partialIntervalMs = 100;
+
 // The external process responsible for recording audio.
 const std::string recordCmd = "sox -q -d -c 1 -r 16000 -b 16 -L -e signed -t raw -";
 
@@ -51,9 +79,11 @@ const std::string playCmd = "sox -q -c 1 -r 48000 -b 16 -L -e signed -t raw - -d
  * Records user audio, then returns an updated session based
  * on the ASR result.
  */
-DiathekeSession waitForInput(Diatheke::Client *client,
+DiathekeSession waitForInput(Diatheke::Client *client, DiathekeMetrics *metrics,
                              const DiathekeSession &session,
                              const DiathekePB::WaitForUserAction &inputAction) {
+  TRACE_SCOPE("waitForInput");
+
   /*
    * The given input action has a couple of flags to help
    * the app decide when to begin recording audio.
@@ -78,6 +108,7 @@ DiathekeSession waitForInput(Diatheke::Client *client,
 
   // Create the ASR stream
   Diatheke::ASRStream stream = client->newSessionASRStream(session.token());
+  ScopedGauge activeStream(metrics->activeStreams(DiathekeMetrics::ASRStream));
 
   // Start the recorder
   Recorder recorder(recordCmd);
@@ -85,8 +116,11 @@ DiathekeSession waitForInput(Diatheke::Client *client,
   std::cout << "\nRecording..." << std::endl;
 
   // Record until we get a result
-  DiathekePB::ASRResult result =
-      Diatheke::ReadASRAudio(stream, &recorder, 8192);
+  DiathekePB::ASRResult result;
+  {
+    TRACE_SCOPE("ReadASRAudio");
+    result = Diatheke::ReadASRAudio(stream, &recorder, 8192);
+  }
   recorder.stop();
 
   // Display the result
@@ -94,45 +128,66 @@ DiathekeSession waitForInput(Diatheke::Client *client,
   std::cout << "    Text: " << result.text() << std::endl;
   std::cout << "    Confidence: " << result.confidence() << std::endl;
 
-  return client->processASRResult(session.token(), result);
+  return metrics->timeRpc(DiathekeMetrics::ProcessASRResult, [&]() {
+    TRACE_SCOPE("processASRResult");
+    return client->processASRResult(session.token(), result);
+  });
 }
 
 // Uses TTS to play back the reply as speech.
-void handleReply(Diatheke::Client *client,
+void handleReply(Diatheke::Client *client, DiathekeMetrics *metrics,
                  const DiathekePB::ReplyAction &reply) {
+  TRACE_SCOPE("handleReply");
+
   std::cout << "\n  Reply:" << std::endl;
   std::cout << "    Text: " << reply.text() << std::endl;
   std::cout << "    Luna Model: " << reply.luna_model() << std::endl;
 
   // Create the TTS stream
   Diatheke::TTSStream stream = client->newTTSStream(reply);
+  ScopedGauge activeStream(metrics->activeStreams(DiathekeMetrics::TTSStream));
+  TRACE_INSTANT("newTTSStream");
 
-  // Start the player
+  // Start the player. The time spent waiting for synthesized audio is
+  // the part of WriteTTSAudio not spent in Player::writeAudio.
   Player player(playCmd);
   player.start();
-  Diatheke::WriteTTSAudio(stream, &player);
+  {
+    TRACE_SCOPE("WriteTTSAudio");
+    Diatheke::WriteTTSAudio(stream, &player);
+  }
   player.stop();
 }
 
 /*
  * Records user audio for the purpose of transcription.
  */
-void handleTranscribe(Diatheke::Client *client,
+void handleTranscribe(Diatheke::Client *client, DiathekeMetrics *metrics,
                       const DiathekePB::TranscribeAction &scribe) {
+  TRACE_SCOPE("handleTranscribe");
+
   Diatheke::TranscribeStream stream = client->newTranscribeStream(scribe);
+  ScopedGauge activeStream(
+      metrics->activeStreams(DiathekeMetrics::TranscribeStream));
 
   // Create the result callback function
   std::string finalTranscription("");
-  auto cb = [&finalTranscription](const DiathekePB::TranscribeResult &result) {
+  PartialStabilizer stabilizer(partialIntervalMs);
+  const int columns = terminalColumns(STDOUT_FILENO);
+  auto cb = [&finalTranscription, &stabilizer,
+             columns](const DiathekePB::TranscribeResult &result) {
     /*
-     * Print the result on the same line (overwrite current contents).
-     * Note that this assumes stdout is going to a terminal.
+     * Update the result on the current line, changing only the words
+     * that differ from what is already shown. Note that this assumes
+     * stdout is going to a terminal.
      */
-    std::cout << "\r" << result.text()
-              << " (confidence: " << result.confidence() << ")"
-              << std::flush;
+    TranscriptDelta delta;
+    if (stabilizer.update(result.text(), !result.is_partial(), &delta)) {
+      std::cout << delta.terminalEdit(columns);
+    }
 
     if (result.is_partial()) {
+      std::cout << std::flush;
       return;
     }
 
@@ -140,7 +195,7 @@ void handleTranscribe(Diatheke::Client *client,
      * As this is the final result (non-partial), go to the next line
      * in preparation for the next result.
      */
-    std::cout << std::endl;
+    std::cout << " (confidence: " << result.confidence() << ")" << std::endl;
 
     // Accumulate all non-partial transcriptions here.
     finalTranscription += result.text();
@@ -152,7 +207,10 @@ void handleTranscribe(Diatheke::Client *client,
   std::cout << "\nRecording transcription..." << std::endl;
 
   // Run the transcription
-  Diatheke::ReadTranscribeAudio(stream, &recorder, 8192, cb);
+  {
+    TRACE_SCOPE("ReadTranscribeAudio");
+    Diatheke::ReadTranscribeAudio(stream, &recorder, 8192, cb);
+  }
 
   std::cout << "\nFinal Transcription: " << finalTranscription << std::endl;
 }
@@ -162,6 +220,7 @@ void handleTranscribe(Diatheke::Client *client,
  * returns an updated session based on the command result.
  */
 DiathekeSession handleCommand(Diatheke::Client *client,
+                              DiathekeMetrics *metrics,
                               const DiathekeSession &session,
                               const DiathekePB::CommandAction &cmd) {
   // Print the command info
@@ -177,7 +236,10 @@ DiathekeSession handleCommand(Diatheke::Client *client,
   // Update the session with the command result
   DiathekePB::CommandResult result;
   result.set_id(cmd.id());
-  return client->processCommandResult(session.token(), result);
+  return metrics->timeRpc(DiathekeMetrics::ProcessCommandResult, [&]() {
+    TRACE_SCOPE("processCommandResult");
+    return client->processCommandResult(session.token(), result);
+  });
 }
 
 /*
@@ -185,21 +247,24 @@ DiathekeSession handleCommand(Diatheke::Client *client,
  * an updated session.
  */
 DiathekeSession processActions(Diatheke::Client *client,
+                               DiathekeMetrics *metrics,
                                const DiathekeSession &session) {
+  TRACE_SCOPE("processActions");
+
   // Iterate through each action in the list and determine its type.
   for (auto action : session.action_list()) {
     if (action.has_input()) {
       // The WaitForUserAction will involve a session update.
-      return waitForInput(client, session, action.input());
+      return waitForInput(client, metrics, session, action.input());
     } else if (action.has_reply()) {
       // Replies do not require a session update.
-      handleReply(client, action.reply());
+      handleReply(client, metrics, action.reply());
     } else if (action.has_command()) {
       // The CommandAction will involve a session update.
-      return handleCommand(client, session, action.command());
+      return handleCommand(client, metrics, session, action.command());
     } else if (action.has_transcribe()) {
       // Transcribe actions do not require a session update.
-      handleTranscribe(client, action.transcribe());
+      handleTranscribe(client, metrics, action.transcribe());
     } else {
       throw std::runtime_error("received unknown action type");
     }
@@ -211,12 +276,24 @@ DiathekeSession processActions(Diatheke::Client *client,
 
 int main(int argc, char *argv[]) {
   try {
+    TRACE_THREAD_NAME("main");
+
     // Create the client. Note this is an insecure connection,
     // which is not recommended for production.
     Diatheke::Client client(serverAddress);
 
+    // Send the startup requests (including creating the session) all
+    // at once, using the cached version and model list if possible.
+    MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+    DiathekeStartup startup(client, serverAddress, modelID, &metadataCache);
+
+    // Record how each request performs
+    MetricsRegistry registry;
+    DiathekeMetrics metrics(registry);
+    MetricsExporter exporter(registry, metricsFile, metricsIntervalMs);
+
     // Print the server version info
-    auto ver = client.version();
+    const auto &ver = startup.version();
     std::cout << "Server Version" << std::endl;
     std::cout << "  Diatheke: " << ver.diatheke() << std::endl;
     std::cout << "  Chosun (NLU): " << ver.chosun() << std::endl;
@@ -224,7 +301,7 @@ int main(int argc, char *argv[]) {
     std::cout << "  Luna (TTS): " << ver.luna() << std::endl;
 
     // Print the list of available models
-    auto modelList = client.listModels();
+    const auto &modelList = startup.models();
     std::cout << "\nAvailable Models:" << std::endl;
     for (auto &mdl : modelList.models()) {
       std::cout << "  ID: " << mdl.id() << std::endl;
@@ -234,12 +311,16 @@ int main(int argc, char *argv[]) {
       std::cout << "    TTS Sample Rate: " << mdl.tts_sample_rate() << std::endl;
     }
 
-    // Create a session
-    auto session = client.createSession(modelID);
+    // Wait for the new session
+    auto session = startup.session();
 
     // Loop forever (or until the program is killed)
     while (true) {
-      session = processActions(&client, session);
+      session = processActions(&client, &metrics, session);
+
+#ifdef ENABLE_TRACING
+      Tracer::writeChromeTrace(traceFile);
+#endif
     }
 
     // Clean up the session.
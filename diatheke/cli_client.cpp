@@ -18,6 +18,12 @@
 #include <diatheke_client_error.h>
 #include <iostream>
 
+#include "diatheke_metrics.h"
+#include "diatheke_startup.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "trace.h"
+
 /*
  * Create some aliases to make the code more readable. The gRPC
  * interface can be a bit verbose.
@@ -38,11 +44,27 @@ const bool insecureConnection = true;
 // The model ID to use when initializing a Diatheke session.
 const std::string modelID = "1";
 
+// The server's version and model list are saved here for this many
+// seconds, so that later runs can start without asking for them again.
+const std::string metadataCacheDir = "diatheke_metadata_cache";
+const int metadataCacheTTL = 600;
+
+// Request durations are written to this file in the Prometheus text
+// format every few seconds, where the node_exporter textfile collector
+// (or anything else) can read them.
+const std::string metricsFile = "diatheke_metrics.prom";
+const int metricsIntervalMs = 5000;
+
+// When built with -DENABLE_TRACING=ON, a trace of everything up to the
+// latest turn is written to this file after each turn, for viewing in
+// Perfetto (ui.perfetto.dev) or chrome://tracing.
+const std::string traceFile = "diatheke_trace.json";
+
 /*
  * Prompts the user for text input, then returns an updated
  * session based on the user-supplied text.
  */
-DiathekeSession waitForInput(Diatheke::Client *client,
+DiathekeSession waitForInput(Diatheke::Client *client, DiathekeMetrics *metrics,
                              const DiathekeSession &session) {
   std::cout << std::endl << "\nDiatheke> " << std::flush;
 
@@ -50,7 +72,10 @@ DiathekeSession waitForInput(Diatheke::Client *client,
   std::string text;
   std::getline(std::cin, text);
 
-  return client->processText(session.token(), text);
+  return metrics->timeRpc(DiathekeMetrics::ProcessText, [&]() {
+    TRACE_SCOPE("processText");
+    return client->processText(session.token(), text);
+  });
 }
 
 // Prints the text of the given reply to stdout.
@@ -63,6 +88,7 @@ void handleReply(const DiathekePB::ReplyAction &reply) {
  * returns an updated session based on the command result.
  */
 DiathekeSession handleCommand(Diatheke::Client *client,
+                              DiathekeMetrics *metrics,
                               const DiathekeSession &session,
                               const DiathekePB::CommandAction &cmd) {
   // Print the command info
@@ -78,7 +104,10 @@ DiathekeSession handleCommand(Diatheke::Client *client,
   // Update the session with the command result
   DiathekePB::CommandResult result;
   result.set_id(cmd.id());
-  return client->processCommandResult(session.token(), result);
+  return metrics->timeRpc(DiathekeMetrics::ProcessCommandResult, [&]() {
+    TRACE_SCOPE("processCommandResult");
+    return client->processCommandResult(session.token(), result);
+  });
 }
 
 /*
@@ -98,18 +127,21 @@ void handleTranscribe(const DiathekePB::TranscribeAction &scribe) {
  * an updated session.
  */
 DiathekeSession processActions(Diatheke::Client *client,
+                               DiathekeMetrics *metrics,
                                const DiathekeSession &session) {
+  TRACE_SCOPE("processActions");
+
   // Iterate through each action in the list and determine its type.
   for (auto action : session.action_list()) {
     if (action.has_input()) {
       // The WaitForUserAction will involve a session update.
-      return waitForInput(client, session);
+      return waitForInput(client, metrics, session);
     } else if (action.has_reply()) {
       // Replies do not require a session update.
       handleReply(action.reply());
     } else if (action.has_command()) {
       // The CommandAction will involve a session update.
-      return handleCommand(client, session, action.command());
+      return handleCommand(client, metrics, session, action.command());
     } else if (action.has_transcribe()) {
       // Transcribe actions do not require a session update.
       handleTranscribe(action.transcribe());
@@ -123,12 +155,24 @@ DiathekeSession processActions(Diatheke::Client *client,
 
 int main(int argc, char *argv[]) {
   try {
+    TRACE_THREAD_NAME("main");
+
     // Create the client. Note this is an insecure connection,
     // which is not recommended for production.
     Diatheke::Client client(serverAddress);
 
+    // Send the startup requests (including creating the session) all
+    // at once, using the cached version and model list if possible.
+    MetadataCache metadataCache(metadataCacheDir, metadataCacheTTL);
+    DiathekeStartup startup(client, serverAddress, modelID, &metadataCache);
+
+    // Record how each request performs
+    MetricsRegistry registry;
+    DiathekeMetrics metrics(registry);
+    MetricsExporter exporter(registry, metricsFile, metricsIntervalMs);
+
     // Request the server version info
-    auto ver = client.version();
+    const auto &ver = startup.version();
     std::cout << "Server Version" << std::endl;
     std::cout << "  Diatheke: " << ver.diatheke() << std::endl;
     std::cout << "  Chosun (NLU): " << ver.chosun() << std::endl;
@@ -136,7 +180,7 @@ int main(int argc, char *argv[]) {
     std::cout << "  Luna (TTS): " << ver.luna() << std::endl;
 
     // Request the list of available models
-    auto modelList = client.listModels();
+    const auto &modelList = startup.models();
     std::cout << "\nAvailable Models:" << std::endl;
     for (auto &mdl : modelList.models()) {
       std::cout << "  ID: " << mdl.id() << std::endl;
@@ -146,12 +190,16 @@ int main(int argc, char *argv[]) {
       std::cout << "    TTS Sample Rate: " << mdl.tts_sample_rate() << std::endl;
     }
 
-    // Create a session
-    auto session = client.createSession(modelID);
+    // Wait for the new session
+    auto session = startup.session();
 
     // Loop forever (or until the program is killed)
     while (true) {
-      session = processActions(&client, session);
+      session = processActions(&client, &metrics, session);
+
+#ifdef ENABLE_TRACING
+      Tracer::writeChromeTrace(traceFile);
+#endif
     }
 
     // Clean up the session.
@@ -0,0 +1,52 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "diatheke_metrics.h"
+
+#include <string>
+
+namespace {
+
+const char *rpcNames[DiathekeMetrics::NumRpcs] = {
+    "process_text", "process_asr_result", "process_command_result"};
+
+const char *streamNames[DiathekeMetrics::NumStreamTypes] = {"asr", "tts",
+                                                            "transcribe"};
+
+} // namespace
+
+DiathekeMetrics::DiathekeMetrics(MetricsRegistry &registry) {
+  for (int i = 0; i < NumRpcs; i++) {
+    std::string labels = std::string("method=\"") + rpcNames[i] + "\"";
+    mRpcDuration[i] =
+        &registry.histogram("diatheke_rpc_duration_seconds",
+                            "Time taken by unary Diatheke calls.", labels, 1e-6);
+    mRpcErrors[i] = &registry.counter("diatheke_rpc_errors_total",
+                                      "Unary Diatheke calls that failed.",
+                                      labels);
+  }
+
+  for (int i = 0; i < NumStreamTypes; i++) {
+    std::string labels = std::string("stream=\"") + streamNames[i] + "\"";
+    mActiveStreams[i] =
+        &registry.gauge("diatheke_active_streams",
+                        "Diatheke streams currently open.", labels);
+  }
+}
+
+Gauge &DiathekeMetrics::activeStreams(StreamType type) {
+  return *mActiveStreams[type];
+}
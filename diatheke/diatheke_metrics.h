@@ -0,0 +1,69 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DIATHEKE_METRICS_H
+#define DIATHEKE_METRICS_H
+
+#include "metrics.h"
+
+/*
+ * DiathekeMetrics records how a client's requests to Diatheke perform,
+ * in a MetricsRegistry (see metrics.h):
+ *
+ *     diatheke_rpc_duration_seconds{method}  time taken by each unary call
+ *     diatheke_rpc_errors_total{method}      calls that failed
+ *     diatheke_active_streams{stream}        ASR, TTS and transcribe
+ *                                            streams currently open
+ *
+ * Unary calls are timed with timeRpc(), and streams are counted for as
+ * long as the ScopedGauge from activeStream() exists. All of this is
+ * safe to use from any thread.
+ */
+class DiathekeMetrics {
+public:
+  enum Rpc { ProcessText, ProcessASRResult, ProcessCommandResult, NumRpcs };
+  enum StreamType { ASRStream, TTSStream, TranscribeStream, NumStreamTypes };
+
+  explicit DiathekeMetrics(MetricsRegistry &registry);
+
+  /*
+   * Call func(), recording how long it took and counting it as an
+   * error if it throws. Returns what func() returns.
+   */
+  template <typename Func>
+  auto timeRpc(Rpc rpc, Func func) -> decltype(func());
+
+  // The gauge of open streams of the given type.
+  Gauge &activeStreams(StreamType type);
+
+private:
+  Histogram *mRpcDuration[NumRpcs];
+  Counter *mRpcErrors[NumRpcs];
+  Gauge *mActiveStreams[NumStreamTypes];
+};
+
+template <typename Func>
+auto DiathekeMetrics::timeRpc(Rpc rpc, Func func) -> decltype(func()) {
+  ScopedTimer timer(*mRpcDuration[rpc]);
+  try {
+    return func();
+  } catch (...) {
+    mRpcErrors[rpc]->add();
+    throw;
+  }
+}
+
+#endif // DIATHEKE_METRICS_H
@@ -0,0 +1,102 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "diatheke_startup.h"
+
+namespace DiathekePB = cobaltspeech::diatheke;
+
+DiathekeStartup::DiathekeStartup(Diatheke::Client &client,
+                                 const std::string &serverAddress,
+                                 const std::string &modelID,
+                                 MetadataCache *cache)
+    : mClient(client), mModelID(modelID), mCache(cache), mVersionKey("diatheke/version/" + serverAddress),
+      mModelsKey("diatheke/models/" + serverAddress), mHaveVersion(false),
+      mHaveModels(false) {
+  // The session is always new, so it is never cached. It is started
+  // first since it is the reply the client needs before anything else.
+  mSessionReply = std::async(std::launch::async, [&client, modelID]() {
+    return client.createSession(modelID);
+  });
+
+  std::string data;
+  if (mCache && mCache->load(mVersionKey, &data) &&
+      mVersion.ParseFromString(data)) {
+    mHaveVersion = true;
+  } else {
+    mVersionReply = std::async(std::launch::async,
+                               [&client]() { return client.version(); });
+  }
+
+  if (mCache && mCache->load(mModelsKey, &data) &&
+      mModels.ParseFromString(data)) {
+    mHaveModels = true;
+  } else {
+    mModelsReply = std::async(std::launch::async,
+                              [&client]() { return client.listModels(); });
+  }
+}
+
+DiathekeStartup::~DiathekeStartup() {
+  // Replies nobody asked for are discarded, along with their errors.
+  if (mSessionReply.valid()) {
+    mSessionReply.wait();
+  }
+  if (mVersionReply.valid()) {
+    mVersionReply.wait();
+  }
+  if (mModelsReply.valid()) {
+    mModelsReply.wait();
+  }
+}
+
+const DiathekePB::VersionResponse &DiathekeStartup::version() {
+  if (!mHaveVersion) {
+    // A reply that threw can't be read again, so a failed request is
+    // sent again rather than waited on.
+    if (!mVersionReply.valid()) {
+      mVersionReply = std::async(std::launch::async,
+                                 [this]() { return mClient.version(); });
+    }
+    mVersion = mVersionReply.get();
+    mHaveVersion = true;
+    if (mCache) {
+      mCache->store(mVersionKey, mVersion.SerializeAsString());
+    }
+  }
+  return mVersion;
+}
+
+const DiathekePB::ListModelsResponse &DiathekeStartup::models() {
+  if (!mHaveModels) {
+    if (!mModelsReply.valid()) {
+      mModelsReply = std::async(std::launch::async,
+                                [this]() { return mClient.listModels(); });
+    }
+    mModels = mModelsReply.get();
+    mHaveModels = true;
+    if (mCache) {
+      mCache->store(mModelsKey, mModels.SerializeAsString());
+    }
+  }
+  return mModels;
+}
+
+DiathekePB::SessionOutput DiathekeStartup::session() {
+  if (!mSessionReply.valid()) {
+    return mClient.createSession(mModelID);
+  }
+  return mSessionReply.get();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (2021) Cobalt Speech and Language, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DIATHEKE_STARTUP_H
+#define DIATHEKE_STARTUP_H
+
+#include <diatheke_client.h>
+#include <future>
+#include <string>
+
+#include "metadata_cache.h"
+
+/*
+ * DiathekeStartup sends the requests a Diatheke client makes before its
+ * first turn (version, listModels and createSession) all at once rather
+ * than one after another, and only waits for a reply when it is first
+ * used.
+ *
+ * If a MetadataCache is given, the version and model list are stored in
+ * it, and unexpired entries are used instead of sending those requests
+ * at all. A process started with a warm cache sends only createSession.
+ *
+ * The methods are not safe to call from multiple threads at once.
+ */
+class DiathekeStartup {
+public:
+  DiathekeStartup(Diatheke::Client &client, const std::string &serverAddress,
+                  const std::string &modelID, MetadataCache *cache = nullptr);
+
+  // Waits for any requests still in flight.
+  ~DiathekeStartup();
+
+  DiathekeStartup(const DiathekeStartup &) = delete;
+  DiathekeStartup &operator=(const DiathekeStartup &) = delete;
+
+  /*
+   * Each of these waits for its reply if it has not already arrived,
+   * and throws a Diatheke::ClientError if the request failed. Calling it
+   * again after a failure sends the request again.
+   */
+  const cobaltspeech::diatheke::VersionResponse &version();
+  const cobaltspeech::diatheke::ListModelsResponse &models();
+
+  /*
+   * Returns the new session, waiting for it if necessary. The session
+   * is only returned once; call this exactly one time unless it throws,
+   * in which case calling it again creates another session.
+   */
+  cobaltspeech::diatheke::SessionOutput session();
+
+private:
+  Diatheke::Client &mClient;
+  std::string mModelID;
+  MetadataCache *mCache;
+  std::string mVersionKey;
+  std::string mModelsKey;
+
+  std::future<cobaltspeech::diatheke::VersionResponse> mVersionReply;
+  std::future<cobaltspeech::diatheke::ListModelsResponse> mModelsReply;
+  std::future<cobaltspeech::diatheke::SessionOutput> mSessionReply;
+
+  bool mHaveVersion;
+  cobaltspeech::diatheke::VersionResponse mVersion;
+  bool mHaveModels;
+  cobaltspeech::diatheke::ListModelsResponse mModels;
+};
+
+#endif // DIATHEKE_STARTUP_H
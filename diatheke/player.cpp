@@ -15,6 +15,7 @@
  */
 
 #include "player.h"
+#include "trace.h"
 
 #include <unistd.h>
 
@@ -26,6 +27,7 @@ Player::~Player() {
 }
 
 void Player::start() {
+  TRACE_SCOPE("Player::start");
   // Ignore if it is already running
   if (mStdin != nullptr) {
     return;
@@ -41,7 +43,9 @@ void Player::stop() {
     return;
   }
 
-  // Close the stdin pipe (and by extension, the application).
+  // Close the stdin pipe (and by extension, the application). This
+  // waits for the application to finish playing what it was sent.
+  TRACE_SCOPE("Player::stop");
   pclose(mStdin);
   mStdin = nullptr;
 }
@@ -51,5 +55,6 @@ size_t Player::writeAudio(const char *audio, size_t sizeInBytes) {
     throw std::runtime_error("can't push audio - player not started.");
   }
 
+  TRACE_SCOPE("Player::writeAudio");
   return fwrite(audio, 1, sizeInBytes, mStdin);
 }
@@ -15,11 +15,9 @@
  */
 
 #include "recorder.h"
+#include "trace.h"
 
-#include <unistd.h>
-
-Recorder::Recorder(const std::string &recordCmd)
-    : mCmd(recordCmd), mStdout(nullptr) {}
+Recorder::Recorder(const std::string &recordCmd) : mProcess(recordCmd) {}
 
 Recorder::~Recorder() {
   // Make sure the recorder is stopped
@@ -27,30 +25,20 @@ Recorder::~Recorder() {
 }
 
 void Recorder::start() {
-  // Ignore if the recorder is already running
-  if (mStdout)
-    return;
-
-  // Start the external process
-  mStdout = popen(mCmd.c_str(), "r");
+  TRACE_SCOPE("Recorder::start");
+  // Start the external process. This is ignored if it is already running.
+  mProcess.start();
 }
 
 size_t Recorder::readAudio(char *buffer, size_t buffSize) {
-  // Throw an error if the recorder is not running.
-  if (mStdout == nullptr) {
-    throw std::runtime_error("can't read audio - recorder not started.");
-  }
-
-  return fread(buffer, 1, buffSize, mStdout);
+  TRACE_SCOPE("Recorder::readAudio");
+  return mProcess.read(buffer, buffSize);
 }
 
-void Recorder::stop() {
-  // Ignore if the recorder is already stopped
-  if (mStdout == nullptr) {
-    return;
-  }
+void Recorder::cancel() { mProcess.cancel(); }
 
-  // Close the stdout stream, which should also close the application.
-  pclose(mStdout);
-  mStdout = nullptr;
+int Recorder::stop() {
+  // Stop the external process without waiting for it to fill another
+  // buffer. This is ignored if it is already stopped.
+  return mProcess.stop();
 }
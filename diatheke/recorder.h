@@ -17,7 +17,8 @@
 #ifndef RECORDER_H
 #define RECORDER_H
 
-#include <cstdio>
+#include "process_source.h"
+
 #include <diatheke_audio_helpers.h>
 #include <string>
 
@@ -43,16 +44,27 @@ public:
   /*
    * Re-implemented from Diatheke::AudioReader. Reads audio
    * data from the recorder application, and stores it in the given
-   * buffer, returning the number of bytes read.
+   * buffer, returning the number of bytes read. Returns as soon as any
+   * audio is available, so fewer than buffSize bytes may be read. A
+   * return value of zero means the application exited or cancel() was
+   * called.
    */
   size_t readAudio(char *buffer, size_t buffSize) override;
 
-  // Stop recording audio, and return the recorded data.
-  void stop();
+  /*
+   * Interrupt a readAudio() call waiting on another thread. All later
+   * calls to readAudio() return zero until the recorder is restarted.
+   */
+  void cancel();
+
+  /*
+   * Stop recording audio, and return the wait status of the recorder
+   * application (see waitpid(2)), or -1 if it was not running.
+   */
+  int stop();
 
 private:
-  std::string mCmd;
-  FILE *mStdout;
+  ProcessSource mProcess;
 };
 
 #endif // RECORDER_H